@@ -0,0 +1,180 @@
+#include "Benchmark.h"
+#include "BenchmarkFixtures.h"
+
+#include <Windows.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdarg>
+#include <random>
+
+double MillisecondsSince(BenchmarkClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+DirectX::XMMATRIX DefaultProjection()
+{
+	return DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV4, 16.0f / 9.0f, 0.1f, 1000.0f);
+}
+
+void BuildBoxRow(int partCount, float spacing, std::vector<Vertex>& vertices, std::vector<DWORD>& indices)
+{
+	for (int part = 0; part < partCount; part++)
+	{
+		for (int corner = 0; corner < 8; corner++)
+			vertices.push_back(Vertex(part * spacing + (corner & 1 ? 4.0f : -4.0f), corner & 2 ? 4.0f : -4.0f, corner & 4 ? 4.0f : -4.0f,
+				0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f));
+
+		DWORD box[] = { 0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5 };
+		for (DWORD index : box)
+			indices.push_back(part * 8 + index);
+	}
+}
+
+Model* CreateStandInModel(const std::vector<Vertex>& vertices, const std::vector<DWORD>& indices, int index)
+{
+	Model* model = new Model;
+	model->GetVertices() = vertices;
+	model->GetIndices() = indices;
+	model->SetVertexCount((int)vertices.size());
+	model->SetIndexCount((int)indices.size());
+	model->SetVertexBuffer((ID3D11Buffer*)(uintptr_t)(0x100000 + index * 0x100));
+	model->SetIndexBuffer((ID3D11Buffer*)(uintptr_t)(0x4000000 + index * 0x100));
+	return model;
+}
+
+void SetBoxSubsets(Model* model, int partCount)
+{
+	for (int part = 0; part < partCount; part++)
+	{
+		model->GetSubsetIndexVector().push_back(part * 36);
+		model->GetSubsetMaterialVector().push_back(part);
+	}
+	model->GetSubsetIndexVector().push_back(partCount * 36);
+	model->GetSubsetCount() = partCount;
+}
+
+Benchmark::Benchmark()
+{
+	this->checks = 0;
+	this->failures = 0;
+}
+
+Benchmark::~Benchmark()
+{
+	if (output.is_open())
+		output.close();
+}
+
+bool Benchmark::Run(const std::wstring& commandLine)
+{
+	struct Entry
+	{
+		const wchar_t* name;
+		void (Benchmark::* function)();
+	};
+
+	const Entry entries[] =
+	{
+		{ L"heightfield", &Benchmark::RunHeightfield },
+		{ L"voxel", &Benchmark::RunVoxel },
+		{ L"foliage", &Benchmark::RunFoliage },
+		{ L"navigation", &Benchmark::RunNavigation },
+		{ L"culling", &Benchmark::RunCulling },
+		{ L"bvh", &Benchmark::RunBVH },
+		{ L"renderqueue", &Benchmark::RunRenderQueue },
+		{ L"statecache", &Benchmark::RunStateCache },
+		{ L"constants", &Benchmark::RunConstants },
+		{ L"instancing", &Benchmark::RunInstancing },
+		{ L"parallelsubmit", &Benchmark::RunParallelSubmit },
+		{ L"staticbatch", &Benchmark::RunStaticBatch },
+		{ L"subsets", &Benchmark::RunSubsets },
+		{ L"transparent", &Benchmark::RunTransparent },
+		{ L"occlusion", &Benchmark::RunOcclusion },
+		{ L"clusters", &Benchmark::RunLightClusters },
+		{ L"shadows", &Benchmark::RunShadows },
+		{ L"pipelines", &Benchmark::RunPipelines },
+		{ L"materials", &Benchmark::RunMaterials },
+		{ L"lod", &Benchmark::RunLod },
+		{ L"visibility", &Benchmark::RunVisibility },
+		{ L"capture", &Benchmark::RunCapture },
+		{ L"geometry", &Benchmark::RunGeometry },
+	};
+
+	output.open("benchmark.txt");
+	if (!output.is_open())
+		return false;
+
+	checks = 0;
+	failures = 0;
+
+	// If no benchmark is named after the switch we run all of them
+	bool anyNamed = false;
+	for (const Entry& entry : entries)
+	{
+		if (commandLine.find(entry.name) != std::wstring::npos)
+			anyNamed = true;
+	}
+
+	for (const Entry& entry : entries)
+	{
+		if (anyNamed && commandLine.find(entry.name) == std::wstring::npos)
+			continue;
+
+		Log("== %ls ==\n", entry.name);
+		(this->*entry.function)();
+		Log("\n");
+	}
+
+	Log("%d of %d checks failed\n", failures, checks);
+	return failures == 0;
+}
+
+void Benchmark::Log(const char* format, ...)
+{
+	char line[1024];
+
+	va_list arguments;
+	va_start(arguments, format);
+	vsnprintf(line, sizeof(line), format, arguments);
+	va_end(arguments);
+
+	output << line;
+	output.flush();
+	OutputDebugStringA(line);
+}
+
+bool Benchmark::Check(bool passed, const char* format, ...)
+{
+	checks++;
+	if (passed)
+		return true;
+
+	char line[1024];
+
+	va_list arguments;
+	va_start(arguments, format);
+	vsnprintf(line, sizeof(line), format, arguments);
+	va_end(arguments);
+
+	failures++;
+	Log("FAILED: %s", line);
+	return false;
+}
+
+void Benchmark::GenerateHeights(int width, int height, std::vector<float>& heights)
+{
+	heights.resize((size_t)width * height);
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> noise(0.0f, 0.05f);
+
+	for (int z = 0; z < height; z++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float hills = sinf(x * 0.011f) * cosf(z * 0.007f) * 6.0f + sinf(x * 0.043f + z * 0.029f) * 2.0f;
+			heights[(size_t)z * width + x] = 7.5f + hills + noise(random);
+		}
+	}
+}
\ No newline at end of file
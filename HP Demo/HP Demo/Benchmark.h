@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+
+/*
+	Headless benchmarks for the CPU side systems, started with "-benchmark" on the command line.
+	Nothing here creates a window or a D3D device. A name after the switch ("-benchmark heightfield")
+	only runs the benchmarks whose name is in the command line.
+	Results are written to benchmark.txt and the debug output. The benchmarks live in one file per subsystem
+	and check their results as they go, Run fails when any check did.
+*/
+class Benchmark
+{
+public:
+	Benchmark();
+	~Benchmark();
+
+	bool Run(const std::wstring& commandLine);
+
+private:
+	void Log(const char* format, ...);
+
+	// Logs the line as a failure when passed is false, returns passed
+	bool Check(bool passed, const char* format, ...);
+
+	void RunHeightfield();
+	void RunVoxel();
+	void RunFoliage();
+	void RunNavigation();
+	void RunCulling();
+	void RunBVH();
+	void RunRenderQueue();
+	void RunStateCache();
+	void RunConstants();
+	void RunInstancing();
+	void RunParallelSubmit();
+	void RunStaticBatch();
+	void RunSubsets();
+	void RunTransparent();
+	void RunOcclusion();
+	void RunLightClusters();
+	void RunShadows();
+	void RunPipelines();
+	void RunMaterials();
+	void RunLod();
+	void RunVisibility();
+	void RunCapture();
+	void RunGeometry();
+
+	// Deterministic rolling hills, used instead of loading content
+	static void GenerateHeights(int width, int height, std::vector<float>& heights);
+
+private:
+	std::ofstream output;
+	int checks;
+	int failures;
+};
\ No newline at end of file
@@ -0,0 +1,413 @@
+#include "Benchmark.h"
+#include "BenchmarkFixtures.h"
+#include "RenderQueue.h"
+#include "StateCache.h"
+#include "PipelineCache.h"
+#include "FrameCapture.h"
+
+#include <cfloat>
+#include <cstring>
+#include <random>
+#include <algorithm>
+
+void Benchmark::RunPipelines()
+{
+	const int requestCount = 10000;
+	const int drawCount = 20000;
+	const int frameCount = 32;
+
+	// Made up object addresses, the cache runs without a device and the recording never looks behind them
+	auto Fake = [](uintptr_t base, int index) { return base + (uintptr_t)index * 64; };
+
+	// The variations the renderer actually has: default, instanced and depth only shaders, opaque, source over and
+	// additive blending, depth writes on or off, back, no culling or the shadow bias, one sampler or one and the comparison sampler
+	const int shaderCount = 3, blendCount = 3, depthCount = 2, rasterizerCount = 3, samplerSetCount = 2;
+	const int variationCount = shaderCount * blendCount * depthCount * rasterizerCount * samplerSetCount;
+
+	auto MakeDesc = [&](int variation)
+	{
+		PipelineDesc desc;
+		int shader = variation % shaderCount; variation /= shaderCount;
+		int blend = variation % blendCount; variation /= blendCount;
+		int depth = variation % depthCount; variation /= depthCount;
+		int rasterizer = variation % rasterizerCount; variation /= rasterizerCount;
+		int samplerSet = variation;
+
+		desc.vertexShader = (ID3D11VertexShader*)Fake(0x10000, shader);
+		desc.pixelShader = (ID3D11PixelShader*)Fake(0x20000, shader);
+		desc.inputLayout = (ID3D11InputLayout*)Fake(0x30000, shader);
+
+		if (blend > 0)
+		{
+			desc.blend.RenderTarget[0].BlendEnable = true;
+			desc.blend.RenderTarget[0].SrcBlend = blend == 1 ? D3D11_BLEND_SRC_ALPHA : D3D11_BLEND_ONE;
+			desc.blend.RenderTarget[0].DestBlend = blend == 1 ? D3D11_BLEND_INV_SRC_ALPHA : D3D11_BLEND_ONE;
+		}
+		if (depth > 0)
+			desc.depthStencil.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+		if (rasterizer == 1)
+			desc.rasterizer.CullMode = D3D11_CULL_NONE;
+		else if (rasterizer == 2)
+		{
+			desc.rasterizer.DepthBias = 1000;
+			desc.rasterizer.SlopeScaledDepthBias = 2.0f;
+		}
+
+		desc.samplerCount = 1 + samplerSet;
+		for (int i = 0; i < desc.samplerCount; i++)
+		{
+			D3D11_SAMPLER_DESC& sampler = desc.samplers[i];
+			sampler.Filter = i == 0 ? D3D11_FILTER_MIN_MAG_MIP_LINEAR : D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+			sampler.AddressU = sampler.AddressV = sampler.AddressW = i == 0 ? D3D11_TEXTURE_ADDRESS_WRAP : D3D11_TEXTURE_ADDRESS_BORDER;
+			sampler.ComparisonFunc = i == 0 ? D3D11_COMPARISON_ALWAYS : D3D11_COMPARISON_LESS_EQUAL;
+			sampler.MaxLOD = D3D11_FLOAT32_MAX;
+		}
+		return desc;
+	};
+
+	std::mt19937 random(1337);
+	std::uniform_int_distribution<int> variationIndex(0, variationCount - 1);
+	std::vector<int> requests(requestCount);
+	for (int& request : requests)
+		request = variationIndex(random);
+
+	Log("%d pipeline requests over %d variations\n", requestCount, variationCount);
+
+	// Every variation has to give one pipeline however often it is asked for, and no two variations the same one
+	PipelineCache cache;
+	cache.Initialize(nullptr);
+	std::vector<const PipelineState*> pipelines(variationCount, nullptr);
+	int mismatches = 0;
+
+	auto start = BenchmarkClock::now();
+	for (int request : requests)
+	{
+		const PipelineState* pipeline = cache.GetPipeline(MakeDesc(request));
+		if (pipelines[request] && pipelines[request] != pipeline)
+			mismatches++;
+		pipelines[request] = pipeline;
+	}
+	double firstMs = MillisecondsSince(start);
+
+	std::vector<uint64_t> hashes;
+	for (const PipelineState* pipeline : pipelines)
+	{
+		if (pipeline)
+			hashes.push_back(pipeline->GetHash());
+	}
+	std::sort(hashes.begin(), hashes.end());
+	int collisions = (int)(hashes.end() - std::unique(hashes.begin(), hashes.end()));
+
+	const PipelineCache::Stats& stats = cache.GetStats();
+	Log("%d pipelines, %d hits, %d misses, %d state object hits, %d misses, %d state objects created, %d failures\n", cache.GetPipelineCount(),
+		stats.pipelineHits, stats.pipelineMisses, stats.stateHits, stats.stateMisses, stats.objectsCreated, stats.failures);
+	Log("%d requests got another pipeline than before, %d hash collisions, %.3f ms for the first pass\n", mismatches, collisions, firstMs);
+	Check(mismatches == 0, "%d requests got another pipeline than before\n", mismatches);
+	Check(collisions == 0, "%d hash collisions\n", collisions);
+
+	// Lookups once everything exists, the description is built every time the way callers do
+	cache.ResetStats();
+	start = BenchmarkClock::now();
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		for (int request : requests)
+			cache.GetPipeline(MakeDesc(request));
+	}
+	double lookupMs = MillisecondsSince(start) / frameCount;
+	Log("lookups: %.3f ms per %d, %.0f ns each, %d misses\n", lookupMs, requestCount, lookupMs * 1e6 / requestCount, cache.GetStats().pipelineMisses);
+	Check(cache.GetStats().pipelineMisses == 0, "%d lookups missed once everything existed\n", cache.GetStats().pipelineMisses);
+
+	// Binding draws in submission order and sorted by pipeline, everything every draw against only what changed
+	std::vector<const PipelineState*> submitted(drawCount);
+	for (const PipelineState*& pipeline : submitted)
+		pipeline = pipelines[variationIndex(random)];
+
+	std::vector<const PipelineState*> sorted = submitted;
+	std::sort(sorted.begin(), sorted.end(), [](const PipelineState* a, const PipelineState* b) { return a->GetHash() < b->GetHash(); });
+
+	const char* orderNames[] = { "submission order", "sorted by pipeline" };
+	const std::vector<const PipelineState*>* orders[] = { &submitted, &sorted };
+	for (int o = 0; o < 2; o++)
+	{
+		const std::vector<const PipelineState*>& draws = *orders[o];
+
+		RecordingBackend full;
+		RecordingBackend diffed;
+		full.SetKeepCalls(false);
+		diffed.SetKeepCalls(false);
+		const PipelineState* previous = nullptr;
+		int changed = 0;
+		for (const PipelineState* pipeline : draws)
+		{
+			pipeline->Bind(&full, nullptr);
+			changed += pipeline->Bind(&diffed, previous);
+			previous = pipeline;
+		}
+
+		// The diff must end up in the same place as binding everything
+		bool same = true;
+		for (int type = 0; type < RecordingBackend::CALL_TYPE_COUNT; type++)
+		{
+			if (type == RecordingBackend::CALL_DRAW)
+				continue;
+			if ((full.GetCallCount((RecordingBackend::CallType)type) > 0) != (diffed.GetCallCount((RecordingBackend::CallType)type) > 0))
+				same = false;
+		}
+
+		Log("%s: %d calls binding everything, %d diffed, %.2f calls per draw\n", orderNames[o], full.GetTotalCalls(), diffed.GetTotalCalls(),
+			changed / (double)drawCount);
+		Check(same, "%s: the diffed binding misses call types\n", orderNames[o]);
+	}
+}
+
+void Benchmark::RunCapture()
+{
+	using namespace DirectX;
+
+	const int modelCount = 3000;
+	const int partCount = 4;
+	const int frameCount = 8;
+	const int repeats = 16;
+	const UINT ringBytes = 4 * 1024 * 1024;
+	const char* capturePath = "benchmark_capture.hpcap";
+
+	ConstantBufferStandIns buffers;
+
+	// Four boxes per model, each a subset with its own material, a few of them transparent
+	std::vector<Vertex> vertices;
+	std::vector<DWORD> indices;
+	BuildBoxRow(partCount, 12.0f, vertices, indices);
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<Model*> models;
+	for (int i = 0; i < modelCount; i++)
+	{
+		Model* model = CreateStandInModel(vertices, indices, i % 64);
+
+		for (int part = 0; part < partCount; part++)
+		{
+			int shade = random() % 64;
+			SurfaceMaterial material;
+			material.diffuseColor = XMFLOAT4((float)(shade % 8) / 8, (float)(shade / 8) / 8, 0.5f, 1.0f);
+			material.ambientColor = XMFLOAT4(0.2f, 0.2f, 0.2f, 1.0f);
+			material.specularColor = XMFLOAT4(0.5f, 0.5f, 0.5f, 32.0f);
+			material.isTransparent = shade % 31 == 0;
+			material.opacity = 0.5f;
+			model->GetMaterial().push_back(material);
+		}
+		SetBoxSubsets(model, partCount);
+
+		model->ComputeBounds(vertices);
+		model->BuildSubsets();
+		model->SetWorldMatrix(XMMatrixRotationY(unit(random) * XM_2PI) * XMMatrixTranslation(position(random), 0.0f, position(random)));
+		models.push_back(model);
+	}
+
+	Shader shader(nullptr);
+	Camera camera;
+	Light light;
+	ID3D11SamplerState* sampler = nullptr;
+	XMMATRIX projection = DefaultProjection();
+
+	// The camera creeps forward, every frame draws the same models with new constants
+	auto ViewOf = [](int frame)
+	{
+		return XMMatrixLookAtLH(XMVectorSet(frame * 0.5f, 20.0f, -600.0f + frame * 2.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	};
+
+	// Frames the way Scene submits them, through a state cache in front of the given backend
+	RenderQueue queue;
+	ShaderConstants constants;
+	constants.Initialize(buffers.camera, buffers.light, buffers.material, buffers.objectRing, ringBytes);
+	auto SubmitFrame = [&](RenderBackend* backend, StateCache* cache, int frame)
+	{
+		XMMATRIX view = ViewOf(frame);
+		RenderBackend* context = backend;
+		if (cache)
+		{
+			cache->Invalidate();
+			context = cache;
+		}
+
+		queue.Begin(view, 1000.0f);
+		for (Model* model : models)
+			queue.Add(RenderQueue::PASS_OPAQUE, &shader, model);
+		queue.Sort();
+		queue.Submit(context, view, projection, &camera, &light, sampler, &constants);
+		queue.SubmitTransparent(context, view, projection, &camera, &light, sampler, &constants);
+	};
+
+	auto Capture = [&](FrameCapture& capture, bool stateCache)
+	{
+		capture.SetResourceSize(buffers.camera, sizeof(Shader::cBufferCamera));
+		capture.SetResourceSize(buffers.light, sizeof(Shader::cBufferLight));
+		capture.SetResourceSize(buffers.material, sizeof(Shader::cBufferMaterial));
+		capture.SetResourceSize(buffers.objectRing, ringBytes);
+
+		StateCache cache(&capture);
+		constants.Initialize(buffers.camera, buffers.light, buffers.material, buffers.objectRing, ringBytes);
+		capture.Start(frameCount);
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			capture.BeginFrame();
+			SubmitFrame(&capture, stateCache ? &cache : nullptr, frame);
+			capture.EndFrame();
+		}
+	};
+
+	Log("%d models of %d subsets, %d frames captured\n", modelCount, partCount, frameCount);
+
+	// What the frames cost without a capture, with an idle one in the way and while capturing. They take
+	// turns and the best of each is kept
+	{
+		double plainMs = DBL_MAX, idleMs = DBL_MAX, capturingMs = DBL_MAX;
+		for (int repeat = 0; repeat < repeats / 4; repeat++)
+		{
+			RecordingBackend recorder;
+			recorder.SetKeepCalls(false);
+			StateCache cache(&recorder);
+			constants.Initialize(buffers.camera, buffers.light, buffers.material, buffers.objectRing, ringBytes);
+			auto start = BenchmarkClock::now();
+			for (int frame = 0; frame < frameCount; frame++)
+				SubmitFrame(&recorder, &cache, frame);
+			plainMs = std::min(plainMs, MillisecondsSince(start) / frameCount);
+
+			FrameCapture idle(&recorder, nullptr);
+			StateCache idleCache(&idle);
+			constants.Initialize(buffers.camera, buffers.light, buffers.material, buffers.objectRing, ringBytes);
+			start = BenchmarkClock::now();
+			for (int frame = 0; frame < frameCount; frame++)
+				SubmitFrame(&idle, &idleCache, frame);
+			idleMs = std::min(idleMs, MillisecondsSince(start) / frameCount);
+
+			FrameCapture capture(&recorder, nullptr);
+			start = BenchmarkClock::now();
+			Capture(capture, true);
+			capturingMs = std::min(capturingMs, MillisecondsSince(start) / frameCount);
+		}
+		Log("submit: %.3f ms per frame, %.3f ms with an idle capture in front of the backend, %.3f ms while capturing\n", plainMs, idleMs, capturingMs);
+	}
+
+	// The capture, with the recording it went to
+	RecordingBackend original;
+	FrameCapture capture(&original, nullptr);
+	Capture(capture, true);
+	const FrameCapture::Stats& captureStats = capture.GetStats();
+	Log("capture: %d commands, %.1f KB, %.1f KB per frame, %.1f KB of update and mapped data, %.1f KB mapped memory compared, %d objects\n",
+		captureStats.commands, captureStats.bytes / 1024.0, captureStats.bytes / 1024.0 / frameCount, captureStats.payloadBytes / 1024.0,
+		captureStats.mappedBytes / 1024.0, (int)capture.GetObjects().size() - 1);
+
+	FrameReplay replay;
+	if (!Check(replay.Load(capture.GetData()), "the capture doesn't load\n"))
+	{
+		for (Model* model : models)
+			delete model;
+		return;
+	}
+
+	// With the objects it was captured with, the replay has to draw the same things with the same state
+	{
+		RecordingBackend replayed;
+		for (uint32_t id = 1; id < (uint32_t)capture.GetObjects().size(); id++)
+			replay.SetObject(id, capture.GetObjects()[id]);
+		bool result = replay.Replay(&replayed);
+
+		int different = 0;
+		const RecordingBackend::CallType compared[] = { RecordingBackend::CALL_UPDATE_SUBRESOURCE, RecordingBackend::CALL_MAP,
+			RecordingBackend::CALL_UNMAP, RecordingBackend::CALL_DRAW };
+		for (RecordingBackend::CallType type : compared)
+		{
+			if (replayed.GetCallCount(type) != original.GetCallCount(type))
+				different++;
+		}
+
+		// Mapped memory ends up the same, the recordings hand out memory per resource
+		MappedResource originalRing, replayedRing;
+		original.Map(buffers.objectRing, 0, RenderBackend::MAP_WRITE_NO_OVERWRITE, 0, &originalRing);
+		replayed.Map(buffers.objectRing, 0, RenderBackend::MAP_WRITE_NO_OVERWRITE, 0, &replayedRing);
+		bool ringSame = memcmp(originalRing.pData, replayedRing.pData, ringBytes) == 0;
+
+		Log("replay with the captured objects: %d frames, %d draws of %d, %d calls before the first frame\n", replay.GetStats().frames,
+			replayed.GetDrawCount(), original.GetDrawCount(), replayed.GetTotalCalls() - original.GetTotalCalls());
+		Check(result, "the replay with the captured objects failed\n");
+		Check(different == 0, "%d of the update, map and draw counts differ from the capture\n", different);
+		Check(replayed.GetDrawStateHash() == original.GetDrawStateHash(), "the replay's draw state differs from the capture\n");
+		Check(ringSame, "the replay's object ring differs from the capture\n");
+	}
+
+	// With stand-ins, twice, the replays have to match each other
+	{
+		FrameReplay standIns;
+		standIns.Load(capture.GetData());
+		RecordingBackend first, second;
+		standIns.Replay(&first);
+		standIns.Replay(&second);
+		Check(first.GetDrawStateHash() == second.GetDrawStateHash(), "two replays with stand-ins differ\n");
+	}
+
+	// What issuing the frame costs on the CPU, decoding the capture included, without a driver or a recording behind it
+	{
+		NullBackend null;
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		double nullMs = DBL_MAX, recordingMs = DBL_MAX;
+		for (int repeat = 0; repeat < repeats; repeat++)
+		{
+			auto start = BenchmarkClock::now();
+			replay.Replay(&null);
+			nullMs = std::min(nullMs, MillisecondsSince(start) / frameCount);
+
+			start = BenchmarkClock::now();
+			replay.Replay(&recorder);
+			recordingMs = std::min(recordingMs, MillisecondsSince(start) / frameCount);
+		}
+		int callsPerFrame = replay.GetStats().commands / frameCount;
+		Log("replay: %.3f ms per frame into a null backend, %.0f ns per command, %.3f ms into a recording backend\n", nullMs,
+			nullMs * 1e6 / callsPerFrame, recordingMs);
+	}
+
+	// Counts of two captures side by side, only the ones that differ
+	auto Diff = [&](const char* title, const FrameReplay& before, const FrameReplay& after)
+	{
+		Log("%s:", title);
+		int differences = 0;
+		for (int op = 0; op < FrameCapture::OP_COUNT; op++)
+		{
+			int a = before.GetStats().opCounts[op], b = after.GetStats().opCounts[op];
+			if (a == b)
+				continue;
+
+			Log(" %s %d -> %d (%+d),", FrameReplay::GetOpName((FrameCapture::Op)op), a, b, b - a);
+			differences++;
+		}
+		Log(differences ? " %d counts differ\n" : " no counts differ\n", differences);
+	};
+
+	// The same frames without the state cache, the kind of regression a diff shows
+	{
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		FrameCapture uncached(&recorder, nullptr);
+		Capture(uncached, false);
+
+		FrameReplay uncachedReplay;
+		uncachedReplay.Load(uncached.GetData());
+		Diff("without the state cache", replay, uncachedReplay);
+	}
+
+	// Against the capture an earlier run left behind, an earlier build when it was rebuilt since
+	FrameReplay earlier;
+	if (earlier.Load(capturePath))
+		Diff("against the last run", earlier, replay);
+	else
+		Log("no capture of an earlier run to compare with\n");
+
+	if (!capture.Save(capturePath))
+		Log("the capture couldn't be saved\n");
+
+	for (Model* model : models)
+		delete model;
+}
\ No newline at end of file
@@ -0,0 +1,506 @@
+#include "Benchmark.h"
+#include "BenchmarkFixtures.h"
+#include "FrustumCuller.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include "VisibilityCache.h"
+#include "JobSystem.h"
+
+#include <cmath>
+#include <cfloat>
+#include <random>
+#include <algorithm>
+
+void Benchmark::RunCulling()
+{
+	using namespace DirectX;
+
+	const int objectCount = 100000;
+	const int frameCount = 256;
+	const float worldSize = 2000.0f;
+
+	// Objects spread over a box around the camera, sizes from pebbles to buildings
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-worldSize * 0.5f, worldSize * 0.5f);
+	std::uniform_real_distribution<float> height(0.0f, 100.0f);
+	std::uniform_real_distribution<float> size(0.25f, 20.0f);
+
+	FrustumCuller culler;
+	culler.Reserve(objectCount);
+	for (int i = 0; i < objectCount; i++)
+		culler.Add(XMFLOAT3(position(random), height(random), position(random)), size(random));
+
+	Log("%d objects, AVX %s\n", objectCount, FrustumCuller::IsAVXSupported() ? "supported" : "not supported");
+
+	XMMATRIX projection = DefaultProjection();
+
+	const FrustumCuller::Path paths[] = { FrustumCuller::Path::Scalar, FrustumCuller::Path::SSE, FrustumCuller::Path::AVX };
+	const char* pathNames[] = { "scalar", "SSE (4 wide)", "AVX (8 wide)" };
+
+	std::vector<int> visible;
+	double scalarMs = 0.0;
+	long long scalarVisible = 0;
+	for (int p = 0; p < 3; p++)
+	{
+		if (paths[p] == FrustumCuller::Path::AVX && !FrustumCuller::IsAVXSupported())
+			continue;
+
+		culler.SetPath(paths[p]);
+
+		// The camera turns around its own axis, so the visible count changes from frame to frame
+		double totalMs = 0.0;
+		long long visibleTotal = 0;
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			float angle = XM_2PI * frame / frameCount;
+			XMVECTOR eye = XMVectorSet(0.0f, 40.0f, 0.0f, 1.0f);
+			XMVECTOR direction = XMVectorSet(cosf(angle), -0.1f, sinf(angle), 0.0f);
+			XMMATRIX view = XMMatrixLookToLH(eye, direction, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+
+			culler.Cull(view * projection, visible);
+			totalMs += culler.GetCullStats().milliseconds;
+			visibleTotal += culler.GetCullStats().visible;
+		}
+
+		if (p == 0)
+		{
+			scalarMs = totalMs;
+			scalarVisible = visibleTotal;
+		}
+
+		Log("%s: %.3f ms per frame, %.1f M objects/s, %lld visible per frame, %.2fx scalar\n", pathNames[p], totalMs / frameCount,
+			objectCount * (double)frameCount / (totalMs * 1000.0), visibleTotal / frameCount, scalarMs / totalMs);
+		Check(visibleTotal == scalarVisible, "%s: visible count differs from scalar\n", pathNames[p]);
+	}
+}
+
+void Benchmark::RunBVH()
+{
+	using namespace DirectX;
+
+	const int sizes[] = { 10000, 100000, 1000000 };
+	const int viewCount = 64;
+	const int pointQueries = 10000;
+
+	for (int objectCount : sizes)
+	{
+		// Same density at every size, about one object per 1000 cubic units
+		float worldSize = 10.0f * cbrtf((float)objectCount);
+
+		std::mt19937 random(1337);
+		std::uniform_real_distribution<float> position(0.0f, worldSize);
+		std::uniform_real_distribution<float> size(0.5f, 4.0f);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+		std::vector<XMFLOAT3> boundsMin(objectCount), boundsMax(objectCount);
+		SceneBVH bvh;
+		for (int i = 0; i < objectCount; i++)
+		{
+			XMFLOAT3 center(position(random), position(random), position(random));
+			float extent = size(random) * 0.5f;
+			boundsMin[i] = XMFLOAT3(center.x - extent, center.y - extent, center.z - extent);
+			boundsMax[i] = XMFLOAT3(center.x + extent, center.y + extent, center.z + extent);
+			bvh.Insert(boundsMin[i], boundsMax[i], nullptr);
+		}
+
+		bvh.Build();
+		const SceneBVH::Stats& stats = bvh.GetStats();
+		Log("%d objects: build %.1f ms, %d nodes, depth %d, SAH cost %.1f\n", objectCount, stats.buildMilliseconds, stats.nodes, stats.depth, stats.sahCost);
+
+		// A tenth of the objects move a little every frame, like props and characters would
+		double refitMs = 0.0;
+		int refitFrames = 8;
+		for (int frame = 0; frame < refitFrames; frame++)
+		{
+			for (int i = frame % 10; i < objectCount; i += 10)
+			{
+				XMFLOAT3 offset(unit(random) * 0.5f, unit(random) * 0.5f, unit(random) * 0.5f);
+				boundsMin[i] = XMFLOAT3(boundsMin[i].x + offset.x, boundsMin[i].y + offset.y, boundsMin[i].z + offset.z);
+				boundsMax[i] = XMFLOAT3(boundsMax[i].x + offset.x, boundsMax[i].y + offset.y, boundsMax[i].z + offset.z);
+				bvh.Move(i, boundsMin[i], boundsMax[i]);
+			}
+
+			auto start = BenchmarkClock::now();
+			bvh.Update();
+			refitMs += MillisecondsSince(start);
+		}
+		Log("  update with 10%% moving: %.2f ms per frame, SAH cost %.1f after %d frames, %d rebuilds\n", refitMs / refitFrames, stats.sahCost, refitFrames, stats.rebuilds - 1);
+
+		// Frustum from inside the volume, looking around
+		XMMATRIX projection = XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, worldSize * 0.5f);
+		std::vector<int> results;
+		double frustumMs = 0.0;
+		long long frustumResults = 0;
+		for (int view = 0; view < viewCount; view++)
+		{
+			float angle = XM_2PI * view / viewCount;
+			XMVECTOR eye = XMVectorSet(worldSize * 0.5f, worldSize * 0.5f, worldSize * 0.5f, 1.0f);
+			XMMATRIX viewMatrix = XMMatrixLookToLH(eye, XMVectorSet(cosf(angle), 0.0f, sinf(angle), 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+
+			results.clear();
+			auto start = BenchmarkClock::now();
+			bvh.QueryFrustum(viewMatrix * projection, results);
+			frustumMs += MillisecondsSince(start);
+			frustumResults += results.size();
+		}
+		Log("  frustum: %.3f ms per query, %lld results\n", frustumMs / viewCount, frustumResults / viewCount);
+
+		// Sphere queries the size of a light
+		long long sphereResults = 0;
+		auto start = BenchmarkClock::now();
+		for (int i = 0; i < pointQueries; i++)
+		{
+			results.clear();
+			bvh.QuerySphere(XMFLOAT3(position(random), position(random), position(random)), 10.0f, results);
+			sphereResults += results.size();
+		}
+		double sphereMs = MillisecondsSince(start);
+		Log("  sphere r=10: %.0f queries/s, %.1f results per query\n", pointQueries * 1000.0 / sphereMs, sphereResults / (double)pointQueries);
+
+		// Picking rays from random points in random directions
+		int hits = 0;
+		start = BenchmarkClock::now();
+		for (int i = 0; i < pointQueries; i++)
+		{
+			XMFLOAT3 origin(position(random), position(random), position(random));
+			XMFLOAT3 direction;
+			XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f)));
+
+			SceneBVH::RayHit hit;
+			hits += bvh.Raycast(origin, direction, worldSize, hit);
+		}
+		double rayMs = MillisecondsSince(start);
+		Log("  ray: %.0f rays/s, %d hits\n", pointQueries * 1000.0 / rayMs, hits);
+	}
+}
+
+void Benchmark::RunOcclusion()
+{
+	using namespace DirectX;
+
+	const int gridSize = 257;
+	const int propCount = 20000;
+	const int frameCount = 32;
+	const int threadCounts[] = { 1, 2, 4, 8 };
+	const int steps[] = { 2, 4, 8 };
+
+	// Rolling hills with a ridge across the middle, like the demo terrain
+	std::vector<float> heights((size_t)gridSize * gridSize);
+	for (int z = 0; z < gridSize; z++)
+	{
+		for (int x = 0; x < gridSize; x++)
+		{
+			float ridge = 18.0f * expf(-powf((z - 128.0f) / 12.0f, 2.0f));
+			heights[(size_t)z * gridSize + x] = 6.0f * sinf(x * 0.07f) * cosf(z * 0.05f) + 6.0f + ridge;
+		}
+	}
+
+	auto heightAt = [&](float x, float z)
+	{
+		int ix = std::min(std::max((int)x, 0), gridSize - 1);
+		int iz = std::min(std::max((int)z, 0), gridSize - 1);
+		return heights[(size_t)iz * gridSize + ix];
+	};
+
+	// Props standing on the ground, 2 x 4 x 2 boxes
+	std::vector<Vertex> box;
+	for (int corner = 0; corner < 8; corner++)
+		box.push_back(Vertex(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 4.0f : 0.0f, corner & 4 ? 1.0f : -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f));
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(2.0f, gridSize - 3.0f);
+	std::vector<Model*> props;
+	for (int i = 0; i < propCount; i++)
+	{
+		float x = position(random), z = position(random);
+		Model* model = new Model;
+		model->ComputeBounds(box);
+		model->SetWorldMatrix(XMMatrixTranslation(x, heightAt(x, z), z));
+		props.push_back(model);
+	}
+
+	FrustumCuller frustumCuller;
+	for (Model* model : props)
+		frustumCuller.AddModel(model);
+
+	// Standing on the near side of the ridge, looking over it
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(128.0f, heightAt(128.0f, 60.0f) + 3.0f, 60.0f, 1.0f), XMVectorSet(128.0f, 10.0f, 256.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+	XMMATRIX viewProjection = view * projection;
+
+	std::vector<int> inFrustum;
+	frustumCuller.Cull(viewProjection, inFrustum);
+	std::vector<Model*> candidates;
+	for (int index : inFrustum)
+		candidates.push_back(props[index]);
+
+	Log("%dx%d heightfield, %d props, %d in the frustum, 256x128 depth buffer, %d hardware threads\n", gridSize, gridSize, propCount,
+		(int)candidates.size(), (int)std::thread::hardware_concurrency());
+
+	for (int step : steps)
+	{
+		OcclusionCuller culler;
+		culler.Initialize(256, 128);
+		culler.AddHeightfield(heights, gridSize, gridSize, 1.0f, step, XMMatrixIdentity());
+
+		std::vector<float> reference;
+		for (int threadCount : threadCounts)
+		{
+			JobSystem jobSystem;
+			if (threadCount > 1)
+				jobSystem.Initialize(threadCount - 1);
+
+			double renderMs = 0.0, testMs = 0.0;
+			std::vector<Model*> visible;
+			for (int frame = 0; frame < frameCount; frame++)
+			{
+				culler.Render(viewProjection, jobSystem);
+				visible = candidates;
+				culler.Cull(visible);
+				renderMs += culler.GetStats().renderMilliseconds;
+				testMs += culler.GetStats().testMilliseconds;
+			}
+
+			// The buffer can't depend on how the tiles were spread over the threads
+			if (reference.empty())
+				reference = culler.GetDepth();
+			bool same = reference == culler.GetDepth();
+
+			const OcclusionCuller::Stats& stats = culler.GetStats();
+			Log("step %d, %d threads: %d occluder triangles, %d rasterized, render %.3f ms, test %.3f ms, %d of %d occluded (%.1f%% cull rate)\n",
+				step, threadCount, stats.occluderTriangles, stats.rasterizedTriangles, renderMs / frameCount, testMs / frameCount,
+				stats.occluded, stats.tested, 100.0 * stats.occluded / std::max(stats.tested, 1));
+			Check(same, "step %d, %d threads: depth differs from one thread\n", step, threadCount);
+		}
+
+		// The hierarchy may only keep more than the full resolution buffer does, never less
+		int hierarchyWrong = 0, fullResolutionOccluded = 0;
+		for (Model* model : candidates)
+		{
+			bool full = culler.IsVisibleFullResolution(model->GetBoundsMin(), model->GetBoundsMax(), model->GetWorldMatrix());
+			bool hierarchy = culler.IsVisible(model->GetBoundsMin(), model->GetBoundsMax(), model->GetWorldMatrix());
+			fullResolutionOccluded += !full;
+			hierarchyWrong += full && !hierarchy;
+		}
+		Log("step %d: %d occluded reading every pixel\n", step, fullResolutionOccluded);
+		Check(hierarchyWrong == 0, "step %d: the hierarchy hides %d boxes the full resolution buffer sees\n", step, hierarchyWrong);
+	}
+
+	// Buried under the ridge has to be hidden, floating above it not
+	{
+		JobSystem jobSystem;
+		OcclusionCuller culler;
+		culler.Initialize(256, 128);
+		culler.AddHeightfield(heights, gridSize, gridSize, 1.0f, 4, XMMatrixIdentity());
+		culler.Render(viewProjection, jobSystem);
+
+		XMFLOAT3 boxMin(-1.0f, 0.0f, -1.0f), boxMax(1.0f, 4.0f, 1.0f);
+		bool buried = culler.IsVisible(boxMin, boxMax, XMMatrixTranslation(128.0f, 5.0f, 180.0f));
+		bool floating = culler.IsVisible(boxMin, boxMax, XMMatrixTranslation(128.0f, 60.0f, 180.0f));
+		Check(!buried, "box behind the ridge visible\n");
+		Check(floating, "box above the ridge hidden\n");
+	}
+
+	for (Model* model : props)
+		delete model;
+}
+
+void Benchmark::RunVisibility()
+{
+	using namespace DirectX;
+
+	const int objectCount = 50000;
+	const int frameCount = 200;
+	const int stressFrames = 2000;
+	const float worldSize = 2000.0f;
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(0.0f, worldSize);
+	std::uniform_real_distribution<float> height(0.0f, 40.0f);
+	std::uniform_real_distribution<float> size(0.5f, 6.0f);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	SceneBVH bvh;
+	std::vector<int> handles;
+	auto InsertRandom = [&]()
+	{
+		XMFLOAT3 center(position(random), height(random), position(random));
+		float extent = size(random) * 0.5f;
+		handles.push_back(bvh.Insert(XMFLOAT3(center.x - extent, center.y - extent, center.z - extent), XMFLOAT3(center.x + extent, center.y + extent, center.z + extent), nullptr));
+	};
+	for (int i = 0; i < objectCount; i++)
+		InsertRandom();
+	bvh.Build();
+	bvh.ClearChanged();
+
+	auto MoveObject = [&](int handle, float distance)
+	{
+		XMFLOAT3 boundsMin = bvh.GetBoundsMin(handle), boundsMax = bvh.GetBoundsMax(handle);
+		XMFLOAT3 offset(unit(random) * distance, unit(random) * distance * 0.1f, unit(random) * distance);
+		bvh.Move(handle, XMFLOAT3(boundsMin.x + offset.x, boundsMin.y + offset.y, boundsMin.z + offset.z),
+			XMFLOAT3(boundsMax.x + offset.x, boundsMax.y + offset.y, boundsMax.z + offset.z));
+	};
+
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(0.4f * XM_PI, 16.0f / 9.0f, 0.1f, 1000.0f);
+	auto ViewFrom = [](XMFLOAT3 eye, float yaw, float pitch)
+	{
+		XMVECTOR direction = XMVectorSet(cosf(pitch) * cosf(yaw), sinf(pitch), cosf(pitch) * sinf(yaw), 0.0f);
+		return XMMatrixLookToLH(XMLoadFloat3(&eye), direction, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	};
+
+	// Everything the plain query finds has to be in the cached result, the cached result should not have much more
+	std::vector<uint8_t> marks;
+	std::vector<int> cached, exact;
+	auto QueryExact = [&](XMMATRIX view)
+	{
+		XMFLOAT4 planes[6];
+		VisibilityCache::GetPlanes(view, projection, planes);
+		for (int p = 0; p < 6; p++)
+			planes[p].w += VisibilityCache::PLANE_TOLERANCE;
+
+		exact.clear();
+		bvh.QueryPlanes(planes, exact);
+	};
+	auto Compare = [&](int& missing, int& extra)
+	{
+		marks.assign(std::max(marks.size(), (size_t)bvh.GetObjectCount() * 2 + handles.size()), 0);
+		for (int handle : cached)
+		{
+			if (handle >= (int)marks.size())
+				marks.resize(handle + 1, 0);
+			marks[handle] = 1;
+		}
+		for (int handle : exact)
+		{
+			if (handle < (int)marks.size() && marks[handle])
+				marks[handle] = 2;
+			else
+				missing++;
+		}
+		for (int handle : cached)
+			extra += marks[handle] == 1;
+	};
+
+	Log("%d objects over %.0fx%.0f, %d frames per case\n", objectCount, worldSize, worldSize, frameCount);
+
+	struct Case
+	{
+		const char* name;
+		float shake;				// Units the eye moves around where it stands
+		float turn;					// Radians the view turns around where it looks
+		float walk;					// Units per frame along the view
+		int movingEvery;			// One object in this many moves every frame, 0 for none
+	};
+
+	const Case cases[] =
+	{
+		{ "still camera, nothing moves", 0.0f, 0.0f, 0.0f, 0 },
+		{ "still camera, 1% of the objects move", 0.0f, 0.0f, 0.0f, 100 },
+		{ "camera shaking by 0.2 units, 1% move", 0.2f, 0.0f, 0.0f, 100 },
+		{ "camera turning by 0.001 rad, 1% move", 0.0f, 0.001f, 0.0f, 100 },
+		{ "camera walking 1 unit per frame, 1% move", 0.0f, 0.0f, 1.0f, 100 },
+	};
+
+	for (const Case& test : cases)
+	{
+		VisibilityCache cache;
+		cache.Initialize(VisibilityCache::Settings());
+
+		double cachedBest = DBL_MAX, cachedTotal = 0.0, queryTotal = 0.0;
+		int missing = 0, extra = 0, boundaryTests = 0, changedTests = 0;
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			if (test.movingEvery > 0)
+			{
+				for (int i = frame % test.movingEvery; i < (int)handles.size(); i += test.movingEvery)
+					MoveObject(handles[i], 0.5f);
+			}
+			bvh.Update();
+
+			XMFLOAT3 eye(200.0f + test.walk * frame + unit(random) * test.shake, 20.0f + unit(random) * test.shake, 1000.0f + unit(random) * test.shake);
+			XMMATRIX view = ViewFrom(eye, unit(random) * test.turn, -0.05f + unit(random) * test.turn);
+
+			cached.clear();
+			BenchmarkClock::time_point start = BenchmarkClock::now();
+			cache.Query(bvh, view, projection, cached);
+			double milliseconds = MillisecondsSince(start);
+			bvh.ClearChanged();
+
+			start = BenchmarkClock::now();
+			QueryExact(view);
+			queryTotal += MillisecondsSince(start);
+
+			if (frame > 0)
+			{
+				cachedTotal += milliseconds;
+				cachedBest = std::min(cachedBest, milliseconds);
+				boundaryTests += cache.GetStats().boundaryTests;
+				changedTests += cache.GetStats().changedTests;
+			}
+			Compare(missing, extra);
+		}
+
+		const VisibilityCache::Stats& stats = cache.GetStats();
+		Log("%s: %d plain, %d made, %d reused, %.3f ms per frame through the cache (%.3f best), %.3f ms plain\n", test.name, stats.plainQueries,
+			stats.rebuilds, stats.reuses, cachedTotal / (frameCount - 1), cachedBest, queryTotal / frameCount);
+		Log("  %d visible of %d candidates, %.0f boundary and %.0f changed tests per frame, %d missing, %.1f extra per frame, %.3f ms saved per frame\n",
+			stats.visible, stats.candidates, boundaryTests / (double)(frameCount - 1), changedTests / (double)(frameCount - 1), missing, extra / (double)frameCount,
+			stats.totalSavedMilliseconds / frameCount);
+		Check(missing == 0, "%s: %d objects the plain query finds are missing from the cached result\n", test.name, missing);
+	}
+
+	// Random camera paths and edits, from nothing changing to far jumps, against the plain query every frame
+	const int pathCount = 4;
+	for (int path = 0; path < pathCount; path++)
+	{
+		VisibilityCache cache;
+		cache.Initialize(VisibilityCache::Settings());
+
+		const float shakes[] = { 0.0f, 1e-4f, 0.01f, 0.5f, 1.9f, 5.0f, 100.0f };
+		const float turns[] = { 0.0f, 1e-6f, 1e-4f, 1e-3f, 0.01f, 0.5f };
+		XMFLOAT3 eye(position(random), 20.0f, position(random));
+		float yaw = unit(random) * XM_PI, pitch = 0.0f;
+		int missing = 0, extra = 0, inserted = 0, removed = 0;
+		for (int frame = 0; frame < stressFrames; frame++)
+		{
+			float shake = shakes[random() % (sizeof(shakes) / sizeof(shakes[0]))];
+			float turn = turns[random() % (sizeof(turns) / sizeof(turns[0]))];
+			eye = XMFLOAT3(eye.x + unit(random) * shake, std::max(eye.y + unit(random) * shake, 1.0f), eye.z + unit(random) * shake);
+			eye = XMFLOAT3(std::min(std::max(eye.x, 0.0f), worldSize), std::min(eye.y, 200.0f), std::min(std::max(eye.z, 0.0f), worldSize));
+			yaw += unit(random) * turn;
+			pitch = std::min(std::max(pitch + unit(random) * turn, -1.0f), 1.0f);
+
+			for (int i = 0; i < 50; i++)
+				MoveObject(handles[random() % handles.size()], unit(random) > 0.0f ? 0.5f : 20.0f);
+			if (random() % 4 == 0)
+			{
+				int index = random() % handles.size();
+				bvh.Remove(handles[index]);
+				handles[index] = handles.back();
+				handles.pop_back();
+				removed++;
+			}
+			if (random() % 4 == 0)
+			{
+				InsertRandom();
+				inserted++;
+			}
+			bvh.Update();
+
+			XMMATRIX view = ViewFrom(eye, yaw, pitch);
+			cached.clear();
+			cache.Query(bvh, view, projection, cached);
+			bvh.ClearChanged();
+
+			QueryExact(view);
+			Compare(missing, extra);
+		}
+
+		Log("random path %d: %d frames, %d made, %d reused, %d inserted, %d removed, %d missing, %.1f extra per frame\n", path, stressFrames,
+			cache.GetStats().rebuilds, cache.GetStats().reuses, inserted, removed, missing, extra / (double)stressFrames);
+		Check(missing == 0, "random path %d: %d objects the plain query finds are missing from the cached result\n", path, missing);
+
+		// Otherwise only the plain query was compared with itself
+		Check(cache.GetStats().reuses > 0, "random path %d: the cached set was never reused\n", path);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+#include "Model.h"
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+/*
+	What the benchmark files share: the clock, the projection of the demo camera, made up addresses in place of
+	D3D objects and the box meshes several of them draw. The recording backends only compare the addresses, so
+	nothing here needs a device.
+*/
+typedef std::chrono::high_resolution_clock BenchmarkClock;
+
+double MillisecondsSince(BenchmarkClock::time_point start);
+
+// 45 degrees at 16:9 out to 1000 units, the scene's camera
+DirectX::XMMATRIX DefaultProjection();
+
+// Stand-ins for the buffers ShaderConstants writes into
+struct ConstantBufferStandIns
+{
+	ID3D11Buffer* camera = (ID3D11Buffer*)(uintptr_t)0x1040;
+	ID3D11Buffer* light = (ID3D11Buffer*)(uintptr_t)0x1080;
+	ID3D11Buffer* material = (ID3D11Buffer*)(uintptr_t)0x10c0;
+	ID3D11Buffer* objectRing = (ID3D11Buffer*)(uintptr_t)0x1100;
+};
+
+// partCount boxes of 8 units in a row, spacing apart on x, 8 vertices and 36 indices each
+void BuildBoxRow(int partCount, float spacing, std::vector<Vertex>& vertices, std::vector<DWORD>& indices);
+
+// A model over the mesh with stand-ins for its vertex and index buffer, models with the same index share them
+Model* CreateStandInModel(const std::vector<Vertex>& vertices, const std::vector<DWORD>& indices, int index);
+
+// One subset per box of a row, subset i drawn with material i
+void SetBoxSubsets(Model* model, int partCount);
\ No newline at end of file
@@ -0,0 +1,726 @@
+#include "Benchmark.h"
+#include "BenchmarkFixtures.h"
+#include "StaticBatcher.h"
+#include "LodSelector.h"
+#include "GeometryBuffer.h"
+#include "TlsfAllocator.h"
+#include "SceneBVH.h"
+#include "RenderQueue.h"
+#include "StateCache.h"
+
+#include <cmath>
+#include <cfloat>
+#include <random>
+#include <algorithm>
+#include <map>
+
+void Benchmark::RunStaticBatch()
+{
+	using namespace DirectX;
+
+	const int propCount = 20000;
+	const int materialCount = 8;
+	const int frameCount = 32;
+	const float worldSize = 1000.0f;
+	const float cellSizes[] = { 32.0f, 64.0f, 128.0f, 256.0f };
+
+	// A box with its own vertices per face, kept on the CPU for the batcher
+	std::vector<Vertex> boxVertices;
+	std::vector<DWORD> boxIndices;
+	for (int face = 0; face < 6; face++)
+	{
+		int axis = face / 2;
+		float sign = face & 1 ? -1.0f : 1.0f;
+		DWORD base = (DWORD)boxVertices.size();
+		for (int corner = 0; corner < 4; corner++)
+		{
+			float u = corner & 1 ? 1.0f : -1.0f;
+			float v = corner & 2 ? 1.0f : -1.0f;
+			float p[3], n[3] = { 0.0f, 0.0f, 0.0f };
+			p[axis] = sign;
+			p[(axis + 1) % 3] = u;
+			p[(axis + 2) % 3] = v;
+			n[axis] = sign;
+			boxVertices.push_back(Vertex(p[0], p[1], p[2], u * 0.5f + 0.5f, v * 0.5f + 0.5f, n[0], n[1], n[2], 1.0f, 0.0f, 0.0f));
+		}
+		DWORD quad[] = { 0, 1, 3, 0, 3, 2 };
+		for (DWORD index : quad)
+			boxIndices.push_back(base + index);
+	}
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-worldSize * 0.5f, worldSize * 0.5f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	// Every prop its own model and buffers, the way they are loaded
+	std::vector<Model*> props(propCount);
+	for (int i = 0; i < propCount; i++)
+	{
+		int material = random() % materialCount;
+		float scale = 0.5f + unit(random) * 2.0f;
+
+		Model* prop = CreateStandInModel(boxVertices, boxIndices, i);
+		prop->ComputeBounds(boxVertices);
+		prop->GetMaterial().push_back(SurfaceMaterial());
+		prop->GetMaterial()[0].diffuseColor = XMFLOAT4((float)material / materialCount, 0.5f, 0.5f, 1.0f);
+		prop->SetWorldMatrix(XMMatrixScaling(scale, scale * 2.0f, scale) * XMMatrixRotationY(unit(random) * XM_2PI) *
+			XMMatrixTranslation(position(random), scale * 2.0f, position(random)));
+		props[i] = prop;
+	}
+
+	Shader shader(nullptr);
+	Camera camera;
+	Light light;
+	ID3D11SamplerState* sampler = nullptr;
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 60.0f, -600.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+
+	Log("%d props of %d triangles, %d materials, %.0f x %.0f world\n", propCount, (int)boxIndices.size() / 3, materialCount, worldSize, worldSize);
+
+	// Cull with a BVH, queue, sort and submit, the same frame Scene renders
+	auto renderFrames = [&](const std::vector<Model*>& models, const char* name)
+	{
+		SceneBVH bvh;
+		for (Model* model : models)
+			bvh.InsertModel(model);
+		bvh.Build();
+
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+		RenderQueue queue;
+		std::vector<int> visible;
+		long long triangles = 0;
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			recorder.Clear();
+			cache.Invalidate();
+
+			visible.clear();
+			bvh.QueryFrustum(view * projection, visible);
+
+			triangles = 0;
+			queue.Begin(view, 1000.0f);
+			for (int handle : visible)
+			{
+				Model* model = (Model*)bvh.GetUserData(handle);
+				queue.Add(RenderQueue::PASS_OPAQUE, &shader, model);
+				triangles += model->GetIndexCount() / 3;
+			}
+			queue.Sort();
+			queue.Submit(&cache, view, projection, &camera, &light, sampler);
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		Log("%s: %d models, %d visible, %d draws, %d calls reach the context, %lld triangles, %.3f ms per frame\n",
+			name, (int)models.size(), (int)visible.size(), recorder.GetDrawCount(), recorder.GetTotalCalls(), triangles, ms);
+	};
+
+	renderFrames(props, "separate props");
+
+	for (float cellSize : cellSizes)
+	{
+		StaticBatcher batcher;
+		for (Model* prop : props)
+			batcher.Add(prop);
+
+		StaticBatcher::Settings settings;
+		settings.cellSize = cellSize;
+		batcher.Build(settings, nullptr);
+
+		const StaticBatcher::Stats& stats = batcher.GetStats();
+		char name[64];
+		snprintf(name, sizeof(name), "batched, %.0f cells", cellSize);
+		Log("%.0f unit cells: %d batches of %d materials, %d vertices, build %.1f ms\n", cellSize, stats.batches, stats.groups, stats.vertices, stats.milliseconds);
+		Check(stats.vertices == propCount * (int)boxVertices.size(), "%.0f unit cells: %d vertices in the batches of %d props\n", cellSize, stats.vertices, propCount);
+		renderFrames(batcher.GetBatches(), name);
+	}
+
+	for (Model* prop : props)
+		delete prop;
+}
+
+void Benchmark::RunLod()
+{
+	using namespace DirectX;
+
+	const int modelCount = 4000;
+	const int rings = 48;
+	const int segments = 96;
+	const int frameCount = 64;
+	const int screenHeight = 1080;
+	const float worldSize = 2000.0f;
+
+	// A bumpy sphere in two subsets, the top and bottom half
+	std::vector<Vertex> vertices;
+	std::vector<DWORD> indices;
+	for (int ring = 0; ring <= rings; ring++)
+	{
+		for (int segment = 0; segment <= segments; segment++)
+		{
+			float theta = XM_PI * ring / rings;
+			float phi = XM_2PI * segment / segments;
+			float bump = 5.0f + 0.3f * sinf(theta * 9.0f) * cosf(phi * 7.0f);
+			XMFLOAT3 normal(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+			vertices.push_back(Vertex(normal.x * bump, normal.y * bump, normal.z * bump, (float)segment / segments, (float)ring / rings,
+				normal.x, normal.y, normal.z, 1.0f, 0.0f, 0.0f));
+		}
+	}
+	for (int ring = 0; ring < rings; ring++)
+	{
+		for (int segment = 0; segment < segments; segment++)
+		{
+			DWORD a = ring * (segments + 1) + segment;
+			DWORD b = a + segments + 1;
+			DWORD quad[] = { a, b, a + 1, a + 1, b, b + 1 };
+			for (DWORD index : quad)
+				indices.push_back(index);
+		}
+	}
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-worldSize * 0.5f, worldSize * 0.5f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<Model*> models;
+	double buildMilliseconds = 0.0;
+	for (int i = 0; i < modelCount; i++)
+	{
+		Model* model = CreateStandInModel(vertices, indices, i);
+		model->GetMaterial().push_back(SurfaceMaterial());
+		model->GetMaterial().push_back(SurfaceMaterial());
+		model->GetSubsetIndexVector() = { 0, (int)indices.size() / 2, (int)indices.size() };
+		model->GetSubsetMaterialVector() = { 0, 1 };
+		model->ComputeBounds(vertices);
+		model->BuildSubsets();
+
+		float scale = 0.5f + unit(random) * 1.5f;
+		model->SetWorldMatrix(XMMatrixScaling(scale, scale, scale) * XMMatrixTranslation(position(random), scale * 5.0f, position(random)));
+
+		// Every model builds its own chain, as the batches do
+		BenchmarkClock::time_point start = BenchmarkClock::now();
+		model->BuildLods(nullptr, 5);
+		buildMilliseconds += MillisecondsSince(start);
+		models.push_back(model);
+	}
+
+	Log("%d models of %d triangles, %d levels, %.3f ms to build the levels of one\n", modelCount, (int)indices.size() / 3, models[0]->GetLodCount(),
+		buildMilliseconds / modelCount);
+	for (int level = 0; level < models[0]->GetLodCount(); level++)
+	{
+		const ModelLod& lod = models[0]->GetLod(level);
+		Log("  LOD %d: %d triangles in %d subsets, error %.3f\n", level, lod.triangleCount, (int)lod.subsets.size(), lod.error);
+	}
+
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(0.4f * XM_PI, 16.0f / 9.0f, 0.1f, 1000.0f);
+	auto CameraAt = [](float t)
+	{
+		return XMFLOAT3(-800.0f + 1600.0f * t, 20.0f, -300.0f + 200.0f * t);
+	};
+
+	// Down a line through the field, everything is selected, the queue counts what it is given
+	{
+		LodSelector selector;
+		selector.Initialize(LodSelector::Settings());
+		selector.SetProjection(projection, screenHeight);
+		selector.GetSettings().budgetMilliseconds = 0.0f;
+
+		Shader shader(nullptr);
+		RenderQueue queue;
+		double fullTriangles = 0.0, selectedTriangles = 0.0, queuedTriangles = 0.0, switches = 0.0;
+		int levels[LodSelector::MAX_LODS] = {};
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			XMFLOAT3 camera = CameraAt((float)frame / frameCount);
+			selector.Select(models, camera);
+			const LodSelector::Stats& stats = selector.GetStats();
+			fullTriangles += stats.fullTriangles;
+			selectedTriangles += stats.selectedTriangles;
+			switches += frame > 0 ? stats.switches : 0;
+			for (int level = 0; level < LodSelector::MAX_LODS; level++)
+				levels[level] += stats.levels[level];
+
+			XMMATRIX view = XMMatrixLookToLH(XMLoadFloat3(&camera), XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+			queue.Begin(view, 1000.0f);
+			for (Model* model : models)
+				queue.Add(RenderQueue::PASS_OPAQUE, &shader, model);
+			queue.Sort();
+			queuedTriangles += queue.GetStats().triangles;
+		}
+
+		Log("camera path: %.0f triangles per frame of %.0f at full detail (%.1f%%), the queue got %.0f, %.1f switches per frame\n",
+			selectedTriangles / frameCount, fullTriangles / frameCount, 100.0 * selectedTriangles / fullTriangles, queuedTriangles / frameCount, switches / (frameCount - 1));
+		Check(queuedTriangles == selectedTriangles, "the queue got %.0f triangles, %.0f were selected\n", queuedTriangles, selectedTriangles);
+		Log("  models per level:");
+		for (int level = 0; level < models[0]->GetLodCount(); level++)
+			Log(" %.0f", levels[level] / (double)frameCount);
+		Log("\n");
+	}
+
+	// The camera steps back and forth, without hysteresis models on a threshold switch every step
+	const float hysteresis[] = { 0.0f, 0.1f, 0.25f };
+	for (float h : hysteresis)
+	{
+		LodSelector selector;
+		LodSelector::Settings settings;
+		settings.hysteresis = h;
+		settings.budgetMilliseconds = 0.0f;
+		selector.Initialize(settings);
+		selector.SetProjection(projection, screenHeight);
+
+		int switches = 0;
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			XMFLOAT3 camera = CameraAt(0.5f);
+			camera.x += frame & 1 ? 1.0f : -1.0f;
+			selector.Select(models, camera);
+			if (frame > 1)
+				switches += selector.GetStats().switches;
+		}
+
+		Log("hysteresis %.2f, camera stepping 2 units back and forth: %.1f switches per frame\n", h, switches / (double)(frameCount - 2));
+	}
+
+	// The distances 4 at a time against one model at a time, from the same starting levels
+	{
+		LodSelector selector;
+		LodSelector::Settings settings;
+		settings.budgetMilliseconds = 0.0f;
+		selector.Initialize(settings);
+		selector.SetProjection(projection, screenHeight);
+
+		XMFLOAT4X4 p;
+		XMStoreFloat4x4(&p, projection);
+		float keepFactor = settings.pixelError / (p._22 * screenHeight * 0.5f);
+		float coarsenFactor = keepFactor * (1.0f - settings.hysteresis);
+
+		std::vector<int> simdLevels(modelCount);
+		double simdBest = DBL_MAX, scalarBest = DBL_MAX;
+		int mismatches = 0, triangleMismatches = 0;
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			XMFLOAT3 camera = CameraAt((float)frame / frameCount);
+			XMVECTOR eye = XMLoadFloat3(&camera);
+
+			for (Model* model : models)
+				model->SetCurrentLod(0);
+			selector.Select(models, camera);
+			simdBest = std::min(simdBest, selector.GetStats().milliseconds);
+			for (int i = 0; i < modelCount; i++)
+				simdLevels[i] = models[i]->GetCurrentLod();
+
+			for (Model* model : models)
+				model->SetCurrentLod(0);
+			BenchmarkClock::time_point start = BenchmarkClock::now();
+			int triangles = 0;
+			for (Model* model : models)
+			{
+				XMMATRIX world = model->GetWorldMatrix();
+				const XMFLOAT4& sphere = model->GetBoundingSphere();
+				XMVECTOR center = XMVector3TransformCoord(XMVectorSet(sphere.x, sphere.y, sphere.z, 1.0f), world);
+				float scale = sqrtf(XMVectorGetX(XMVectorMax(XMVector3LengthSq(world.r[0]), XMVectorMax(XMVector3LengthSq(world.r[1]), XMVector3LengthSq(world.r[2])))));
+				float distance = std::max(XMVectorGetX(XMVector3Length(XMVectorSubtract(center, eye))) - sphere.w * scale, settings.minDistance);
+
+				// From LOD 0 only the coarsening limit matters
+				int level = 0;
+				while (level + 1 < model->GetLodCount() && model->GetLod(level + 1).error <= distance / scale * coarsenFactor)
+					level++;
+				model->SetCurrentLod(level);
+				triangles += model->GetLod(level).triangleCount;
+			}
+			scalarBest = std::min(scalarBest, MillisecondsSince(start));
+			triangleMismatches += triangles != selector.GetStats().selectedTriangles;
+
+			for (int i = 0; i < modelCount; i++)
+				mismatches += simdLevels[i] != models[i]->GetCurrentLod();
+		}
+
+		Log("select, best frame: %.3f ms 4 at a time (%.0f ns per model), %.3f ms one at a time without hysteresis (%.0f ns per model)\n",
+			simdBest, simdBest * 1e6 / modelCount, scalarBest, scalarBest * 1e6 / modelCount);
+		Log("  %d levels and %d triangle counts differ from the scalar selection\n", mismatches, triangleMismatches);
+		Check(mismatches == 0 && triangleMismatches == 0, "the selection 4 at a time differs from the scalar one\n");
+	}
+
+	// Frame time stands in as a cost per triangle, without bias it would take twice the budget
+	{
+		LodSelector selector;
+		selector.Initialize(LodSelector::Settings());
+		selector.SetProjection(projection, screenHeight);
+		for (Model* model : models)
+			model->SetCurrentLod(0);
+
+		const LodSelector::Settings& settings = selector.GetSettings();
+		XMFLOAT3 camera = CameraAt(0.5f);
+		selector.Select(models, camera);
+		double fixedMilliseconds = 4.0;
+		double perTriangle = (2.0 * settings.budgetMilliseconds - fixedMilliseconds) / selector.GetStats().selectedTriangles;
+
+		Log("budget %.1f ms, %.1f ms without bias:\n", settings.budgetMilliseconds, fixedMilliseconds + perTriangle * selector.GetStats().selectedTriangles);
+		for (int frame = 0; frame < 240; frame++)
+		{
+			selector.Select(models, camera);
+			const LodSelector::Stats& stats = selector.GetStats();
+			double frameMilliseconds = fixedMilliseconds + perTriangle * stats.selectedTriangles;
+			selector.UpdateBias((float)frameMilliseconds);
+
+			if (frame == 0 || frame == 15 || frame == 30 || frame == 60 || frame == 120 || frame == 239)
+				Log("  frame %3d: bias %.2f, threshold %.1f px, %d triangles, %.1f ms\n", frame, stats.bias, stats.threshold, stats.selectedTriangles, frameMilliseconds);
+		}
+	}
+
+	for (Model* model : models)
+		delete model;
+}
+
+void Benchmark::RunGeometry()
+{
+	using namespace DirectX;
+
+	const uint32_t capacity = 1 << 24;
+	const int operations = 200000;
+	const int repeats = 3;
+
+	// Mesh sizes spread evenly over the powers of two from 32 to 32768 elements
+	auto RandomSize = [](std::mt19937& random)
+	{
+		return (uint32_t)std::exp2(std::uniform_real_distribution<float>(5.0f, 15.0f)(random));
+	};
+
+	// Reference, first fit over the free ranges in offset order, merged with their neighbours on free
+	struct FirstFit
+	{
+		std::map<uint32_t, uint32_t> freeRanges;		// Offset to size
+
+		void Initialize(uint32_t capacity)
+		{
+			freeRanges.clear();
+			freeRanges[0] = capacity;
+		}
+
+		int64_t Allocate(uint32_t size)
+		{
+			for (auto range = freeRanges.begin(); range != freeRanges.end(); ++range)
+			{
+				if (range->second < size)
+					continue;
+
+				uint32_t offset = range->first;
+				uint32_t rest = range->second - size;
+				freeRanges.erase(range);
+				if (rest > 0)
+					freeRanges[offset + size] = rest;
+				return offset;
+			}
+			return -1;
+		}
+
+		void Free(uint32_t offset, uint32_t size)
+		{
+			auto next = freeRanges.lower_bound(offset);
+			if (next != freeRanges.end() && offset + size == next->first)
+			{
+				size += next->second;
+				next = freeRanges.erase(next);
+			}
+			if (next != freeRanges.begin())
+			{
+				auto previous = std::prev(next);
+				if (previous->first + previous->second == offset)
+				{
+					previous->second += size;
+					return;
+				}
+			}
+			freeRanges.emplace_hint(next, offset, size);
+		}
+
+		float Fragmentation(int& blocks) const
+		{
+			uint64_t total = 0;
+			uint32_t largest = 0;
+			for (const auto& range : freeRanges)
+			{
+				total += range.second;
+				largest = std::max(largest, range.second);
+			}
+			blocks = (int)freeRanges.size();
+			return total > 0 ? 1.0f - (float)largest / (float)total : 0.0f;
+		}
+	};
+
+	struct Live
+	{
+		int64_t handle;
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	// Allocates until the target number of meshes is live, then frees a random one or allocates again at even odds.
+	// Both allocators get the same random sequence
+	auto Churn = [&](auto& allocate, auto& release, std::vector<Live>& live, int target, int count, int& failed)
+	{
+		std::mt19937 random(4242);
+		failed = 0;
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t coin = random();
+			if ((int)live.size() < target || (coin & 1 && !live.empty() && (int)live.size() < target * 2))
+			{
+				uint32_t size = RandomSize(random);
+				Live entry;
+				if (allocate(size, entry))
+					live.push_back(entry);
+				else
+					failed++;
+			}
+			else if (!live.empty())
+			{
+				size_t victim = random() % live.size();
+				release(live[victim]);
+				live[victim] = live.back();
+				live.pop_back();
+			}
+		}
+	};
+
+	TlsfAllocator tlsf;
+	auto TlsfAllocate = [&](uint32_t size, Live& entry)
+	{
+		int block = tlsf.Allocate(size);
+		entry.handle = block;
+		entry.offset = block >= 0 ? tlsf.GetOffset(block) : 0;
+		entry.size = block >= 0 ? tlsf.GetSize(block) : 0;
+		return block >= 0;
+	};
+	auto TlsfFree = [&](const Live& entry) { tlsf.Free((int)entry.handle); };
+
+	FirstFit firstFit;
+	auto FirstFitAllocate = [&](uint32_t size, Live& entry)
+	{
+		int64_t offset = firstFit.Allocate(size);
+		entry.handle = offset;
+		entry.offset = (uint32_t)offset;
+		entry.size = size;
+		return offset >= 0;
+	};
+	auto FirstFitFree = [&](const Live& entry) { firstFit.Free(entry.offset, entry.size); };
+
+	// Live ranges inside the capacity, apart from each other and adding up to what the allocator says is used
+	auto RangesConsistent = [&](std::vector<Live> live)
+	{
+		std::sort(live.begin(), live.end(), [](const Live& a, const Live& b) { return a.offset < b.offset; });
+		uint64_t used = 0;
+		int overlaps = 0;
+		for (size_t i = 0; i < live.size(); i++)
+		{
+			used += live[i].size;
+			if (i + 1 < live.size() && live[i].offset + live[i].size > live[i + 1].offset)
+				overlaps++;
+		}
+		bool inside = live.empty() || (uint64_t)live.back().offset + live.back().size <= capacity;
+		return overlaps == 0 && inside && used == tlsf.GetUsed() && (int)live.size() == tlsf.GetAllocationCount();
+	};
+
+	Log("%u elements, mesh sizes from 32 to 32768, %d operations per run\n", capacity, operations);
+
+	// Correctness under churn, and everything merges back into one block once it is all freed
+	{
+		tlsf.Initialize(capacity);
+		std::vector<Live> live;
+		int failed;
+		bool consistent = true;
+		for (int round = 0; round < 20; round++)
+		{
+			Churn(TlsfAllocate, TlsfFree, live, 1500, operations / 20, failed);
+			consistent = consistent && RangesConsistent(live) && tlsf.Validate();
+		}
+
+		for (const Live& entry : live)
+			tlsf.Free((int)entry.handle);
+		TlsfAllocator::Stats stats = tlsf.GetStats();
+		Log("tlsf: after the churn and freeing everything %d free block of %u\n", stats.freeBlocks, stats.largestFree);
+		Check(consistent, "tlsf ranges inconsistent through the churn\n");
+		Check(stats.freeBlocks == 1 && stats.largestFree == capacity && stats.used == 0, "tlsf didn't merge back into one block\n");
+	}
+
+	// Time per operation with few and many live meshes, first fit walks more free ranges the more there are.
+	// Both times have the same random numbers and bookkeeping of the live meshes in them
+	const int targets[] = { 100, 1000, 2500 };
+	for (int target : targets)
+	{
+		double tlsfMs = DBL_MAX, firstFitMs = DBL_MAX;
+		int tlsfFailed = 0, firstFitFailed = 0;
+		TlsfAllocator::Stats tlsfStats;
+		float firstFitFragmentation = 0.0f;
+		int firstFitBlocks = 0;
+		uint64_t firstFitUsed = 0;
+		for (int repeat = 0; repeat < repeats; repeat++)
+		{
+			std::vector<Live> live;
+			tlsf.Initialize(capacity);
+			Churn(TlsfAllocate, TlsfFree, live, target, operations, tlsfFailed);
+			live.clear();
+			tlsf.Initialize(capacity);
+			auto start = BenchmarkClock::now();
+			Churn(TlsfAllocate, TlsfFree, live, target, operations, tlsfFailed);
+			tlsfMs = std::min(tlsfMs, MillisecondsSince(start));
+			tlsfStats = tlsf.GetStats();
+
+			live.clear();
+			firstFit.Initialize(capacity);
+			start = BenchmarkClock::now();
+			Churn(FirstFitAllocate, FirstFitFree, live, target, operations, firstFitFailed);
+			firstFitMs = std::min(firstFitMs, MillisecondsSince(start));
+			firstFitFragmentation = firstFit.Fragmentation(firstFitBlocks);
+			firstFitUsed = 0;
+			for (const Live& entry : live)
+				firstFitUsed += entry.size;
+		}
+
+		Log("%d to %d live meshes: tlsf %.0f ns per operation, %.1f%% used, %d free blocks, fragmentation %.3f, %d failed | "
+			"first fit %.0f ns per operation, %.1f%% used, %d free blocks, fragmentation %.3f, %d failed\n",
+			target, target * 2, tlsfMs * 1e6 / operations, 100.0 * tlsfStats.used / capacity, tlsfStats.freeBlocks, tlsfStats.fragmentation, tlsfFailed,
+			firstFitMs * 1e6 / operations, 100.0 * firstFitUsed / capacity, firstFitBlocks, firstFitFragmentation, firstFitFailed);
+	}
+
+	// Frees wait for the frames in flight, a mesh bigger than a page gets its own
+	{
+		GeometryBuffer::Settings settings;
+		settings.pageVertices = 4096;
+		settings.pageIndices = 16384;
+		GeometryBuffer geometry;
+		geometry.Initialize(nullptr, nullptr, settings);
+
+		GeometryBuffer::Allocation first, second, large;
+		geometry.Allocate(1000, 3000, first);
+		geometry.Allocate(1000, 3000, second);
+		geometry.BeginFrame();
+		geometry.Free(first);
+		geometry.EndFrame();
+
+		int retiredAt = -1;
+		for (int frame = 1; frame < 8 && retiredAt < 0; frame++)
+		{
+			geometry.BeginFrame();
+			if (geometry.GetStats().pendingFrees == 0)
+				retiredAt = frame;
+			geometry.EndFrame();
+		}
+
+		// The freed range is the first again, the one after it is still taken
+		GeometryBuffer::Allocation again;
+		geometry.Allocate(1000, 3000, again);
+		geometry.Allocate(10000, 100, large);
+		Log("geometry buffer: freed in frame 0, given back at the start of frame %d with %d frames in flight, reused at vertex %u index %u, "
+			"a mesh of 10000 vertices went on page %d of %d vertices\n", retiredAt, settings.framesInFlight, again.baseVertex, again.startIndex,
+			large.page, (int)geometry.GetVertexAllocator(large.page).GetCapacity());
+		Check(retiredAt == settings.framesInFlight, "the free came back at frame %d, not after %d frames in flight\n", retiredAt, settings.framesInFlight);
+		Check(again.baseVertex == 0 && again.startIndex == 0, "the freed range wasn't reused\n");
+		Check(large.page == 1 && geometry.GetVertexAllocator(large.page).GetCapacity() >= 10000, "the large mesh didn't get a page of its own\n");
+	}
+
+	// Models on one shared page against a buffer pair each, drawn through the queue and the state cache
+	{
+		const int modelCount = 3000;
+		const UINT ringBytes = 4 * 1024 * 1024;
+		ConstantBufferStandIns buffers;
+
+		std::vector<Vertex> vertices;
+		std::vector<DWORD> indices;
+		BuildBoxRow(1, 0.0f, vertices, indices);
+
+		GeometryBuffer geometry;
+		geometry.Initialize(nullptr, nullptr, GeometryBuffer::Settings());
+
+		std::mt19937 random(1337);
+		std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+		std::vector<Model*> ownModels, sharedModels;
+		double createMs = 0.0;
+		for (int i = 0; i < modelCount; i++)
+		{
+			XMMATRIX world = XMMatrixTranslation(position(random), 0.0f, position(random));
+
+			Model* own = CreateStandInModel(vertices, indices, i);
+			own->GetMaterial().push_back(SurfaceMaterial());
+			own->ComputeBounds(vertices);
+			own->BuildSubsets();
+			own->SetWorldMatrix(world);
+			ownModels.push_back(own);
+
+			Model::SetSharedGeometry(&geometry);
+			Model* shared = new Model;
+			shared->GetMaterial().push_back(SurfaceMaterial());
+			auto start = BenchmarkClock::now();
+			shared->InitializeTerrain(vertices, indices, nullptr);
+			createMs += MillisecondsSince(start);
+			Model::SetSharedGeometry(nullptr);
+			shared->SetWorldMatrix(world);
+			sharedModels.push_back(shared);
+		}
+
+		Shader shader(nullptr);
+		Camera camera;
+		Light light;
+		XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 20.0f, -600.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		XMMATRIX projection = DefaultProjection();
+
+		auto Frame = [&](const std::vector<Model*>& models, int& geometryBinds, int& draws)
+		{
+			RecordingBackend recorder;
+			recorder.SetKeepCalls(false);
+			StateCache cache(&recorder);
+			RenderQueue queue;
+			ShaderConstants constants;
+			constants.Initialize(buffers.camera, buffers.light, buffers.material, buffers.objectRing, ringBytes);
+
+			queue.Begin(view, 1000.0f);
+			for (Model* model : models)
+				queue.Add(RenderQueue::PASS_OPAQUE, &shader, model);
+			queue.Sort();
+			queue.Submit(&cache, view, projection, &camera, &light, nullptr, &constants);
+
+			geometryBinds = recorder.GetCallCount(RecordingBackend::CALL_SET_VERTEX_BUFFERS) + recorder.GetCallCount(RecordingBackend::CALL_SET_INDEX_BUFFER);
+			draws = recorder.GetDrawCount();
+		};
+
+		int ownBinds, ownDraws, sharedBinds, sharedDraws;
+		Frame(ownModels, ownBinds, ownDraws);
+		Frame(sharedModels, sharedBinds, sharedDraws);
+
+		// Every model has its own ranges, the draws only differ in them
+		bool distinct = true;
+		for (int i = 1; i < modelCount; i++)
+			distinct = distinct && sharedModels[i]->GetBaseVertex() == sharedModels[i - 1]->GetBaseVertex() + (int)vertices.size() &&
+				sharedModels[i]->GetStartIndex() == sharedModels[i - 1]->GetStartIndex() + (int)indices.size();
+
+		GeometryBuffer::Stats stats = geometry.GetStats();
+		Log("%d models: %d vertex and index buffer binds for %d draws with a buffer pair each, %d for %d draws on %d shared page, "
+			"%.2f us to initialize a model onto the page\n", modelCount, ownBinds, ownDraws, sharedBinds, sharedDraws, stats.pages, createMs * 1000.0 / modelCount);
+		Check(sharedDraws == ownDraws, "%d draws on the shared page, %d with a buffer pair each\n", sharedDraws, ownDraws);
+		Check(distinct, "the models' ranges aren't one after another\n");
+
+		// Every model given back at once, nothing returns before the frames in flight are over
+		geometry.BeginFrame();
+		for (Model* model : sharedModels)
+			model->Shutdown();
+		geometry.EndFrame();
+		int pendingAfterShutdown = geometry.GetStats().pendingFrees;
+		for (int frame = 0; frame < geometry.GetStats().pendingFrees + 8 && geometry.GetStats().pendingFrees > 0; frame++)
+		{
+			geometry.BeginFrame();
+			geometry.EndFrame();
+		}
+		stats = geometry.GetStats();
+		TlsfAllocator::Stats vertexStats = geometry.GetVertexAllocator(0).GetStats();
+		Log("after shutting the models down: %d frees pending, then %d retired, %d allocations left, %d free vertex block\n",
+			pendingAfterShutdown, stats.retiredFrees, stats.allocations, vertexStats.freeBlocks);
+		Check(pendingAfterShutdown == modelCount && stats.allocations == 0 && vertexStats.freeBlocks == 1, "the models' ranges weren't all given back\n");
+
+		for (Model* model : ownModels)
+			delete model;
+		for (Model* model : sharedModels)
+			delete model;
+	}
+}
\ No newline at end of file
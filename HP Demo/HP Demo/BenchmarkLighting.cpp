@@ -0,0 +1,282 @@
+#include "Benchmark.h"
+#include "BenchmarkFixtures.h"
+#include "LightClusters.h"
+#include "ShadowCascades.h"
+#include "SceneBVH.h"
+#include "JobSystem.h"
+
+#include <cmath>
+#include <cfloat>
+#include <random>
+#include <algorithm>
+
+void Benchmark::RunLightClusters()
+{
+	using namespace DirectX;
+
+	const int lightCounts[] = { 1024, 2048, 4096, 8192 };
+	const int threadCounts[] = { 1, 2, 4, 8 };
+	const int frameCount = 32;
+	const float worldSize = 512.0f;
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<PointLight> allLights(8192);
+	for (PointLight& light : allLights)
+	{
+		light.position = XMFLOAT3(unit(random) * worldSize, unit(random) * 20.0f, unit(random) * worldSize);
+		light.range = 4.0f + unit(random) * 8.0f;
+		light.color = XMFLOAT3(unit(random), unit(random), unit(random));
+		light.intensity = 1.0f;
+	}
+
+	// Over the field from one corner, like walking through the demo terrain
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(20.0f, 15.0f, 20.0f, 1.0f), XMVectorSet(256.0f, 0.0f, 256.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+
+	LightClusters::Settings settings;
+	LightClusters clusters;
+	clusters.Initialize(settings, nullptr, 8192);
+	clusters.SetProjection(projection, 1280, 720);
+
+	Log("%dx%dx%d clusters, lights with 4 to 12 range over %.0fx%.0f, %d hardware threads\n", settings.clustersX, settings.clustersY, settings.clustersZ,
+		worldSize, worldSize, (int)std::thread::hardware_concurrency());
+
+	for (int lightCount : lightCounts)
+	{
+		std::vector<PointLight> lights(allLights.begin(), allLights.begin() + lightCount);
+
+		for (int threadCount : threadCounts)
+		{
+			if (threadCount > 1 && lightCount != 4096)
+				continue;
+
+			JobSystem jobSystem;
+			if (threadCount > 1)
+				jobSystem.Initialize(threadCount - 1);
+
+			double ms = 0.0;
+			for (int frame = 0; frame < frameCount; frame++)
+			{
+				clusters.Build(lights, view, jobSystem);
+				ms += clusters.GetStats().milliseconds;
+			}
+			ms /= frameCount;
+
+			const LightClusters::Stats& stats = clusters.GetStats();
+			Log("%d lights, %d threads: %d in view, %d clusters lit, %d indices (%.1f per lit cluster), %d dropped, %.3f ms per frame (%.3f ms per 1k lights)\n",
+				lightCount, threadCount, stats.visibleLights, stats.occupiedClusters, stats.indices, stats.indices / (double)std::max(stats.occupiedClusters, 1),
+				stats.dropped, ms, ms * 1024.0 / lightCount);
+		}
+	}
+
+	// Every cluster has to list exactly the lights a plain sphere against box test finds, with nothing dropped
+	{
+		settings.maxLightsPerCluster = 4096;
+		clusters.Initialize(settings, nullptr, 8192);
+		clusters.SetProjection(projection, 1280, 720);
+
+		JobSystem jobSystem;
+		std::vector<PointLight> lights(allLights.begin(), allLights.begin() + 4096);
+		clusters.Build(lights, view, jobSystem);
+
+		int wrong = 0;
+		for (int cluster = 0; cluster < clusters.GetClusterCount(); cluster++)
+		{
+			XMFLOAT3 boxMin, boxMax;
+			clusters.GetClusterBounds(cluster, boxMin, boxMax);
+
+			std::vector<uint32_t> expected;
+			for (int i = 0; i < (int)lights.size(); i++)
+			{
+				XMFLOAT3 center;
+				XMStoreFloat3(&center, XMVector3TransformCoord(XMLoadFloat3(&lights[i].position), view));
+				float dx = std::max(std::max(boxMin.x - center.x, center.x - boxMax.x), 0.0f);
+				float dy = std::max(std::max(boxMin.y - center.y, center.y - boxMax.y), 0.0f);
+				float dz = std::max(std::max(boxMin.z - center.z, center.z - boxMax.z), 0.0f);
+				if (dx * dx + dy * dy + dz * dz <= lights[i].range * lights[i].range)
+					expected.push_back(i);
+			}
+
+			const uint32_t* first = clusters.GetLightIndices().data() + clusters.GetClusterOffsets()[cluster];
+			std::vector<uint32_t> found(first, first + clusters.GetClusterCounts()[cluster]);
+			std::sort(found.begin(), found.end());
+			wrong += found != expected;
+		}
+		Log("4096 lights against a scalar test: %d of %d clusters differ\n", wrong, clusters.GetClusterCount());
+		Check(wrong == 0, "%d clusters differ from the scalar test\n", wrong);
+	}
+}
+
+void Benchmark::RunShadows()
+{
+	using namespace DirectX;
+
+	const float worldSize = 1024.0f;
+	const int objectCount = 20000;
+	const int frameCount = 64;
+	const int threadCounts[] = { 1, 2, 4, 8 };
+
+	// Boxes from knee high to towers over a flat field
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	SceneBVH sceneBVH;
+	std::vector<XMFLOAT3> boxMin, boxMax;
+	for (int i = 0; i < objectCount; i++)
+	{
+		float x = unit(random) * worldSize, z = unit(random) * worldSize;
+		float size = 1.0f + unit(random) * 3.0f;
+		float height = 1.0f + unit(random) * unit(random) * 40.0f;
+		boxMin.push_back(XMFLOAT3(x - size, 0.0f, z - size));
+		boxMax.push_back(XMFLOAT3(x + size, height, z + size));
+		sceneBVH.Insert(boxMin.back(), boxMax.back(), nullptr);
+	}
+	sceneBVH.Build();
+
+	XMFLOAT3 sceneMin, sceneMax;
+	sceneBVH.GetBounds(sceneMin, sceneMax);
+
+	// Low evening sun, long shadows reach far into the view
+	XMFLOAT3 toLight;
+	XMStoreFloat3(&toLight, XMVector3Normalize(XMVectorSet(-0.6f, 0.35f, 0.4f, 0.0f)));
+
+	XMMATRIX projection = DefaultProjection();
+	auto CameraView = [&](int frame)
+	{
+		// Walking and turning a little every frame
+		float yaw = 0.3f + frame * 0.013f;
+		XMVECTOR eye = XMVectorSet(500.0f + frame * 0.37f, 2.0f, 480.0f + frame * 0.21f, 1.0f);
+		return XMMatrixLookToLH(eye, XMVectorSet(sinf(yaw), -0.05f, cosf(yaw), 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	};
+
+	ShadowCascades::Settings settings;
+	ShadowCascades shadows;
+	shadows.Initialize(settings, nullptr);
+	Log("%d cascades of %d, %.0f shadow distance, %d boxes over %.0fx%.0f, %d hardware threads\n", settings.cascadeCount, settings.resolution,
+		settings.shadowDistance, objectCount, worldSize, worldSize, (int)std::thread::hardware_concurrency());
+
+	// Fitting: sizes have to stay the same and the origins on whole texels, and every slice has to be inside its cascade
+	{
+		float radius[ShadowCascades::MAX_CASCADES] = {};
+		int resized = 0, offGrid = 0, uncovered = 0;
+		double fitMilliseconds = 0.0;
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			XMMATRIX view = CameraView(frame);
+			shadows.Fit(view, projection, toLight, sceneMin, sceneMax);
+			fitMilliseconds += shadows.GetStats().fitMilliseconds;
+
+			XMMATRIX inverseView = XMMatrixInverse(nullptr, view);
+			XMFLOAT4X4 perspective;
+			XMStoreFloat4x4(&perspective, projection);
+
+			for (int i = 0; i < shadows.GetCascadeCount(); i++)
+			{
+				const ShadowCascades::Cascade& cascade = shadows.GetCascade(i);
+				if (frame > 0 && cascade.radius != radius[i])
+					resized++;
+				radius[i] = cascade.radius;
+
+				// Left and bottom edges of the ortho box in light space
+				const XMFLOAT4X4& ortho = cascade.projection;
+				float left = -(1.0f + ortho._41) / ortho._11;
+				float bottom = -(1.0f + ortho._42) / ortho._22;
+				float texelsX = left / cascade.texelSize, texelsY = bottom / cascade.texelSize;
+				if (fabsf(texelsX - roundf(texelsX)) > 0.01f || fabsf(texelsY - roundf(texelsY)) > 0.01f)
+					offGrid++;
+
+				for (int corner = 0; corner < 8; corner++)
+				{
+					float depth = corner & 4 ? cascade.splitFar : cascade.splitNear;
+					XMVECTOR viewPoint = XMVectorSet((corner & 1 ? 1.0f : -1.0f) * depth / perspective._11, (corner & 2 ? 1.0f : -1.0f) * depth / perspective._22, depth, 1.0f);
+					XMFLOAT3 clip;
+					XMStoreFloat3(&clip, XMVector3TransformCoord(XMVector3TransformCoord(viewPoint, inverseView), XMLoadFloat4x4(&cascade.viewProjection)));
+					if (fabsf(clip.x) > 1.0f || fabsf(clip.y) > 1.0f || clip.z < 0.0f || clip.z > 1.0f)
+						uncovered++;
+				}
+			}
+		}
+
+		for (int i = 0; i < shadows.GetCascadeCount(); i++)
+		{
+			const ShadowCascades::Cascade& cascade = shadows.GetCascade(i);
+			Log("cascade %d: %.1f to %.1f, radius %.2f, %.3f per texel\n", i, cascade.splitNear, cascade.splitFar, cascade.radius, cascade.texelSize);
+		}
+		Log("%d frames: fit %.4f ms, %d size changes, %d origins off the texel grid, %d slice corners outside their cascade\n",
+			frameCount, fitMilliseconds / frameCount, resized, offGrid, uncovered);
+		Check(resized == 0, "%d cascade size changes while the camera moved\n", resized);
+		Check(offGrid == 0, "%d cascade origins off the texel grid\n", offGrid);
+		Check(uncovered == 0, "%d slice corners outside their cascade\n", uncovered);
+	}
+
+	// Culling, one job per cascade
+	for (int threadCount : threadCounts)
+	{
+		JobSystem jobSystem;
+		if (threadCount > 1)
+			jobSystem.Initialize(threadCount - 1);
+
+		double cullMilliseconds = 0.0;
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			shadows.Fit(CameraView(frame), projection, toLight, sceneMin, sceneMax);
+			shadows.Cull(sceneBVH, jobSystem);
+			cullMilliseconds += shadows.GetStats().cullMilliseconds;
+		}
+
+		const ShadowCascades::Stats& stats = shadows.GetStats();
+		Log("%d threads: cull %.3f ms, casters %d / %d / %d / %d\n", threadCount, cullMilliseconds / frameCount,
+			stats.casters[0], stats.casters[1], stats.casters[2], stats.casters[3]);
+	}
+
+	// Every box that reaches into a cascade's light space box has to be found, also the ones the camera can't see
+	{
+		XMMATRIX view = CameraView(frameCount - 1);
+		JobSystem jobSystem;
+		shadows.Fit(view, projection, toLight, sceneMin, sceneMax);
+		shadows.Cull(sceneBVH, jobSystem);
+
+		std::vector<int> inView;
+		sceneBVH.QueryFrustum(view * projection, inView);
+		std::vector<char> visible(objectCount, 0);
+		for (int handle : inView)
+			visible[handle] = 1;
+
+		int missed = 0, extra = 0, outOfView = 0;
+		for (int i = 0; i < shadows.GetCascadeCount(); i++)
+		{
+			XMMATRIX viewProjection = XMLoadFloat4x4(&shadows.GetCascade(i).viewProjection);
+			std::vector<char> found(objectCount, 0);
+			for (int handle : shadows.GetCasters(i))
+				found[handle] = 1;
+
+			for (int object = 0; object < objectCount; object++)
+			{
+				XMFLOAT3 clipMin(FLT_MAX, FLT_MAX, FLT_MAX), clipMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				for (int corner = 0; corner < 8; corner++)
+				{
+					XMVECTOR point = XMVectorSet(corner & 1 ? boxMax[object].x : boxMin[object].x, corner & 2 ? boxMax[object].y : boxMin[object].y,
+						corner & 4 ? boxMax[object].z : boxMin[object].z, 1.0f);
+					XMFLOAT3 clip;
+					XMStoreFloat3(&clip, XMVector3TransformCoord(point, viewProjection));
+					clipMin = XMFLOAT3(std::min(clipMin.x, clip.x), std::min(clipMin.y, clip.y), std::min(clipMin.z, clip.z));
+					clipMax = XMFLOAT3(std::max(clipMax.x, clip.x), std::max(clipMax.y, clip.y), std::max(clipMax.z, clip.z));
+				}
+
+				bool overlaps = clipMax.x >= -1.0f && clipMin.x <= 1.0f && clipMax.y >= -1.0f && clipMin.y <= 1.0f && clipMax.z >= 0.0f && clipMin.z <= 1.0f;
+				if (overlaps && !found[object])
+					missed++;
+				if (!overlaps && found[object])
+					extra++;
+				if (found[object] && !visible[object])
+					outOfView++;
+			}
+		}
+		Log("against every box: %d casters missed, %d extra, %d found casters outside the view frustum\n", missed, extra, outOfView);
+		Check(missed == 0, "%d boxes in a cascade were not found as casters\n", missed);
+		Check(extra == 0, "%d casters found outside their cascade\n", extra);
+
+		// The low sun has to put casters behind and beside the camera, or missed == 0 says nothing about them
+		Check(outOfView > 0, "no casters outside the view frustum, the scene does not test them\n");
+	}
+}
\ No newline at end of file
@@ -0,0 +1,1004 @@
+#include "Benchmark.h"
+#include "BenchmarkFixtures.h"
+#include "RenderQueue.h"
+#include "StateCache.h"
+#include "ShaderConstants.h"
+#include "CommandRecorder.h"
+#include "MaterialTable.h"
+#include "FrustumCuller.h"
+#include "JobSystem.h"
+
+#include <cfloat>
+#include <cstring>
+#include <random>
+#include <algorithm>
+
+void Benchmark::RunRenderQueue()
+{
+	const int packetCount = 50000;
+	const int frameCount = 64;
+	const int shaderCount = 8;
+	const int materialCount = 256;
+	const int textureCount = 512;
+	const int meshCount = 5000;
+
+	// The queue only compares the state pointers, so made up addresses stand in for real objects
+	struct FakePacket
+	{
+		Shader* shader;
+		Model* model;
+		uint64_t material;
+		ID3D11ShaderResourceView* texture;
+		float depth;
+	};
+
+	std::mt19937 random(1337);
+	std::uniform_int_distribution<int> shaderIndex(0, shaderCount - 1);
+	std::uniform_int_distribution<int> materialIndex(0, materialCount - 1);
+	std::uniform_int_distribution<int> textureIndex(0, textureCount - 1);
+	std::uniform_int_distribution<int> meshIndex(0, meshCount - 1);
+	std::uniform_real_distribution<float> depth(0.1f, 1000.0f);
+
+	std::vector<FakePacket> input(packetCount);
+	for (FakePacket& packet : input)
+	{
+		packet.shader = (Shader*)(uintptr_t)(0x1000 + shaderIndex(random) * 0x100);
+		packet.model = (Model*)(uintptr_t)(0x100000 + meshIndex(random) * 0x100);
+		packet.material = 1 + materialIndex(random);
+		packet.texture = (ID3D11ShaderResourceView*)(uintptr_t)(0x10000000 + textureIndex(random) * 0x100);
+		packet.depth = depth(random);
+	}
+
+	Log("%d packets, %d shaders, %d materials, %d textures, %d meshes\n", packetCount, shaderCount, materialCount, textureCount, meshCount);
+
+	RenderQueue queue;
+	double addMs = 0.0, sortMs = 0.0;
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		auto start = BenchmarkClock::now();
+		queue.Begin(DirectX::XMMatrixIdentity(), 1000.0f);
+		for (const FakePacket& packet : input)
+			queue.Add(RenderQueue::PASS_OPAQUE, packet.shader, packet.model, packet.material, packet.texture, packet.depth);
+		addMs += MillisecondsSince(start);
+
+		queue.Sort();
+		sortMs += queue.GetStats().sortMilliseconds;
+	}
+
+	// Same keys through std::sort, for comparison with the radix sort
+	std::vector<SortKey> keys(packetCount);
+	double stdSortMs = 0.0;
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		for (int i = 0; i < packetCount; i++)
+		{
+			const RenderQueue::DrawPacket& packet = queue.GetSortedPacket((i * 7919) % packetCount);
+			keys[i].key = (uint64_t)(uintptr_t)packet.shader << 40 ^ packet.materialHash << 24 ^ (uint64_t)(uintptr_t)packet.texture ^ i;
+			keys[i].index = i;
+		}
+
+		auto start = BenchmarkClock::now();
+		std::sort(keys.begin(), keys.end(), [](const SortKey& a, const SortKey& b) { return a.key < b.key; });
+		stdSortMs += MillisecondsSince(start);
+	}
+
+	const RenderQueue::Stats& stats = queue.GetStats();
+	Log("add %.3f ms, sort %.3f ms (radix), std::sort %.3f ms per frame\n", addMs / frameCount, sortMs / frameCount, stdSortMs / frameCount);
+	Log("state changes per frame: %d immediate, %d unsorted with diffs, %d sorted (%.1fx fewer than immediate)\n",
+		stats.immediateStateChanges, stats.unsortedStateChanges, stats.stateChanges, stats.immediateStateChanges / (double)stats.stateChanges);
+
+	// Sorted order has to keep every packet exactly once, with non decreasing keys
+	int shaderSwitches = 0;
+	for (int i = 1; i < queue.GetPacketCount(); i++)
+		if (queue.GetSortedPacket(i).shader != queue.GetSortedPacket(i - 1).shader)
+			shaderSwitches++;
+	Log("shader switches %d (%d shaders)\n", shaderSwitches, shaderCount);
+	Check(shaderSwitches == shaderCount - 1, "sort order wrong, %d shader switches\n", shaderSwitches);
+}
+
+void Benchmark::RunStateCache()
+{
+	const int drawCount = 20000;
+	const int frameCount = 32;
+	const int shaderCount = 8;
+	const int textureCount = 64;
+	const int meshCount = 500;
+
+	// Made up object addresses, neither backend here looks behind the pointers
+	auto Fake = [](uintptr_t base, int index) { return base + (uintptr_t)index * 64; };
+
+	struct FakeShader
+	{
+		ID3D11InputLayout* inputLayout;
+		ID3D11VertexShader* vertexShader;
+		ID3D11PixelShader* pixelShader;
+		ID3D11Buffer* objectBuffer;
+		ID3D11Buffer* cameraBuffer;
+		ID3D11Buffer* lightBuffer;
+		ID3D11Buffer* materialBuffer;
+	};
+
+	struct FakeDraw
+	{
+		int shader;
+		int mesh;
+		ID3D11Buffer* vertexBuffer;
+		ID3D11Buffer* indexBuffer;
+		ID3D11ShaderResourceView* texture;
+		ID3D11ShaderResourceView* normalMap;
+	};
+
+	std::vector<FakeShader> shaders(shaderCount);
+	for (int i = 0; i < shaderCount; i++)
+	{
+		shaders[i].inputLayout = (ID3D11InputLayout*)Fake(0x10000, i);
+		shaders[i].vertexShader = (ID3D11VertexShader*)Fake(0x20000, i);
+		shaders[i].pixelShader = (ID3D11PixelShader*)Fake(0x30000, i);
+		shaders[i].objectBuffer = (ID3D11Buffer*)Fake(0x40000, i * 4 + 0);
+		shaders[i].cameraBuffer = (ID3D11Buffer*)Fake(0x40000, i * 4 + 1);
+		shaders[i].lightBuffer = (ID3D11Buffer*)Fake(0x40000, i * 4 + 2);
+		shaders[i].materialBuffer = (ID3D11Buffer*)Fake(0x40000, i * 4 + 3);
+	}
+	ID3D11SamplerState* sampler = (ID3D11SamplerState*)Fake(0x50000, 0);
+
+	// Every mesh has its own buffers and one shader, texture and normal map
+	std::mt19937 random(1337);
+	std::uniform_int_distribution<int> meshIndex(0, meshCount - 1);
+	std::vector<FakeDraw> meshes(meshCount);
+	for (int i = 0; i < meshCount; i++)
+	{
+		meshes[i].shader = random() % shaderCount;
+		meshes[i].mesh = i;
+		meshes[i].vertexBuffer = (ID3D11Buffer*)Fake(0x1000000, i * 2);
+		meshes[i].indexBuffer = (ID3D11Buffer*)Fake(0x1000000, i * 2 + 1);
+		meshes[i].texture = (ID3D11ShaderResourceView*)Fake(0x2000000, random() % textureCount);
+		meshes[i].normalMap = random() % 2 ? (ID3D11ShaderResourceView*)Fake(0x3000000, random() % textureCount) : nullptr;
+	}
+
+	std::vector<FakeDraw> submitted(drawCount);
+	for (FakeDraw& draw : submitted)
+		draw = meshes[meshIndex(random)];
+
+	std::vector<FakeDraw> sorted = submitted;
+	std::sort(sorted.begin(), sorted.end(), [](const FakeDraw& a, const FakeDraw& b)
+	{
+		if (a.shader != b.shader)
+			return a.shader < b.shader;
+		if (a.texture != b.texture)
+			return a.texture < b.texture;
+		return a.mesh < b.mesh;
+	});
+
+	// The calls Model::Render and Shader::Render make for one draw
+	auto EmitDraw = [&](RenderBackend* context, const FakeDraw& draw)
+	{
+		const FakeShader& shader = shaders[draw.shader];
+		UINT stride = sizeof(Vertex);
+		UINT offset = 0;
+		char constants[192] = {};
+
+		context->IASetVertexBuffers(0, 1, &draw.vertexBuffer, &stride, &offset);
+		context->IASetIndexBuffer(draw.indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+		context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+		context->UpdateSubresource(shader.objectBuffer, 0, nullptr, constants, 0, 0);
+		context->VSSetConstantBuffers(0, 1, &shader.objectBuffer);
+		context->PSSetShaderResources(0, 1, &draw.texture);
+		if (draw.normalMap)
+			context->PSSetShaderResources(2, 1, &draw.normalMap);
+		context->UpdateSubresource(shader.materialBuffer, 0, nullptr, constants, 0, 0);
+		context->PSSetConstantBuffers(1, 1, &shader.materialBuffer);
+		context->GSSetConstantBuffers(1, 1, &shader.materialBuffer);
+		context->UpdateSubresource(shader.cameraBuffer, 0, nullptr, constants, 0, 0);
+		context->VSSetConstantBuffers(1, 1, &shader.cameraBuffer);
+		context->GSSetConstantBuffers(0, 1, &shader.cameraBuffer);
+		context->UpdateSubresource(shader.lightBuffer, 0, nullptr, constants, 0, 0);
+		context->PSSetConstantBuffers(0, 1, &shader.lightBuffer);
+
+		context->IASetInputLayout(shader.inputLayout);
+		context->VSSetShader(shader.vertexShader, nullptr, 0);
+		context->PSSetShader(shader.pixelShader, nullptr, 0);
+		context->PSSetSamplers(0, 1, &sampler);
+		context->DrawIndexed(36, 0, 0);
+	};
+
+	Log("%d draws, %d shaders, %d textures, %d meshes\n", drawCount, shaderCount, textureCount, meshCount);
+
+	const char* orderNames[] = { "submission order", "sorted by state" };
+	const std::vector<FakeDraw>* orders[] = { &submitted, &sorted };
+	for (int o = 0; o < 2; o++)
+	{
+		const std::vector<FakeDraw>& draws = *orders[o];
+
+		RecordingBackend direct;
+		RecordingBackend filtered;
+		StateCache cache(&filtered);
+		for (const FakeDraw& draw : draws)
+		{
+			EmitDraw(&direct, draw);
+			EmitDraw(&cache, draw);
+		}
+
+		// The same state at every draw means the filtering dropped nothing that mattered
+		const StateCache::Stats& stats = cache.GetStats();
+		Log("%s: %d calls, %d forwarded, %.1f%% filtered, %.1f calls per draw\n", orderNames[o], stats.calls, stats.forwarded,
+			100.0 * (stats.calls - stats.forwarded) / stats.calls, stats.forwarded / (double)stats.draws);
+		Check(direct.GetDrawCount() == filtered.GetDrawCount(), "%s: %d draws through the cache, %d without\n", orderNames[o], filtered.GetDrawCount(), direct.GetDrawCount());
+		Check(direct.GetDrawStateHash() == filtered.GetDrawStateHash(), "%s: draw state differs through the cache\n", orderNames[o]);
+
+		for (int type = 0; type < RecordingBackend::CALL_TYPE_COUNT; type++)
+		{
+			RecordingBackend::CallType callType = (RecordingBackend::CallType)type;
+			if (direct.GetCallCount(callType) == 0)
+				continue;
+
+			Log("  %-22s %7d -> %7d\n", RecordingBackend::GetCallName(callType), direct.GetCallCount(callType), filtered.GetCallCount(callType));
+		}
+	}
+
+	// What the filtering costs on the CPU, behind a backend that only counts
+	RecordingBackend counter;
+	counter.SetKeepCalls(false);
+	StateCache cache(&counter);
+
+	auto start = BenchmarkClock::now();
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		for (const FakeDraw& draw : sorted)
+			EmitDraw(&counter, draw);
+	}
+	double directMs = MillisecondsSince(start) / frameCount;
+
+	start = BenchmarkClock::now();
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		cache.Invalidate();
+		for (const FakeDraw& draw : sorted)
+			EmitDraw(&cache, draw);
+	}
+	double cachedMs = MillisecondsSince(start) / frameCount;
+
+	Log("per frame: %.3f ms straight to the backend, %.3f ms through the cache\n", directMs, cachedMs);
+}
+
+void Benchmark::RunConstants()
+{
+	using namespace DirectX;
+
+	const int drawCount = 20000;
+	const int frameCount = 32;
+	const int materialCount = 64;
+	const int meshCount = 500;
+	const UINT ringBytes = 4 * 1024 * 1024;
+
+	// Stand-ins for the buffers, the recording backend never looks behind them
+	ID3D11Buffer* objectBuffer = (ID3D11Buffer*)(uintptr_t)0x1000;
+	ConstantBufferStandIns buffers;
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+
+	std::vector<Model*> models(meshCount);
+	for (int i = 0; i < meshCount; i++)
+	{
+		float shade = (float)(random() % materialCount) / materialCount;
+
+		models[i] = new Model;
+		models[i]->GetMaterial().push_back(SurfaceMaterial());
+		models[i]->GetMaterial()[0].diffuseColor = XMFLOAT4(shade, shade, shade, 1.0f);
+		models[i]->SetWorldMatrix(XMMatrixTranslation(position(random), 0.0f, position(random)));
+	}
+
+	// Draws in the order the render queue puts them, by material
+	std::vector<Model*> draws(drawCount);
+	for (Model*& model : draws)
+		model = models[random() % meshCount];
+	std::sort(draws.begin(), draws.end(), [](Model* a, Model* b)
+	{
+		if (a->GetMaterial()[0].diffuseColor.x != b->GetMaterial()[0].diffuseColor.x)
+			return a->GetMaterial()[0].diffuseColor.x < b->GetMaterial()[0].diffuseColor.x;
+		return a < b;
+	});
+
+	Camera camera;
+	Light light;
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 50.0f, -600.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+
+	Log("%d draws, %d materials, %d meshes, %u KB ring\n", drawCount, materialCount, meshCount, ringBytes / 1024);
+
+	// Every draw writes all four buffers, the way Shader::Render does
+	{
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+
+		Shader::cBufferPerObject objectCB;
+		Shader::cBufferCamera cameraCB = {};
+		Shader::cBufferLight lightCB = {};
+		Shader::cBufferMaterial materialCB = {};
+		size_t bytes = 0;
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			cache.ResetStats();
+			recorder.Clear();
+			bytes = 0;
+
+			for (Model* model : draws)
+			{
+				Shader::FillObjectCB(objectCB, model, view, projection);
+				cache.UpdateSubresource(objectBuffer, 0, nullptr, &objectCB, 0, 0);
+				cache.VSSetConstantBuffers(0, 1, &objectBuffer);
+
+				Shader::FillMaterialCB(materialCB, model);
+				cache.UpdateSubresource(buffers.material, 0, nullptr, &materialCB, 0, 0);
+				cache.PSSetConstantBuffers(1, 1, &buffers.material);
+				cache.GSSetConstantBuffers(1, 1, &buffers.material);
+
+				Shader::FillCameraCB(cameraCB, &camera);
+				cache.UpdateSubresource(buffers.camera, 0, nullptr, &cameraCB, 0, 0);
+				cache.VSSetConstantBuffers(1, 1, &buffers.camera);
+				cache.GSSetConstantBuffers(0, 1, &buffers.camera);
+
+				Shader::FillLightCB(lightCB, &light);
+				cache.UpdateSubresource(buffers.light, 0, nullptr, &lightCB, 0, 0);
+				cache.PSSetConstantBuffers(0, 1, &buffers.light);
+
+				cache.DrawIndexed(36, 0, 0);
+				bytes += sizeof(objectCB) + sizeof(materialCB) + sizeof(cameraCB) + sizeof(lightCB);
+			}
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		Log("per draw buffers: %.1f KB uploaded, %d updates, %d maps, %d calls reach the context, %.3f ms per frame\n", bytes / 1024.0,
+			recorder.GetCallCount(RecordingBackend::CALL_UPDATE_SUBRESOURCE), recorder.GetCallCount(RecordingBackend::CALL_MAP), recorder.GetTotalCalls(), ms);
+	}
+
+	// Frame and material buffers written when they change, object data through the ring
+	{
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+
+		ShaderConstants constants;
+		constants.Initialize(buffers.camera, buffers.light, buffers.material, buffers.objectRing, ringBytes);
+		std::vector<UINT> offsets(draws.size());
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			cache.ResetStats();
+			recorder.Clear();
+			constants.ResetStats();
+
+			constants.SetFrame(&cache, &camera, &light);
+			cache.VSSetConstantBuffers(1, 1, &buffers.camera);
+			cache.GSSetConstantBuffers(0, 1, &buffers.camera);
+			cache.PSSetConstantBuffers(0, 1, &buffers.light);
+			cache.PSSetConstantBuffers(1, 1, &buffers.material);
+			cache.GSSetConstantBuffers(1, 1, &buffers.material);
+
+			size_t first = 0;
+			while (first < draws.size())
+			{
+				size_t last = first + constants.MapObjects(&cache, (int)(draws.size() - first));
+				for (size_t i = first; i < last; i++)
+					offsets[i] = constants.WriteObject(draws[i], view, projection);
+				constants.UnmapObjects(&cache);
+
+				for (size_t i = first; i < last; i++)
+				{
+					if (i == 0 || draws[i]->GetMaterial()[0].diffuseColor.x != draws[i - 1]->GetMaterial()[0].diffuseColor.x)
+						constants.SetMaterial(&cache, draws[i]);
+
+					UINT constantCount = ShaderConstants::OBJECT_CONSTANTS;
+					cache.VSSetConstantBuffers1(0, 1, &buffers.objectRing, &offsets[i], &constantCount);
+					cache.DrawIndexed(36, 0, 0);
+				}
+				first = last;
+			}
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		const ShaderConstants::Stats& stats = constants.GetStats();
+		Log("split buffers + ring: %.1f KB uploaded, %d updates (%d skipped), %d maps, %d discards, %d calls reach the context, %.3f ms per frame\n",
+			stats.bytesUploaded / 1024.0, stats.updates, stats.skippedUpdates, stats.maps, stats.discards, recorder.GetTotalCalls(), ms);
+	}
+
+	for (Model* model : models)
+		delete model;
+}
+
+void Benchmark::RunInstancing()
+{
+	using namespace DirectX;
+
+	const int instanceCount = 10000;
+	const int frameCount = 32;
+
+	// Stand-in for the instance buffer, the recording backend maps memory of its own for it
+	ID3D11Buffer* instanceBuffer = (ID3D11Buffer*)(uintptr_t)0x1000;
+
+	// A unit box for the bounds, the backend never sees the vertices
+	std::vector<Vertex> corners;
+	for (int i = 0; i < 8; i++)
+		corners.push_back(Vertex(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f));
+
+	Model mesh;
+	mesh.ComputeBounds(corners);
+	mesh.SetIndexCount(36);
+	mesh.GetMaterial().push_back(SurfaceMaterial());
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<XMMATRIX> worlds(instanceCount);
+	for (XMMATRIX& world : worlds)
+	{
+		float scale = 0.5f + unit(random) * 2.0f;
+		world = XMMatrixScaling(scale, scale, scale) * XMMatrixRotationY(unit(random) * XM_2PI) * XMMatrixTranslation(position(random), 0.0f, position(random));
+	}
+
+	Shader shader(nullptr);
+	Camera camera;
+	Light light;
+	ID3D11SamplerState* sampler = nullptr;
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 50.0f, -600.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+
+	Log("%d instances of one mesh\n", instanceCount);
+
+	// Every placement its own Model, culled together and drawn with Shader::Render
+	{
+		std::vector<Model> models(instanceCount, mesh);
+		FrustumCuller culler;
+		culler.Reserve(instanceCount);
+		for (int i = 0; i < instanceCount; i++)
+		{
+			// The copy shares the buffers and bounds, not the materials
+			models[i].GetMaterial().push_back(SurfaceMaterial());
+			models[i].SetWorldMatrix(worlds[i]);
+			culler.AddModel(&models[i]);
+		}
+
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+		std::vector<int> visible;
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			recorder.Clear();
+			cache.Invalidate();
+
+			culler.Cull(view * projection, visible);
+			for (int index : visible)
+			{
+				models[index].Render(&cache);
+				shader.Render(&cache, &models[index], view, projection, &camera, &light, sampler);
+			}
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		Log("model per instance: %d visible, %d draws, %d calls reach the context, %.3f ms per frame\n",
+			(int)visible.size(), recorder.GetDrawCount(), recorder.GetTotalCalls(), ms);
+	}
+
+	// One Model carrying the instances, gathered into the instance buffer and drawn once
+	{
+		for (int i = 0; i < instanceCount; i++)
+			mesh.AddInstance(worlds[i], XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+		mesh.SetInstanceBuffer(instanceBuffer, instanceCount);
+
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+		double gatherMs = 0.0;
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			recorder.Clear();
+			cache.Invalidate();
+
+			auto gatherStart = BenchmarkClock::now();
+			mesh.GatherVisibleInstances(&cache, view * projection);
+			gatherMs += MillisecondsSince(gatherStart);
+
+			mesh.RenderInstanced(&cache);
+			shader.RenderInstanced(&cache, &mesh, mesh.GetVisibleInstanceCount(), 0, view, projection, &camera, &light, sampler);
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		Log("instanced: %d visible, %d draws, %d calls reach the context, %.1f KB instance data, %.3f ms per frame (%.3f ms cull + gather)\n",
+			mesh.GetVisibleInstanceCount(), recorder.GetDrawCount(), recorder.GetTotalCalls(), mesh.GetVisibleInstanceCount() * sizeof(ModelInstance) / 1024.0,
+			ms, gatherMs / frameCount);
+
+		mesh.SetInstanceBuffer(nullptr, 0);
+	}
+}
+
+void Benchmark::RunParallelSubmit()
+{
+	using namespace DirectX;
+
+	const int drawCount = 20000;
+	const int frameCount = 32;
+	const int shaderCount = 4;
+	const int materialCount = 64;
+	const int meshCount = 500;
+	const int threadCounts[] = { 2, 4, 8 };
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+
+	// Shaders without a device bind null objects, the recording backend only compares them
+	std::vector<Shader*> shaders(shaderCount);
+	for (Shader*& shader : shaders)
+		shader = new Shader(nullptr);
+
+	std::vector<Model*> models(meshCount);
+	for (int i = 0; i < meshCount; i++)
+	{
+		float shade = (float)(random() % materialCount) / materialCount;
+
+		models[i] = new Model;
+		models[i]->SetIndexCount(36);
+		models[i]->GetMaterial().push_back(SurfaceMaterial());
+		models[i]->GetMaterial()[0].diffuseColor = XMFLOAT4(shade, shade, shade, 1.0f);
+		models[i]->SetWorldMatrix(XMMatrixTranslation(position(random), 0.0f, position(random)));
+	}
+
+	Camera camera;
+	Light light;
+	ID3D11SamplerState* sampler = nullptr;
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 50.0f, -600.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+
+	RenderQueue queue;
+	queue.Begin(view, 1000.0f);
+	for (int i = 0; i < drawCount; i++)
+		queue.Add(RenderQueue::PASS_OPAQUE, shaders[random() % shaderCount], models[random() % meshCount]);
+	queue.Sort();
+
+	Log("%d draws, %d shaders, %d materials, %d meshes, %u hardware threads\n", drawCount, shaderCount, materialCount, meshCount, std::thread::hardware_concurrency());
+
+	// One thread through the state cache, as Scene does without workers
+	double serialMs = 0.0;
+	{
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			recorder.Clear();
+			cache.Invalidate();
+			queue.Submit(&cache, view, projection, &camera, &light, sampler);
+		}
+		serialMs = MillisecondsSince(start) / frameCount;
+
+		Log("serial: %d draws, %d calls reach the context, %.3f ms per frame\n", recorder.GetDrawCount(), recorder.GetTotalCalls(), serialMs);
+	}
+
+	// Ranges recorded on their own contexts and appended in order
+	for (int threadCount : threadCounts)
+	{
+		JobSystem jobSystem;
+		jobSystem.Initialize(threadCount - 1);
+
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+		RecordingCommandRecorder commandRecorder(&recorder, false);
+		double recordMs = 0.0;
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			recorder.Clear();
+			cache.Invalidate();
+			queue.SubmitParallel(&cache, &commandRecorder, jobSystem, view, projection, &camera, &light, sampler);
+			recordMs += queue.GetStats().recordMilliseconds;
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		Log("%d threads: %d command lists, %d draws, %d calls reach the context, %.3f ms per frame (%.3f ms recording and executing), %.2fx serial\n",
+			threadCount, queue.GetStats().commandLists, recorder.GetDrawCount(), recorder.GetTotalCalls(), ms, recordMs / frameCount, serialMs / ms);
+	}
+
+	// Every draw has to see the same bound state as in the serial submission
+	{
+		RecordingBackend serial;
+		StateCache serialCache(&serial);
+		queue.Submit(&serialCache, view, projection, &camera, &light, sampler);
+
+		JobSystem jobSystem;
+		jobSystem.Initialize(3);
+
+		RecordingBackend parallel;
+		StateCache parallelCache(&parallel);
+		RecordingCommandRecorder commandRecorder(&parallel, true);
+		queue.SubmitParallel(&parallelCache, &commandRecorder, jobSystem, view, projection, &camera, &light, sampler);
+
+		Log("draw state serial %016llx, parallel %016llx\n", (unsigned long long)serial.GetDrawStateHash(), (unsigned long long)parallel.GetDrawStateHash());
+		Check(serial.GetDrawCount() == parallel.GetDrawCount(), "%d draws serial, %d parallel\n", serial.GetDrawCount(), parallel.GetDrawCount());
+		Check(serial.GetDrawStateHash() == parallel.GetDrawStateHash(), "the parallel draws differ from the serial ones\n");
+	}
+
+	for (Model* model : models)
+		delete model;
+	for (Shader* shader : shaders)
+		delete shader;
+}
+
+void Benchmark::RunSubsets()
+{
+	using namespace DirectX;
+
+	const int modelCount = 5000;
+	const int partCount = 4;
+	const int paletteSize = 16;
+	const int frameCount = 32;
+	const float partSpacing = 12.0f;
+
+	// Four boxes in a row, each its own subset with its own material, like an obj with groups
+	std::vector<Vertex> vertices;
+	std::vector<DWORD> indices;
+	BuildBoxRow(partCount, partSpacing, vertices, indices);
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	auto createModels = [&](bool subsets, std::vector<Model*>& models)
+	{
+		random.seed(1337);
+		for (int i = 0; i < modelCount; i++)
+		{
+			Model* model = CreateStandInModel(vertices, indices, i);
+
+			for (int part = 0; part < partCount; part++)
+			{
+				float shade = (float)(random() % paletteSize) / paletteSize;
+				model->GetMaterial().push_back(SurfaceMaterial());
+				model->GetMaterial()[part].diffuseColor = XMFLOAT4(shade, 1.0f - shade, 0.5f, 1.0f);
+			}
+			SetBoxSubsets(model, partCount);
+
+			model->ComputeBounds(vertices);
+			if (subsets)
+				model->BuildSubsets();
+			model->SetWorldMatrix(XMMatrixRotationY(unit(random) * XM_2PI) * XMMatrixTranslation(position(random), 0.0f, position(random)));
+			models.push_back(model);
+		}
+	};
+
+	std::vector<Model*> wholeModels, subsetModels;
+	createModels(false, wholeModels);
+	createModels(true, subsetModels);
+
+	Shader shader(nullptr);
+	Camera camera;
+	Light light;
+	ID3D11SamplerState* sampler = nullptr;
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 20.0f, -100.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 300.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+
+	Log("%d models of %d subsets, %d materials in the palette\n", modelCount, partCount, paletteSize);
+
+	auto renderFrames = [&](const std::vector<Model*>& models, bool cullSubsets, const char* name)
+	{
+		FrustumCuller culler;
+		for (Model* model : models)
+			culler.AddModel(model);
+
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		StateCache cache(&recorder);
+		RenderQueue queue;
+		std::vector<int> visible;
+
+		auto start = BenchmarkClock::now();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			recorder.Clear();
+			cache.Invalidate();
+
+			culler.Cull(view * projection, visible);
+			if (cullSubsets)
+				queue.Begin(view, projection, 1000.0f);
+			else
+				queue.Begin(view, 1000.0f);
+			for (int index : visible)
+				queue.Add(RenderQueue::PASS_OPAQUE, &shader, models[index]);
+			queue.Sort();
+			queue.Submit(&cache, view, projection, &camera, &light, sampler);
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		// Every draw updates the object buffer, the rest of the updates are material switches
+		int materialSwitches = recorder.GetCallCount(RecordingBackend::CALL_UPDATE_SUBRESOURCE) - recorder.GetDrawCount();
+		const RenderQueue::Stats& stats = queue.GetStats();
+		Log("%s: %d models visible, %d draws, %d subsets culled, %d material switches, %d state changes, %d calls reach the context, %.3f ms per frame\n",
+			name, (int)visible.size(), recorder.GetDrawCount(), stats.culledSubsets, materialSwitches, stats.stateChanges, recorder.GetTotalCalls(), ms);
+	};
+
+	renderFrames(wholeModels, false, "whole model, first material");
+	renderFrames(subsetModels, false, "per subset");
+	renderFrames(subsetModels, true, "per subset, subsets culled");
+
+	for (Model* model : wholeModels)
+		delete model;
+	for (Model* model : subsetModels)
+		delete model;
+}
+
+void Benchmark::RunTransparent()
+{
+	const int packetCount = 50000;
+	const int frameCount = 64;
+	const int shaderCount = 8;
+	const int materialCount = 256;
+
+	struct FakePacket
+	{
+		Shader* shader;
+		uint64_t material;
+		float depth;
+		int id;
+	};
+
+	// Some centers behind the camera too, large surfaces can have them
+	std::mt19937 random(1337);
+	std::uniform_int_distribution<int> shaderIndex(0, shaderCount - 1);
+	std::uniform_int_distribution<int> materialIndex(0, materialCount - 1);
+	std::uniform_real_distribution<float> depth(-50.0f, 1000.0f);
+
+	std::vector<FakePacket> input(packetCount);
+	for (int i = 0; i < packetCount; i++)
+	{
+		input[i].shader = (Shader*)(uintptr_t)(0x1000 + shaderIndex(random) * 0x100);
+		input[i].material = 1 + materialIndex(random);
+		input[i].depth = depth(random);
+		input[i].id = i;
+	}
+
+	Log("%d transparent packets, %d shaders, %d materials\n", packetCount, shaderCount, materialCount);
+
+	// The id rides in startIndex so the sorted packets can be matched to their depth
+	Model* model = (Model*)(uintptr_t)0x100000;
+	RenderQueue queue;
+	double sortMs = 0.0;
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		queue.Begin(DirectX::XMMatrixIdentity(), 1000.0f);
+		for (const FakePacket& packet : input)
+			queue.Add(RenderQueue::PASS_TRANSPARENT, packet.shader, model, packet.material, nullptr, packet.depth, packet.id, 3);
+		queue.Sort();
+		sortMs += queue.GetStats().sortMilliseconds;
+	}
+
+	// Same order with a float compare through std::sort
+	std::vector<FakePacket> sorted;
+	double stdSortMs = 0.0;
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		sorted = input;
+
+		auto start = BenchmarkClock::now();
+		std::sort(sorted.begin(), sorted.end(), [](const FakePacket& a, const FakePacket& b) { return a.depth > b.depth; });
+		stdSortMs += MillisecondsSince(start);
+	}
+
+	const RenderQueue::Stats& stats = queue.GetStats();
+	Log("sort %.3f ms (radix on float keys), std::sort %.3f ms per frame\n", sortMs / frameCount, stdSortMs / frameCount);
+	Log("state changes per frame: %d immediate, %d back to front\n", stats.immediateStateChanges, stats.stateChanges);
+
+	// Farthest first, every packet once, all of them in the transparent range
+	bool ordered = queue.GetTransparentFirst() == 0 && stats.transparentDraws == packetCount;
+	std::vector<char> seen(packetCount, 0);
+	for (int i = 0; i < queue.GetPacketCount(); i++)
+	{
+		int id = queue.GetSortedPacket(i).startIndex;
+		ordered = ordered && !seen[id] && (i == 0 || input[queue.GetSortedPacket(i - 1).startIndex].depth >= input[id].depth);
+		seen[id] = 1;
+	}
+	Check(ordered, "back to front order wrong\n");
+
+	// Mixed with opaque packets the transparent ones have to end up after all of them
+	queue.Begin(DirectX::XMMatrixIdentity(), 1000.0f);
+	for (int i = 0; i < packetCount; i++)
+		queue.Add(i & 1 ? RenderQueue::PASS_TRANSPARENT : RenderQueue::PASS_OPAQUE, input[i].shader, model, input[i].material, nullptr, input[i].depth, i, 3);
+	queue.Sort();
+
+	bool split = queue.GetTransparentFirst() == packetCount / 2;
+	for (int i = 0; i < queue.GetPacketCount(); i++)
+		split = split && (queue.GetSortedPacket(i).startIndex & 1) == (i >= queue.GetTransparentFirst() ? 1 : 0);
+	Log("opaque and transparent mixed: transparent from %d of %d\n", queue.GetTransparentFirst(), queue.GetPacketCount());
+	Check(split, "opaque and transparent packets mixed up\n");
+}
+
+void Benchmark::RunMaterials()
+{
+	using namespace DirectX;
+
+	const int modelCount = 5000;
+	const int partCount = 4;
+	const int paletteSize = 256;
+	const int frameCount = 32;
+	const int editsPerFrame = 16;
+	const UINT ringBytes = 4 * 1024 * 1024;
+
+	ConstantBufferStandIns buffers;
+
+	// Four boxes per model, each a subset with a material from the palette
+	std::vector<Vertex> vertices;
+	std::vector<DWORD> indices;
+	BuildBoxRow(partCount, 12.0f, vertices, indices);
+
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<Model*> models;
+	for (int i = 0; i < modelCount; i++)
+	{
+		Model* model = CreateStandInModel(vertices, indices, i);
+
+		for (int part = 0; part < partCount; part++)
+		{
+			int shade = random() % paletteSize;
+			SurfaceMaterial material;
+			material.diffuseColor = XMFLOAT4((float)(shade % 16) / 16, (float)(shade / 16) / 16, 0.5f, 1.0f);
+			material.ambientColor = XMFLOAT4(0.2f, 0.2f, 0.2f, 1.0f);
+			material.specularColor = XMFLOAT4(0.5f, 0.5f, 0.5f, 32.0f);
+			material.isTransparent = shade % 31 == 0;
+			material.opacity = 0.5f;
+			model->GetMaterial().push_back(material);
+		}
+		SetBoxSubsets(model, partCount);
+
+		model->ComputeBounds(vertices);
+		model->BuildSubsets();
+		model->SetWorldMatrix(XMMatrixRotationY(unit(random) * XM_2PI) * XMMatrixTranslation(position(random), 0.0f, position(random)));
+		models.push_back(model);
+	}
+
+	Shader shader(nullptr);
+	Camera camera;
+	Light light;
+	ID3D11SamplerState* sampler = nullptr;
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 20.0f, -600.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = DefaultProjection();
+
+	Log("%d models of %d subsets, %d materials in the palette, %d frames\n", modelCount, partCount, paletteSize, frameCount);
+
+	MaterialTable table;
+	table.Initialize(nullptr, 1024);
+
+	// Only the submit is timed, sorting is the same for all three. The three take turns every frame and
+	// the best frame of each is kept, so a busy machine slows them down alike
+	struct Mode
+	{
+		RecordingBackend recorder;
+		StateCache cache{ &recorder };
+		RenderQueue queue;
+		ShaderConstants constants;
+		double submitMilliseconds = DBL_MAX;
+	};
+	const char* names[] = { "material cbuffer per draw", "shared material cbuffer", "material table" };
+	const int modeCount = 3;
+	Mode* modes[modeCount];
+	for (int mode = 0; mode < modeCount; mode++)
+	{
+		modes[mode] = new Mode;
+		modes[mode]->recorder.SetKeepCalls(false);
+		modes[mode]->constants.Initialize(buffers.camera, buffers.light, buffers.material, buffers.objectRing, ringBytes);
+	}
+	modes[2]->queue.SetMaterialTable(&table);
+
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		table.ResetStats();
+		for (int mode = 0; mode < modeCount; mode++)
+		{
+			Mode& m = *modes[mode];
+			m.recorder.Clear();
+			m.cache.Invalidate();
+			m.constants.ResetStats();
+
+			m.queue.Begin(view, 1000.0f);
+			for (Model* model : models)
+				m.queue.Add(RenderQueue::PASS_OPAQUE, &shader, model);
+			m.queue.Sort();
+
+			if (mode == 2)
+				table.Upload(&m.cache);
+
+			ShaderConstants* constants = mode == 0 ? nullptr : &m.constants;
+			auto start = BenchmarkClock::now();
+			m.queue.Submit(&m.cache, view, projection, &camera, &light, sampler, constants);
+			m.queue.SubmitTransparent(&m.cache, view, projection, &camera, &light, sampler, constants);
+			m.submitMilliseconds = std::min(m.submitMilliseconds, MillisecondsSince(start));
+		}
+	}
+
+	for (int mode = 0; mode < modeCount; mode++)
+	{
+		Mode& m = *modes[mode];
+		int draws = m.recorder.GetDrawCount();
+		Log("%s: %d draws, %d state changes, %d updates, %d calls reach the context, %.3f ms best frame, %.0f ns per draw", names[mode], draws,
+			m.queue.GetStats().stateChanges, m.recorder.GetCallCount(RecordingBackend::CALL_UPDATE_SUBRESOURCE), m.recorder.GetTotalCalls(),
+			m.submitMilliseconds, m.submitMilliseconds * 1e6 / draws);
+		if (mode > 0)
+			Log(", %.1f KB constants", m.constants.GetStats().bytesUploaded / 1024.0);
+		Log("\n");
+		delete modes[mode];
+	}
+
+	// The table has to hold what the material cbuffer would have
+	int different = 0;
+	for (Model* model : models)
+	{
+		for (int i = 0; i < (int)model->GetMaterial().size(); i++)
+		{
+			Shader::cBufferMaterial materialCB = {};
+			Shader::FillMaterialCB(materialCB, model, i);
+			const MaterialTable::Entry& entry = table.GetEntry(model->GetMaterialTableFirst() + i);
+
+			UINT flags = (materialCB.hasTexture ? MaterialTable::FLAG_TEXTURE : 0) | (materialCB.isTerrain ? MaterialTable::FLAG_TERRAIN : 0) |
+				(materialCB.hasNormMap ? MaterialTable::FLAG_NORMAL_MAP : 0) | (materialCB.hasLightMap ? MaterialTable::FLAG_LIGHT_MAP : 0);
+			if (memcmp(&entry.diffuseColor, &materialCB.diffuseColor, sizeof(XMFLOAT4) * 3) != 0 || entry.flags != flags || entry.opacity != materialCB.opacity)
+				different++;
+		}
+	}
+	Log("table: %d entries of %d bytes, capacity %d, %d differ from the material cbuffer\n", table.GetCount(), (int)sizeof(MaterialTable::Entry),
+		table.GetCapacity(), different);
+	Check(different == 0, "%d table entries differ from the material cbuffer\n", different);
+
+	// Edits: a few materials here and there every frame, then one model at a time
+	{
+		table.ResetStats();
+		auto start = BenchmarkClock::now();
+		RecordingBackend recorder;
+		recorder.SetKeepCalls(false);
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			for (int edit = 0; edit < editsPerFrame; edit++)
+			{
+				Model* model = models[random() % modelCount];
+				SurfaceMaterial& material = model->GetMaterial()[random() % partCount];
+				material.diffuseColor.z = unit(random);
+				table.UpdateModel(model);
+			}
+			table.Upload(&recorder);
+		}
+		double ms = MillisecondsSince(start) / frameCount;
+
+		const MaterialTable::Stats& stats = table.GetStats();
+		Log("%d scattered edits per frame: %.1f updates, %.0f entries and %.1f KB per frame of %.1f KB, %.3f ms per frame\n", editsPerFrame,
+			stats.uploads / (double)frameCount, stats.entriesUploaded / (double)frameCount, stats.bytesUploaded / 1024.0 / frameCount, table.GetCount() * sizeof(MaterialTable::Entry) / 1024.0, ms);
+
+		table.ResetStats();
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			Model* model = models[random() % modelCount];
+			for (SurfaceMaterial& material : model->GetMaterial())
+				material.diffuseColor.z = unit(random);
+			table.UpdateModel(model);
+			table.UpdateModel(models[random() % modelCount]);
+			table.Upload(&recorder);
+		}
+		Log("one model edited per frame: %.1f updates, %.0f entries and %.2f KB per frame, %d unchanged edits skipped\n", stats.uploads / (double)frameCount, stats.entriesUploaded / (double)frameCount,
+			stats.bytesUploaded / 1024.0 / frameCount, stats.unchangedEdits);
+	}
+
+	for (Model* model : models)
+		delete model;
+}
\ No newline at end of file
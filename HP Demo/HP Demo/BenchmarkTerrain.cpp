@@ -0,0 +1,381 @@
+#include "Benchmark.h"
+#include "BenchmarkFixtures.h"
+#include "CompressedHeightfield.h"
+#include "VoxelTerrain.h"
+#include "Foliage.h"
+#include "NavigationGrid.h"
+#include "JobSystem.h"
+
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+void Benchmark::RunHeightfield()
+{
+	const int size = 4096;
+	const int queryCount = 4000000;
+	const float maxError = 0.01f;
+
+	std::vector<float> heights;
+	GenerateHeights(size, size, heights);
+
+	/*
+		Compression and size
+	*/
+	CompressedHeightfield compressed;
+	auto start = BenchmarkClock::now();
+	bool packed = compressed.Compress(heights.data(), size, size, maxError);
+	double compressMs = MillisecondsSince(start);
+	if (!Check(packed, "the grid didn't compress with max error %.3f\n", maxError))
+		return;
+
+	size_t rawBytes = heights.size() * sizeof(float);
+	size_t compressedBytes = compressed.GetCompressedBytes();
+	Log("grid %dx%d, max error %.3f\n", size, size, maxError);
+	Log("raw %.2f MB, compressed %.2f MB, ratio %.2f:1, compress %.1f ms\n",
+		rawBytes / (1024.0 * 1024.0), compressedBytes / (1024.0 * 1024.0), (double)rawBytes / compressedBytes, compressMs);
+
+	/*
+		Whole map decode, tile by tile, against copying the same tiles out of the raw grid
+	*/
+	const int tileSize = CompressedHeightfield::TILE_SIZE;
+	std::vector<float> tile(tileSize * tileSize);
+	float checksum = 0.0f;
+	float worstError = 0.0f;
+
+	start = BenchmarkClock::now();
+	for (int tileZ = 0; tileZ < compressed.GetTilesZ(); tileZ++)
+	{
+		for (int tileX = 0; tileX < compressed.GetTilesX(); tileX++)
+		{
+			compressed.DecodeTile(tileX, tileZ, tile.data());
+			checksum += tile[0];
+		}
+	}
+	double decodeMs = MillisecondsSince(start);
+
+	start = BenchmarkClock::now();
+	for (int tileZ = 0; tileZ < compressed.GetTilesZ(); tileZ++)
+	{
+		for (int tileX = 0; tileX < compressed.GetTilesX(); tileX++)
+		{
+			for (int z = 0; z < tileSize; z++)
+			{
+				const float* row = &heights[(size_t)(tileZ * tileSize + z) * size + tileX * tileSize];
+				std::copy(row, row + tileSize, &tile[z * tileSize]);
+			}
+			checksum += tile[0];
+		}
+	}
+	double copyMs = MillisecondsSince(start);
+
+	double samples = (double)size * size;
+	Log("tile decode %.1f Msamples/s (%.1f ms), raw tile copy %.1f Msamples/s (%.1f ms)\n",
+		samples / (decodeMs * 1000.0), decodeMs, samples / (copyMs * 1000.0), copyMs);
+
+	/*
+		Random GetTriangleHeight style queries
+	*/
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> position(0.0f, (float)(size - 1));
+	std::vector<float> queries((size_t)queryCount * 2);
+	for (size_t i = 0; i < queries.size(); i++)
+	{
+		queries[i] = position(random);
+	}
+
+	auto rawTriangleHeight = [&](float x, float z) {
+		int column = (int)x;
+		int row = (int)z;
+		float valueX = x - column;
+		float valueZ = z - row;
+		const float* quad = &heights[(size_t)row * size + column];
+		if (valueX + valueZ <= 1.0f)
+			return quad[0] + valueX * (quad[1] - quad[0]) + valueZ * (quad[size] - quad[0]);
+		return quad[size + 1] + (1.0f - valueX) * (quad[size] - quad[size + 1]) + (1.0f - valueZ) * (quad[1] - quad[size + 1]);
+	};
+
+	start = BenchmarkClock::now();
+	for (int i = 0; i < queryCount; i++)
+	{
+		checksum += compressed.GetTriangleHeight(queries[i * 2], queries[i * 2 + 1]);
+	}
+	double compressedQueryMs = MillisecondsSince(start);
+
+	start = BenchmarkClock::now();
+	for (int i = 0; i < queryCount; i++)
+	{
+		checksum += rawTriangleHeight(queries[i * 2], queries[i * 2 + 1]);
+	}
+	double rawQueryMs = MillisecondsSince(start);
+
+	for (int i = 0; i < queryCount; i += 16)
+	{
+		float difference = fabsf(compressed.GetTriangleHeight(queries[i * 2], queries[i * 2 + 1]) - rawTriangleHeight(queries[i * 2], queries[i * 2 + 1]));
+		worstError = std::max(worstError, difference);
+	}
+
+	Log("query compressed %.1f ns, raw %.1f ns (%d queries), worst error %.4f\n",
+		compressedQueryMs * 1.0e6 / queryCount, rawQueryMs * 1.0e6 / queryCount, queryCount, worstError);
+	Check(worstError <= maxError * 1.001f, "worst error %.4f is over the max error\n", worstError);
+	Log("checksum %f\n", checksum);
+}
+
+void Benchmark::RunVoxel()
+{
+	const int chunksPerSide = 8;
+	const int editCount = 32;
+
+	JobSystem jobSystem;
+	jobSystem.Initialize();
+
+	VoxelTerrain voxels;
+	voxels.Initialize(chunksPerSide, chunksPerSide, 1.0f);
+
+	auto start = BenchmarkClock::now();
+	voxels.Generate(1337, jobSystem);
+	double generateMs = MillisecondsSince(start);
+
+	/*
+		Full mesh of every chunk, the throughput number
+	*/
+	voxels.MeshDirtyChunks(jobSystem);
+	const VoxelTerrain::MeshStats fullMesh = voxels.GetMeshStats();
+
+	Log("%d chunks of %dx%dx%d, %d threads, generate %.1f ms\n", fullMesh.chunksMeshed,
+		VoxelTerrain::CHUNK_SIZE, VoxelTerrain::CHUNK_HEIGHT, VoxelTerrain::CHUNK_SIZE, jobSystem.GetThreadCount(), generateMs);
+	Log("full mesh %.1f ms, %.0f chunks/s, %d quads\n", fullMesh.milliseconds,
+		fullMesh.chunksMeshed * 1000.0 / fullMesh.milliseconds, fullMesh.quads);
+
+	/*
+		Incremental edits: dig a small hole and remesh only what it touched. Edits near a chunk
+		border dirty the neighbours too, so the spread of chunk counts is part of the result.
+	*/
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> positionXZ(0.0f, (float)voxels.GetBlocksX());
+	std::uniform_real_distribution<float> positionY(8.0f, VoxelTerrain::CHUNK_HEIGHT - 8.0f);
+
+	double totalMs = 0.0, worstMs = 0.0;
+	int totalChunks = 0;
+	int changedBlocks = 0;
+	for (int i = 0; i < editCount; i++)
+	{
+		changedBlocks += voxels.FillSphere(positionXZ(random), positionY(random), positionXZ(random), 3.0f, 0);
+
+		int meshed = voxels.MeshDirtyChunks(jobSystem);
+		totalChunks += meshed;
+		totalMs += voxels.GetMeshStats().milliseconds;
+		worstMs = std::max(worstMs, voxels.GetMeshStats().milliseconds);
+	}
+
+	Log("edit remesh avg %.3f ms, worst %.3f ms, %.2f chunks per edit (%d edits, %d blocks changed)\n",
+		totalMs / editCount, worstMs, (double)totalChunks / editCount, editCount, changedBlocks);
+
+	voxels.Shutdown();
+	jobSystem.Shutdown();
+}
+
+void Benchmark::RunFoliage()
+{
+	using namespace DirectX;
+
+	const int size = 1024;
+	const int viewCount = 64;
+
+	std::vector<float> heights;
+	GenerateHeights(size, size, heights);
+
+	JobSystem jobSystem;
+	jobSystem.Initialize();
+
+	// Same rules as the scene, the grass spacing is what gets the count to ~500k
+	Foliage foliage;
+
+	Foliage::Layer trees;
+	trees.minDistance = 3.0f;
+	trees.maxHeight = 11.0f;
+	trees.maxSlope = 25.0f;
+	trees.density = 0.6f;
+	trees.boundingRadius = 2.5f;
+	foliage.AddLayer(trees);
+
+	Foliage::Layer rocks;
+	rocks.minDistance = 4.0f;
+	rocks.maxSlope = 60.0f;
+	rocks.density = 0.3f;
+	rocks.boundingRadius = 0.5f;
+	foliage.AddLayer(rocks);
+
+	Foliage::Layer grass;
+	grass.minDistance = 1.15f;
+	grass.maxSlope = 35.0f;
+	grass.boundingRadius = 0.45f;
+	foliage.AddLayer(grass);
+
+	foliage.Scatter(heights.data(), size, size, 1.0f, XMMatrixIdentity(), 1337, jobSystem);
+
+	Log("grid %dx%d, %d threads, %d chunks\n", size, size, jobSystem.GetThreadCount(), foliage.GetChunkCount());
+	Log("scatter %.1f ms, %d instances (trees %d, rocks %d, grass %d), %.2f MB\n", foliage.GetScatterMilliseconds(), foliage.GetInstanceCount(),
+		foliage.GetLayerInstanceCount(0), foliage.GetLayerInstanceCount(1), foliage.GetLayerInstanceCount(2),
+		foliage.GetInstanceCount() * sizeof(FoliageInstance) / (1024.0 * 1024.0));
+
+	/*
+		Per frame cost: a camera in the middle of the map turning around, cull + copying the visible
+		instances like the instance buffer upload does
+	*/
+	std::vector<FoliageInstance> visible(foliage.GetInstanceCount());
+	XMMATRIX projection = DefaultProjection();
+
+	double cullMs = 0.0, gatherMs = 0.0;
+	long long visibleInstances = 0, visibleChunks = 0;
+	for (int i = 0; i < viewCount; i++)
+	{
+		float angle = XM_2PI * i / viewCount;
+		XMVECTOR eye = XMVectorSet(size * 0.5f, 30.0f, size * 0.5f, 1.0f);
+		XMVECTOR direction = XMVectorSet(cosf(angle), -0.2f, sinf(angle), 0.0f);
+		XMMATRIX view = XMMatrixLookToLH(eye, direction, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+
+		foliage.Cull(view * projection);
+		foliage.GatherVisible(visible.data());
+
+		cullMs += foliage.GetCullStats().cullMilliseconds;
+		gatherMs += foliage.GetCullStats().gatherMilliseconds;
+		visibleInstances += foliage.GetCullStats().visibleInstances;
+		visibleChunks += foliage.GetCullStats().visibleChunks;
+	}
+
+	Log("per frame: cull %.3f ms, gather %.3f ms, %lld visible chunks, %lld visible instances (%d views)\n",
+		cullMs / viewCount, gatherMs / viewCount, visibleChunks / viewCount, visibleInstances / viewCount, viewCount);
+
+	jobSystem.Shutdown();
+}
+
+void Benchmark::RunNavigation()
+{
+	const int size = 4096;
+	const int queryCount = 2000;
+
+	std::vector<float> heights;
+	GenerateHeights(size, size, heights);
+
+	/*
+		Walls every 256 points in both directions with a few gaps, and closed boxes
+		so some of the queries are unreachable
+	*/
+	const float wallHeight = 4.0f;
+	for (int line = 256; line < size; line += 256)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			bool gap = (i / 64) % 7 == 3;
+			if (!gap)
+			{
+				heights[(size_t)i * size + line] += wallHeight;
+				heights[(size_t)line * size + i] += wallHeight;
+			}
+		}
+	}
+
+	std::mt19937 boxRandom(7);
+	std::uniform_int_distribution<int> boxPosition(64, size - 192);
+	for (int box = 0; box < 32; box++)
+	{
+		int x0 = boxPosition(boxRandom), z0 = boxPosition(boxRandom);
+		for (int i = 0; i <= 96; i++)
+		{
+			heights[(size_t)z0 * size + x0 + i] += wallHeight;
+			heights[(size_t)(z0 + 96) * size + x0 + i] += wallHeight;
+			heights[(size_t)(z0 + i) * size + x0] += wallHeight;
+			heights[(size_t)(z0 + i) * size + x0 + 96] += wallHeight;
+		}
+	}
+
+	JobSystem jobSystem;
+	jobSystem.Initialize();
+
+	NavigationGrid::Settings settings;
+	NavigationGrid navigation;
+	if (!Check(navigation.Initialize(heights.data(), size, size, 1.0f, settings, jobSystem), "navigation grid failed to initialize\n"))
+		return;
+
+	const NavigationGrid::Stats& stats = navigation.GetStats();
+	Log("grid %dx%d, %d threads, %d walkable (%.1f%%)\n", size, size, jobSystem.GetThreadCount(), stats.walkableCells, 100.0 * stats.walkableCells / ((double)size * size));
+	Log("build %.1f ms, %d abstract nodes, %d edges, connectivity %.1f MB\n", stats.buildMilliseconds, stats.abstractNodes, stats.abstractEdges,
+		stats.connectivityBytes / (1024.0 * 1024.0));
+
+	// The scene builds its grid from the terrain's compressed heights, only points on a limit can come out different
+	{
+		CompressedHeightfield compressed;
+		NavigationGrid fromCompressed;
+		if (Check(compressed.Compress(heights.data(), size, size, 0.01f), "the heights failed to compress\n") &&
+			Check(fromCompressed.Initialize(compressed, 1.0f, settings, jobSystem), "navigation grid failed to initialize from the compressed heights\n"))
+		{
+			int differing = 0;
+			for (int z = 0; z < size; z++)
+			{
+				for (int x = 0; x < size; x++)
+					differing += navigation.IsWalkable(x, z) != fromCompressed.IsWalkable(x, z);
+			}
+
+			Log("from the compressed heights: build %.1f ms, %d points walkable where the raw grid says not or the other way\n",
+				fromCompressed.GetStats().buildMilliseconds, differing);
+			Check(differing <= size * size / 1000, "%d points differ in walkability between the raw and compressed heights\n", differing);
+		}
+	}
+
+	// Random walkable pairs, the same pairs before and after the edit
+	std::mt19937 random(1337);
+	std::uniform_int_distribution<int> position(0, size - 1);
+	std::vector<int> pairs;
+	while ((int)pairs.size() < queryCount * 4)
+	{
+		int x = position(random), z = position(random);
+		if (navigation.IsWalkable(x, z))
+		{
+			pairs.push_back(x);
+			pairs.push_back(z);
+		}
+	}
+
+	auto RunQueries = [&](const char* label)
+	{
+		std::vector<uint32_t> path;
+		int found = 0, unreachable = 0;
+		long long pathLength = 0;
+
+		auto start = BenchmarkClock::now();
+		for (int i = 0; i < queryCount; i++)
+		{
+			const int* pair = &pairs[i * 4];
+			if (!navigation.IsReachable(pair[0], pair[1], pair[2], pair[3]))
+				unreachable++;
+			else if (navigation.FindPath(pair[0], pair[1], pair[2], pair[3], path))
+			{
+				found++;
+				pathLength += path.size();
+			}
+		}
+		double ms = MillisecondsSince(start);
+
+		Log("%s: %d queries in %.1f ms, %.0f queries/s, %d found, %d unreachable, average path %lld points\n", label, queryCount, ms,
+			queryCount * 1000.0 / ms, found, unreachable, found ? pathLength / found : 0);
+	};
+
+	RunQueries("cold cache");
+	RunQueries("warm cache");
+
+	// Flatten a 128 point stretch of the first wall and tell the grid about it
+	const int edit = 1024;
+	for (int i = edit; i < edit + 128; i++)
+		heights[(size_t)i * size + 256] -= wallHeight;
+
+	auto start = BenchmarkClock::now();
+	int changed = navigation.UpdateRegion(256, edit, 256, edit + 127, jobSystem);
+	double updateMs = MillisecondsSince(start);
+
+	Log("update after wall edit: %d points changed, %.3f ms, %d abstract nodes, %d edges\n", changed, updateMs, stats.abstractNodes, stats.abstractEdges);
+
+	RunQueries("after edit");
+
+	jobSystem.Shutdown();
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "CommandRecorder.h"
+#include <algorithm>
+
+/*
+	CommandRecorder
+*/
+
+int CommandRecorder::RecordParallel(JobSystem& jobSystem, size_t count, size_t minRangeItems, const RangeFunction& record)
+{
+	int rangeCount = (int)std::min((size_t)jobSystem.GetThreadCount(), (count + minRangeItems - 1) / minRangeItems);
+	if (rangeCount == 0)
+		return 0;
+
+	if (!Prepare(rangeCount))
+		return -1;
+
+	std::vector<char> finished(rangeCount, 0);
+	jobSystem.ParallelFor(rangeCount, [&](int range, int /*threadIndex*/)
+	{
+		size_t first, last;
+		GetRange(count, rangeCount, range, first, last);
+
+		RenderBackend* backend = Begin(range);
+		record(backend, first, last);
+		finished[range] = Finish(range);
+	});
+
+	for (int range = 0; range < rangeCount; range++)
+	{
+		if (!finished[range])
+			return -1;
+	}
+
+	Execute(rangeCount);
+	return rangeCount;
+}
+
+void CommandRecorder::GetRange(size_t count, int rangeCount, int range, size_t& first, size_t& last)
+{
+	first = count * range / rangeCount;
+	last = count * (range + 1) / rangeCount;
+}
+
+/*
+	RecordingCommandRecorder
+*/
+
+RecordingCommandRecorder::RecordingCommandRecorder(RecordingBackend* target, bool keepCalls)
+{
+	this->target = target;
+	this->keepCalls = keepCalls;
+}
+
+RecordingCommandRecorder::~RecordingCommandRecorder()
+{
+	for (Context& context : contexts)
+	{
+		delete context.cache;
+		delete context.recording;
+	}
+	contexts.clear();
+}
+
+bool RecordingCommandRecorder::Prepare(int count)
+{
+	while ((int)contexts.size() < count)
+	{
+		Context context;
+		context.recording = new RecordingBackend;
+		context.recording->SetKeepCalls(keepCalls);
+		context.cache = new StateCache(context.recording);
+		contexts.push_back(context);
+	}
+
+	return true;
+}
+
+RenderBackend* RecordingCommandRecorder::Begin(int index)
+{
+	Context& context = contexts[index];
+
+	context.recording->Clear();
+	context.cache->Invalidate();
+	return context.cache;
+}
+
+bool RecordingCommandRecorder::Finish(int /*index*/)
+{
+	return true;
+}
+
+void RecordingCommandRecorder::Execute(int count)
+{
+	for (int i = 0; i < count; i++)
+		target->Append(*contexts[i].recording);
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+#include "RenderBackend.h"
+#include "StateCache.h"
+#include "JobSystem.h"
+#include <vector>
+#include <functional>
+
+/*
+	Contexts that draws are recorded into from several threads at once and then played back in order.
+	A context is recorded by one thread at a time and starts out with nothing bound, so what records
+	into it binds everything it needs first. Resources are not mapped while recording.
+	D3D11CommandRecorder (D3D11CommandRecorder.h) records onto deferred contexts and executes the command
+	lists on the immediate context. RecordingCommandRecorder records into RecordingBackends, so the parallel
+	submission can be run, timed and checked without a device.
+*/
+class CommandRecorder
+{
+public:
+	virtual ~CommandRecorder() {}
+
+	// Makes sure there are count contexts, on the thread that executes them before the frame is recorded
+	virtual bool Prepare(int count) = 0;
+	virtual int GetContextCount() const = 0;
+
+	// Backend to record context index with, and the end of its recording
+	virtual RenderBackend* Begin(int index) = 0;
+	virtual bool Finish(int index) = 0;
+
+	// Plays contexts [0, count) back in index order
+	virtual void Execute(int count) = 0;
+
+	// Records items [first, last) onto backend
+	typedef std::function<void(RenderBackend* backend, size_t first, size_t last)> RangeFunction;
+
+	/*
+		Splits items [0, count) into ranges of at least minRangeItems, no more of them than the job system has
+		threads, records range i onto context i from the job system and executes the ranges in order.
+		Returns the number of ranges, -1 when a context could not be prepared or finished, nothing is executed then.
+	*/
+	int RecordParallel(JobSystem& jobSystem, size_t count, size_t minRangeItems, const RangeFunction& record);
+
+	// Range i of rangeCount over [0, count). They follow each other and differ by one item in size at most
+	static void GetRange(size_t count, int rangeCount, int range, size_t& first, size_t& last);
+};
+
+class RecordingCommandRecorder : public CommandRecorder
+{
+public:
+	// Execute appends the recordings to target, the stand-in for the immediate context
+	RecordingCommandRecorder(RecordingBackend* target, bool keepCalls);
+	~RecordingCommandRecorder();
+
+	bool Prepare(int count) override;
+	int GetContextCount() const override { return (int)this->contexts.size(); }
+
+	RenderBackend* Begin(int index) override;
+	bool Finish(int index) override;
+	void Execute(int count) override;
+
+	const RecordingBackend& GetRecording(int index) const { return *this->contexts[index].recording; }
+
+private:
+	struct Context
+	{
+		RecordingBackend* recording = nullptr;
+		StateCache* cache = nullptr;
+	};
+
+private:
+	RecordingBackend* target;
+	bool keepCalls;
+	std::vector<Context> contexts;
+};
\ No newline at end of file
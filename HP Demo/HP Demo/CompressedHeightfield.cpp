@@ -0,0 +1,238 @@
+#include "CompressedHeightfield.h"
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+
+CompressedHeightfield::CompressedHeightfield()
+{
+	this->width = 0;
+	this->height = 0;
+	this->tilesX = 0;
+	this->tilesZ = 0;
+}
+
+CompressedHeightfield::~CompressedHeightfield()
+{
+}
+
+bool CompressedHeightfield::Compress(const float* heights, int width, int height, float maxError)
+{
+	if (!heights || width < 2 || height < 2 || maxError <= 0.0f)
+		return false;
+
+	Clear();
+
+	this->width = width;
+	this->height = height;
+	this->tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	this->tilesZ = (height + TILE_SIZE - 1) / TILE_SIZE;
+	tiles.resize((size_t)tilesX * tilesZ);
+
+	/*
+		First pass: base, range and bit count per tile, so we know where every tile starts.
+		Rounding to the nearest step gives an error of at most step / 2.
+	*/
+	uint32_t totalBits = 0;
+	for (int tileZ = 0; tileZ < tilesZ; tileZ++)
+	{
+		for (int tileX = 0; tileX < tilesX; tileX++)
+		{
+			int endX = std::min((tileX + 1) * TILE_SIZE, width);
+			int endZ = std::min((tileZ + 1) * TILE_SIZE, height);
+
+			float minHeight = heights[(tileZ * TILE_SIZE) * width + tileX * TILE_SIZE];
+			float maxHeight = minHeight;
+			for (int z = tileZ * TILE_SIZE; z < endZ; z++)
+			{
+				for (int x = tileX * TILE_SIZE; x < endX; x++)
+				{
+					minHeight = std::min(minHeight, heights[z * width + x]);
+					maxHeight = std::max(maxHeight, heights[z * width + x]);
+				}
+			}
+
+			Tile& tile = tiles[tileZ * tilesX + tileX];
+			tile.baseHeight = minHeight;
+			tile.bitOffset = totalBits;
+			tile.bits = 0;
+			tile.step = 0.0f;
+
+			float range = maxHeight - minHeight;
+			if (range > 2.0f * maxError)
+			{
+				// Past 24 bits the float step can't keep the error bound, the map needs a bigger maxError
+				float levels = ceilf(range / (2.0f * maxError)) + 1.0f;
+				if (levels > (float)(1u << MAX_BITS))
+				{
+					Clear();
+					return false;
+				}
+
+				uint8_t bits = 1;
+				while ((float)(1u << bits) < levels)
+					bits++;
+
+				tile.bits = bits;
+				tile.step = range / (float)((1u << bits) - 1);
+			}
+
+			totalBits += (uint32_t)tile.bits * TILE_SIZE * TILE_SIZE;
+		}
+	}
+
+	// One extra word so reads that straddle the last word never go out of bounds
+	words.assign(totalBits / 32 + 2, 0u);
+
+	// Second pass: quantize and pack
+	for (int tileZ = 0; tileZ < tilesZ; tileZ++)
+	{
+		for (int tileX = 0; tileX < tilesX; tileX++)
+		{
+			const Tile& tile = tiles[tileZ * tilesX + tileX];
+			if (tile.bits == 0)
+				continue;
+
+			uint32_t maxValue = (1u << tile.bits) - 1;
+			for (int localZ = 0; localZ < TILE_SIZE; localZ++)
+			{
+				int z = std::min(tileZ * TILE_SIZE + localZ, height - 1);
+				for (int localX = 0; localX < TILE_SIZE; localX++)
+				{
+					int x = std::min(tileX * TILE_SIZE + localX, width - 1);
+
+					float delta = (heights[z * width + x] - tile.baseHeight) / tile.step;
+					uint32_t value = std::min((uint32_t)(delta + 0.5f), maxValue);
+
+					WriteBits(tile.bitOffset + (uint32_t)(localZ * TILE_SIZE + localX) * tile.bits, tile.bits, value);
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+void CompressedHeightfield::Clear()
+{
+	width = 0;
+	height = 0;
+	tilesX = 0;
+	tilesZ = 0;
+	tiles.clear();
+	words.clear();
+}
+
+float CompressedHeightfield::GetSample(int x, int z) const
+{
+	const Tile& tile = tiles[(z / TILE_SIZE) * tilesX + (x / TILE_SIZE)];
+	if (tile.bits == 0)
+		return tile.baseHeight;
+
+	uint32_t local = (uint32_t)((z % TILE_SIZE) * TILE_SIZE + (x % TILE_SIZE));
+	return tile.baseHeight + tile.step * (float)ReadBits(tile.bitOffset + local * tile.bits, tile.bits);
+}
+
+float CompressedHeightfield::GetTriangleHeight(float x, float z) const
+{
+	int column = (int)floorf(x);
+	int row = (int)floorf(z);
+
+	// Outside of the terrain
+	if (row < 0 || column < 0 || column >= width - 1 || row >= height - 1)
+	{
+		return 0;
+	}
+
+	float valueX = x - column;
+	float valueZ = z - row;
+
+	float topRight = GetSample(column, row);
+	float topLeft = GetSample(column + 1, row);
+	float bottomLeft = GetSample(column, row + 1);
+	float bottomRight = GetSample(column + 1, row + 1);
+
+	// Upper triangle in the quad
+	if (valueX + valueZ <= 1.0f)
+	{
+		return topRight + valueX * (topLeft - topRight) + valueZ * (bottomLeft - topRight);
+	}
+
+	// Lower triangle
+	return bottomRight + (1.0f - valueX) * (bottomLeft - bottomRight) + (1.0f - valueZ) * (topLeft - bottomRight);
+}
+
+void CompressedHeightfield::DecodeTile(int tileX, int tileZ, float* output) const
+{
+	const Tile& tile = tiles[tileZ * tilesX + tileX];
+	int validX = std::min(TILE_SIZE, width - tileX * TILE_SIZE);
+	int validZ = std::min(TILE_SIZE, height - tileZ * TILE_SIZE);
+
+	if (tile.bits == 0)
+	{
+		for (int z = 0; z < validZ; z++)
+		{
+			std::fill(output + z * TILE_SIZE, output + z * TILE_SIZE + validX, tile.baseHeight);
+		}
+		return;
+	}
+
+	/*
+		Samples are stored back to back, so walk the stream with a 64 bit window
+		instead of doing a random access read for every sample.
+	*/
+	uint32_t mask = (1u << tile.bits) - 1;
+	for (int z = 0; z < validZ; z++)
+	{
+		uint32_t bitPosition = tile.bitOffset + (uint32_t)(z * TILE_SIZE) * tile.bits;
+		uint32_t wordIndex = bitPosition >> 5;
+		uint32_t shift = bitPosition & 31;
+		uint64_t window = (uint64_t)words[wordIndex] | ((uint64_t)words[wordIndex + 1] << 32);
+
+		for (int x = 0; x < validX; x++)
+		{
+			if (shift + tile.bits > 64)
+			{
+				wordIndex++;
+				shift -= 32;
+				window = (uint64_t)words[wordIndex] | ((uint64_t)words[wordIndex + 1] << 32);
+			}
+
+			uint32_t value = (uint32_t)(window >> shift) & mask;
+			output[z * TILE_SIZE + x] = tile.baseHeight + tile.step * (float)value;
+			shift += tile.bits;
+		}
+	}
+}
+
+void CompressedHeightfield::GetTileWordRange(int tileX, int tileZ, uint32_t& firstWord, uint32_t& wordCount) const
+{
+	const Tile& tile = tiles[tileZ * tilesX + tileX];
+	uint32_t endBit = tile.bitOffset + (uint32_t)tile.bits * TILE_SIZE * TILE_SIZE;
+
+	firstWord = tile.bitOffset >> 5;
+	wordCount = tile.bits == 0 ? 0 : ((endBit + 31) >> 5) - firstWord;
+}
+
+size_t CompressedHeightfield::GetCompressedBytes() const
+{
+	return tiles.size() * sizeof(Tile) + words.size() * sizeof(uint32_t);
+}
+
+uint32_t CompressedHeightfield::ReadBits(uint32_t bitPosition, uint8_t bits) const
+{
+	uint32_t wordIndex = bitPosition >> 5;
+	uint64_t window = (uint64_t)words[wordIndex] | ((uint64_t)words[wordIndex + 1] << 32);
+	return (uint32_t)(window >> (bitPosition & 31)) & ((1u << bits) - 1);
+}
+
+void CompressedHeightfield::WriteBits(uint32_t bitPosition, uint8_t bits, uint32_t value)
+{
+	uint32_t mask = (1u << bits) - 1;
+	assert((value & ~mask) == 0);
+
+	uint32_t wordIndex = bitPosition >> 5;
+	uint64_t shifted = (uint64_t)(value & mask) << (bitPosition & 31);
+
+	words[wordIndex] |= (uint32_t)shifted;
+	words[wordIndex + 1] |= (uint32_t)(shifted >> 32);
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+	Compressed, random access heightfield.
+	The grid is split into square tiles. Each tile stores its base height and quantization step,
+	and every sample is stored as a bit packed quantized delta from the base, using as few bits as
+	the requested max error allows. Single samples, triangle heights and whole tiles can be decoded
+	without touching the rest of the map.
+*/
+class CompressedHeightfield
+{
+public:
+	static const int TILE_SIZE = 32;
+	static const int MAX_BITS = 24;			// Bits per sample a tile can use at most
+
+	struct Tile
+	{
+		float baseHeight;
+		float step;
+		uint32_t bitOffset;		// First bit of the tile in the packed stream
+		uint8_t bits;			// Bits per sample, 0 for flat tiles
+	};
+
+public:
+	CompressedHeightfield();
+	~CompressedHeightfield();
+
+	// maxError is the largest allowed difference between a decoded and an original height.
+	// Fails when a tile's range would need more than MAX_BITS bits per sample to keep it
+	bool Compress(const float* heights, int width, int height, float maxError);
+	void Clear();
+
+	// Height of a single grid sample
+	float GetSample(int x, int z) const;
+
+	// Same interpolation as Terrain::GetTriangleHeight, x and z in grid units
+	float GetTriangleHeight(float x, float z) const;
+
+	// Decodes one tile into output (TILE_SIZE * TILE_SIZE floats, row by row). Edge tiles only fill their valid part
+	void DecodeTile(int tileX, int tileZ, float* output) const;
+
+	// Packed words a tile lives in, for streaming it somewhere else without decoding
+	void GetTileWordRange(int tileX, int tileZ, uint32_t& firstWord, uint32_t& wordCount) const;
+
+	int GetWidth() const { return this->width; }
+	int GetHeight() const { return this->height; }
+	int GetTilesX() const { return this->tilesX; }
+	int GetTilesZ() const { return this->tilesZ; }
+	const Tile& GetTile(int tileX, int tileZ) const { return this->tiles[tileZ * tilesX + tileX]; }
+	const std::vector<uint32_t>& GetPackedWords() const { return this->words; }
+
+	// Bytes used by the tile headers and the packed stream
+	size_t GetCompressedBytes() const;
+
+private:
+	uint32_t ReadBits(uint32_t bitPosition, uint8_t bits) const;
+	void WriteBits(uint32_t bitPosition, uint8_t bits, uint32_t value);
+
+private:
+	int width, height;
+	int tilesX, tilesZ;
+
+	std::vector<Tile> tiles;
+	std::vector<uint32_t> words;
+};
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "D3D11Backend.h"
+#include <cstddef>
+
+// The values and structs the backend interface has in place of the D3D11 ones
+static_assert(RenderBackend::MAP_WRITE_DISCARD == D3D11_MAP_WRITE_DISCARD, "MAP_WRITE_DISCARD");
+static_assert(RenderBackend::MAP_WRITE_NO_OVERWRITE == D3D11_MAP_WRITE_NO_OVERWRITE, "MAP_WRITE_NO_OVERWRITE");
+static_assert(BoundState::CONSTANT_BUFFER_SLOTS == D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, "CONSTANT_BUFFER_SLOTS");
+static_assert(BoundState::SAMPLER_SLOTS == D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, "SAMPLER_SLOTS");
+static_assert(sizeof(ResourceBox) == sizeof(D3D11_BOX) && offsetof(ResourceBox, back) == offsetof(D3D11_BOX, back), "ResourceBox");
+static_assert(sizeof(MappedResource) == sizeof(D3D11_MAPPED_SUBRESOURCE) && offsetof(MappedResource, DepthPitch) == offsetof(D3D11_MAPPED_SUBRESOURCE, DepthPitch), "MappedResource");
+
+D3D11Backend::D3D11Backend(ID3D11DeviceContext* context)
+{
+	this->context = context;
+	this->context1 = nullptr;
+
+	context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&context1);
+}
+
+D3D11Backend::~D3D11Backend()
+{
+	ReleasePtr(context1);
+}
+
+UINT D3D11Backend::GetBufferSize(ID3D11Resource* resource)
+{
+	D3D11_RESOURCE_DIMENSION dimension;
+	resource->GetType(&dimension);
+	if (dimension != D3D11_RESOURCE_DIMENSION_BUFFER)
+		return 0;
+
+	D3D11_BUFFER_DESC desc;
+	static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+	return desc.ByteWidth;
+}
+
+void D3D11Backend::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	context->IASetInputLayout(inputLayout);
+}
+
+void D3D11Backend::IASetPrimitiveTopology(UINT topology)
+{
+	context->IASetPrimitiveTopology((D3D11_PRIMITIVE_TOPOLOGY)topology);
+}
+
+void D3D11Backend::IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	context->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+}
+
+void D3D11Backend::IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset)
+{
+	context->IASetIndexBuffer(buffer, (DXGI_FORMAT)format, offset);
+}
+
+void D3D11Backend::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	context->VSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void D3D11Backend::GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	context->GSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void D3D11Backend::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	context->PSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void D3D11Backend::VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	context->VSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void D3D11Backend::GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	context->GSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void D3D11Backend::PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	context->PSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void D3D11Backend::VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	context1->VSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void D3D11Backend::GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	context1->GSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void D3D11Backend::PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	context1->PSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void D3D11Backend::VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	context->VSSetShaderResources(startSlot, count, views);
+}
+
+void D3D11Backend::GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	context->GSSetShaderResources(startSlot, count, views);
+}
+
+void D3D11Backend::PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	context->PSSetShaderResources(startSlot, count, views);
+}
+
+void D3D11Backend::VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	context->VSSetSamplers(startSlot, count, samplers);
+}
+
+void D3D11Backend::GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	context->GSSetSamplers(startSlot, count, samplers);
+}
+
+void D3D11Backend::PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	context->PSSetSamplers(startSlot, count, samplers);
+}
+
+void D3D11Backend::OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	context->OMSetBlendState(blendState, blendFactor, sampleMask);
+}
+
+void D3D11Backend::OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+	context->OMSetDepthStencilState(depthStencilState, stencilRef);
+}
+
+void D3D11Backend::RSSetState(ID3D11RasterizerState* rasterizerState)
+{
+	context->RSSetState(rasterizerState);
+}
+
+void D3D11Backend::UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch)
+{
+	context->UpdateSubresource(resource, subresource, (const D3D11_BOX*)box, data, rowPitch, depthPitch);
+}
+
+HRESULT D3D11Backend::Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped)
+{
+	return context->Map(resource, subresource, (D3D11_MAP)mapType, mapFlags, (D3D11_MAPPED_SUBRESOURCE*)mapped);
+}
+
+void D3D11Backend::Unmap(ID3D11Resource* resource, UINT subresource)
+{
+	context->Unmap(resource, subresource);
+}
+
+void D3D11Backend::Draw(UINT vertexCount, UINT startVertex)
+{
+	context->Draw(vertexCount, startVertex);
+}
+
+void D3D11Backend::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	context->DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void D3D11Backend::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	context->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+#include "DX.h"
+#include "RenderBackend.h"
+#include <d3d11_1.h>
+
+/*
+	Forwards every call to a device context, immediate or deferred.
+	The UINT arguments go back to the D3D11 enums they came from, ResourceBox and MappedResource are
+	the D3D11 structs under another name.
+*/
+class D3D11Backend : public RenderBackend
+{
+public:
+	D3D11Backend(ID3D11DeviceContext* context);
+	~D3D11Backend();
+
+	ID3D11DeviceContext* GetContext() const { return this->context; }
+
+	// The *SetConstantBuffers1 calls need the 11.1 interface of the context
+	bool SupportsConstantOffsets() const { return this->context1 != nullptr; }
+
+	// Byte width of a buffer, 0 for the other resources. What FrameCapture asks real resources for their size with
+	static UINT GetBufferSize(ID3D11Resource* resource);
+
+	void IASetInputLayout(ID3D11InputLayout* inputLayout) override;
+	void IASetPrimitiveTopology(UINT topology) override;
+	void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+	void IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset) override;
+
+	void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+
+	void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+
+	void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+
+	void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+
+	void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) override;
+	void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) override;
+	void RSSetState(ID3D11RasterizerState* rasterizerState) override;
+
+	void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch) override;
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped) override;
+	void Unmap(ID3D11Resource* resource, UINT subresource) override;
+
+	void Draw(UINT vertexCount, UINT startVertex) override;
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) override;
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+
+private:
+	ID3D11DeviceContext* context;
+	ID3D11DeviceContext1* context1;
+};
\ No newline at end of file
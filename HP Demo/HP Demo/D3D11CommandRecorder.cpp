@@ -0,0 +1,107 @@
+#include "D3D11CommandRecorder.h"
+
+D3D11CommandRecorder::D3D11CommandRecorder(ID3D11Device* device, ID3D11DeviceContext* immediateContext)
+{
+	this->device = device;
+	this->immediateContext = immediateContext;
+
+	D3D11_FEATURE_DATA_THREADING threading;
+	ZeroMemory(&threading, sizeof(threading));
+	this->driverCommandLists = SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_THREADING, &threading, sizeof(threading))) && threading.DriverCommandLists;
+
+	this->renderTarget = nullptr;
+	this->depthStencil = nullptr;
+	ZeroMemory(this->viewports, sizeof(this->viewports));
+	this->viewportCount = 0;
+	this->rasterizerState = nullptr;
+	this->depthStencilState = nullptr;
+	this->stencilRef = 0;
+	this->blendState = nullptr;
+	ZeroMemory(this->blendFactor, sizeof(this->blendFactor));
+	this->sampleMask = 0xffffffff;
+}
+
+D3D11CommandRecorder::~D3D11CommandRecorder()
+{
+	ReleaseOutputState();
+
+	for (Context& context : contexts)
+	{
+		ReleasePtr(context.commandList);
+		delete context.cache;
+		delete context.backend;
+		ReleasePtr(context.deferred);
+	}
+	contexts.clear();
+}
+
+bool D3D11CommandRecorder::Prepare(int count)
+{
+	while ((int)contexts.size() < count)
+	{
+		Context context;
+		if (FAILED(device->CreateDeferredContext(0, &context.deferred)))
+			return false;
+
+		context.backend = new D3D11Backend(context.deferred);
+		context.cache = new StateCache(context.backend);
+		contexts.push_back(context);
+	}
+
+	ReleaseOutputState();
+
+	immediateContext->OMGetRenderTargets(1, &renderTarget, &depthStencil);
+	viewportCount = D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE;
+	immediateContext->RSGetViewports(&viewportCount, viewports);
+	immediateContext->RSGetState(&rasterizerState);
+	immediateContext->OMGetDepthStencilState(&depthStencilState, &stencilRef);
+	immediateContext->OMGetBlendState(&blendState, blendFactor, &sampleMask);
+
+	return true;
+}
+
+RenderBackend* D3D11CommandRecorder::Begin(int index)
+{
+	Context& context = contexts[index];
+
+	// The rest of the state goes through the cache, which starts out knowing nothing
+	context.deferred->OMSetRenderTargets(1, &renderTarget, depthStencil);
+	context.deferred->RSSetViewports(viewportCount, viewports);
+	context.cache->Invalidate();
+	context.cache->RSSetState(rasterizerState);
+	context.cache->OMSetDepthStencilState(depthStencilState, stencilRef);
+	context.cache->OMSetBlendState(blendState, blendFactor, sampleMask);
+
+	return context.cache;
+}
+
+bool D3D11CommandRecorder::Finish(int index)
+{
+	Context& context = contexts[index];
+
+	ReleasePtr(context.commandList);
+	return SUCCEEDED(context.deferred->FinishCommandList(FALSE, &context.commandList));
+}
+
+void D3D11CommandRecorder::Execute(int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (!contexts[i].commandList)
+			continue;
+
+		immediateContext->ExecuteCommandList(contexts[i].commandList, TRUE);
+		ReleasePtr(contexts[i].commandList);
+	}
+
+	ReleaseOutputState();
+}
+
+void D3D11CommandRecorder::ReleaseOutputState()
+{
+	ReleasePtr(renderTarget);
+	ReleasePtr(depthStencil);
+	ReleasePtr(rasterizerState);
+	ReleasePtr(depthStencilState);
+	ReleasePtr(blendState);
+}
\ No newline at end of file
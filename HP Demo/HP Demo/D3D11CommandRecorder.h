@@ -0,0 +1,58 @@
+#pragma once
+#include "DX.h"
+#include "CommandRecorder.h"
+#include "D3D11Backend.h"
+
+/*
+	Records onto deferred contexts, each behind a StateCache of its own, and executes the command lists
+	on the immediate context.
+*/
+class D3D11CommandRecorder : public CommandRecorder
+{
+public:
+	D3D11CommandRecorder(ID3D11Device* device, ID3D11DeviceContext* immediateContext);
+	~D3D11CommandRecorder();
+
+	// Without driver command lists the runtime emulates them and recording scales less
+	bool HasDriverCommandLists() const { return this->driverCommandLists; }
+
+	// Also copies the output state of the immediate context, which every deferred context starts from
+	bool Prepare(int count) override;
+	int GetContextCount() const override { return (int)this->contexts.size(); }
+
+	RenderBackend* Begin(int index) override;
+	bool Finish(int index) override;
+
+	// The immediate context keeps its state, the command lists don't change what it has bound
+	void Execute(int count) override;
+
+private:
+	struct Context
+	{
+		ID3D11DeviceContext* deferred = nullptr;
+		D3D11Backend* backend = nullptr;
+		StateCache* cache = nullptr;
+		ID3D11CommandList* commandList = nullptr;
+	};
+
+	void ReleaseOutputState();
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* immediateContext;
+	bool driverCommandLists;
+
+	std::vector<Context> contexts;
+
+	// Taken from the immediate context in Prepare, holds a reference until Execute
+	ID3D11RenderTargetView* renderTarget;
+	ID3D11DepthStencilView* depthStencil;
+	D3D11_VIEWPORT viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+	UINT viewportCount;
+	ID3D11RasterizerState* rasterizerState;
+	ID3D11DepthStencilState* depthStencilState;
+	UINT stencilRef;
+	ID3D11BlendState* blendState;
+	FLOAT blendFactor[4];
+	UINT sampleMask;
+};
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "DX.h"
+#include "PipelineCache.h"
 
 DX11::DX11()
 {
@@ -10,6 +11,7 @@ DX11::DX11()
     ZeroMemory(&viewport, sizeof(D3D11_VIEWPORT));
     this->renderTargetView = 0;
     this->depthState_lessEqual = 0;
+    this->depthState_readOnly = 0;
     this->depthStencilView = 0;
 
     this->anisotropic = 0;
@@ -17,6 +19,8 @@ DX11::DX11()
 
     this->alphaEnableBlendingState = 0;
     this->alphaDisableBlendingState = 0;
+    this->transparentBlendState = 0;
+    this->pipelineCache = 0;
 
     this->hr = 0;
 
@@ -81,6 +85,10 @@ bool DX11::Initialize(int screenWidth, int screenHeight, HWND hwnd, float screen
         &context);
     assert(SUCCEEDED(hr));
 
+    // The state objects below come from the cache, it owns them
+    pipelineCache = new PipelineCache;
+    pipelineCache->Initialize(device);
+
 
     /*
         Get backbuffer from swapchain.
@@ -152,8 +160,13 @@ bool DX11::Initialize(int screenWidth, int screenHeight, HWND hwnd, float screen
     depthStencilDesc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
     depthStencilDesc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
 
-    hr = device->CreateDepthStencilState(&depthStencilDesc, &depthState_lessEqual);
-    assert(SUCCEEDED(hr));
+    depthState_lessEqual = pipelineCache->GetDepthStencilState(depthStencilDesc);
+    assert(depthState_lessEqual);
+
+    // Same test without writing depth, for transparent surfaces
+    depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+    depthState_readOnly = pipelineCache->GetDepthStencilState(depthStencilDesc);
+    assert(depthState_readOnly);
 
     context->OMSetDepthStencilState(depthState_lessEqual, 1);
 
@@ -231,14 +244,25 @@ bool DX11::Initialize(int screenWidth, int screenHeight, HWND hwnd, float screen
     blendStateDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
     blendStateDesc.RenderTarget[0].RenderTargetWriteMask = 0x0f;
 
-    hr = device->CreateBlendState(&blendStateDesc, &alphaEnableBlendingState);
-    if (FAILED(hr))
+    alphaEnableBlendingState = pipelineCache->GetBlendState(blendStateDesc);
+    if (!alphaEnableBlendingState)
         return false;
 
     blendStateDesc.RenderTarget[0].BlendEnable = false;
 
-    hr = device->CreateBlendState(&blendStateDesc, &alphaDisableBlendingState);
-    if (FAILED(hr))
+    alphaDisableBlendingState = pipelineCache->GetBlendState(blendStateDesc);
+    if (!alphaDisableBlendingState)
+        return false;
+
+    // Source over for the transparent pass, the pixel shader outputs opacity in alpha
+    blendStateDesc.RenderTarget[0].BlendEnable = true;
+    blendStateDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+    blendStateDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+    blendStateDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+    blendStateDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+
+    transparentBlendState = pipelineCache->GetBlendState(blendStateDesc);
+    if (!transparentBlendState)
         return false;
 
     /*
@@ -262,8 +286,8 @@ bool DX11::Initialize(int screenWidth, int screenHeight, HWND hwnd, float screen
     samplerDesc.MinLOD = 0;
     samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
 
-    hr = device->CreateSamplerState(&samplerDesc, &minmagmipLin);
-    if (FAILED(hr))
+    minmagmipLin = pipelineCache->GetSamplerState(samplerDesc);
+    if (!minmagmipLin)
     {
         return false;
     }
@@ -283,8 +307,8 @@ bool DX11::Initialize(int screenWidth, int screenHeight, HWND hwnd, float screen
     samplerDesc.MinLOD = FLT_MIN;
     samplerDesc.MaxLOD = FLT_MAX;
 
-    hr = device->CreateSamplerState(&samplerDesc, &anisotropic);
-    if (FAILED(hr))
+    anisotropic = pipelineCache->GetSamplerState(samplerDesc);
+    if (!anisotropic)
     {
         return false;
     }
@@ -294,16 +318,26 @@ bool DX11::Initialize(int screenWidth, int screenHeight, HWND hwnd, float screen
 
 void DX11::Shutdown()
 {
-    ReleasePtr(anisotropic);
-    ReleasePtr(minmagmipLin);
+    // Releases the depth, blend and sampler states
+    if (pipelineCache)
+    {
+        pipelineCache->Shutdown();
+        delete pipelineCache;
+        pipelineCache = 0;
+    }
+    anisotropic = 0;
+    minmagmipLin = 0;
+    depthState_lessEqual = 0;
+    depthState_readOnly = 0;
+    alphaEnableBlendingState = 0;
+    alphaDisableBlendingState = 0;
+    transparentBlendState = 0;
+
     ReleasePtr(device);
     ReleasePtr(context);
     ReleasePtr(swapchain);
     ReleasePtr(renderTargetView);
-    ReleasePtr(depthState_lessEqual);
     ReleasePtr(depthStencilView);
-    ReleasePtr(alphaEnableBlendingState);
-    ReleasePtr(alphaDisableBlendingState);
 }
 
 void DX11::BeginScene(float red, float green, float blue, float alpha)
@@ -15,6 +15,8 @@
 
 using namespace DirectX;
 
+class PipelineCache;
+
 class DX11
 {
 public:
@@ -35,10 +37,15 @@ public:
 	ID3D11RenderTargetView*& GetRenderTarget() { return this->renderTargetView; }
 	ID3D11DepthStencilView*& GetDepthStencilView() { return this->depthStencilView; }
 	ID3D11DepthStencilState* GetDepthStencilState() { return this->depthState_lessEqual; }
+	ID3D11DepthStencilState* GetDepthReadOnlyState() { return this->depthState_readOnly; }		// Depth test without depth writes
+	ID3D11BlendState* GetTransparentBlendState() { return this->transparentBlendState; }		// Source alpha over the target
 
 	ID3D11SamplerState* GetMinMagMipSampler() { return this->minmagmipLin; }
 	ID3D11SamplerState* GetAnisotropicSampler() { return this->anisotropic; }
 
+	// Made its fixed states, pipelines and states made through it share them
+	PipelineCache* GetPipelineCache() { return this->pipelineCache; }
+
 	void GetProjectionMatrix(DirectX::XMMATRIX&);
 	void GetCubemapProjectionMatrix(DirectX::XMMATRIX&);
 	void GetWorldMatrix(DirectX::XMMATRIX&);
@@ -55,6 +62,7 @@ private:
 	D3D11_VIEWPORT viewport;
 	ID3D11RenderTargetView* renderTargetView;
 	ID3D11DepthStencilState* depthState_lessEqual;
+	ID3D11DepthStencilState* depthState_readOnly;
 	ID3D11DepthStencilView* depthStencilView;
 
 	ID3D11SamplerState* minmagmipLin;
@@ -62,6 +70,9 @@ private:
 
 	ID3D11BlendState* alphaEnableBlendingState;
 	ID3D11BlendState* alphaDisableBlendingState;
+	ID3D11BlendState* transparentBlendState;
+
+	PipelineCache* pipelineCache;
 
 	HRESULT hr;
 
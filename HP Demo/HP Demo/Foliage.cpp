@@ -0,0 +1,533 @@
+#include "Foliage.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <algorithm>
+
+const float Foliage::MAX_SCALE = 8.0f;
+
+// Bridson's algorithm, candidates tried around an active point before it is retired
+static const int POISSON_CANDIDATES = 20;
+
+/*
+	Acceleration grid for the Poisson disk test. Cells are minDistance / sqrt(2) wide,
+	so a cell holds at most one point and a neighbour test only looks at the 5x5 cells around it.
+*/
+struct Foliage::ScatterGrid
+{
+	float cellSize;
+	int width, height;
+	std::vector<DirectX::XMFLOAT2> points;	// x < 0 is an empty cell
+};
+
+Foliage::Foliage()
+{
+	this->heights = nullptr;
+	this->gridWidth = 0;
+	this->gridHeight = 0;
+	this->cellSpace = 1.0f;
+	this->world = DirectX::XMMatrixIdentity();
+	this->chunksX = 0;
+	this->chunksZ = 0;
+	this->instanceBuffer = nullptr;
+	this->scatterMilliseconds = 0.0;
+}
+
+Foliage::~Foliage()
+{
+	Shutdown();
+}
+
+int Foliage::AddLayer(const Layer& layer)
+{
+	layers.push_back(layer);
+	return (int)layers.size() - 1;
+}
+
+bool Foliage::Scatter(const Terrain* terrain, DirectX::XMMATRIX world, unsigned int seed, JobSystem& jobSystem)
+{
+	if (!terrain || terrain->GetHeightGrid().empty())
+		return false;
+
+	return Scatter(terrain->GetHeightGrid().data(), terrain->GetWidth(), terrain->GetHeight(), terrain->GetCellSpace(), world, seed, jobSystem);
+}
+
+bool Foliage::Scatter(const float* heights, int gridWidth, int gridHeight, float cellSpace, DirectX::XMMATRIX world, unsigned int seed, JobSystem& jobSystem)
+{
+	using namespace DirectX;
+
+	if (!heights || gridWidth < 2 || gridHeight < 2 || layers.empty())
+		return false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	this->heights = heights;
+	this->gridWidth = gridWidth;
+	this->gridHeight = gridHeight;
+	this->cellSpace = cellSpace;
+	this->world = world;
+
+	this->chunksX = (gridWidth - 1 + CHUNK_CELLS - 1) / CHUNK_CELLS;
+	this->chunksZ = (gridHeight - 1 + CHUNK_CELLS - 1) / CHUNK_CELLS;
+	int chunkCount = chunksX * chunksZ;
+	float chunkSize = CHUNK_CELLS * cellSpace;
+
+	instances.clear();
+	ranges.assign((size_t)layers.size() * chunkCount + 1, 0);
+
+	std::vector<std::vector<FoliageInstance>> chunkInstances(chunkCount);
+
+	for (int layerIndex = 0; layerIndex < (int)layers.size(); layerIndex++)
+	{
+		const Layer& layer = layers[layerIndex];
+
+		ScatterGrid grid;
+		grid.cellSize = layer.minDistance / sqrtf(2.0f);
+		grid.width = (int)ceilf((gridWidth - 1) * cellSpace / grid.cellSize) + 1;
+		grid.height = (int)ceilf((gridHeight - 1) * cellSpace / grid.cellSize) + 1;
+		grid.points.assign((size_t)grid.width * grid.height, XMFLOAT2(-1.0f, -1.0f));
+
+		for (int i = 0; i < chunkCount; i++)
+		{
+			chunkInstances[i].clear();
+		}
+
+		/*
+			Chunks only write points inside themselves but read the points around them.
+			Running the chunks in four checkerboard passes keeps chunks that run at the same time
+			a whole chunk apart, which is safe as long as the disk radius is well below a chunk.
+		*/
+		bool parallel = layer.minDistance * 2.0f < chunkSize;
+		for (int pass = 0; pass < 4; pass++)
+		{
+			std::vector<int> passChunks;
+			for (int z = pass / 2; z < chunksZ; z += 2)
+			{
+				for (int x = pass % 2; x < chunksX; x += 2)
+				{
+					passChunks.push_back(z * chunksX + x);
+				}
+			}
+
+			auto job = [&](int job, int thread) {
+				int chunk = passChunks[job];
+				ScatterChunk(layerIndex, chunk % chunksX, chunk / chunksX, seed, grid, chunkInstances[chunk]);
+			};
+
+			if (parallel)
+			{
+				jobSystem.ParallelFor((int)passChunks.size(), job);
+			}
+			else
+			{
+				for (int i = 0; i < (int)passChunks.size(); i++)
+				{
+					job(i, 0);
+				}
+			}
+		}
+
+		for (int chunk = 0; chunk < chunkCount; chunk++)
+		{
+			ranges[layerIndex * chunkCount + chunk] = (uint32_t)instances.size();
+			instances.insert(instances.end(), chunkInstances[chunk].begin(), chunkInstances[chunk].end());
+		}
+	}
+	ranges[layers.size() * chunkCount] = (uint32_t)instances.size();
+
+	/*
+		Chunk bounds over every layer, grown by the scaled mesh radius
+	*/
+	chunks.resize(chunkCount);
+	for (int chunk = 0; chunk < chunkCount; chunk++)
+	{
+		XMVECTOR boundsMin = XMVectorReplicate(1.0e30f);
+		XMVECTOR boundsMax = XMVectorReplicate(-1.0e30f);
+
+		for (int layerIndex = 0; layerIndex < (int)layers.size(); layerIndex++)
+		{
+			float radiusScale = layers[layerIndex].boundingRadius * MAX_SCALE / 65535.0f;
+			uint32_t first = ranges[layerIndex * chunkCount + chunk];
+			uint32_t last = ranges[layerIndex * chunkCount + chunk + 1];
+
+			for (uint32_t i = first; i < last; i++)
+			{
+				XMVECTOR position = XMLoadFloat3(&instances[i].position);
+				XMVECTOR radius = XMVectorReplicate(radiusScale * instances[i].scale);
+				boundsMin = XMVectorMin(boundsMin, XMVectorSubtract(position, radius));
+				boundsMax = XMVectorMax(boundsMax, XMVectorAdd(position, radius));
+			}
+		}
+
+		XMStoreFloat3(&chunks[chunk].boundsMin, boundsMin);
+		XMStoreFloat3(&chunks[chunk].boundsMax, boundsMax);
+	}
+
+	visibleLayerCounts.assign(layers.size(), 0);
+
+	scatterMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	char message[256];
+	snprintf(message, sizeof(message), "Foliage: %d instances in %d layers, %d chunks, %.2f MB, scattered in %.1f ms\n",
+		(int)instances.size(), (int)layers.size(), chunkCount, instances.size() * sizeof(FoliageInstance) / (1024.0 * 1024.0), scatterMilliseconds);
+	OutputDebugStringA(message);
+
+	return true;
+}
+
+void Foliage::ScatterChunk(int layerIndex, int chunkX, int chunkZ, unsigned int seed, ScatterGrid& grid, std::vector<FoliageInstance>& output)
+{
+	using namespace DirectX;
+
+	const Layer& layer = layers[layerIndex];
+
+	float minX = chunkX * CHUNK_CELLS * cellSpace;
+	float minZ = chunkZ * CHUNK_CELLS * cellSpace;
+	float maxX = std::min((chunkX + 1) * CHUNK_CELLS * cellSpace, (gridWidth - 1) * cellSpace);
+	float maxZ = std::min((chunkZ + 1) * CHUNK_CELLS * cellSpace, (gridHeight - 1) * cellSpace);
+
+	// Same result no matter which thread or in which order the chunk runs
+	std::mt19937 random(seed ^ (unsigned int)(layerIndex * 0x9E3779B1u) ^ (unsigned int)((chunkZ * chunksX + chunkX) * 0x85EBCA77u));
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	float radiusSquared = layer.minDistance * layer.minDistance;
+	float maxSlopeCos = cosf(XMConvertToRadians(layer.maxSlope));
+
+	auto tryInsert = [&](float x, float z) {
+		if (x < minX || z < minZ || x >= maxX || z >= maxZ)
+			return false;
+
+		int cellX = (int)(x / grid.cellSize);
+		int cellZ = (int)(z / grid.cellSize);
+
+		for (int nz = std::max(cellZ - 2, 0); nz <= std::min(cellZ + 2, grid.height - 1); nz++)
+		{
+			for (int nx = std::max(cellX - 2, 0); nx <= std::min(cellX + 2, grid.width - 1); nx++)
+			{
+				const XMFLOAT2& point = grid.points[nz * grid.width + nx];
+				if (point.x < 0.0f)
+					continue;
+
+				float dx = point.x - x;
+				float dz = point.y - z;
+				if (dx * dx + dz * dz < radiusSquared)
+					return false;
+			}
+		}
+
+		grid.points[cellZ * grid.width + cellX] = XMFLOAT2(x, z);
+		return true;
+	};
+
+	/*
+		Every Poisson point takes its place in the pattern, the height, slope and density rules
+		only decide if an instance is made from it. That keeps the spacing even next to rejected areas.
+	*/
+	auto emit = [&](float x, float z) {
+		float height = SampleHeight(x, z);
+		if (height < layer.minHeight || height > layer.maxHeight)
+			return;
+
+		if (SampleSlope(x, z) < maxSlopeCos)
+			return;
+
+		if (unit(random) > layer.density)
+			return;
+
+		float scale = layer.minScale + (layer.maxScale - layer.minScale) * unit(random);
+
+		FoliageInstance instance;
+		XMStoreFloat3(&instance.position, XMVector3TransformCoord(XMVectorSet(x, height, z, 1.0f), world));
+		instance.yaw = (uint16_t)(unit(random) * 65535.0f);
+		instance.scale = (uint16_t)(std::min(scale / MAX_SCALE, 1.0f) * 65535.0f);
+		output.push_back(instance);
+	};
+
+	std::vector<XMFLOAT2> active;
+
+	// A few seeds per chunk, most of them land next to points of the chunks before
+	for (int i = 0; i < 4; i++)
+	{
+		float x = minX + (maxX - minX) * unit(random);
+		float z = minZ + (maxZ - minZ) * unit(random);
+		if (tryInsert(x, z))
+		{
+			active.push_back(XMFLOAT2(x, z));
+			emit(x, z);
+		}
+	}
+
+	while (!active.empty())
+	{
+		int index = (int)(unit(random) * active.size()) % (int)active.size();
+		XMFLOAT2 center = active[index];
+
+		bool found = false;
+		for (int i = 0; i < POISSON_CANDIDATES; i++)
+		{
+			float angle = XM_2PI * unit(random);
+			float distance = layer.minDistance * (1.0f + unit(random));
+			float x = center.x + cosf(angle) * distance;
+			float z = center.y + sinf(angle) * distance;
+
+			if (tryInsert(x, z))
+			{
+				active.push_back(XMFLOAT2(x, z));
+				emit(x, z);
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+		{
+			active[index] = active.back();
+			active.pop_back();
+		}
+	}
+}
+
+float Foliage::SampleHeight(float x, float z) const
+{
+	// Same triangle split as Terrain::GetTriangleHeight
+	float gridX = std::min(std::max(x / cellSpace, 0.0f), (float)(gridWidth - 1));
+	float gridZ = std::min(std::max(z / cellSpace, 0.0f), (float)(gridHeight - 1));
+	int column = std::min((int)gridX, gridWidth - 2);
+	int row = std::min((int)gridZ, gridHeight - 2);
+	float valueX = gridX - column;
+	float valueZ = gridZ - row;
+
+	const float* quad = &heights[row * gridWidth + column];
+	if (valueX + valueZ <= 1.0f)
+		return quad[0] + valueX * (quad[1] - quad[0]) + valueZ * (quad[gridWidth] - quad[0]);
+
+	return quad[gridWidth + 1] + (1.0f - valueX) * (quad[gridWidth] - quad[gridWidth + 1]) + (1.0f - valueZ) * (quad[1] - quad[gridWidth + 1]);
+}
+
+float Foliage::SampleSlope(float x, float z) const
+{
+	// Y of the normal from central differences on the nearest grid point
+	int column = std::min(std::max((int)(x / cellSpace + 0.5f), 1), gridWidth - 2);
+	int row = std::min(std::max((int)(z / cellSpace + 0.5f), 1), gridHeight - 2);
+
+	float dx = (heights[row * gridWidth + column + 1] - heights[row * gridWidth + column - 1]) / (2.0f * cellSpace);
+	float dz = (heights[(row + 1) * gridWidth + column] - heights[(row - 1) * gridWidth + column]) / (2.0f * cellSpace);
+
+	return 1.0f / sqrtf(dx * dx + dz * dz + 1.0f);
+}
+
+void Foliage::Cull(DirectX::XMMATRIX viewProjection)
+{
+	using namespace DirectX;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	/*
+		Frustum planes straight from the combined matrix (Gribb / Hartmann), unnormalized is fine
+		since only the sign of the box test is used.
+	*/
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+	XMVECTOR planes[6] =
+	{
+		XMVectorAdd(columns.r[3], columns.r[0]),
+		XMVectorSubtract(columns.r[3], columns.r[0]),
+		XMVectorAdd(columns.r[3], columns.r[1]),
+		XMVectorSubtract(columns.r[3], columns.r[1]),
+		columns.r[2],
+		XMVectorSubtract(columns.r[3], columns.r[2]),
+	};
+
+	visibleChunks.clear();
+	for (int chunk = 0; chunk < (int)chunks.size(); chunk++)
+	{
+		XMVECTOR boundsMin = XMLoadFloat3(&chunks[chunk].boundsMin);
+		XMVECTOR boundsMax = XMLoadFloat3(&chunks[chunk].boundsMax);
+
+		// Empty chunks keep inverted bounds
+		if (XMVector3Less(boundsMax, boundsMin))
+			continue;
+
+		XMVECTOR center = XMVectorSetW(XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f), 1.0f);
+		XMVECTOR extents = XMVectorScale(XMVectorSubtract(boundsMax, boundsMin), 0.5f);
+
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+		{
+			float distance = XMVectorGetX(XMVector4Dot(planes[p], center));
+			float radius = XMVectorGetX(XMVector3Dot(XMVectorAbs(planes[p]), extents));
+			inside = distance + radius >= 0.0f;
+		}
+
+		if (inside)
+			visibleChunks.push_back(chunk);
+	}
+
+	int chunkCount = (int)chunks.size();
+	cullStats.visibleChunks = (int)visibleChunks.size();
+	cullStats.visibleInstances = 0;
+	for (int layerIndex = 0; layerIndex < (int)layers.size(); layerIndex++)
+	{
+		int count = 0;
+		for (unsigned int i = 0; i < visibleChunks.size(); i++)
+		{
+			int range = layerIndex * chunkCount + visibleChunks[i];
+			count += ranges[range + 1] - ranges[range];
+		}
+		visibleLayerCounts[layerIndex] = count;
+		cullStats.visibleInstances += count;
+	}
+
+	cullStats.cullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void Foliage::GatherVisible(FoliageInstance* destination)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Chunks of a layer are next to each other in memory, so neighbouring visible chunks turn into one copy
+	int chunkCount = (int)chunks.size();
+	for (int layerIndex = 0; layerIndex < (int)layers.size(); layerIndex++)
+	{
+		unsigned int i = 0;
+		while (i < visibleChunks.size())
+		{
+			uint32_t first = ranges[layerIndex * chunkCount + visibleChunks[i]];
+			unsigned int j = i + 1;
+			while (j < visibleChunks.size() && visibleChunks[j] == visibleChunks[j - 1] + 1)
+				j++;
+			uint32_t last = ranges[layerIndex * chunkCount + visibleChunks[j - 1] + 1];
+
+			memcpy(destination, &instances[first], (last - first) * sizeof(FoliageInstance));
+			destination += last - first;
+			i = j;
+		}
+	}
+
+	cullStats.gatherMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int Foliage::GetLayerInstanceCount(int layer) const
+{
+	int chunkCount = (int)chunks.size();
+	return ranges[(layer + 1) * chunkCount] - ranges[layer * chunkCount];
+}
+
+bool Foliage::CreateBuffers(ID3D11Device* device)
+{
+	if (instances.empty())
+		return false;
+
+	ReleasePtr(instanceBuffer);
+
+	// Room for everything, the whole map can be in view
+	D3D11_BUFFER_DESC bufferDesc;
+	ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.ByteWidth = (UINT)(sizeof(FoliageInstance) * instances.size());
+	bufferDesc.StructureByteStride = sizeof(FoliageInstance);
+
+	HRESULT hr = device->CreateBuffer(&bufferDesc, nullptr, &instanceBuffer);
+	if (FAILED(hr))
+		return false;
+
+	return true;
+}
+
+Model* Foliage::CreateConeMesh(ID3D11Device* device, int sides, float radius, float height, DirectX::XMFLOAT4 color)
+{
+	using namespace DirectX;
+
+	std::vector<Vertex> vertices;
+	std::vector<DWORD> indices;
+
+	// Every face gets its own vertices so the normals stay flat
+	for (int i = 0; i < sides; i++)
+	{
+		float angle0 = XM_2PI * i / sides;
+		float angle1 = XM_2PI * (i + 1) / sides;
+		XMVECTOR base0 = XMVectorSet(cosf(angle0) * radius, 0.0f, sinf(angle0) * radius, 0.0f);
+		XMVECTOR base1 = XMVectorSet(cosf(angle1) * radius, 0.0f, sinf(angle1) * radius, 0.0f);
+		XMVECTOR top = XMVectorSet(0.0f, height, 0.0f, 0.0f);
+
+		XMVECTOR normal = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(top, base0), XMVectorSubtract(base1, base0)));
+		XMVECTOR tangent = XMVector3Normalize(XMVectorSubtract(base1, base0));
+
+		XMVECTOR corners[3] = { base0, top, base1 };
+		DWORD first = (DWORD)vertices.size();
+		for (int c = 0; c < 3; c++)
+		{
+			Vertex vertex;
+			XMStoreFloat3(&vertex.pos, corners[c]);
+			XMStoreFloat3(&vertex.normal, normal);
+			XMStoreFloat3(&vertex.tangent, tangent);
+			vertex.texCoord = XMFLOAT2((float)c * 0.5f, c == 1 ? 0.0f : 1.0f);
+			vertices.push_back(vertex);
+			indices.push_back(first + c);
+		}
+	}
+
+	Model* model = new Model("FoliageCone");
+	if (!model->InitializeTerrain(vertices, indices, device))
+	{
+		delete model;
+		return nullptr;
+	}
+
+	SurfaceMaterial material;
+	material.diffuseColor = color;
+	material.ambientColor = XMFLOAT4(color.x * 0.5f, color.y * 0.5f, color.z * 0.5f, 1.0f);
+	material.specularColor = XMFLOAT4(0.05f, 0.05f, 0.05f, 0.0f);
+	model->GetMaterial().push_back(material);
+
+	return model;
+}
+
+bool Foliage::Render(RenderBackend* context, Shader* shader, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler)
+{
+	if (!instanceBuffer)
+		return true;
+
+	Cull(view * projection);
+	if (cullStats.visibleInstances == 0)
+		return true;
+
+	MappedResource mapped;
+	HRESULT hr = context->Map(instanceBuffer, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped);
+	if (FAILED(hr))
+		return false;
+
+	GatherVisible((FoliageInstance*)mapped.pData);
+	context->Unmap(instanceBuffer, 0);
+
+	unsigned int stride = sizeof(FoliageInstance);
+	unsigned int offset = 0;
+	int startInstance = 0;
+
+	for (int layerIndex = 0; layerIndex < (int)layers.size(); layerIndex++)
+	{
+		Model* mesh = layers[layerIndex].mesh;
+		int count = visibleLayerCounts[layerIndex];
+
+		if (mesh && count > 0)
+		{
+			mesh->Render(context);
+			context->IASetVertexBuffers(1, 1, &instanceBuffer, &stride, &offset);
+
+			if (!shader->RenderInstanced(context, mesh, count, startInstance, view, projection, camera, light, sampler))
+				return false;
+		}
+
+		startInstance += count;
+	}
+
+	return true;
+}
+
+void Foliage::Shutdown()
+{
+	ReleasePtr(instanceBuffer);
+}
\ No newline at end of file
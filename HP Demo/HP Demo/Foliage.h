@@ -0,0 +1,120 @@
+#pragma once
+#include "DX.h"
+#include "Model.h"
+#include "Shader.h"
+#include "Terrain.h"
+#include "JobSystem.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Compact transform, the same 16 bytes are used on the CPU and as per instance vertex data
+struct FoliageInstance
+{
+	DirectX::XMFLOAT3 position;
+	uint16_t yaw;		// 0..65535 maps to 0..2 pi
+	uint16_t scale;		// 0..65535 maps to 0..MAX_SCALE
+};
+
+/*
+	Trees, rocks and grass scattered over the terrain.
+	Every layer is a Poisson disk pattern filtered by height and slope rules. Instances are sorted into
+	a grid of terrain chunks, whole chunks are frustum culled and the visible ones are drawn with one
+	instanced draw per layer.
+*/
+class Foliage
+{
+public:
+	static const int CHUNK_CELLS = 32;		// Terrain grid cells per chunk side
+	static const float MAX_SCALE;
+
+	struct Layer
+	{
+		std::string name;
+		float minDistance = 1.0f;			// Poisson disk radius in world units
+		float minHeight = -1.0e6f;			// Terrain local height range
+		float maxHeight = 1.0e6f;
+		float maxSlope = 30.0f;				// Degrees
+		float density = 1.0f;				// Fraction of the Poisson points that are kept
+		float minScale = 1.0f;
+		float maxScale = 1.0f;
+		float boundingRadius = 1.0f;		// Of the mesh at scale 1, used for the chunk bounds
+		Model* mesh = nullptr;				// Not owned
+	};
+
+	struct CullStats
+	{
+		int visibleChunks = 0;
+		int visibleInstances = 0;
+		double cullMilliseconds = 0.0;
+		double gatherMilliseconds = 0.0;
+	};
+
+public:
+	Foliage();
+	~Foliage();
+
+	int AddLayer(const Layer& layer);
+	Layer& GetLayer(int index) { return this->layers[index]; }
+	int GetLayerCount() const { return (int)this->layers.size(); }
+
+	// Places every layer over the height grid. Heights are terrain local, world is the terrain world matrix
+	bool Scatter(const float* heights, int gridWidth, int gridHeight, float cellSpace, DirectX::XMMATRIX world, unsigned int seed, JobSystem& jobSystem);
+	bool Scatter(const Terrain* terrain, DirectX::XMMATRIX world, unsigned int seed, JobSystem& jobSystem);
+
+	// Frustum culls the chunks, then writes the visible instances layer after layer
+	void Cull(DirectX::XMMATRIX viewProjection);
+	void GatherVisible(FoliageInstance* destination);
+
+	// GPU side
+	bool CreateBuffers(ID3D11Device* device);
+
+	// Flat shaded cone with its base at y = 0, placeholder mesh for a layer. The caller owns the model
+	static Model* CreateConeMesh(ID3D11Device* device, int sides, float radius, float height, DirectX::XMFLOAT4 color);
+
+	bool Render(RenderBackend* context, Shader* shader, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler);
+	void Shutdown();
+
+	int GetInstanceCount() const { return (int)this->instances.size(); }
+	int GetLayerInstanceCount(int layer) const;
+	int GetChunkCount() const { return this->chunksX * this->chunksZ; }
+	const CullStats& GetCullStats() const { return this->cullStats; }
+	double GetScatterMilliseconds() const { return this->scatterMilliseconds; }
+
+private:
+	struct Chunk
+	{
+		DirectX::XMFLOAT3 boundsMin;
+		DirectX::XMFLOAT3 boundsMax;
+	};
+
+	struct ScatterGrid;
+
+	void ScatterChunk(int layerIndex, int chunkX, int chunkZ, unsigned int seed, ScatterGrid& grid, std::vector<FoliageInstance>& output);
+	float SampleHeight(float x, float z) const;
+	float SampleSlope(float x, float z) const;
+
+private:
+	std::vector<Layer> layers;
+
+	// Height grid used while scattering
+	const float* heights;
+	int gridWidth, gridHeight;
+	float cellSpace;
+	DirectX::XMMATRIX world;
+
+	int chunksX, chunksZ;
+	std::vector<Chunk> chunks;
+
+	// Sorted by layer, then chunk. Layer l in chunk c is [ranges[l * chunkCount + c], ranges[l * chunkCount + c + 1])
+	std::vector<FoliageInstance> instances;
+	std::vector<uint32_t> ranges;
+
+	std::vector<int> visibleChunks;
+	std::vector<int> visibleLayerCounts;
+
+	ID3D11Buffer* instanceBuffer;
+
+	double scatterMilliseconds;
+	CullStats cullStats;
+};
\ No newline at end of file
@@ -0,0 +1,1136 @@
+#include "FrameCapture.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+// Where the stand-ins of a replay start, far from anything a null check or a small offset hits
+static const uintptr_t STAND_IN_BASE = 0x10000;
+
+FrameCapture::FrameCapture(RenderBackend* backend, ResourceSizeFunction describeResource) : tracker(0)
+{
+	this->backend = backend;
+	this->describeResource = describeResource;
+	this->framesLeft = 0;
+	this->capturing = false;
+
+	tracker.SetKeepCalls(false);
+}
+
+FrameCapture::~FrameCapture()
+{
+}
+
+void FrameCapture::SetResourceSize(ID3D11Resource* resource, UINT bytes)
+{
+	resourceSizes[resource] = bytes;
+}
+
+void FrameCapture::Start(int frames)
+{
+	framesLeft = frames;
+	capturing = false;
+	stream.clear();
+	objectIds.clear();
+	objects.clear();
+	shadows.clear();
+	openMaps.clear();
+	stats = Stats();
+}
+
+void FrameCapture::BeginFrame()
+{
+	if (framesLeft <= 0)
+		return;
+
+	if (!capturing)
+	{
+		capturing = true;
+		stream.resize(sizeof(FileHeader));
+		objects.push_back(nullptr);
+		WriteState();
+	}
+
+	WriteOp(OP_FRAME);
+	stats.frames++;
+}
+
+bool FrameCapture::EndFrame()
+{
+	if (!capturing)
+		return false;
+
+	WriteFrameCount();
+	if (--framesLeft > 0)
+		return false;
+
+	capturing = false;
+	return true;
+}
+
+void FrameCapture::WriteFrameCount()
+{
+	FileHeader header;
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.frames = (uint32_t)stats.frames;
+	header.objects = (uint32_t)objects.size() - 1;
+	memcpy(stream.data(), &header, sizeof(FileHeader));
+	stats.bytes = stream.size();
+}
+
+bool FrameCapture::Save(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	file.write((const char*)stream.data(), stream.size());
+	return file.good();
+}
+
+void FrameCapture::WriteOp(Op op)
+{
+	stream.push_back((uint8_t)op);
+	stats.commands++;
+}
+
+void FrameCapture::WriteUInt(uint64_t value)
+{
+	// 7 bits a byte, the top bit says more follow
+	while (value >= 0x80)
+	{
+		stream.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	stream.push_back((uint8_t)value);
+}
+
+void FrameCapture::WriteInt(int64_t value)
+{
+	// Zigzag, small negative numbers stay short
+	WriteUInt(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void FrameCapture::WriteFloat(float value)
+{
+	WriteBytes(&value, sizeof(float));
+}
+
+void FrameCapture::WriteBytes(const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	stream.insert(stream.end(), bytes, bytes + size);
+}
+
+uint32_t FrameCapture::DeclareObject(const void* object, ObjectKind kind)
+{
+	if (!object)
+		return 0;
+
+	auto found = objectIds.find(object);
+	if (found != objectIds.end())
+		return found->second;
+
+	uint32_t id = (uint32_t)objects.size();
+	objectIds[object] = id;
+	objects.push_back(object);
+
+	WriteOp(OP_OBJECT);
+	WriteUInt(id);
+	WriteUInt(kind);
+	return id;
+}
+
+UINT FrameCapture::GetResourceSize(ID3D11Resource* resource)
+{
+	auto found = resourceSizes.find(resource);
+	if (found != resourceSizes.end())
+		return found->second;
+
+	if (!describeResource)
+		return 0;
+
+	return describeResource(resource);
+}
+
+void FrameCapture::WriteState()
+{
+	const BoundState& state = tracker.GetState();
+
+	uint32_t inputLayout = DeclareObject(state.inputLayout, OBJECT_INPUT_LAYOUT);
+	WriteOp(OP_SET_INPUT_LAYOUT);
+	WriteUInt(inputLayout);
+
+	WriteOp(OP_SET_TOPOLOGY);
+	WriteUInt(state.topology);
+
+	for (int slot = 0; slot < BoundState::VERTEX_BUFFER_SLOTS; slot++)
+		DeclareObject(state.vertexBuffers[slot], OBJECT_BUFFER);
+	WriteOp(OP_SET_VERTEX_BUFFERS);
+	WriteUInt(0);
+	WriteUInt(BoundState::VERTEX_BUFFER_SLOTS);
+	for (int slot = 0; slot < BoundState::VERTEX_BUFFER_SLOTS; slot++)
+	{
+		WriteUInt(DeclareObject(state.vertexBuffers[slot], OBJECT_BUFFER));
+		WriteUInt(state.strides[slot]);
+		WriteUInt(state.offsets[slot]);
+	}
+
+	uint32_t indexBuffer = DeclareObject(state.indexBuffer, OBJECT_BUFFER);
+	WriteOp(OP_SET_INDEX_BUFFER);
+	WriteUInt(indexBuffer);
+	WriteUInt(state.indexFormat);
+	WriteUInt(state.indexOffset);
+
+	WriteSetShader(BoundState::STAGE_VS, state.vertexShader);
+	WriteSetShader(BoundState::STAGE_GS, state.geometryShader);
+	WriteSetShader(BoundState::STAGE_PS, state.pixelShader);
+
+	for (int stage = 0; stage < BoundState::STAGE_COUNT; stage++)
+	{
+		// Whole buffers first, then the slots bound by a window
+		WriteSetConstantBuffers(stage, 0, BoundState::CONSTANT_BUFFER_SLOTS, state.constantBuffers[stage], nullptr, nullptr);
+		for (UINT slot = 0; slot < BoundState::CONSTANT_BUFFER_SLOTS; slot++)
+		{
+			if (state.constantCounts[stage][slot] != 0)
+				WriteSetConstantBuffers(stage, slot, 1, &state.constantBuffers[stage][slot], &state.firstConstants[stage][slot], &state.constantCounts[stage][slot]);
+		}
+
+		WriteSetViews(OP_SET_SHADER_RESOURCES, OBJECT_SHADER_RESOURCE_VIEW, stage, 0, BoundState::RESOURCE_SLOTS, (const void* const*)state.resources[stage]);
+		WriteSetViews(OP_SET_SAMPLERS, OBJECT_SAMPLER, stage, 0, BoundState::SAMPLER_SLOTS, (const void* const*)state.samplers[stage]);
+	}
+
+	uint32_t blendState = DeclareObject(state.blendState, OBJECT_BLEND_STATE);
+	WriteOp(OP_SET_BLEND_STATE);
+	WriteUInt(blendState);
+	WriteUInt(1);
+	for (int i = 0; i < 4; i++)
+		WriteFloat(state.blendFactor[i]);
+	WriteUInt(state.sampleMask);
+
+	uint32_t depthStencilState = DeclareObject(state.depthStencilState, OBJECT_DEPTH_STENCIL_STATE);
+	WriteOp(OP_SET_DEPTH_STENCIL_STATE);
+	WriteUInt(depthStencilState);
+	WriteUInt(state.stencilRef);
+
+	uint32_t rasterizerState = DeclareObject(state.rasterizerState, OBJECT_RASTERIZER_STATE);
+	WriteOp(OP_SET_RASTERIZER_STATE);
+	WriteUInt(rasterizerState);
+}
+
+void FrameCapture::WriteSetShader(int stage, const void* shader)
+{
+	static const ObjectKind kinds[BoundState::STAGE_COUNT] = { OBJECT_VERTEX_SHADER, OBJECT_GEOMETRY_SHADER, OBJECT_PIXEL_SHADER };
+
+	uint32_t id = DeclareObject(shader, kinds[stage]);
+	WriteOp(OP_SET_SHADER);
+	WriteUInt(stage);
+	WriteUInt(id);
+}
+
+void FrameCapture::WriteSetConstantBuffers(int stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	for (UINT i = 0; i < count; i++)
+		DeclareObject(buffers ? buffers[i] : nullptr, OBJECT_BUFFER);
+
+	bool windows = firstConstants && constantCounts;
+	WriteOp(windows ? OP_SET_CONSTANT_BUFFERS1 : OP_SET_CONSTANT_BUFFERS);
+	WriteUInt(stage);
+	WriteUInt(startSlot);
+	WriteUInt(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		WriteUInt(DeclareObject(buffers ? buffers[i] : nullptr, OBJECT_BUFFER));
+		if (windows)
+		{
+			WriteUInt(firstConstants[i]);
+			WriteUInt(constantCounts[i]);
+		}
+	}
+}
+
+void FrameCapture::WriteSetViews(Op op, ObjectKind kind, int stage, UINT startSlot, UINT count, const void* const* views)
+{
+	for (UINT i = 0; i < count; i++)
+		DeclareObject(views ? views[i] : nullptr, kind);
+
+	WriteOp(op);
+	WriteUInt(stage);
+	WriteUInt(startSlot);
+	WriteUInt(count);
+	for (UINT i = 0; i < count; i++)
+		WriteUInt(DeclareObject(views ? views[i] : nullptr, kind));
+}
+
+void FrameCapture::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	tracker.IASetInputLayout(inputLayout);
+	if (capturing)
+	{
+		uint32_t id = DeclareObject(inputLayout, OBJECT_INPUT_LAYOUT);
+		WriteOp(OP_SET_INPUT_LAYOUT);
+		WriteUInt(id);
+	}
+	backend->IASetInputLayout(inputLayout);
+}
+
+void FrameCapture::IASetPrimitiveTopology(UINT topology)
+{
+	tracker.IASetPrimitiveTopology(topology);
+	if (capturing)
+	{
+		WriteOp(OP_SET_TOPOLOGY);
+		WriteUInt(topology);
+	}
+	backend->IASetPrimitiveTopology(topology);
+}
+
+void FrameCapture::IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	tracker.IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+	if (capturing)
+	{
+		for (UINT i = 0; i < count; i++)
+			DeclareObject(buffers[i], OBJECT_BUFFER);
+
+		WriteOp(OP_SET_VERTEX_BUFFERS);
+		WriteUInt(startSlot);
+		WriteUInt(count);
+		for (UINT i = 0; i < count; i++)
+		{
+			WriteUInt(DeclareObject(buffers[i], OBJECT_BUFFER));
+			WriteUInt(strides[i]);
+			WriteUInt(offsets[i]);
+		}
+	}
+	backend->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+}
+
+void FrameCapture::IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset)
+{
+	tracker.IASetIndexBuffer(buffer, format, offset);
+	if (capturing)
+	{
+		uint32_t id = DeclareObject(buffer, OBJECT_BUFFER);
+		WriteOp(OP_SET_INDEX_BUFFER);
+		WriteUInt(id);
+		WriteUInt(format);
+		WriteUInt(offset);
+	}
+	backend->IASetIndexBuffer(buffer, format, offset);
+}
+
+void FrameCapture::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	tracker.VSSetShader(shader, classInstances, classInstanceCount);
+	if (capturing)
+		WriteSetShader(BoundState::STAGE_VS, shader);
+	backend->VSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void FrameCapture::GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	tracker.GSSetShader(shader, classInstances, classInstanceCount);
+	if (capturing)
+		WriteSetShader(BoundState::STAGE_GS, shader);
+	backend->GSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void FrameCapture::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	tracker.PSSetShader(shader, classInstances, classInstanceCount);
+	if (capturing)
+		WriteSetShader(BoundState::STAGE_PS, shader);
+	backend->PSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void FrameCapture::VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	tracker.VSSetConstantBuffers(startSlot, count, buffers);
+	if (capturing)
+		WriteSetConstantBuffers(BoundState::STAGE_VS, startSlot, count, buffers, nullptr, nullptr);
+	backend->VSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void FrameCapture::GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	tracker.GSSetConstantBuffers(startSlot, count, buffers);
+	if (capturing)
+		WriteSetConstantBuffers(BoundState::STAGE_GS, startSlot, count, buffers, nullptr, nullptr);
+	backend->GSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void FrameCapture::PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	tracker.PSSetConstantBuffers(startSlot, count, buffers);
+	if (capturing)
+		WriteSetConstantBuffers(BoundState::STAGE_PS, startSlot, count, buffers, nullptr, nullptr);
+	backend->PSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void FrameCapture::VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	tracker.VSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+	if (capturing)
+		WriteSetConstantBuffers(BoundState::STAGE_VS, startSlot, count, buffers, firstConstants, constantCounts);
+	backend->VSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void FrameCapture::GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	tracker.GSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+	if (capturing)
+		WriteSetConstantBuffers(BoundState::STAGE_GS, startSlot, count, buffers, firstConstants, constantCounts);
+	backend->GSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void FrameCapture::PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	tracker.PSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+	if (capturing)
+		WriteSetConstantBuffers(BoundState::STAGE_PS, startSlot, count, buffers, firstConstants, constantCounts);
+	backend->PSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void FrameCapture::VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	tracker.VSSetShaderResources(startSlot, count, views);
+	if (capturing)
+		WriteSetViews(OP_SET_SHADER_RESOURCES, OBJECT_SHADER_RESOURCE_VIEW, BoundState::STAGE_VS, startSlot, count, (const void* const*)views);
+	backend->VSSetShaderResources(startSlot, count, views);
+}
+
+void FrameCapture::GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	tracker.GSSetShaderResources(startSlot, count, views);
+	if (capturing)
+		WriteSetViews(OP_SET_SHADER_RESOURCES, OBJECT_SHADER_RESOURCE_VIEW, BoundState::STAGE_GS, startSlot, count, (const void* const*)views);
+	backend->GSSetShaderResources(startSlot, count, views);
+}
+
+void FrameCapture::PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	tracker.PSSetShaderResources(startSlot, count, views);
+	if (capturing)
+		WriteSetViews(OP_SET_SHADER_RESOURCES, OBJECT_SHADER_RESOURCE_VIEW, BoundState::STAGE_PS, startSlot, count, (const void* const*)views);
+	backend->PSSetShaderResources(startSlot, count, views);
+}
+
+void FrameCapture::VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	tracker.VSSetSamplers(startSlot, count, samplers);
+	if (capturing)
+		WriteSetViews(OP_SET_SAMPLERS, OBJECT_SAMPLER, BoundState::STAGE_VS, startSlot, count, (const void* const*)samplers);
+	backend->VSSetSamplers(startSlot, count, samplers);
+}
+
+void FrameCapture::GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	tracker.GSSetSamplers(startSlot, count, samplers);
+	if (capturing)
+		WriteSetViews(OP_SET_SAMPLERS, OBJECT_SAMPLER, BoundState::STAGE_GS, startSlot, count, (const void* const*)samplers);
+	backend->GSSetSamplers(startSlot, count, samplers);
+}
+
+void FrameCapture::PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	tracker.PSSetSamplers(startSlot, count, samplers);
+	if (capturing)
+		WriteSetViews(OP_SET_SAMPLERS, OBJECT_SAMPLER, BoundState::STAGE_PS, startSlot, count, (const void* const*)samplers);
+	backend->PSSetSamplers(startSlot, count, samplers);
+}
+
+void FrameCapture::OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	tracker.OMSetBlendState(blendState, blendFactor, sampleMask);
+	if (capturing)
+	{
+		uint32_t id = DeclareObject(blendState, OBJECT_BLEND_STATE);
+		WriteOp(OP_SET_BLEND_STATE);
+		WriteUInt(id);
+		WriteUInt(blendFactor ? 1 : 0);
+		if (blendFactor)
+		{
+			for (int i = 0; i < 4; i++)
+				WriteFloat(blendFactor[i]);
+		}
+		WriteUInt(sampleMask);
+	}
+	backend->OMSetBlendState(blendState, blendFactor, sampleMask);
+}
+
+void FrameCapture::OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+	tracker.OMSetDepthStencilState(depthStencilState, stencilRef);
+	if (capturing)
+	{
+		uint32_t id = DeclareObject(depthStencilState, OBJECT_DEPTH_STENCIL_STATE);
+		WriteOp(OP_SET_DEPTH_STENCIL_STATE);
+		WriteUInt(id);
+		WriteUInt(stencilRef);
+	}
+	backend->OMSetDepthStencilState(depthStencilState, stencilRef);
+}
+
+void FrameCapture::RSSetState(ID3D11RasterizerState* rasterizerState)
+{
+	tracker.RSSetState(rasterizerState);
+	if (capturing)
+	{
+		uint32_t id = DeclareObject(rasterizerState, OBJECT_RASTERIZER_STATE);
+		WriteOp(OP_SET_RASTERIZER_STATE);
+		WriteUInt(id);
+	}
+	backend->RSSetState(rasterizerState);
+}
+
+void FrameCapture::UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch)
+{
+	if (capturing)
+	{
+		// Buffers are measured by the box or their size, textures need a box and are measured by their pitches
+		size_t size;
+		if (rowPitch == 0)
+			size = box ? box->right - box->left : GetResourceSize(resource);
+		else if (box)
+			size = (size_t)(box->back - box->front - 1) * depthPitch + (size_t)(box->bottom - box->top) * rowPitch;
+		else
+			size = 0;
+
+		uint32_t id = DeclareObject(resource, OBJECT_RESOURCE);
+		WriteOp(OP_UPDATE_SUBRESOURCE);
+		WriteUInt(id);
+		WriteUInt(subresource);
+		WriteUInt(box ? 1 : 0);
+		if (box)
+		{
+			WriteUInt(box->left);
+			WriteUInt(box->top);
+			WriteUInt(box->front);
+			WriteUInt(box->right);
+			WriteUInt(box->bottom);
+			WriteUInt(box->back);
+		}
+		WriteUInt(rowPitch);
+		WriteUInt(depthPitch);
+		WriteUInt(size);
+		WriteBytes(data, size);
+		stats.payloadBytes += size;
+	}
+	backend->UpdateSubresource(resource, subresource, box, data, rowPitch, depthPitch);
+}
+
+HRESULT FrameCapture::Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped)
+{
+	HRESULT result = backend->Map(resource, subresource, mapType, mapFlags, mapped);
+	if (!capturing || result < 0)
+		return result;
+
+	UINT size = GetResourceSize(resource);
+	if (size == 0 && !describeResource)
+		size = mapped->RowPitch;
+
+	uint32_t id = DeclareObject(resource, OBJECT_RESOURCE);
+	WriteOp(OP_MAP);
+	WriteUInt(id);
+	WriteUInt(subresource);
+	WriteUInt(mapType);
+	WriteUInt(mapFlags);
+	WriteUInt(size);
+
+	OpenMap openMap;
+	openMap.resource = resource;
+	openMap.subresource = subresource;
+	openMap.data = (const uint8_t*)mapped->pData;
+	openMap.size = size;
+	openMaps.push_back(openMap);
+	return result;
+}
+
+void FrameCapture::Unmap(ID3D11Resource* resource, UINT subresource)
+{
+	// Mapped before the capture started, the replay never saw the map
+	int open = (int)openMaps.size() - 1;
+	while (open >= 0 && (openMaps[open].resource != resource || openMaps[open].subresource != subresource))
+		open--;
+
+	if (capturing && open >= 0)
+	{
+		const OpenMap& openMap = openMaps[open];
+		std::vector<uint8_t>& shadow = shadows[resource];
+		if (shadow.size() < openMap.size)
+			shadow.resize(openMap.size, 0);
+
+		// Neighbouring blocks that differ make one run
+		runs.clear();
+		for (UINT offset = 0; offset < openMap.size; offset += MAP_BLOCK)
+		{
+			UINT block = std::min(openMap.size - offset, (UINT)MAP_BLOCK);
+			if (memcmp(openMap.data + offset, shadow.data() + offset, block) == 0)
+				continue;
+
+			if (!runs.empty() && runs[runs.size() - 2] + runs.back() == offset)
+				runs.back() += block;
+			else
+			{
+				runs.push_back(offset);
+				runs.push_back(block);
+			}
+		}
+
+		WriteOp(OP_UNMAP);
+		WriteUInt(DeclareObject(resource, OBJECT_RESOURCE));
+		WriteUInt(subresource);
+		WriteUInt(runs.size() / 2);
+		for (size_t run = 0; run < runs.size(); run += 2)
+		{
+			UINT offset = runs[run], size = runs[run + 1];
+			WriteUInt(offset);
+			WriteUInt(size);
+			WriteBytes(openMap.data + offset, size);
+			memcpy(shadow.data() + offset, openMap.data + offset, size);
+			stats.payloadBytes += size;
+		}
+		stats.mappedBytes += openMap.size;
+	}
+
+	if (open >= 0)
+		openMaps.erase(openMaps.begin() + open);
+	backend->Unmap(resource, subresource);
+}
+
+void FrameCapture::Draw(UINT vertexCount, UINT startVertex)
+{
+	if (capturing)
+	{
+		WriteOp(OP_DRAW);
+		WriteUInt(vertexCount);
+		WriteUInt(startVertex);
+	}
+	backend->Draw(vertexCount, startVertex);
+}
+
+void FrameCapture::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	if (capturing)
+	{
+		WriteOp(OP_DRAW_INDEXED);
+		WriteUInt(indexCount);
+		WriteUInt(startIndex);
+		WriteInt(baseVertex);
+	}
+	backend->DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void FrameCapture::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	if (capturing)
+	{
+		WriteOp(OP_DRAW_INDEXED_INSTANCED);
+		WriteUInt(indexCount);
+		WriteUInt(instanceCount);
+		WriteUInt(startIndex);
+		WriteInt(baseVertex);
+		WriteUInt(startInstance);
+	}
+	backend->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+/*
+	FrameReplay
+*/
+
+// Reads the stream front to back, every read fails once it would run past the end
+class CaptureReader
+{
+public:
+	CaptureReader(const uint8_t* data, size_t size) : data(data), size(size), position(0), failed(false) {}
+
+	bool AtEnd() const { return this->position >= this->size; }
+	bool Failed() const { return this->failed; }
+	void Fail() { this->failed = true; }
+
+	uint64_t UInt()
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (position >= size)
+				break;
+
+			uint8_t byte = data[position++];
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		failed = true;
+		return 0;
+	}
+
+	int64_t Int()
+	{
+		uint64_t value = UInt();
+		return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+	}
+
+	float Float()
+	{
+		float value = 0.0f;
+		const uint8_t* bytes = Bytes(sizeof(float));
+		if (bytes)
+			memcpy(&value, bytes, sizeof(float));
+		return value;
+	}
+
+	// Points into the stream, null when there aren't that many bytes left
+	const uint8_t* Bytes(size_t count)
+	{
+		if (count > size - position)
+		{
+			failed = true;
+			return nullptr;
+		}
+
+		const uint8_t* bytes = data + position;
+		position += count;
+		return bytes;
+	}
+
+private:
+	const uint8_t* data;
+	size_t size;
+	size_t position;
+	bool failed;
+};
+
+FrameReplay::FrameReplay()
+{
+	memset(&header, 0, sizeof(FrameCapture::FileHeader));
+}
+
+FrameReplay::~FrameReplay()
+{
+}
+
+bool FrameReplay::Load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+
+	std::vector<uint8_t> contents((size_t)file.tellg());
+	file.seekg(0);
+	if (!file.read((char*)contents.data(), contents.size()))
+		return false;
+
+	return Load(contents);
+}
+
+bool FrameReplay::Load(const std::vector<uint8_t>& data)
+{
+	this->data = data;
+	stats = Stats();
+	if (data.size() < sizeof(FrameCapture::FileHeader))
+		return false;
+
+	memcpy(&header, data.data(), sizeof(FrameCapture::FileHeader));
+	if (header.magic != FrameCapture::MAGIC || header.version != FrameCapture::VERSION)
+		return false;
+
+	objects.resize(header.objects + 1);
+	objectKinds.assign(header.objects + 1, FrameCapture::OBJECT_RESOURCE);
+	objects[0] = nullptr;
+	for (uint32_t id = 1; id <= header.objects; id++)
+		objects[id] = (const void*)(STAND_IN_BASE + (uintptr_t)id * 16);
+
+	return Execute(nullptr, stats);
+}
+
+void FrameReplay::SetObject(uint32_t id, const void* object)
+{
+	objects[id] = object;
+}
+
+bool FrameReplay::Replay(RenderBackend* backend)
+{
+	Stats counts;
+	return Execute(backend, counts);
+}
+
+const char* FrameReplay::GetOpName(FrameCapture::Op op)
+{
+	static const char* names[FrameCapture::OP_COUNT] =
+	{
+		"Frame", "Object", "SetInputLayout", "SetTopology", "SetVertexBuffers", "SetIndexBuffer", "SetShader",
+		"SetConstantBuffers", "SetConstantBuffers1", "SetShaderResources", "SetSamplers", "SetBlendState",
+		"SetDepthStencilState", "SetRasterizerState", "UpdateSubresource", "Map", "Unmap", "Draw", "DrawIndexed",
+		"DrawIndexedInstanced",
+	};
+	return names[op];
+}
+
+bool FrameReplay::Execute(RenderBackend* backend, Stats& counts)
+{
+	// Slots of one call, as many as any stage has
+	static const UINT MAX_SLOTS = 128;		// D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT
+	const void* slotObjects[MAX_SLOTS];
+	UINT slotValues[2][MAX_SLOTS];
+
+	struct OpenMap
+	{
+		uint32_t id;
+		UINT subresource;
+		UINT mapType;
+		uint8_t* data;
+		UINT size;
+	};
+	std::vector<OpenMap> openMaps;
+
+	shadows.assign(objects.size(), std::vector<uint8_t>());
+	mappedBefore.assign(objects.size(), 0);
+
+	CaptureReader reader(data.data(), data.size());
+	reader.Bytes(sizeof(FrameCapture::FileHeader));
+
+	auto readObject = [&]() -> const void*
+	{
+		uint64_t id = reader.UInt();
+		if (id >= objects.size())
+		{
+			reader.Fail();
+			return nullptr;
+		}
+		return objects[(size_t)id];
+	};
+
+	while (!reader.AtEnd() && !reader.Failed())
+	{
+		const uint8_t* opByte = reader.Bytes(1);
+		if (*opByte >= FrameCapture::OP_COUNT)
+			return false;
+
+		FrameCapture::Op op = (FrameCapture::Op)*opByte;
+		counts.commands++;
+		counts.opCounts[op]++;
+
+		switch (op)
+		{
+		case FrameCapture::OP_FRAME:
+			counts.frames++;
+			break;
+
+		case FrameCapture::OP_OBJECT:
+		{
+			uint64_t id = reader.UInt();
+			uint64_t kind = reader.UInt();
+			if (id == 0 || id >= objects.size() || kind >= FrameCapture::OBJECT_KIND_COUNT)
+				return false;
+			objectKinds[(size_t)id] = (FrameCapture::ObjectKind)kind;
+			break;
+		}
+
+		case FrameCapture::OP_SET_INPUT_LAYOUT:
+		{
+			const void* inputLayout = readObject();
+			if (backend && !reader.Failed())
+				backend->IASetInputLayout((ID3D11InputLayout*)inputLayout);
+			break;
+		}
+
+		case FrameCapture::OP_SET_TOPOLOGY:
+		{
+			UINT topology = (UINT)reader.UInt();
+			if (backend && !reader.Failed())
+				backend->IASetPrimitiveTopology(topology);
+			break;
+		}
+
+		case FrameCapture::OP_SET_VERTEX_BUFFERS:
+		{
+			UINT startSlot = (UINT)reader.UInt();
+			UINT count = (UINT)reader.UInt();
+			if (count > MAX_SLOTS)
+				return false;
+			for (UINT i = 0; i < count; i++)
+			{
+				slotObjects[i] = readObject();
+				slotValues[0][i] = (UINT)reader.UInt();
+				slotValues[1][i] = (UINT)reader.UInt();
+			}
+			if (backend && !reader.Failed())
+				backend->IASetVertexBuffers(startSlot, count, (ID3D11Buffer* const*)slotObjects, slotValues[0], slotValues[1]);
+			break;
+		}
+
+		case FrameCapture::OP_SET_INDEX_BUFFER:
+		{
+			const void* buffer = readObject();
+			UINT format = (UINT)reader.UInt();
+			UINT offset = (UINT)reader.UInt();
+			if (backend && !reader.Failed())
+				backend->IASetIndexBuffer((ID3D11Buffer*)buffer, format, offset);
+			break;
+		}
+
+		case FrameCapture::OP_SET_SHADER:
+		{
+			uint64_t stage = reader.UInt();
+			const void* shader = readObject();
+			if (!backend || reader.Failed())
+				break;
+
+			if (stage == BoundState::STAGE_VS)
+				backend->VSSetShader((ID3D11VertexShader*)shader, nullptr, 0);
+			else if (stage == BoundState::STAGE_GS)
+				backend->GSSetShader((ID3D11GeometryShader*)shader, nullptr, 0);
+			else if (stage == BoundState::STAGE_PS)
+				backend->PSSetShader((ID3D11PixelShader*)shader, nullptr, 0);
+			else
+				return false;
+			break;
+		}
+
+		case FrameCapture::OP_SET_CONSTANT_BUFFERS:
+		case FrameCapture::OP_SET_CONSTANT_BUFFERS1:
+		{
+			bool windows = op == FrameCapture::OP_SET_CONSTANT_BUFFERS1;
+			uint64_t stage = reader.UInt();
+			UINT startSlot = (UINT)reader.UInt();
+			UINT count = (UINT)reader.UInt();
+			if (count > MAX_SLOTS || stage >= BoundState::STAGE_COUNT)
+				return false;
+			for (UINT i = 0; i < count; i++)
+			{
+				slotObjects[i] = readObject();
+				if (windows)
+				{
+					slotValues[0][i] = (UINT)reader.UInt();
+					slotValues[1][i] = (UINT)reader.UInt();
+				}
+			}
+			if (!backend || reader.Failed())
+				break;
+
+			ID3D11Buffer* const* buffers = (ID3D11Buffer* const*)slotObjects;
+			if (windows)
+			{
+				if (stage == BoundState::STAGE_VS)
+					backend->VSSetConstantBuffers1(startSlot, count, buffers, slotValues[0], slotValues[1]);
+				else if (stage == BoundState::STAGE_GS)
+					backend->GSSetConstantBuffers1(startSlot, count, buffers, slotValues[0], slotValues[1]);
+				else
+					backend->PSSetConstantBuffers1(startSlot, count, buffers, slotValues[0], slotValues[1]);
+			}
+			else
+			{
+				if (stage == BoundState::STAGE_VS)
+					backend->VSSetConstantBuffers(startSlot, count, buffers);
+				else if (stage == BoundState::STAGE_GS)
+					backend->GSSetConstantBuffers(startSlot, count, buffers);
+				else
+					backend->PSSetConstantBuffers(startSlot, count, buffers);
+			}
+			break;
+		}
+
+		case FrameCapture::OP_SET_SHADER_RESOURCES:
+		case FrameCapture::OP_SET_SAMPLERS:
+		{
+			uint64_t stage = reader.UInt();
+			UINT startSlot = (UINT)reader.UInt();
+			UINT count = (UINT)reader.UInt();
+			if (count > MAX_SLOTS || stage >= BoundState::STAGE_COUNT)
+				return false;
+			for (UINT i = 0; i < count; i++)
+				slotObjects[i] = readObject();
+			if (!backend || reader.Failed())
+				break;
+
+			if (op == FrameCapture::OP_SET_SHADER_RESOURCES)
+			{
+				ID3D11ShaderResourceView* const* views = (ID3D11ShaderResourceView* const*)slotObjects;
+				if (stage == BoundState::STAGE_VS)
+					backend->VSSetShaderResources(startSlot, count, views);
+				else if (stage == BoundState::STAGE_GS)
+					backend->GSSetShaderResources(startSlot, count, views);
+				else
+					backend->PSSetShaderResources(startSlot, count, views);
+			}
+			else
+			{
+				ID3D11SamplerState* const* samplers = (ID3D11SamplerState* const*)slotObjects;
+				if (stage == BoundState::STAGE_VS)
+					backend->VSSetSamplers(startSlot, count, samplers);
+				else if (stage == BoundState::STAGE_GS)
+					backend->GSSetSamplers(startSlot, count, samplers);
+				else
+					backend->PSSetSamplers(startSlot, count, samplers);
+			}
+			break;
+		}
+
+		case FrameCapture::OP_SET_BLEND_STATE:
+		{
+			const void* blendState = readObject();
+			bool hasFactor = reader.UInt() != 0;
+			FLOAT blendFactor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+			if (hasFactor)
+			{
+				for (int i = 0; i < 4; i++)
+					blendFactor[i] = reader.Float();
+			}
+			UINT sampleMask = (UINT)reader.UInt();
+			if (backend && !reader.Failed())
+				backend->OMSetBlendState((ID3D11BlendState*)blendState, hasFactor ? blendFactor : nullptr, sampleMask);
+			break;
+		}
+
+		case FrameCapture::OP_SET_DEPTH_STENCIL_STATE:
+		{
+			const void* depthStencilState = readObject();
+			UINT stencilRef = (UINT)reader.UInt();
+			if (backend && !reader.Failed())
+				backend->OMSetDepthStencilState((ID3D11DepthStencilState*)depthStencilState, stencilRef);
+			break;
+		}
+
+		case FrameCapture::OP_SET_RASTERIZER_STATE:
+		{
+			const void* rasterizerState = readObject();
+			if (backend && !reader.Failed())
+				backend->RSSetState((ID3D11RasterizerState*)rasterizerState);
+			break;
+		}
+
+		case FrameCapture::OP_UPDATE_SUBRESOURCE:
+		{
+			const void* resource = readObject();
+			UINT subresource = (UINT)reader.UInt();
+			bool hasBox = reader.UInt() != 0;
+			ResourceBox box = {};
+			if (hasBox)
+			{
+				box.left = (UINT)reader.UInt();
+				box.top = (UINT)reader.UInt();
+				box.front = (UINT)reader.UInt();
+				box.right = (UINT)reader.UInt();
+				box.bottom = (UINT)reader.UInt();
+				box.back = (UINT)reader.UInt();
+			}
+			UINT rowPitch = (UINT)reader.UInt();
+			UINT depthPitch = (UINT)reader.UInt();
+			size_t size = (size_t)reader.UInt();
+			const uint8_t* payload = reader.Bytes(size);
+			counts.payloadBytes += size;
+			if (backend && !reader.Failed())
+				backend->UpdateSubresource((ID3D11Resource*)resource, subresource, hasBox ? &box : nullptr, payload, rowPitch, depthPitch);
+			break;
+		}
+
+		case FrameCapture::OP_MAP:
+		{
+			uint64_t id = reader.UInt();
+			OpenMap openMap;
+			openMap.subresource = (UINT)reader.UInt();
+			openMap.mapType = (UINT)reader.UInt();
+			UINT mapFlags = (UINT)reader.UInt();
+			openMap.size = (UINT)reader.UInt();
+			if (reader.Failed() || id == 0 || id >= objects.size())
+				return false;
+
+			openMap.id = (uint32_t)id;
+			openMap.data = nullptr;
+			if (shadows[openMap.id].size() < openMap.size)
+				shadows[openMap.id].resize(openMap.size, 0);
+
+			if (backend)
+			{
+				MappedResource mapped;
+				if (backend->Map((ID3D11Resource*)objects[openMap.id], openMap.subresource, openMap.mapType, mapFlags, &mapped) < 0)
+					return false;
+				openMap.data = (uint8_t*)mapped.pData;
+			}
+			openMaps.push_back(openMap);
+			break;
+		}
+
+		case FrameCapture::OP_UNMAP:
+		{
+			uint64_t id = reader.UInt();
+			UINT subresource = (UINT)reader.UInt();
+			uint64_t runCount = reader.UInt();
+
+			int open = (int)openMaps.size() - 1;
+			while (open >= 0 && (openMaps[open].id != id || openMaps[open].subresource != subresource))
+				open--;
+			if (reader.Failed() || open < 0)
+				return false;
+
+			// The changed blocks go into the shadow, and into the mapped memory unless all of it is copied after
+			OpenMap openMap = openMaps[open];
+			openMaps.erase(openMaps.begin() + open);
+			std::vector<uint8_t>& shadow = shadows[openMap.id];
+			bool whole = openMap.mapType == RenderBackend::MAP_WRITE_DISCARD || !mappedBefore[openMap.id];
+
+			for (uint64_t run = 0; run < runCount; run++)
+			{
+				size_t offset = (size_t)reader.UInt();
+				size_t size = (size_t)reader.UInt();
+				const uint8_t* payload = reader.Bytes(size);
+				if (reader.Failed() || offset + size > shadow.size())
+					return false;
+
+				memcpy(shadow.data() + offset, payload, size);
+				if (openMap.data && !whole)
+					memcpy(openMap.data + offset, payload, size);
+				counts.payloadBytes += size;
+			}
+
+			if (backend)
+			{
+				if (openMap.data && whole)
+					memcpy(openMap.data, shadow.data(), openMap.size);
+				mappedBefore[openMap.id] = 1;
+				backend->Unmap((ID3D11Resource*)objects[openMap.id], subresource);
+			}
+			break;
+		}
+
+		case FrameCapture::OP_DRAW:
+		{
+			UINT vertexCount = (UINT)reader.UInt();
+			UINT startVertex = (UINT)reader.UInt();
+			if (backend && !reader.Failed())
+				backend->Draw(vertexCount, startVertex);
+			break;
+		}
+
+		case FrameCapture::OP_DRAW_INDEXED:
+		{
+			UINT indexCount = (UINT)reader.UInt();
+			UINT startIndex = (UINT)reader.UInt();
+			INT baseVertex = (INT)reader.Int();
+			if (backend && !reader.Failed())
+				backend->DrawIndexed(indexCount, startIndex, baseVertex);
+			break;
+		}
+
+		case FrameCapture::OP_DRAW_INDEXED_INSTANCED:
+		{
+			UINT indexCount = (UINT)reader.UInt();
+			UINT instanceCount = (UINT)reader.UInt();
+			UINT startIndex = (UINT)reader.UInt();
+			INT baseVertex = (INT)reader.Int();
+			UINT startInstance = (UINT)reader.UInt();
+			if (backend && !reader.Failed())
+				backend->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+			break;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	return !reader.Failed() && openMaps.empty();
+}
\ No newline at end of file
@@ -0,0 +1,268 @@
+#pragma once
+#include "RenderBackend.h"
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+/*
+	Captures the calls that reach it into a compact binary stream, for one frame or several, and
+	forwards them to the backend behind it. FrameReplay issues a capture again on any backend.
+	Every call is an opcode byte and its arguments as variable length integers. Objects are numbered in
+	the order they are first seen and declared in the stream when they are, so a capture never holds
+	pointers. Updates carry their data. What is written into mapped memory is compared with what the
+	capture last recorded for the resource when it is unmapped, and only the 16 byte blocks that differ
+	are kept, so the first map of a resource in a capture records what it holds and later ones what changed.
+	The bound state is followed all the time and written first, a capture doesn't depend on the calls
+	before it. Class instances and texture maps are not captured.
+	Only what goes through it is: render targets, viewports, clears and the uploads of the geometry pages
+	and voxel chunks go to the device context directly and are not in a capture, neither is what is
+	recorded on deferred contexts.
+	Nothing is recorded while no capture runs, the calls are only forwarded and the state followed.
+*/
+class FrameCapture : public RenderBackend
+{
+public:
+	enum Op
+	{
+		OP_FRAME,						// Start of a frame
+		OP_OBJECT,						// Number and kind of an object the stream hasn't used before
+		OP_SET_INPUT_LAYOUT,
+		OP_SET_TOPOLOGY,
+		OP_SET_VERTEX_BUFFERS,
+		OP_SET_INDEX_BUFFER,
+		OP_SET_SHADER,
+		OP_SET_CONSTANT_BUFFERS,
+		OP_SET_CONSTANT_BUFFERS1,
+		OP_SET_SHADER_RESOURCES,
+		OP_SET_SAMPLERS,
+		OP_SET_BLEND_STATE,
+		OP_SET_DEPTH_STENCIL_STATE,
+		OP_SET_RASTERIZER_STATE,
+		OP_UPDATE_SUBRESOURCE,
+		OP_MAP,
+		OP_UNMAP,						// With the blocks that were written while it was mapped
+		OP_DRAW,
+		OP_DRAW_INDEXED,
+		OP_DRAW_INDEXED_INSTANCED,
+		OP_COUNT,
+	};
+
+	enum ObjectKind
+	{
+		OBJECT_INPUT_LAYOUT,
+		OBJECT_BUFFER,
+		OBJECT_VERTEX_SHADER,
+		OBJECT_GEOMETRY_SHADER,
+		OBJECT_PIXEL_SHADER,
+		OBJECT_SHADER_RESOURCE_VIEW,
+		OBJECT_SAMPLER,
+		OBJECT_BLEND_STATE,
+		OBJECT_DEPTH_STENCIL_STATE,
+		OBJECT_RASTERIZER_STATE,
+		OBJECT_RESOURCE,				// Updated or mapped before it was bound
+		OBJECT_KIND_COUNT,
+	};
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t frames;
+		uint32_t objects;				// Numbered 1 to objects, 0 is null
+	};
+
+	static const uint32_t MAGIC = 0x43465048;		// "HPFC"
+	static const uint32_t VERSION = 1;
+
+	// Granularity of the mapped memory comparison
+	static const UINT MAP_BLOCK = 16;
+
+	struct Stats
+	{
+		int frames = 0;
+		int commands = 0;
+		size_t bytes = 0;				// Of the stream, header included
+		size_t payloadBytes = 0;		// Update data and mapped blocks
+		size_t mappedBytes = 0;			// Compared at unmap
+	};
+
+	// Size in bytes of a resource, 0 when it is not known
+	typedef UINT (*ResourceSizeFunction)(ID3D11Resource* resource);
+
+public:
+	/*
+		With describeResource the resources are real objects and it is asked for the size of a mapped or updated
+		buffer, D3D11Backend::GetBufferSize reads it from the buffer's description. Without, they are stand-ins,
+		sizes come from SetResourceSize, and mapped sizes from the row pitch the backend's Map returns.
+	*/
+	FrameCapture(RenderBackend* backend, ResourceSizeFunction describeResource);
+	~FrameCapture();
+
+	void SetResourceSize(ID3D11Resource* resource, UINT bytes);
+
+	// Captures the next frames, from the next BeginFrame on. Drops what an earlier capture recorded
+	void Start(int frames);
+
+	void BeginFrame();
+
+	// True when this was the last frame of the capture, it can be saved from here on
+	bool EndFrame();
+
+	bool IsCapturing() const { return this->capturing; }
+	bool IsPending() const { return this->framesLeft > 0; }
+
+	// The whole file, header and stream
+	const std::vector<uint8_t>& GetData() const { return this->stream; }
+	bool Save(const std::string& path) const;
+
+	// The object behind every number the stream uses, 0 is null
+	const std::vector<const void*>& GetObjects() const { return this->objects; }
+
+	RenderBackend* GetBackend() const { return this->backend; }
+	const Stats& GetStats() const { return this->stats; }
+
+	void IASetInputLayout(ID3D11InputLayout* inputLayout) override;
+	void IASetPrimitiveTopology(UINT topology) override;
+	void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+	void IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset) override;
+
+	void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+
+	void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+
+	void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+
+	void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+
+	void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) override;
+	void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) override;
+	void RSSetState(ID3D11RasterizerState* rasterizerState) override;
+
+	void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch) override;
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped) override;
+	void Unmap(ID3D11Resource* resource, UINT subresource) override;
+
+	void Draw(UINT vertexCount, UINT startVertex) override;
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) override;
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+
+private:
+	struct OpenMap
+	{
+		ID3D11Resource* resource;
+		UINT subresource;
+		const uint8_t* data;
+		UINT size;
+	};
+
+	void WriteOp(Op op);
+	void WriteUInt(uint64_t value);
+	void WriteInt(int64_t value);
+	void WriteFloat(float value);
+	void WriteBytes(const void* data, size_t size);
+
+	// Number of the object, declared in the stream the first time it is seen
+	uint32_t DeclareObject(const void* object, ObjectKind kind);
+
+	UINT GetResourceSize(ID3D11Resource* resource);
+
+	// The state the tracker holds, as calls, so the capture starts from it
+	void WriteState();
+	void WriteSetShader(int stage, const void* shader);
+	void WriteSetConstantBuffers(int stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts);
+	void WriteSetViews(Op op, ObjectKind kind, int stage, UINT startSlot, UINT count, const void* const* views);
+
+	void WriteFrameCount();
+
+private:
+	RenderBackend* backend;
+	ResourceSizeFunction describeResource;
+
+	// Follows the bound state, nothing else of it is used
+	RecordingBackend tracker;
+
+	int framesLeft;
+	bool capturing;
+
+	std::vector<uint8_t> stream;
+	std::unordered_map<const void*, uint32_t> objectIds;
+	std::vector<const void*> objects;
+	std::unordered_map<ID3D11Resource*, UINT> resourceSizes;
+
+	// What the capture last recorded for every mapped resource
+	std::unordered_map<ID3D11Resource*, std::vector<uint8_t>> shadows;
+	std::vector<OpenMap> openMaps;
+	std::vector<UINT> runs;						// Offset and size of the changed blocks of one unmap
+
+	Stats stats;
+};
+
+/*
+	Issues a capture again, call for call, on any backend. Objects are stand-in pointers unless they
+	are set with SetObject, so a RecordingBackend or a NullBackend can replay a capture without a device.
+	Mapped memory is written the way it was captured: completely when the map discards or the resource
+	wasn't mapped before in the replay, otherwise only the blocks that changed.
+*/
+class FrameReplay
+{
+public:
+	struct Stats
+	{
+		int frames = 0;
+		int commands = 0;
+		int opCounts[FrameCapture::OP_COUNT] = {};
+		size_t payloadBytes = 0;
+	};
+
+public:
+	FrameReplay();
+	~FrameReplay();
+
+	// Reads the whole capture and walks it once, false when it is not a capture or it is cut short
+	bool Load(const std::string& path);
+	bool Load(const std::vector<uint8_t>& data);
+
+	// The object to hand the backend for a number, instead of its stand-in
+	void SetObject(uint32_t id, const void* object);
+
+	int GetFrameCount() const { return (int)this->header.frames; }
+	int GetObjectCount() const { return (int)this->header.objects; }
+	FrameCapture::ObjectKind GetObjectKind(uint32_t id) const { return this->objectKinds[id]; }
+
+	// Counts of what the capture holds, from the walk at load
+	const Stats& GetStats() const { return this->stats; }
+
+	// All frames of the capture
+	bool Replay(RenderBackend* backend);
+
+	static const char* GetOpName(FrameCapture::Op op);
+
+private:
+	// Without a backend the stream is only walked and counted
+	bool Execute(RenderBackend* backend, Stats& counts);
+
+private:
+	std::vector<uint8_t> data;
+	FrameCapture::FileHeader header;
+
+	std::vector<const void*> objects;
+	std::vector<FrameCapture::ObjectKind> objectKinds;
+
+	// What the capture recorded for every mapped resource, by number
+	std::vector<std::vector<uint8_t>> shadows;
+	std::vector<uint8_t> mappedBefore;
+
+	Stats stats;
+};
\ No newline at end of file
@@ -0,0 +1,261 @@
+#include "FrustumCuller.h"
+#include "Model.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <intrin.h>
+#include <immintrin.h>
+
+static const int BATCH = 8;
+
+// Padding spheres have a hugely negative radius and fail every plane, so there is no tail loop
+static const float PADDING_CENTER = 0.0f;
+static const float PADDING_RADIUS = -3.0e38f;
+
+FrustumCuller::FrustumCuller()
+{
+	this->count = 0;
+	this->path = IsAVXSupported() ? Path::AVX : Path::SSE;
+	memset(this->planes, 0, sizeof(this->planes));
+}
+
+FrustumCuller::~FrustumCuller()
+{
+}
+
+bool FrustumCuller::IsAVXSupported()
+{
+	int info[4];
+	__cpuid(info, 1);
+
+	// The CPU has AVX and the OS saves the YMM registers on a context switch
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+
+	return (_xgetbv(0) & 6) == 6;
+}
+
+void FrustumCuller::SetPath(Path path)
+{
+	if (path == Path::AVX && !IsAVXSupported())
+		path = Path::SSE;
+
+	this->path = path;
+}
+
+void FrustumCuller::Clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	radius.clear();
+	count = 0;
+}
+
+void FrustumCuller::Reserve(int count)
+{
+	size_t padded = (size_t)(count + BATCH - 1) / BATCH * BATCH;
+	centerX.reserve(padded);
+	centerY.reserve(padded);
+	centerZ.reserve(padded);
+	radius.reserve(padded);
+}
+
+int FrustumCuller::Add(DirectX::XMFLOAT3 center, float radius)
+{
+	int index = count++;
+
+	// Grow by a whole batch of padding, the new object takes the first slot
+	if ((size_t)index >= this->radius.size())
+	{
+		size_t padded = this->radius.size() + BATCH;
+		centerX.resize(padded, PADDING_CENTER);
+		centerY.resize(padded, PADDING_CENTER);
+		centerZ.resize(padded, PADDING_CENTER);
+		this->radius.resize(padded, PADDING_RADIUS);
+	}
+
+	Set(index, center, radius);
+	return index;
+}
+
+void FrustumCuller::Set(int index, DirectX::XMFLOAT3 center, float radius)
+{
+	centerX[index] = center.x;
+	centerY[index] = center.y;
+	centerZ[index] = center.z;
+	this->radius[index] = radius;
+}
+
+int FrustumCuller::AddModel(Model* model)
+{
+	int index = Add(DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f), 0.0f);
+	SetModel(index, model);
+	return index;
+}
+
+void FrustumCuller::SetModel(int index, Model* model)
+{
+	SetTransformed(index, model->GetBoundingSphere(), model->GetWorldMatrix());
+}
+
+void FrustumCuller::SetTransformed(int index, DirectX::XMFLOAT4 sphere, DirectX::XMMATRIX world)
+{
+	using namespace DirectX;
+
+	// Non uniform scale stretches the sphere, the largest axis scale keeps it conservative
+	float scale = sqrtf(std::max(XMVectorGetX(XMVector3LengthSq(world.r[0])),
+		std::max(XMVectorGetX(XMVector3LengthSq(world.r[1])), XMVectorGetX(XMVector3LengthSq(world.r[2])))));
+
+	XMFLOAT3 center;
+	XMStoreFloat3(&center, XMVector3TransformCoord(XMVectorSet(sphere.x, sphere.y, sphere.z, 1.0f), world));
+	Set(index, center, sphere.w * scale);
+}
+
+void FrustumCuller::ExtractPlanes(DirectX::XMMATRIX viewProjection)
+{
+	using namespace DirectX;
+
+	// Gribb / Hartmann, normalized so the plane distance can be compared to the radius
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+	XMVECTOR extracted[6] =
+	{
+		XMVectorAdd(columns.r[3], columns.r[0]),
+		XMVectorSubtract(columns.r[3], columns.r[0]),
+		XMVectorAdd(columns.r[3], columns.r[1]),
+		XMVectorSubtract(columns.r[3], columns.r[1]),
+		columns.r[2],
+		XMVectorSubtract(columns.r[3], columns.r[2]),
+	};
+
+	for (int p = 0; p < 6; p++)
+		XMStoreFloat4((XMFLOAT4*)planes[p], XMPlaneNormalize(extracted[p]));
+}
+
+int FrustumCuller::Cull(DirectX::XMMATRIX viewProjection, std::vector<int>& visible)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	ExtractPlanes(viewProjection);
+
+	// Room for every object, the SIMD loops write a whole batch before the count is known
+	visible.resize(radius.size());
+
+	int visibleCount = 0;
+	if (path == Path::AVX)
+		visibleCount = CullAVX(visible.data());
+	else if (path == Path::SSE)
+		visibleCount = CullSSE(visible.data());
+	else
+		visibleCount = CullScalar(visible.data());
+
+	visible.resize(visibleCount);
+
+	cullStats.tested = count;
+	cullStats.visible = visibleCount;
+	cullStats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return visibleCount;
+}
+
+int FrustumCuller::CullScalar(int* output) const
+{
+	int visibleCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+			inside = planes[p][0] * centerX[i] + planes[p][1] * centerY[i] + planes[p][2] * centerZ[i] + planes[p][3] >= -radius[i];
+
+		if (inside)
+			output[visibleCount++] = i;
+	}
+
+	return visibleCount;
+}
+
+int FrustumCuller::CullSSE(int* output) const
+{
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm_set1_ps(planes[p][0]);
+		planeY[p] = _mm_set1_ps(planes[p][1]);
+		planeZ[p] = _mm_set1_ps(planes[p][2]);
+		planeW[p] = _mm_set1_ps(planes[p][3]);
+	}
+
+	int visibleCount = 0;
+	int size = (int)radius.size();
+	for (int i = 0; i < size; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&centerX[i]);
+		__m128 y = _mm_loadu_ps(&centerY[i]);
+		__m128 z = _mm_loadu_ps(&centerZ[i]);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+
+		// Distance to each plane must be >= -radius, all six planes are and-ed together
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])),
+				_mm_add_ps(_mm_mul_ps(z, planeZ[p]), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		// Branchless compaction, every lane is written and only the visible ones advance the count
+		int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			output[visibleCount] = i + lane;
+			visibleCount += (mask >> lane) & 1;
+		}
+	}
+
+	return visibleCount;
+}
+
+int FrustumCuller::CullAVX(int* output) const
+{
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm256_set1_ps(planes[p][0]);
+		planeY[p] = _mm256_set1_ps(planes[p][1]);
+		planeZ[p] = _mm256_set1_ps(planes[p][2]);
+		planeW[p] = _mm256_set1_ps(planes[p][3]);
+	}
+
+	int visibleCount = 0;
+	int size = (int)radius.size();
+	for (int i = 0; i < size; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(&centerX[i]);
+		__m256 y = _mm256_loadu_ps(&centerY[i]);
+		__m256 z = _mm256_loadu_ps(&centerZ[i]);
+		__m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&radius[i]));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])),
+				_mm256_add_ps(_mm256_mul_ps(z, planeZ[p]), planeW[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int lane = 0; lane < 8; lane++)
+		{
+			output[visibleCount] = i + lane;
+			visibleCount += (mask >> lane) & 1;
+		}
+	}
+
+	// Leaves the upper halves of the YMM registers clean for SSE code that follows
+	_mm256_zeroupper();
+
+	return visibleCount;
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+#include "DX.h"
+#include <vector>
+#include <cstdint>
+
+class Model;
+
+/*
+	Frustum culling for lots of objects at once.
+	World space bounding spheres are kept as separate x, y, z and radius arrays so 4 (SSE) or
+	8 (AVX) objects are tested against a plane with a few instructions. Cull writes the indices
+	of the visible objects into a compact list in object order, ready for submission.
+*/
+class FrustumCuller
+{
+public:
+	enum class Path
+	{
+		Scalar,
+		SSE,
+		AVX,
+	};
+
+	struct CullStats
+	{
+		int tested = 0;
+		int visible = 0;
+		double milliseconds = 0.0;
+	};
+
+public:
+	FrustumCuller();
+	~FrustumCuller();
+
+	void Clear();
+	void Reserve(int count);
+
+	// Returns the object index
+	int Add(DirectX::XMFLOAT3 center, float radius);
+	void Set(int index, DirectX::XMFLOAT3 center, float radius);
+
+	// Object space bounding sphere of the model moved by its world matrix
+	int AddModel(Model* model);
+	void SetModel(int index, Model* model);
+
+	// Object space sphere (xyz center, w radius) moved by a world matrix
+	void SetTransformed(int index, DirectX::XMFLOAT4 sphere, DirectX::XMMATRIX world);
+
+	// AVX is used when the CPU and OS support it, otherwise SSE
+	void SetPath(Path path);
+	Path GetPath() const { return this->path; }
+	static bool IsAVXSupported();
+
+	// Indices of the objects that touch the frustum, in increasing order
+	int Cull(DirectX::XMMATRIX viewProjection, std::vector<int>& visible);
+
+	int GetCount() const { return this->count; }
+	const CullStats& GetCullStats() const { return this->cullStats; }
+
+private:
+	void ExtractPlanes(DirectX::XMMATRIX viewProjection);
+	int CullScalar(int* output) const;
+	int CullSSE(int* output) const;
+	int CullAVX(int* output) const;
+
+private:
+	// Padded to a multiple of 8 with spheres that are never visible
+	std::vector<float> centerX, centerY, centerZ, radius;
+	int count;
+
+	// Normalized planes as x, y, z, w rows
+	float planes[6][4];
+
+	Path path;
+	CullStats cullStats;
+};
\ No newline at end of file
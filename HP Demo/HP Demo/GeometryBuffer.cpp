@@ -0,0 +1,266 @@
+#include "GeometryBuffer.h"
+#include "Model.h"
+#include <algorithm>
+
+GeometryBuffer::GeometryBuffer()
+{
+	this->device = nullptr;
+	this->context = nullptr;
+	this->frame = 0;
+	this->retiredFrees = 0;
+	this->bytesUploaded = 0;
+}
+
+GeometryBuffer::~GeometryBuffer()
+{
+	Shutdown();
+}
+
+bool GeometryBuffer::Initialize(ID3D11Device* device, ID3D11DeviceContext* context, const Settings& settings)
+{
+	Shutdown();
+
+	this->device = device;
+	this->context = context;
+	this->settings = settings;
+	this->frame = 0;
+	this->retiredFrees = 0;
+	this->bytesUploaded = 0;
+
+	return AddPage(settings.pageVertices, settings.pageIndices);
+}
+
+void GeometryBuffer::Shutdown()
+{
+	for (Page& page : pages)
+	{
+		ReleasePtr(page.vertexBuffer);
+		ReleasePtr(page.indexBuffer);
+	}
+	pages.clear();
+	pendingFrees.clear();
+
+	for (Fence& fence : fences)
+		ReleasePtr(fence.query);
+	fences.clear();
+
+	for (ID3D11Query*& query : unusedQueries)
+		ReleasePtr(query);
+	unusedQueries.clear();
+}
+
+bool GeometryBuffer::AddPage(UINT vertexCount, UINT indexCount)
+{
+	Page page;
+	page.vertexBuffer = nullptr;
+	page.indexBuffer = nullptr;
+
+	if (device)
+	{
+		D3D11_BUFFER_DESC bufferDesc;
+		ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		bufferDesc.ByteWidth = sizeof(Vertex) * vertexCount;
+		bufferDesc.StructureByteStride = sizeof(Vertex);
+
+		if (FAILED(device->CreateBuffer(&bufferDesc, nullptr, &page.vertexBuffer)))
+			return false;
+
+		ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		bufferDesc.ByteWidth = sizeof(DWORD) * indexCount;
+		bufferDesc.StructureByteStride = sizeof(DWORD);
+
+		if (FAILED(device->CreateBuffer(&bufferDesc, nullptr, &page.indexBuffer)))
+		{
+			ReleasePtr(page.vertexBuffer);
+			return false;
+		}
+	}
+
+	page.vertices.Initialize(vertexCount);
+	page.indices.Initialize(indexCount);
+	pages.push_back(page);
+	return true;
+}
+
+bool GeometryBuffer::Allocate(UINT vertexCount, UINT indexCount, Allocation& allocation)
+{
+	for (int page = 0; page < (int)pages.size(); page++)
+	{
+		if (AllocateOn(page, vertexCount, indexCount, allocation))
+			return true;
+	}
+
+	// None of the pages had room, the new one is made for the mesh when it is bigger than a page
+	if (!AddPage(std::max(settings.pageVertices, vertexCount), std::max(settings.pageIndices, indexCount)))
+		return false;
+
+	return AllocateOn((int)pages.size() - 1, vertexCount, indexCount, allocation);
+}
+
+bool GeometryBuffer::AllocateOn(int pageIndex, UINT vertexCount, UINT indexCount, Allocation& allocation)
+{
+	Page& page = pages[pageIndex];
+	int vertexBlock = page.vertices.Allocate(vertexCount);
+	if (vertexBlock < 0)
+		return false;
+
+	int indexBlock = page.indices.Allocate(indexCount);
+	if (indexBlock < 0)
+	{
+		page.vertices.Free(vertexBlock);
+		return false;
+	}
+
+	allocation.page = pageIndex;
+	allocation.vertexBlock = vertexBlock;
+	allocation.indexBlock = indexBlock;
+	allocation.baseVertex = page.vertices.GetOffset(vertexBlock);
+	allocation.startIndex = page.indices.GetOffset(indexBlock);
+	return true;
+}
+
+void GeometryBuffer::Upload(const Allocation& allocation, const Vertex* vertices, UINT vertexCount, const DWORD* indices, UINT indexCount)
+{
+	const Page& page = pages[allocation.page];
+
+	D3D11_BOX box;
+	box.top = 0;
+	box.bottom = 1;
+	box.front = 0;
+	box.back = 1;
+
+	if (page.vertexBuffer && vertexCount > 0)
+	{
+		box.left = allocation.baseVertex * sizeof(Vertex);
+		box.right = box.left + vertexCount * sizeof(Vertex);
+		context->UpdateSubresource(page.vertexBuffer, 0, &box, vertices, 0, 0);
+	}
+
+	if (page.indexBuffer && indexCount > 0)
+	{
+		box.left = allocation.startIndex * sizeof(DWORD);
+		box.right = box.left + indexCount * sizeof(DWORD);
+		context->UpdateSubresource(page.indexBuffer, 0, &box, indices, 0, 0);
+	}
+
+	bytesUploaded += vertexCount * sizeof(Vertex) + indexCount * sizeof(DWORD);
+}
+
+void GeometryBuffer::Free(const Allocation& allocation)
+{
+	if (allocation.page < 0)
+		return;
+
+	PendingFree pending;
+	pending.allocation = allocation;
+	pending.frame = frame;
+	pendingFrees.push_back(pending);
+}
+
+void GeometryBuffer::BeginFrame()
+{
+	uint64_t completedFrames = 0;
+	if (device)
+	{
+		// Queries finish in order, the last one done tells how many frames the GPU finished
+		size_t done = 0;
+		while (done < fences.size() && context->GetData(fences[done].query, nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
+		{
+			completedFrames = fences[done].frame + 1;
+			unusedQueries.push_back(fences[done].query);
+			done++;
+		}
+		fences.erase(fences.begin(), fences.begin() + done);
+
+		// Before the first fence is done, everything freed so far may still be drawn
+		if (done == 0)
+			return;
+	}
+	else if (frame + 1 > (uint64_t)settings.framesInFlight)
+		completedFrames = frame + 1 - settings.framesInFlight;
+
+	Retire(completedFrames);
+}
+
+void GeometryBuffer::EndFrame()
+{
+	if (device)
+	{
+		ID3D11Query* query = nullptr;
+		if (!unusedQueries.empty())
+		{
+			query = unusedQueries.back();
+			unusedQueries.pop_back();
+		}
+		else
+		{
+			D3D11_QUERY_DESC queryDesc;
+			ZeroMemory(&queryDesc, sizeof(D3D11_QUERY_DESC));
+			queryDesc.Query = D3D11_QUERY_EVENT;
+			if (FAILED(device->CreateQuery(&queryDesc, &query)))
+				query = nullptr;
+		}
+
+		// Without a query the frees of this frame wait for the next fence
+		if (query)
+		{
+			context->End(query);
+
+			Fence fence;
+			fence.query = query;
+			fence.frame = frame;
+			fences.push_back(fence);
+		}
+	}
+
+	frame++;
+}
+
+void GeometryBuffer::Retire(uint64_t completedFrames)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < pendingFrees.size(); i++)
+	{
+		const PendingFree& pending = pendingFrees[i];
+		if (pending.frame >= completedFrames)
+		{
+			pendingFrees[kept++] = pending;
+			continue;
+		}
+
+		Page& page = pages[pending.allocation.page];
+		page.vertices.Free(pending.allocation.vertexBlock);
+		page.indices.Free(pending.allocation.indexBlock);
+		retiredFrees++;
+	}
+	pendingFrees.resize(kept);
+}
+
+GeometryBuffer::Stats GeometryBuffer::GetStats() const
+{
+	Stats stats;
+	stats.pages = (int)pages.size();
+	for (const Page& page : pages)
+	{
+		TlsfAllocator::Stats vertexStats = page.vertices.GetStats();
+		TlsfAllocator::Stats indexStats = page.indices.GetStats();
+
+		stats.allocations += vertexStats.allocations;
+		stats.vertexCapacity += vertexStats.capacity;
+		stats.verticesUsed += vertexStats.used;
+		stats.indexCapacity += indexStats.capacity;
+		stats.indicesUsed += indexStats.used;
+		stats.fragmentation = std::max(stats.fragmentation, std::max(vertexStats.fragmentation, indexStats.fragmentation));
+	}
+
+	// Pending frees still hold their ranges
+	stats.allocations -= (int)pendingFrees.size();
+	stats.pendingFrees = (int)pendingFrees.size();
+	stats.retiredFrees = retiredFrees;
+	stats.bytesUploaded = bytesUploaded;
+	return stats;
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+#include "DX.h"
+#include "TlsfAllocator.h"
+#include <vector>
+#include <cstdint>
+
+struct Vertex;
+
+/*
+	The vertices and indices of the models in a few big buffers instead of a buffer pair per model.
+	A page is a vertex buffer and an index buffer, each with a TLSF allocator over its elements. A mesh gets
+	a range in both from the first page with room, and is drawn with the start of its index range as start
+	index and the start of its vertex range as base vertex, so its indices stay what the loader made.
+	Models on the same page bind the same buffers, only the draw arguments differ between them.
+	A mesh bigger than a page gets a page of its own that fits it.
+	Ranges freed during a frame can still be read by the frames the GPU hasn't finished. They wait in a list
+	and go back to their allocator once an event query issued after the frame they were freed in is done.
+	Only for the thread that owns the immediate context.
+*/
+class GeometryBuffer
+{
+public:
+	struct Settings
+	{
+		UINT pageVertices = 1 << 19;		// 22 MB of vertices
+		UINT pageIndices = 1 << 21;			// 8 MB of indices
+		int framesInFlight = 3;				// Without a device, frees wait this many frames instead of a query
+	};
+
+	struct Allocation
+	{
+		int page = -1;
+		int vertexBlock = -1;
+		int indexBlock = -1;
+		UINT baseVertex = 0;
+		UINT startIndex = 0;
+	};
+
+	struct Stats
+	{
+		int pages = 0;
+		int allocations = 0;
+		UINT vertexCapacity = 0;
+		UINT verticesUsed = 0;
+		UINT indexCapacity = 0;
+		UINT indicesUsed = 0;
+		float fragmentation = 0.0f;			// Worst of the vertex and index allocators of every page
+		int pendingFrees = 0;				// Waiting for the GPU
+		int retiredFrees = 0;				// Since Initialize
+		size_t bytesUploaded = 0;
+	};
+
+public:
+	GeometryBuffer();
+	~GeometryBuffer();
+
+	// Without a device nothing is created and uploads are only counted, for the benchmark
+	bool Initialize(ID3D11Device* device, ID3D11DeviceContext* context, const Settings& settings);
+
+	// Frees everything at once, the GPU has to be done with it
+	void Shutdown();
+
+	// Room for the mesh on the first page it fits on, a new page when none has it
+	bool Allocate(UINT vertexCount, UINT indexCount, Allocation& allocation);
+
+	// Copies the mesh into its ranges through the immediate context
+	void Upload(const Allocation& allocation, const Vertex* vertices, UINT vertexCount, const DWORD* indices, UINT indexCount);
+
+	// The ranges go back once the GPU finished the frame this is called in
+	void Free(const Allocation& allocation);
+
+	// Gives back the frees of the frames the GPU finished, before anything is allocated in the frame
+	void BeginFrame();
+
+	// Ends the frame with a query that tells when the GPU is done with it
+	void EndFrame();
+
+	int GetPageCount() const { return (int)this->pages.size(); }
+	ID3D11Buffer* GetVertexBuffer(int page) const { return this->pages[page].vertexBuffer; }
+	ID3D11Buffer* GetIndexBuffer(int page) const { return this->pages[page].indexBuffer; }
+	const TlsfAllocator& GetVertexAllocator(int page) const { return this->pages[page].vertices; }
+	const TlsfAllocator& GetIndexAllocator(int page) const { return this->pages[page].indices; }
+
+	uint64_t GetFrame() const { return this->frame; }
+
+	// Walks the allocators, for statistics
+	Stats GetStats() const;
+
+private:
+	struct Page
+	{
+		ID3D11Buffer* vertexBuffer;
+		ID3D11Buffer* indexBuffer;
+		TlsfAllocator vertices;
+		TlsfAllocator indices;
+	};
+
+	struct PendingFree
+	{
+		Allocation allocation;
+		uint64_t frame;
+	};
+
+	struct Fence
+	{
+		ID3D11Query* query;
+		uint64_t frame;
+	};
+
+	bool AddPage(UINT vertexCount, UINT indexCount);
+	bool AllocateOn(int page, UINT vertexCount, UINT indexCount, Allocation& allocation);
+	void Retire(uint64_t completedFrames);
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+	Settings settings;
+
+	std::vector<Page> pages;
+
+	uint64_t frame;							// Frames ended so far, the one being recorded
+	std::vector<PendingFree> pendingFrees;
+	std::vector<Fence> fences;				// Oldest first
+	std::vector<ID3D11Query*> unusedQueries;
+
+	int retiredFrees;
+	size_t bytesUploaded;
+};
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "JobSystem.h"
+
+JobSystem::JobSystem()
+{
+	this->currentJob = nullptr;
+	this->jobCount = 0;
+	this->nextIndex = 0;
+	this->remaining = 0;
+	this->generation = 0;
+	this->activeWorkers = 0;
+	this->running = false;
+}
+
+JobSystem::~JobSystem()
+{
+	Shutdown();
+}
+
+bool JobSystem::Initialize(unsigned int threadCount)
+{
+	if (running)
+		return true;
+
+	if (threadCount == 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	running = true;
+
+	// Thread index 0 is reserved for the thread calling ParallelFor
+	for (unsigned int i = 0; i < threadCount; i++)
+	{
+		workers.push_back(std::thread(&JobSystem::WorkerLoop, this, (int)i + 1));
+	}
+
+	return true;
+}
+
+void JobSystem::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running)
+			return;
+		running = false;
+	}
+	wakeCondition.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	workers.clear();
+}
+
+void JobSystem::ParallelFor(int jobCount, const std::function<void(int, int)>& job)
+{
+	if (jobCount <= 0)
+		return;
+
+	// No workers, just run everything on this thread
+	if (workers.empty())
+	{
+		for (int i = 0; i < jobCount; i++)
+		{
+			job(i, 0);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> submitLock(submitMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->currentJob = &job;
+		this->jobCount = jobCount;
+		this->remaining = jobCount;
+		this->nextIndex = 0;
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	RunJobs(0);
+
+	// Wait for the last jobs and for every worker to leave RunJobs, so no one touches the job after we return
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return remaining == 0 && activeWorkers == 0; });
+	this->currentJob = nullptr;
+}
+
+void JobSystem::WorkerLoop(int threadIndex)
+{
+	unsigned int seenGeneration = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return !running || generation != seenGeneration; });
+			if (!running)
+				return;
+
+			seenGeneration = generation;
+
+			// Woke up after the caller already finished every job, nothing left to take
+			if (remaining == 0)
+				continue;
+
+			activeWorkers++;
+		}
+
+		RunJobs(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		doneCondition.notify_all();
+	}
+}
+
+void JobSystem::RunJobs(int threadIndex)
+{
+	int index = nextIndex++;
+	while (index < jobCount)
+	{
+		(*currentJob)(index, threadIndex);
+		remaining--;
+
+		index = nextIndex++;
+	}
+}
\ No newline at end of file
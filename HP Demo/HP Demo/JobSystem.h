@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/*
+	Small pool of worker threads that is created once and reused.
+	ParallelFor hands out job indices from a shared counter, the calling thread helps out
+	and the call returns when every job is finished. One ParallelFor runs at a time.
+*/
+class JobSystem
+{
+public:
+	JobSystem();
+	~JobSystem();
+
+	// threadCount = 0 uses one worker per hardware thread (minus the calling thread)
+	bool Initialize(unsigned int threadCount = 0);
+	void Shutdown();
+
+	// Runs job(jobIndex, threadIndex) for every jobIndex in [0, jobCount). threadIndex is in [0, GetThreadCount())
+	void ParallelFor(int jobCount, const std::function<void(int, int)>& job);
+
+	// Workers + the calling thread
+	int GetThreadCount() const { return (int)this->workers.size() + 1; }
+
+private:
+	void WorkerLoop(int threadIndex);
+	void RunJobs(int threadIndex);
+
+private:
+	std::vector<std::thread> workers;
+
+	std::mutex submitMutex;
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+
+	const std::function<void(int, int)>* currentJob;
+	int jobCount;
+	std::atomic<int> nextIndex;
+	std::atomic<int> remaining;
+
+	unsigned int generation;
+	int activeWorkers;
+	bool running;
+};
\ No newline at end of file
@@ -0,0 +1,464 @@
+#include "LightClusters.h"
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <immintrin.h>
+
+// Padding lights are far away with no range, they fail every test so there is no tail loop
+static const float PADDING_POSITION = -3.0e38f;
+
+static bool CreateStructuredBuffer(ID3D11Device* device, UINT stride, UINT count, ID3D11Buffer** buffer, ID3D11ShaderResourceView** view)
+{
+	D3D11_BUFFER_DESC bufferDesc;
+	ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.ByteWidth = stride * std::max(count, 1u);
+	bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = stride;
+
+	if (FAILED(device->CreateBuffer(&bufferDesc, nullptr, buffer)))
+		return false;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+	ZeroMemory(&viewDesc, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
+	viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+	viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	viewDesc.Buffer.FirstElement = 0;
+	viewDesc.Buffer.NumElements = std::max(count, 1u);
+
+	return SUCCEEDED(device->CreateShaderResourceView(*buffer, &viewDesc, view));
+}
+
+LightClusters::LightClusters()
+{
+	this->maxLights = 0;
+	this->depthScale = 0.0f;
+	this->depthBias = 0.0f;
+	this->tileScale = DirectX::XMFLOAT2(0.0f, 0.0f);
+	this->cameraPosition = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	this->cameraForward = DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f);
+
+	this->lightBuffer = nullptr;
+	this->gridBuffer = nullptr;
+	this->indexBuffer = nullptr;
+	this->constantBuffer = nullptr;
+	this->lightView = nullptr;
+	this->gridView = nullptr;
+	this->indexView = nullptr;
+	this->indexCapacity = 0;
+}
+
+LightClusters::~LightClusters()
+{
+	Shutdown();
+}
+
+bool LightClusters::Initialize(const Settings& settings, ID3D11Device* device, int maxLights)
+{
+	Shutdown();
+
+	if (settings.clustersX <= 0 || settings.clustersY <= 0 || settings.clustersZ <= 0 || settings.nearDepth <= 0.0f || settings.farDepth <= settings.nearDepth)
+		return false;
+
+	this->settings = settings;
+	this->maxLights = maxLights;
+
+	// Exponential slices, every slice is as thick relative to its distance
+	float logRatio = logf(settings.farDepth / settings.nearDepth);
+	sliceDepths.resize(settings.clustersZ + 1);
+	for (int z = 0; z <= settings.clustersZ; z++)
+		sliceDepths[z] = settings.nearDepth * expf(logRatio * z / settings.clustersZ);
+	depthScale = settings.clustersZ / logRatio;
+	depthBias = -settings.clustersZ * logf(settings.nearDepth) / logRatio;
+
+	slices.resize(settings.clustersZ);
+	clusterOffsets.assign(GetClusterCount(), 0);
+	clusterCounts.assign(GetClusterCount(), 0);
+	stats = Stats();
+
+	if (!device)
+		return true;
+
+	indexCapacity = (UINT)(GetClusterCount() * settings.maxLightsPerCluster);
+	if (!CreateStructuredBuffer(device, sizeof(GPULight), (UINT)maxLights, &lightBuffer, &lightView) ||
+		!CreateStructuredBuffer(device, sizeof(uint32_t) * 2, (UINT)GetClusterCount(), &gridBuffer, &gridView) ||
+		!CreateStructuredBuffer(device, sizeof(uint32_t), indexCapacity, &indexBuffer, &indexView))
+	{
+		Shutdown();
+		return false;
+	}
+
+	D3D11_BUFFER_DESC bufferDesc;
+	ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.ByteWidth = sizeof(cBufferClusters);
+	bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	if (FAILED(device->CreateBuffer(&bufferDesc, nullptr, &constantBuffer)))
+	{
+		Shutdown();
+		return false;
+	}
+
+	return true;
+}
+
+void LightClusters::Shutdown()
+{
+	ReleasePtr(lightView);
+	ReleasePtr(gridView);
+	ReleasePtr(indexView);
+	ReleasePtr(lightBuffer);
+	ReleasePtr(gridBuffer);
+	ReleasePtr(indexBuffer);
+	ReleasePtr(constantBuffer);
+	indexCapacity = 0;
+}
+
+void LightClusters::SetProjection(DirectX::XMMATRIX projection, int screenWidth, int screenHeight)
+{
+	using namespace DirectX;
+
+	XMFLOAT4X4 p;
+	XMStoreFloat4x4(&p, projection);
+
+	int clustersX = settings.clustersX, clustersY = settings.clustersY, clustersZ = settings.clustersZ;
+	tileScale = XMFLOAT2((float)clustersX / screenWidth, (float)clustersY / screenHeight);
+
+	// A tile's x range only depends on its column and y range on its row, at both ends of the slice
+	boxMinX.resize(clustersZ * clustersX);
+	boxMaxX.resize(clustersZ * clustersX);
+	boxMinY.resize(clustersZ * clustersY);
+	boxMaxY.resize(clustersZ * clustersY);
+	for (int z = 0; z < clustersZ; z++)
+	{
+		float depths[2] = { sliceDepths[z], sliceDepths[z + 1] };
+
+		// View x at depth d for clip x: ndc = (x * _11 + d * _31) / d
+		for (int x = 0; x < clustersX; x++)
+		{
+			float ndc[2] = { -1.0f + 2.0f * x / clustersX, -1.0f + 2.0f * (x + 1) / clustersX };
+			float low = FLT_MAX, high = -FLT_MAX;
+			for (float depth : depths)
+			{
+				for (float n : ndc)
+				{
+					float viewX = depth * (n - p._31) / p._11;
+					low = std::min(low, viewX);
+					high = std::max(high, viewX);
+				}
+			}
+			boxMinX[z * clustersX + x] = low;
+			boxMaxX[z * clustersX + x] = high;
+		}
+
+		// Rows go down the screen, y goes up in view space
+		for (int y = 0; y < clustersY; y++)
+		{
+			float ndc[2] = { 1.0f - 2.0f * y / clustersY, 1.0f - 2.0f * (y + 1) / clustersY };
+			float low = FLT_MAX, high = -FLT_MAX;
+			for (float depth : depths)
+			{
+				for (float n : ndc)
+				{
+					float viewY = depth * (n - p._32) / p._22;
+					low = std::min(low, viewY);
+					high = std::max(high, viewY);
+				}
+			}
+			boxMinY[z * clustersY + y] = low;
+			boxMaxY[z * clustersY + y] = high;
+		}
+	}
+}
+
+void LightClusters::GetClusterBounds(int cluster, DirectX::XMFLOAT3& boxMin, DirectX::XMFLOAT3& boxMax) const
+{
+	int x = cluster % settings.clustersX;
+	int y = cluster / settings.clustersX % settings.clustersY;
+	int z = cluster / (settings.clustersX * settings.clustersY);
+
+	boxMin = DirectX::XMFLOAT3(boxMinX[z * settings.clustersX + x], boxMinY[z * settings.clustersY + y], sliceDepths[z]);
+	boxMax = DirectX::XMFLOAT3(boxMaxX[z * settings.clustersX + x], boxMaxY[z * settings.clustersY + y], sliceDepths[z + 1]);
+}
+
+void LightClusters::PadCandidates(std::vector<float>& x, std::vector<float>& y, std::vector<float>& z, std::vector<float>& radius, std::vector<uint32_t>& light)
+{
+	size_t padded = (x.size() + 3) / 4 * 4;
+	x.resize(padded, PADDING_POSITION);
+	y.resize(padded, PADDING_POSITION);
+	z.resize(padded, PADDING_POSITION);
+	radius.resize(padded, 0.0f);
+	light.resize(padded, 0);
+}
+
+// Squared distance from 4 sphere centers to a box, 0 inside
+static inline __m128 BoxDistanceSq(__m128 x, __m128 y, __m128 z, __m128 minX, __m128 maxX, __m128 minY, __m128 maxY, __m128 minZ, __m128 maxZ)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+	__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+	__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+}
+
+void LightClusters::BuildSlice(int z)
+{
+	Slice& slice = slices[z];
+	int clustersX = settings.clustersX, clustersY = settings.clustersY;
+
+	slice.x.clear();
+	slice.y.clear();
+	slice.z.clear();
+	slice.radius.clear();
+	slice.light.clear();
+	slice.indices.clear();
+	slice.counts.assign(clustersX * clustersY, 0);
+	slice.dropped = 0;
+
+	// Lights reaching into the slice's depth range
+	__m128 sliceNear = _mm_set1_ps(sliceDepths[z]);
+	__m128 sliceFar = _mm_set1_ps(sliceDepths[z + 1]);
+	for (size_t i = 0; i < radius.size(); i += 4)
+	{
+		__m128 lightZ = _mm_loadu_ps(&viewZ[i]);
+		__m128 lightRadius = _mm_loadu_ps(&radius[i]);
+		__m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(lightZ, lightRadius), sliceNear), _mm_cmple_ps(_mm_sub_ps(lightZ, lightRadius), sliceFar));
+
+		int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; mask >> lane; lane++)
+		{
+			if (!(mask >> lane & 1))
+				continue;
+
+			size_t light = i + lane;
+			slice.x.push_back(viewX[light]);
+			slice.y.push_back(viewY[light]);
+			slice.z.push_back(viewZ[light]);
+			slice.radius.push_back(radius[light]);
+			slice.light.push_back((uint32_t)light);
+		}
+	}
+	if (slice.light.empty())
+		return;
+	PadCandidates(slice.x, slice.y, slice.z, slice.radius, slice.light);
+
+	__m128 minZ = sliceNear, maxZ = sliceFar;
+	__m128 rowMinX = _mm_set1_ps(boxMinX[z * clustersX]);
+	__m128 rowMaxX = _mm_set1_ps(boxMaxX[z * clustersX + clustersX - 1]);
+
+	for (int y = 0; y < clustersY; y++)
+	{
+		__m128 minY = _mm_set1_ps(boxMinY[z * clustersY + y]);
+		__m128 maxY = _mm_set1_ps(boxMaxY[z * clustersY + y]);
+
+		// The lights that touch the whole row first, the clusters of the row only test those
+		slice.rowX.clear();
+		slice.rowY.clear();
+		slice.rowZ.clear();
+		slice.rowRadius.clear();
+		slice.rowLight.clear();
+		for (size_t i = 0; i < slice.light.size(); i += 4)
+		{
+			__m128 lightRadius = _mm_loadu_ps(&slice.radius[i]);
+			__m128 distanceSq = BoxDistanceSq(_mm_loadu_ps(&slice.x[i]), _mm_loadu_ps(&slice.y[i]), _mm_loadu_ps(&slice.z[i]), rowMinX, rowMaxX, minY, maxY, minZ, maxZ);
+
+			int mask = _mm_movemask_ps(_mm_cmple_ps(distanceSq, _mm_mul_ps(lightRadius, lightRadius)));
+			for (int lane = 0; mask >> lane; lane++)
+			{
+				if (!(mask >> lane & 1))
+					continue;
+
+				size_t candidate = i + lane;
+				slice.rowX.push_back(slice.x[candidate]);
+				slice.rowY.push_back(slice.y[candidate]);
+				slice.rowZ.push_back(slice.z[candidate]);
+				slice.rowRadius.push_back(slice.radius[candidate]);
+				slice.rowLight.push_back(slice.light[candidate]);
+			}
+		}
+		if (slice.rowLight.empty())
+			continue;
+		PadCandidates(slice.rowX, slice.rowY, slice.rowZ, slice.rowRadius, slice.rowLight);
+
+		for (int x = 0; x < clustersX; x++)
+		{
+			__m128 minX = _mm_set1_ps(boxMinX[z * clustersX + x]);
+			__m128 maxX = _mm_set1_ps(boxMaxX[z * clustersX + x]);
+			uint32_t& count = slice.counts[y * clustersX + x];
+
+			for (size_t i = 0; i < slice.rowLight.size(); i += 4)
+			{
+				__m128 lightRadius = _mm_loadu_ps(&slice.rowRadius[i]);
+				__m128 distanceSq = BoxDistanceSq(_mm_loadu_ps(&slice.rowX[i]), _mm_loadu_ps(&slice.rowY[i]), _mm_loadu_ps(&slice.rowZ[i]), minX, maxX, minY, maxY, minZ, maxZ);
+
+				int mask = _mm_movemask_ps(_mm_cmple_ps(distanceSq, _mm_mul_ps(lightRadius, lightRadius)));
+				for (int lane = 0; mask >> lane; lane++)
+				{
+					if (!(mask >> lane & 1))
+						continue;
+
+					if (count == (uint32_t)settings.maxLightsPerCluster)
+					{
+						slice.dropped++;
+						continue;
+					}
+					slice.indices.push_back(slice.rowLight[i + lane]);
+					count++;
+				}
+			}
+		}
+	}
+}
+
+int LightClusters::Build(const std::vector<PointLight>& lights, DirectX::XMMATRIX view, JobSystem& jobSystem)
+{
+	using namespace DirectX;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int lightCount = std::min((int)lights.size(), maxLights);
+	stats = Stats();
+	stats.lights = lightCount;
+
+	XMMATRIX inverseView = XMMatrixInverse(nullptr, view);
+	XMStoreFloat3(&cameraForward, XMVector3Normalize(inverseView.r[2]));
+	XMStoreFloat3(&cameraPosition, inverseView.r[3]);
+
+	// World to view space, 4 lights at a time
+	size_t padded = (size_t)(lightCount + 3) / 4 * 4;
+	viewX.assign(padded, PADDING_POSITION);
+	viewY.assign(padded, PADDING_POSITION);
+	viewZ.assign(padded, PADDING_POSITION);
+	radius.assign(padded, 0.0f);
+	gpuLights.resize(lightCount);
+
+	XMFLOAT4X4 v;
+	XMStoreFloat4x4(&v, view);
+	float worldX[4], worldY[4], worldZ[4];
+	for (int i = 0; i < lightCount; i += 4)
+	{
+		for (int lane = 0; lane < 4; lane++)
+		{
+			const PointLight& light = lights[std::min(i + lane, lightCount - 1)];
+			worldX[lane] = light.position.x;
+			worldY[lane] = light.position.y;
+			worldZ[lane] = light.position.z;
+		}
+
+		__m128 x = _mm_loadu_ps(worldX), y = _mm_loadu_ps(worldY), z = _mm_loadu_ps(worldZ);
+		__m128 resultX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(v._11)), _mm_mul_ps(y, _mm_set1_ps(v._21))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(v._31)), _mm_set1_ps(v._41)));
+		__m128 resultY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(v._12)), _mm_mul_ps(y, _mm_set1_ps(v._22))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(v._32)), _mm_set1_ps(v._42)));
+		__m128 resultZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(v._13)), _mm_mul_ps(y, _mm_set1_ps(v._23))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(v._33)), _mm_set1_ps(v._43)));
+
+		// The last batch keeps its padding
+		int laneCount = std::min(4, lightCount - i);
+		float storedX[4], storedY[4], storedZ[4];
+		_mm_storeu_ps(storedX, resultX);
+		_mm_storeu_ps(storedY, resultY);
+		_mm_storeu_ps(storedZ, resultZ);
+		for (int lane = 0; lane < laneCount; lane++)
+		{
+			const PointLight& light = lights[i + lane];
+			viewX[i + lane] = storedX[lane];
+			viewY[i + lane] = storedY[lane];
+			viewZ[i + lane] = storedZ[lane];
+			radius[i + lane] = light.range;
+
+			GPULight& gpuLight = gpuLights[i + lane];
+			gpuLight.position = light.position;
+			gpuLight.range = light.range;
+			gpuLight.color = XMFLOAT3(light.color.x * light.intensity, light.color.y * light.intensity, light.color.z * light.intensity);
+			gpuLight.padding = 0.0f;
+
+			stats.visibleLights += storedZ[lane] + light.range >= settings.nearDepth && storedZ[lane] - light.range <= settings.farDepth;
+		}
+	}
+
+	jobSystem.ParallelFor(settings.clustersZ, [&](int z, int threadIndex)
+	{
+		BuildSlice(z);
+	});
+
+	// Slices in order into one list
+	lightIndices.clear();
+	int clustersPerSlice = settings.clustersX * settings.clustersY;
+	for (int z = 0; z < settings.clustersZ; z++)
+	{
+		const Slice& slice = slices[z];
+		uint32_t offset = (uint32_t)lightIndices.size();
+		for (int i = 0; i < clustersPerSlice; i++)
+		{
+			uint32_t count = slice.counts[i];
+			clusterOffsets[z * clustersPerSlice + i] = offset;
+			clusterCounts[z * clustersPerSlice + i] = count;
+			offset += count;
+			stats.occupiedClusters += count > 0;
+		}
+
+		lightIndices.insert(lightIndices.end(), slice.indices.begin(), slice.indices.end());
+		stats.dropped += slice.dropped;
+	}
+
+	stats.indices = (int)lightIndices.size();
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return stats.indices;
+}
+
+bool LightClusters::Upload(RenderBackend* context)
+{
+	if (!lightBuffer)
+		return false;
+
+	MappedResource mapped;
+	if (FAILED(context->Map(lightBuffer, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	memcpy(mapped.pData, gpuLights.data(), sizeof(GPULight) * gpuLights.size());
+	context->Unmap(lightBuffer, 0);
+
+	if (FAILED(context->Map(gridBuffer, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	uint32_t* grid = (uint32_t*)mapped.pData;
+	for (int i = 0; i < GetClusterCount(); i++)
+	{
+		grid[i * 2] = clusterOffsets[i];
+		grid[i * 2 + 1] = clusterCounts[i];
+	}
+	context->Unmap(gridBuffer, 0);
+
+	// Build keeps every cluster under maxLightsPerCluster, the list always fits
+	if (FAILED(context->Map(indexBuffer, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	memcpy(mapped.pData, lightIndices.data(), sizeof(uint32_t) * std::min((UINT)lightIndices.size(), indexCapacity));
+	context->Unmap(indexBuffer, 0);
+
+	cBufferClusters data;
+	ZeroMemory(&data, sizeof(cBufferClusters));
+	data.cameraPosition = cameraPosition;
+	data.depthScale = depthScale;
+	data.cameraForward = cameraForward;
+	data.depthBias = depthBias;
+	data.tileScale = tileScale;
+	data.clustersX = settings.clustersX;
+	data.clustersY = settings.clustersY;
+	data.clustersZ = settings.clustersZ;
+	data.lightCount = (UINT)gpuLights.size();
+
+	if (FAILED(context->Map(constantBuffer, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	memcpy(mapped.pData, &data, sizeof(cBufferClusters));
+	context->Unmap(constantBuffer, 0);
+
+	return true;
+}
+
+void LightClusters::Bind(RenderBackend* context) const
+{
+	ID3D11ShaderResourceView* views[3] = { lightView, gridView, indexView };
+	context->PSSetShaderResources(LIGHT_SLOT, 3, views);
+	context->PSSetConstantBuffers(CBUFFER_SLOT, 1, &constantBuffer);
+}
\ No newline at end of file
@@ -0,0 +1,158 @@
+#pragma once
+#include "DX.h"
+#include "RenderBackend.h"
+#include "JobSystem.h"
+#include <vector>
+#include <cstdint>
+
+struct PointLight
+{
+	DirectX::XMFLOAT3 position;			// World space
+	float range;						// Nothing is lit past it
+	DirectX::XMFLOAT3 color;
+	float intensity;
+};
+
+/*
+	Clustered forward shading for many point lights.
+	The view frustum is cut into a grid of clusters, tiles on screen times slices in depth that get
+	exponentially thicker with distance. Every frame the lights are moved to view space and each depth
+	slice is a job: it keeps the lights that reach into the slice, narrows them down per row of tiles and
+	tests them against every cluster of the row with SSE, 4 lights at a time, sphere against the box
+	around the cluster. The result is one compact list of light indices with an offset and count per
+	cluster, which DefaultPS reads for the cluster its pixel is in.
+*/
+class LightClusters
+{
+public:
+	struct Settings
+	{
+		int clustersX = 16;
+		int clustersY = 9;
+		int clustersZ = 24;
+		float nearDepth = 0.1f;
+		float farDepth = 1000.0f;
+		int maxLightsPerCluster = 128;		// More than this in a cluster are dropped
+	};
+
+	struct Stats
+	{
+		int lights = 0;
+		int visibleLights = 0;				// In front of the camera and inside the depth range
+		int occupiedClusters = 0;
+		int indices = 0;
+		int dropped = 0;					// Over maxLightsPerCluster
+		double milliseconds = 0.0;
+	};
+
+	// Layouts of the buffers DefaultPS reads
+	struct GPULight
+	{
+		DirectX::XMFLOAT3 position;
+		float range;
+		DirectX::XMFLOAT3 color;			// Times intensity
+		float padding;
+	};
+
+	__declspec(align(16))
+		struct cBufferClusters
+	{
+		DirectX::XMFLOAT3 cameraPosition;
+		float depthScale;					// Slice = log(view depth) * depthScale + depthBias
+		DirectX::XMFLOAT3 cameraForward;
+		float depthBias;
+		DirectX::XMFLOAT2 tileScale;		// Pixel to tile
+		UINT clustersX, clustersY;
+		UINT clustersZ;
+		UINT lightCount;
+		UINT padding[2];
+	};
+
+	// Shader slots, see DefaultPS
+	static const UINT LIGHT_SLOT = 4;
+	static const UINT GRID_SLOT = 5;
+	static const UINT INDEX_SLOT = 6;
+	static const UINT CBUFFER_SLOT = 2;
+
+public:
+	LightClusters();
+	~LightClusters();
+
+	// Without a device only the CPU side is made, for the benchmark
+	bool Initialize(const Settings& settings, ID3D11Device* device, int maxLights);
+	void Shutdown();
+
+	// The cluster boxes follow the projection, set it again when it changes
+	void SetProjection(DirectX::XMMATRIX projection, int screenWidth, int screenHeight);
+
+	// Assigns the lights to the clusters of this view, returns how many indices the list has
+	int Build(const std::vector<PointLight>& lights, DirectX::XMMATRIX view, JobSystem& jobSystem);
+
+	// Writes the lights, grid and index list of the last Build into the GPU buffers
+	bool Upload(RenderBackend* context);
+
+	// Binds them to the pixel shader. Only reads, several threads can bind onto their own contexts
+	void Bind(RenderBackend* context) const;
+
+	int GetClusterCount() const { return this->settings.clustersX * this->settings.clustersY * this->settings.clustersZ; }
+	int GetClusterIndex(int x, int y, int z) const { return (z * this->settings.clustersY + y) * this->settings.clustersX + x; }
+
+	// Offset and count of every cluster in the index list
+	const std::vector<uint32_t>& GetClusterOffsets() const { return this->clusterOffsets; }
+	const std::vector<uint32_t>& GetClusterCounts() const { return this->clusterCounts; }
+	const std::vector<uint32_t>& GetLightIndices() const { return this->lightIndices; }
+
+	// View space box of a cluster, for checking the assignment
+	void GetClusterBounds(int cluster, DirectX::XMFLOAT3& boxMin, DirectX::XMFLOAT3& boxMax) const;
+
+	const Settings& GetSettings() const { return this->settings; }
+	const Stats& GetStats() const { return this->stats; }
+
+private:
+	// What one slice found, copied into the shared list once every slice is done
+	struct Slice
+	{
+		std::vector<float> x, y, z, radius;		// Candidate lights, padded to a multiple of 4
+		std::vector<uint32_t> light;
+		std::vector<float> rowX, rowY, rowZ, rowRadius;
+		std::vector<uint32_t> rowLight;
+		std::vector<uint32_t> indices;
+		std::vector<uint32_t> counts;			// Per cluster of the slice
+		int dropped = 0;
+	};
+
+	void BuildSlice(int z);
+	static void PadCandidates(std::vector<float>& x, std::vector<float>& y, std::vector<float>& z, std::vector<float>& radius, std::vector<uint32_t>& light);
+
+private:
+	Settings settings;
+	int maxLights;
+
+	// Cluster boxes in view space
+	std::vector<float> boxMinX, boxMinY, boxMaxX, boxMaxY;
+	std::vector<float> sliceDepths;				// clustersZ + 1 boundaries
+	float depthScale, depthBias;
+	DirectX::XMFLOAT2 tileScale;
+
+	// Lights of the frame, view space
+	std::vector<float> viewX, viewY, viewZ, radius;
+	std::vector<GPULight> gpuLights;
+	DirectX::XMFLOAT3 cameraPosition;
+	DirectX::XMFLOAT3 cameraForward;
+
+	std::vector<Slice> slices;
+	std::vector<uint32_t> clusterOffsets;
+	std::vector<uint32_t> clusterCounts;
+	std::vector<uint32_t> lightIndices;
+
+	ID3D11Buffer* lightBuffer;
+	ID3D11Buffer* gridBuffer;
+	ID3D11Buffer* indexBuffer;
+	ID3D11Buffer* constantBuffer;
+	ID3D11ShaderResourceView* lightView;
+	ID3D11ShaderResourceView* gridView;
+	ID3D11ShaderResourceView* indexView;
+	UINT indexCapacity;
+
+	Stats stats;
+};
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "LodSelector.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <immintrin.h>
+
+LodSelector::LodSelector()
+{
+	this->pixelsPerUnit = 1.0f;
+	this->bias = 0.0f;
+	this->averageFrameMilliseconds = 0.0f;
+}
+
+void LodSelector::Initialize(const Settings& settings)
+{
+	this->settings = settings;
+	this->bias = 0.0f;
+	this->averageFrameMilliseconds = 0.0f;
+	this->stats = Stats();
+}
+
+void LodSelector::SetProjection(DirectX::XMMATRIX projection, int screenHeight)
+{
+	DirectX::XMFLOAT4X4 p;
+	DirectX::XMStoreFloat4x4(&p, projection);
+	pixelsPerUnit = p._22 * screenHeight * 0.5f;
+}
+
+void LodSelector::UpdateBias(float frameMilliseconds)
+{
+	if (settings.budgetMilliseconds <= 0.0f)
+	{
+		bias = 0.0f;
+		return;
+	}
+
+	// Averaged over a few frames, one slow frame should not change the detail
+	averageFrameMilliseconds = averageFrameMilliseconds > 0.0f ? averageFrameMilliseconds * 0.9f + frameMilliseconds * 0.1f : frameMilliseconds;
+
+	// Back to full detail only with some headroom, or the bias would go up and down every frame
+	if (averageFrameMilliseconds > settings.budgetMilliseconds)
+		bias = std::min(bias + settings.biasStep, settings.maxBias);
+	else if (averageFrameMilliseconds < settings.budgetMilliseconds * 0.85f)
+		bias = std::max(bias - settings.biasStep, 0.0f);
+}
+
+int LodSelector::PickLevel(const Model* model, float coarsenError, float keepError) const
+{
+	int levels = std::min(model->GetLodCount(), MAX_LODS);
+	int current = std::min(model->GetCurrentLod(), levels - 1);
+
+	// Errors grow with the level, the coarsest one under the limit is the last under it
+	int coarsest = 0;
+	while (coarsest + 1 < levels && model->GetLod(coarsest + 1).error <= coarsenError)
+		coarsest++;
+	if (coarsest > current)
+		return coarsest;
+
+	// Only finer when the current level is over the threshold itself
+	if (model->GetLod(current).error <= keepError)
+		return current;
+
+	int finer = 0;
+	while (finer + 1 < current && model->GetLod(finer + 1).error <= keepError)
+		finer++;
+	return finer;
+}
+
+void LodSelector::Select(const std::vector<Model*>& models, DirectX::XMFLOAT3 cameraPosition)
+{
+	using namespace DirectX;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	stats = Stats();
+	stats.models = (int)models.size();
+	stats.bias = bias;
+	stats.threshold = settings.pixelError * exp2f(bias);
+
+	// Object space error a level may have: threshold pixels at the sphere distance, back through the scale
+	float keepFactor = stats.threshold / std::max(pixelsPerUnit, 1e-6f);
+	__m128 cameraX = _mm_set1_ps(cameraPosition.x);
+	__m128 cameraY = _mm_set1_ps(cameraPosition.y);
+	__m128 cameraZ = _mm_set1_ps(cameraPosition.z);
+	__m128 minDistance = _mm_set1_ps(settings.minDistance);
+	__m128 keep = _mm_set1_ps(keepFactor);
+	__m128 coarsen = _mm_set1_ps(keepFactor * (1.0f - settings.hysteresis));
+
+	// 4 models at a time, they are still in the cache when their levels are picked
+	size_t count = models.size();
+	for (size_t first = 0; first < count; first += 4)
+	{
+		size_t batch = std::min(count - first, (size_t)4);
+
+		// World sphere centers, the padding is at the camera with no size
+		__declspec(align(16)) float centerX[4], centerY[4], centerZ[4], radius[4], scaleSq[4];
+		for (size_t i = 0; i < 4; i++)
+		{
+			if (i >= batch)
+			{
+				centerX[i] = cameraPosition.x;
+				centerY[i] = cameraPosition.y;
+				centerZ[i] = cameraPosition.z;
+				radius[i] = 0.0f;
+				scaleSq[i] = 1.0f;
+				continue;
+			}
+
+			// World matrices are affine, no divide by w
+			XMMATRIX world = models[first + i]->GetWorldMatrix();
+			const XMFLOAT4& sphere = models[first + i]->GetBoundingSphere();
+			XMVECTOR center = XMVectorMultiplyAdd(XMVectorReplicate(sphere.x), world.r[0],
+				XMVectorMultiplyAdd(XMVectorReplicate(sphere.y), world.r[1], XMVectorMultiplyAdd(XMVectorReplicate(sphere.z), world.r[2], world.r[3])));
+			centerX[i] = XMVectorGetX(center);
+			centerY[i] = XMVectorGetY(center);
+			centerZ[i] = XMVectorGetZ(center);
+			radius[i] = sphere.w;
+			scaleSq[i] = XMVectorGetX(XMVectorMax(XMVector3LengthSq(world.r[0]), XMVectorMax(XMVector3LengthSq(world.r[1]), XMVector3LengthSq(world.r[2]))));
+		}
+
+		// Largest axis scale of the world matrices, for the radii and the errors
+		__m128 worldScale = _mm_sqrt_ps(_mm_load_ps(scaleSq));
+		__m128 dx = _mm_sub_ps(_mm_load_ps(centerX), cameraX);
+		__m128 dy = _mm_sub_ps(_mm_load_ps(centerY), cameraY);
+		__m128 dz = _mm_sub_ps(_mm_load_ps(centerZ), cameraZ);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		distance = _mm_max_ps(_mm_sub_ps(distance, _mm_mul_ps(_mm_load_ps(radius), worldScale)), minDistance);
+
+		__declspec(align(16)) float keepErrors[4], coarsenErrors[4];
+		__m128 perScale = _mm_div_ps(distance, worldScale);
+		_mm_store_ps(keepErrors, _mm_mul_ps(perScale, keep));
+		_mm_store_ps(coarsenErrors, _mm_mul_ps(perScale, coarsen));
+
+		for (size_t i = 0; i < batch; i++)
+		{
+			Model* model = models[first + i];
+			if (model->GetLodCount() < 2)
+			{
+				int triangles = model->GetIndexCount() / 3;
+				stats.levels[0]++;
+				stats.fullTriangles += triangles;
+				stats.selectedTriangles += triangles;
+				continue;
+			}
+
+			int level = PickLevel(model, coarsenErrors[i], keepErrors[i]);
+			if (level != model->GetCurrentLod())
+			{
+				model->SetCurrentLod(level);
+				stats.switches++;
+			}
+
+			stats.lodModels++;
+			stats.levels[level]++;
+			stats.fullTriangles += model->GetLod(0).triangleCount;
+			stats.selectedTriangles += model->GetLod(level).triangleCount;
+		}
+	}
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+#include "DX.h"
+#include "Model.h"
+#include <vector>
+
+/*
+	Picks the level of detail of every visible model from its screen space error.
+	The geometric error of a level, scaled by the model world matrix and seen at the distance of its
+	bounding sphere, becomes pixels through the projection. The coarsest level under the pixel threshold
+	is picked, but a model only goes coarser once the level is under the threshold by the hysteresis and
+	only goes finer once its level is over the threshold, so models near a switch don't flicker.
+	The distances and error limits are worked out 4 models at a time with SSE, only the walk down the
+	levels is per model. A bias makes the threshold bigger while frames are over the time budget.
+*/
+class LodSelector
+{
+public:
+	static const int MAX_LODS = 8;
+
+	struct Settings
+	{
+		float pixelError = 2.0f;			// Largest error on screen, in pixels
+		float hysteresis = 0.25f;			// Part of the threshold a level has to be under to be switched to
+		float minDistance = 0.1f;			// Of the camera to a sphere, inside it is LOD 0
+		float budgetMilliseconds = 16.6f;	// Frame time the bias aims for, 0 turns it off
+		float biasStep = 0.05f;				// Per frame, the threshold doubles for every 1 of bias
+		float maxBias = 3.0f;
+	};
+
+	struct Stats
+	{
+		int models = 0;
+		int lodModels = 0;					// With more than LOD 0
+		int levels[MAX_LODS] = {};			// Models per picked level
+		int switches = 0;					// Models that changed level
+		int fullTriangles = 0;				// What LOD 0 of everything would have been
+		int selectedTriangles = 0;
+		float bias = 0.0f;
+		float threshold = 0.0f;				// Pixels, with the bias
+		double milliseconds = 0.0;
+	};
+
+public:
+	LodSelector();
+
+	void Initialize(const Settings& settings);
+
+	// Pixels per world unit at distance 1, from the vertical scale of a perspective projection
+	void SetProjection(DirectX::XMMATRIX projection, int screenHeight);
+
+	// Moves the bias towards the frame time budget, once per frame with the last frame time
+	void UpdateBias(float frameMilliseconds);
+	void SetBias(float bias) { this->bias = bias; }
+	float GetBias() const { return this->bias; }
+
+	// Sets the current level of every model
+	void Select(const std::vector<Model*>& models, DirectX::XMFLOAT3 cameraPosition);
+
+	const Settings& GetSettings() const { return this->settings; }
+	Settings& GetSettings() { return this->settings; }
+	const Stats& GetStats() const { return this->stats; }
+
+private:
+	int PickLevel(const Model* model, float coarsenError, float keepError) const;
+
+private:
+	Settings settings;
+	float pixelsPerUnit;
+	float bias;
+	float averageFrameMilliseconds;
+
+	Stats stats;
+};
\ No newline at end of file
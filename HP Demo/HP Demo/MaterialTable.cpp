@@ -0,0 +1,205 @@
+#include "MaterialTable.h"
+#include <algorithm>
+#include <cstring>
+
+MaterialTable::MaterialTable()
+{
+	this->device = nullptr;
+	this->buffer = nullptr;
+	this->view = nullptr;
+	this->capacity = 0;
+	this->dirtyCount = 0;
+}
+
+MaterialTable::~MaterialTable()
+{
+	Shutdown();
+}
+
+bool MaterialTable::Initialize(ID3D11Device* device, int capacity)
+{
+	Shutdown();
+
+	this->device = device;
+	entries.clear();
+	dirtyBlocks.clear();
+	dirtyCount = 0;
+	stats = Stats();
+
+	return CreateBuffer(std::max(capacity, 1));
+}
+
+void MaterialTable::Shutdown()
+{
+	ReleasePtr(view);
+	ReleasePtr(buffer);
+	capacity = 0;
+}
+
+bool MaterialTable::CreateBuffer(int capacity)
+{
+	ReleasePtr(view);
+	ReleasePtr(buffer);
+	this->capacity = capacity;
+
+	if (!device)
+		return true;
+
+	// Written with UpdateSubresource, a dirty range at a time
+	D3D11_BUFFER_DESC bufferDesc;
+	ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	bufferDesc.ByteWidth = sizeof(Entry) * capacity;
+	bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = sizeof(Entry);
+
+	if (FAILED(device->CreateBuffer(&bufferDesc, nullptr, &buffer)))
+		return false;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+	ZeroMemory(&viewDesc, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
+	viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+	viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	viewDesc.Buffer.FirstElement = 0;
+	viewDesc.Buffer.NumElements = capacity;
+
+	return SUCCEEDED(device->CreateShaderResourceView(buffer, &viewDesc, &view));
+}
+
+MaterialTable::Entry MaterialTable::MakeEntry(const SurfaceMaterial& material)
+{
+	// The same values Shader::FillMaterialCB puts in the material cbuffer
+	Entry entry;
+	ZeroMemory(&entry, sizeof(Entry));
+	entry.diffuseColor = material.diffuseColor;
+	entry.ambientColor = material.ambientColor;
+	entry.specularColor = material.specularColor;
+	entry.flags = (material.hasTexture ? FLAG_TEXTURE : 0) | (material.isTerrain ? FLAG_TERRAIN : 0) |
+		(material.hasNormalMap ? FLAG_NORMAL_MAP : 0) | (material.hasLightMap ? FLAG_LIGHT_MAP : 0);
+	entry.opacity = material.isTransparent ? material.opacity : 1.0f;
+	return entry;
+}
+
+void MaterialTable::MarkDirty(int index)
+{
+	int block = index / BLOCK_ENTRIES;
+	if (block >= (int)dirtyBlocks.size())
+		dirtyBlocks.resize(block + 1, 0);
+
+	if (!dirtyBlocks[block])
+	{
+		dirtyBlocks[block] = 1;
+		dirtyCount++;
+	}
+}
+
+int MaterialTable::Add(const SurfaceMaterial& material)
+{
+	int index = (int)entries.size();
+	entries.push_back(MakeEntry(material));
+	MarkDirty(index);
+
+	stats.materials = (int)entries.size();
+	return index;
+}
+
+void MaterialTable::AddModel(Model* model)
+{
+	const std::vector<SurfaceMaterial>& materials = model->GetMaterial();
+	int first = (int)entries.size();
+	for (const SurfaceMaterial& material : materials)
+		Add(material);
+
+	model->SetMaterialTableFirst(first);
+}
+
+bool MaterialTable::Set(int index, const SurfaceMaterial& material)
+{
+	Entry entry = MakeEntry(material);
+	if (memcmp(&entry, &entries[index], sizeof(Entry)) == 0)
+	{
+		stats.unchangedEdits++;
+		return false;
+	}
+
+	entries[index] = entry;
+	MarkDirty(index);
+	stats.edits++;
+	return true;
+}
+
+void MaterialTable::UpdateModel(Model* model)
+{
+	int first = model->GetMaterialTableFirst();
+	if (first < 0)
+		return;
+
+	const std::vector<SurfaceMaterial>& materials = model->GetMaterial();
+	for (int i = 0; i < (int)materials.size(); i++)
+		Set(first + i, materials[i]);
+}
+
+bool MaterialTable::Upload(RenderBackend* context)
+{
+	if (!IsDirty())
+		return true;
+
+	// Outgrown, the new buffer gets everything
+	if ((int)entries.size() > capacity)
+	{
+		int newCapacity = capacity;
+		while (newCapacity < (int)entries.size())
+			newCapacity *= 2;
+		if (!CreateBuffer(newCapacity))
+			return false;
+
+		UploadRange(context, 0, (int)entries.size());
+		stats.resizes++;
+	}
+	else
+	{
+		// One update per run of neighbouring dirty blocks
+		int blockCount = (int)dirtyBlocks.size();
+		for (int block = 0; block < blockCount; block++)
+		{
+			if (!dirtyBlocks[block])
+				continue;
+
+			int runEnd = block + 1;
+			while (runEnd < blockCount && dirtyBlocks[runEnd])
+				runEnd++;
+
+			UploadRange(context, block * BLOCK_ENTRIES, std::min(runEnd * BLOCK_ENTRIES, (int)entries.size()));
+			block = runEnd;
+		}
+	}
+
+	std::fill(dirtyBlocks.begin(), dirtyBlocks.end(), 0);
+	dirtyCount = 0;
+	return true;
+}
+
+void MaterialTable::UploadRange(RenderBackend* context, int first, int last)
+{
+	if (buffer)
+	{
+		ResourceBox box;
+		box.left = (UINT)(first * sizeof(Entry));
+		box.right = (UINT)(last * sizeof(Entry));
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+		context->UpdateSubresource(buffer, 0, &box, &entries[first], 0, 0);
+	}
+
+	stats.uploads++;
+	stats.entriesUploaded += last - first;
+	stats.bytesUploaded += (last - first) * sizeof(Entry);
+}
+
+void MaterialTable::Bind(RenderBackend* context) const
+{
+	context->PSSetShaderResources(MATERIAL_SLOT, 1, &view);
+}
\ No newline at end of file
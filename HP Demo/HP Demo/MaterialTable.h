@@ -0,0 +1,103 @@
+#pragma once
+#include "DX.h"
+#include "RenderBackend.h"
+#include "Model.h"
+#include <vector>
+#include <cstdint>
+
+/*
+	Every material of the queued models in one structured buffer, read by DefaultPS through an index
+	in the object constants instead of a material cbuffer written per draw.
+	The CPU side is a compact copy of what the buffer holds. Models are added once, their materials
+	go one after another, and edits mark the block of entries they are in. Upload writes every run of
+	dirty blocks with its own update, and makes the buffer again, bigger, when the table outgrew it.
+*/
+class MaterialTable
+{
+public:
+	// Layout of TableMaterial in DefaultPS, 64 bytes
+	struct Entry
+	{
+		DirectX::XMFLOAT4 diffuseColor;
+		DirectX::XMFLOAT4 ambientColor;
+		DirectX::XMFLOAT4 specularColor;
+		UINT flags;
+		float opacity;						// 1 unless the material is transparent
+		UINT padding[2];
+	};
+
+	static const UINT FLAG_TEXTURE = 1;
+	static const UINT FLAG_TERRAIN = 2;
+	static const UINT FLAG_NORMAL_MAP = 4;
+	static const UINT FLAG_LIGHT_MAP = 8;
+
+	struct Stats
+	{
+		int materials = 0;
+		int edits = 0;						// Set calls that changed an entry
+		int unchangedEdits = 0;				// Set calls that wrote what was already there
+		int uploads = 0;					// UpdateSubresource calls
+		int entriesUploaded = 0;
+		size_t bytesUploaded = 0;
+		int resizes = 0;
+	};
+
+	// Shader slot, see DefaultPS
+	static const UINT MATERIAL_SLOT = 8;
+
+	// Entries per dirty block, 1 KB
+	static const int BLOCK_ENTRIES = 16;
+
+public:
+	MaterialTable();
+	~MaterialTable();
+
+	// Without a device the table only keeps its CPU copy and counts what it would upload, for the benchmark
+	bool Initialize(ID3D11Device* device, int capacity);
+	void Shutdown();
+
+	static Entry MakeEntry(const SurfaceMaterial& material);
+
+	// Returns the index of the new entry
+	int Add(const SurfaceMaterial& material);
+
+	// Adds all materials of the model and tells the model where they are
+	void AddModel(Model* model);
+
+	// Marks the entry dirty when it differs from what the table holds, returns whether it did
+	bool Set(int index, const SurfaceMaterial& material);
+
+	// Reads the materials of a model that was added again, after they were edited
+	void UpdateModel(Model* model);
+
+	// Writes the dirty blocks, once per frame before anything reads the table
+	bool Upload(RenderBackend* context);
+
+	// Only reads, several threads can bind onto their own contexts
+	void Bind(RenderBackend* context) const;
+
+	int GetCount() const { return (int)this->entries.size(); }
+	int GetCapacity() const { return this->capacity; }
+	const Entry& GetEntry(int index) const { return this->entries[index]; }
+	bool IsDirty() const { return this->dirtyCount > 0; }
+
+	const Stats& GetStats() const { return this->stats; }
+	void ResetStats() { this->stats = Stats(); this->stats.materials = (int)this->entries.size(); }
+
+private:
+	bool CreateBuffer(int capacity);
+	void MarkDirty(int index);
+	void UploadRange(RenderBackend* context, int first, int last);
+
+private:
+	ID3D11Device* device;
+	ID3D11Buffer* buffer;
+	ID3D11ShaderResourceView* view;
+	int capacity;
+
+	std::vector<Entry> entries;
+	std::vector<uint8_t> dirtyBlocks;
+	int dirtyCount;
+
+	Stats stats;
+};
\ No newline at end of file
@@ -1,18 +1,39 @@
 #include "Model.h"
+#include "D3D11Backend.h"
+#include <algorithm>
+#include <cfloat>
+#include <unordered_map>
+#include <cstdint>
+
+GeometryBuffer* Model::sharedGeometry = nullptr;
 
 Model::Model()
 {
     this->hr = 0;
     this->vertexBuffer = 0;
     this->indexBuffer = 0;
+    this->geometry = 0;
+    this->baseVertex = 0;
+    this->startIndex = 0;
 
     this->vertexCount = 0;
     this->indexCount = 0;
 
     this->texture = 0;
+    this->normalMap = 0;
+    this->lightMap = 0;
+    this->cubemapTexture = 0;
     this->world = DirectX::XMMatrixIdentity();
     this->modelName = "";
     this->subsetCount = 0;
+    this->boundsMin = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+    this->boundsMax = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+    this->boundingSphere = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+    this->instanceBuffer = 0;
+    this->instanceCapacity = 0;
+    this->visibleInstanceCount = 0;
+    this->materialTableFirst = -1;
+    this->currentLod = 0;
 }
 
 Model::Model(const Model& other)
@@ -21,13 +42,31 @@ Model::Model(const Model& other)
     this->vertexBuffer = other.vertexBuffer;
     this->indexBuffer = other.indexBuffer;
 
+    // The copy draws from the same ranges, only the original frees them
+    this->geometry = other.geometry;
+    this->baseVertex = other.baseVertex;
+    this->startIndex = other.startIndex;
+
     this->vertexCount = other.vertexCount;
     this->indexCount = other.indexCount;
 
     this->texture = other.texture;
+    this->normalMap = other.normalMap;
+    this->lightMap = other.lightMap;
+    this->cubemapTexture = other.cubemapTexture;
     this->world = other.world;
     this->modelName = other.modelName;
     this->subsetCount = other.subsetCount;
+    this->boundsMin = other.boundsMin;
+    this->boundsMax = other.boundsMax;
+    this->boundingSphere = other.boundingSphere;
+
+    // The instances and material table entries are not shared with the copy
+    this->instanceBuffer = 0;
+    this->instanceCapacity = 0;
+    this->visibleInstanceCount = 0;
+    this->materialTableFirst = -1;
+    this->currentLod = 0;
 }
 
 Model::Model(std::string name)
@@ -35,14 +74,28 @@ Model::Model(std::string name)
     this->hr = 0;
     this->vertexBuffer = 0;
     this->indexBuffer = 0;
+    this->geometry = 0;
+    this->baseVertex = 0;
+    this->startIndex = 0;
 
     this->vertexCount = 0;
     this->indexCount = 0;
 
     this->texture = 0;
+    this->normalMap = 0;
+    this->lightMap = 0;
+    this->cubemapTexture = 0;
     this->world = DirectX::XMMatrixIdentity();
     this->modelName = name;
     this->subsetCount = 0;
+    this->boundsMin = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+    this->boundsMax = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+    this->boundingSphere = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+    this->instanceBuffer = 0;
+    this->instanceCapacity = 0;
+    this->visibleInstanceCount = 0;
+    this->materialTableFirst = -1;
+    this->currentLod = 0;
 }
 
 Model::~Model()
@@ -84,6 +137,12 @@ void Model::Shutdown()
 }
 
 void Model::Render(ID3D11DeviceContext* context)
+{
+    D3D11Backend backend(context);
+    Render(&backend);
+}
+
+void Model::Render(RenderBackend* context)
 {
     unsigned int stride;
     unsigned int offset;
@@ -102,6 +161,106 @@ void Model::Render(ID3D11DeviceContext* context)
     context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 }
 
+void Model::RenderInstanced(RenderBackend* context)
+{
+    unsigned int stride = sizeof(ModelInstance);
+    unsigned int offset = 0;
+
+    Render(context);
+    context->IASetVertexBuffers(1, 1, &instanceBuffer, &stride, &offset);
+}
+
+int Model::AddInstance(DirectX::XMMATRIX world, DirectX::XMFLOAT4 params)
+{
+    int index = (int)instances.size();
+    instances.push_back(ModelInstance());
+    instanceCuller.Add(DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f), 0.0f);
+
+    SetInstance(index, world, params);
+    return index;
+}
+
+void Model::SetInstance(int index, DirectX::XMMATRIX world, DirectX::XMFLOAT4 params)
+{
+    DirectX::XMMATRIX transposed = DirectX::XMMatrixTranspose(world);
+
+    ModelInstance& instance = instances[index];
+    DirectX::XMStoreFloat4(&instance.world[0], transposed.r[0]);
+    DirectX::XMStoreFloat4(&instance.world[1], transposed.r[1]);
+    DirectX::XMStoreFloat4(&instance.world[2], transposed.r[2]);
+    instance.params = params;
+
+    instanceCuller.SetTransformed(index, boundingSphere, world);
+}
+
+void Model::ClearInstances()
+{
+    instances.clear();
+    instanceCuller.Clear();
+    visibleInstances.clear();
+    visibleInstanceCount = 0;
+}
+
+bool Model::CreateInstanceBuffer(ID3D11Device* device)
+{
+    if (instances.empty())
+        return false;
+
+    if (instanceBuffer) {
+        instanceBuffer->Release();
+        instanceBuffer = 0;
+    }
+
+    D3D11_BUFFER_DESC bufferDesc;
+    ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.ByteWidth = (UINT)(sizeof(ModelInstance) * instances.size());
+    bufferDesc.StructureByteStride = sizeof(ModelInstance);
+
+    hr = device->CreateBuffer(&bufferDesc, nullptr, &instanceBuffer);
+    if (FAILED(hr))
+        return false;
+
+    instanceCapacity = (int)instances.size();
+    return true;
+}
+
+void Model::SetInstanceBuffer(ID3D11Buffer* buffer, int capacity)
+{
+    this->instanceBuffer = buffer;
+    this->instanceCapacity = capacity;
+}
+
+int Model::GatherVisibleInstances(RenderBackend* context, DirectX::XMMATRIX viewProjection)
+{
+    visibleInstanceCount = 0;
+    if (!instanceBuffer || instances.empty())
+        return 0;
+
+    // With the model world in the matrix the planes come out in model space, where the instance spheres are
+    instanceCuller.Cull(world * viewProjection, visibleInstances);
+
+    int count = std::min((int)visibleInstances.size(), instanceCapacity);
+    if (count == 0)
+        return 0;
+
+    MappedResource mapped;
+    if (FAILED(context->Map(instanceBuffer, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped)))
+        return 0;
+
+    // Written front to back, the mapped memory is never read
+    ModelInstance* destination = (ModelInstance*)mapped.pData;
+    for (int i = 0; i < count; i++)
+        destination[i] = instances[visibleInstances[i]];
+
+    context->Unmap(instanceBuffer, 0);
+
+    visibleInstanceCount = count;
+    return count;
+}
+
 int Model::GetVertexCount()
 {
     return vertexCount;
@@ -122,6 +281,11 @@ ID3D11ShaderResourceView* Model::GetNormalMap()
     return this->normalMap->GetTexture();
 }
 
+ID3D11ShaderResourceView* Model::GetLightMap()
+{
+    return this->lightMap->GetTexture();
+}
+
 bool Model::InitializeTerrain(std::vector<Vertex> vertices, std::vector<DWORD> indices, ID3D11Device* device)
 {
     this->indices = indices;
@@ -129,6 +293,54 @@ bool Model::InitializeTerrain(std::vector<Vertex> vertices, std::vector<DWORD> i
 
     indexCount = (int)indices.size();
     vertexCount = (int)vertices.size();
+    ComputeBounds(vertices);
+    BuildSubsets();
+
+    if (!CreateGeometry(device)) {
+        MessageBox(0, L"Failed to 'CreateBuffer' for the new model", L"Graphics scene Initialization Message", MB_ICONERROR);
+        return false;
+    }
+
+    return true;
+}
+
+bool Model::CreateGeometry(ID3D11Device* device)
+{
+    // The level of detail ranges start after the full indices
+    std::vector<DWORD> lodAppended;
+    const std::vector<DWORD>* allIndices = &indices;
+    if (!lodIndices.empty()) {
+        lodAppended.reserve(indices.size() + lodIndices.size());
+        lodAppended.insert(lodAppended.end(), indices.begin(), indices.end());
+        lodAppended.insert(lodAppended.end(), lodIndices.begin(), lodIndices.end());
+        allIndices = &lodAppended;
+    }
+
+    if (vertices.empty() || allIndices->empty())
+        return false;
+
+    UINT newVertexCount = (UINT)vertices.size();
+    UINT newIndexCount = (UINT)allIndices->size();
+
+    if (sharedGeometry) {
+        GeometryBuffer::Allocation allocation;
+        if (!sharedGeometry->Allocate(newVertexCount, newIndexCount, allocation))
+            return false;
+
+        sharedGeometry->Upload(allocation, &vertices[0], newVertexCount, &(*allIndices)[0], newIndexCount);
+
+        ReleaseGeometry();
+        geometry = sharedGeometry;
+        geometryAllocation = allocation;
+        vertexBuffer = geometry->GetVertexBuffer(allocation.page);
+        indexBuffer = geometry->GetIndexBuffer(allocation.page);
+        baseVertex = (int)allocation.baseVertex;
+        startIndex = (int)allocation.startIndex;
+        return true;
+    }
+
+    if (!device)
+        return false;
 
     // Vertexbuffer desc
     D3D11_BUFFER_DESC bufferDesc;
@@ -137,7 +349,7 @@ bool Model::InitializeTerrain(std::vector<Vertex> vertices, std::vector<DWORD> i
     bufferDesc.Usage = D3D11_USAGE_DEFAULT;
     bufferDesc.CPUAccessFlags = 0u;
     bufferDesc.MiscFlags = 0u;
-    bufferDesc.ByteWidth = sizeof(Vertex) * vertexCount;
+    bufferDesc.ByteWidth = sizeof(Vertex) * newVertexCount;
     bufferDesc.StructureByteStride = sizeof(Vertex);
 
     /*
@@ -147,11 +359,10 @@ bool Model::InitializeTerrain(std::vector<Vertex> vertices, std::vector<DWORD> i
     ZeroMemory(&resourceData, sizeof(D3D11_SUBRESOURCE_DATA));
     resourceData.pSysMem = &vertices[0];
 
-    hr = device->CreateBuffer(&bufferDesc, &resourceData, &vertexBuffer);
-    if (FAILED(hr)) {
-        MessageBox(0, L"Failed to 'CreateBuffer' for the new model", L"Graphics scene Initialization Message", MB_ICONERROR);
+    ID3D11Buffer* newVertexBuffer = 0;
+    hr = device->CreateBuffer(&bufferDesc, &resourceData, &newVertexBuffer);
+    if (FAILED(hr))
         return false;
-    }
 
     // Indexbuffer description for new model
     ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
@@ -159,31 +370,214 @@ bool Model::InitializeTerrain(std::vector<Vertex> vertices, std::vector<DWORD> i
     bufferDesc.Usage = D3D11_USAGE_DEFAULT;
     bufferDesc.CPUAccessFlags = 0u;
     bufferDesc.MiscFlags = 0u;
-    bufferDesc.ByteWidth = sizeof(DWORD) * indexCount;
+    bufferDesc.ByteWidth = sizeof(DWORD) * newIndexCount;
     bufferDesc.StructureByteStride = sizeof(DWORD);
 
     ZeroMemory(&resourceData, sizeof(D3D11_SUBRESOURCE_DATA));
-    resourceData.pSysMem = &indices[0];
+    resourceData.pSysMem = &(*allIndices)[0];
 
-    // Create indexbuffer for cube
-    hr = device->CreateBuffer(&bufferDesc, &resourceData, &indexBuffer);
+    ID3D11Buffer* newIndexBuffer = 0;
+    hr = device->CreateBuffer(&bufferDesc, &resourceData, &newIndexBuffer);
     if (FAILED(hr)) {
-        MessageBox(0, L"Failed to 'CreateBuffer' for IndexBuffer_Cube.", L"Graphics scene Initialization Message", MB_ICONERROR);
+        newVertexBuffer->Release();
         return false;
     }
 
-    if (vertexBuffer != 0 && indexBuffer != 0)
+    ReleaseGeometry();
+    vertexBuffer = newVertexBuffer;
+    indexBuffer = newIndexBuffer;
+    return true;
+}
+
+void Model::ComputeBounds(const std::vector<Vertex>& vertices)
+{
+    using namespace DirectX;
+
+    if (vertices.empty())
     {
-        return true;
+        boundsMin = boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        boundingSphere = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+        return;
     }
-    else
+
+    XMVECTOR minimum = XMLoadFloat3(&vertices[0].pos);
+    XMVECTOR maximum = minimum;
+    for (size_t i = 1; i < vertices.size(); i++)
     {
-        return false;
+        XMVECTOR position = XMLoadFloat3(&vertices[i].pos);
+        minimum = XMVectorMin(minimum, position);
+        maximum = XMVectorMax(maximum, position);
+    }
+
+    XMStoreFloat3(&boundsMin, minimum);
+    XMStoreFloat3(&boundsMax, maximum);
+
+    // Sphere around the box center, sized by the farthest vertex instead of the box corner
+    XMVECTOR center = XMVectorScale(XMVectorAdd(minimum, maximum), 0.5f);
+    XMVECTOR radiusSq = XMVectorZero();
+    for (size_t i = 0; i < vertices.size(); i++)
+        radiusSq = XMVectorMax(radiusSq, XMVector3LengthSq(XMVectorSubtract(XMLoadFloat3(&vertices[i].pos), center)));
+
+    XMStoreFloat4(&boundingSphere, XMVectorSetW(center, sqrtf(XMVectorGetX(radiusSq))));
+}
+
+void Model::BuildSubsets()
+{
+    using namespace DirectX;
+
+    subsets.clear();
+    lods.clear();
+    lodIndices.clear();
+    currentLod = 0;
+
+    int totalIndices = (int)indices.size();
+    if (subsetIndexStart.size() < 2 || subsetMaterials.empty()) {
+        ModelSubset subset;
+        subset.indexCount = totalIndices;
+        subset.boundingSphere = boundingSphere;
+        subsets.push_back(subset);
+        return;
+    }
+
+    // The starts have one more entry than there are subsets, the end of the last one
+    for (size_t i = 0; i + 1 < subsetIndexStart.size() && i < subsetMaterials.size(); i++) {
+        ModelSubset subset;
+        subset.startIndex = std::min(std::max(subsetIndexStart[i], 0), totalIndices);
+        subset.indexCount = std::min(std::max(subsetIndexStart[i + 1], 0), totalIndices) - subset.startIndex;
+        subset.material = std::min(std::max(subsetMaterials[i], 0), std::max((int)materials.size() - 1, 0));
+        if (subset.indexCount <= 0)
+            continue;
+
+        XMVECTOR minimum = XMVectorReplicate(FLT_MAX);
+        XMVECTOR maximum = XMVectorReplicate(-FLT_MAX);
+        for (int j = subset.startIndex; j < subset.startIndex + subset.indexCount; j++) {
+            XMVECTOR position = XMLoadFloat3(&vertices[indices[j]].pos);
+            minimum = XMVectorMin(minimum, position);
+            maximum = XMVectorMax(maximum, position);
+        }
+
+        XMVECTOR center = XMVectorScale(XMVectorAdd(minimum, maximum), 0.5f);
+        XMVECTOR radiusSq = XMVectorZero();
+        for (int j = subset.startIndex; j < subset.startIndex + subset.indexCount; j++)
+            radiusSq = XMVectorMax(radiusSq, XMVector3LengthSq(XMVectorSubtract(XMLoadFloat3(&vertices[indices[j]].pos), center)));
+
+        XMStoreFloat4(&subset.boundingSphere, XMVectorSetW(center, sqrtf(XMVectorGetX(radiusSq))));
+        subsets.push_back(subset);
     }
 }
 
+int Model::BuildLods(ID3D11Device* device, int maxLevels)
+{
+    using namespace DirectX;
+
+    lods.clear();
+    lodIndices.clear();
+    currentLod = 0;
+
+    if (subsets.empty())
+        BuildSubsets();
+
+    float extent = std::max(boundsMax.x - boundsMin.x, std::max(boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z));
+    if (maxLevels < 2 || vertices.empty() || indices.empty() || extent <= 0.0f)
+        return 1;
+
+    ModelLod full;
+    full.subsets = subsets;
+    for (const ModelSubset& subset : subsets)
+        full.triangleCount += subset.indexCount / 3;
+    lods.push_back(full);
+
+    std::vector<DWORD> cellVertex(vertices.size());
+    std::unordered_map<uint64_t, DWORD> cellFirst;
+    for (int cells = LOD_GRID_CELLS; cells >= 1 && (int)lods.size() < maxLevels; cells /= 2) {
+        // Every vertex moves onto the first vertex of its cell, at most a cell diagonal away
+        float cellSize = extent / cells;
+        float inverseCell = 1.0f / cellSize;
+        cellFirst.clear();
+        for (size_t i = 0; i < vertices.size(); i++) {
+            const XMFLOAT3& position = vertices[i].pos;
+            uint64_t x = (uint64_t)std::max((position.x - boundsMin.x) * inverseCell, 0.0f);
+            uint64_t y = (uint64_t)std::max((position.y - boundsMin.y) * inverseCell, 0.0f);
+            uint64_t z = (uint64_t)std::max((position.z - boundsMin.z) * inverseCell, 0.0f);
+            cellVertex[i] = cellFirst.emplace(x | y << 21 | z << 42, (DWORD)i).first->second;
+        }
+
+        ModelLod lod;
+        lod.error = cellSize * 1.7320508f;
+        size_t levelStart = lodIndices.size();
+        for (const ModelSubset& subset : subsets) {
+            ModelSubset simplified = subset;
+            simplified.startIndex = (int)(indices.size() + lodIndices.size());
+            for (int j = subset.startIndex; j + 2 < subset.startIndex + subset.indexCount; j += 3) {
+                DWORD a = cellVertex[indices[j]];
+                DWORD b = cellVertex[indices[j + 1]];
+                DWORD c = cellVertex[indices[j + 2]];
+                if (a == b || b == c || c == a)
+                    continue;
+
+                lodIndices.push_back(a);
+                lodIndices.push_back(b);
+                lodIndices.push_back(c);
+            }
+
+            simplified.indexCount = (int)(indices.size() + lodIndices.size()) - simplified.startIndex;
+            if (simplified.indexCount == 0)
+                continue;
+
+            lod.subsets.push_back(simplified);
+            lod.triangleCount += simplified.indexCount / 3;
+        }
+
+        // Too close to the level before, a coarser grid may still be worth it
+        if (lod.triangleCount == 0 || lod.triangleCount * 4 > lods.back().triangleCount * 3) {
+            lodIndices.resize(levelStart);
+            if (lod.triangleCount == 0)
+                break;
+            continue;
+        }
+
+        lods.push_back(lod);
+    }
+
+    if (lods.size() < 2) {
+        lods.clear();
+        return 1;
+    }
+
+    // A model on a shared page moves to ranges that have room for the new indices
+    if (device || geometry) {
+        if (!CreateGeometry(device)) {
+            lods.clear();
+            lodIndices.clear();
+            return 1;
+        }
+    }
+
+    return (int)lods.size();
+}
+
 void Model::ShutdownBuffers()
 {
+    if (instanceBuffer) {
+        instanceBuffer->Release();
+        instanceBuffer = 0;
+    }
+    instanceCapacity = 0;
+
+    ReleaseGeometry();
+}
+
+void Model::ReleaseGeometry()
+{
+    // Ranges of a shared page go back once the GPU is done with them, the page stays
+    if (geometry) {
+        geometry->Free(geometryAllocation);
+        geometry = 0;
+        geometryAllocation = GeometryBuffer::Allocation();
+        vertexBuffer = 0;
+        indexBuffer = 0;
+    }
+
     if (indexBuffer) {
         indexBuffer->Release();
         indexBuffer = 0;
@@ -193,6 +587,9 @@ void Model::ShutdownBuffers()
         vertexBuffer->Release();
         vertexBuffer = 0;
     }
+
+    baseVertex = 0;
+    startIndex = 0;
 }
 
 bool Model::CreateQuad(ID3D11Device* device)
@@ -214,49 +611,16 @@ bool Model::CreateQuad(ID3D11Device* device)
 
     };
 
+    vertices.assign(cube, cube + ARRAYSIZE(cube));
+    indices.assign(cubeIndices, cubeIndices + ARRAYSIZE(cubeIndices));
     indexCount = ARRAYSIZE(cubeIndices);
     vertexCount = ARRAYSIZE(cube);
 
-    // Vertexbuffer description for cube
-    D3D11_BUFFER_DESC bufferDesc;
-    ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
-    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-    bufferDesc.CPUAccessFlags = 0u;
-    bufferDesc.MiscFlags = 0u;
-    bufferDesc.ByteWidth = sizeof(Vertex) * vertexCount;
-    bufferDesc.StructureByteStride = sizeof(Vertex);
-
-    D3D11_SUBRESOURCE_DATA resourceData;
-    ZeroMemory(&resourceData, sizeof(D3D11_SUBRESOURCE_DATA));
-    resourceData.pSysMem = cube;
-
-    // Create vertexbuffer for cube
-    hr = device->CreateBuffer(&bufferDesc, &resourceData, &vertexBuffer);
-    if (FAILED(hr)) {
+    if (!CreateGeometry(device)) {
         MessageBox(0, L"Failed to 'CreateBuffer' for VertexBuffer_Cube.", L"Graphics scene Initialization Message", MB_ICONERROR);
         return false;
     }
 
-    // Indexbuffer description for cube
-    ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
-    bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-    bufferDesc.CPUAccessFlags = 0u;
-    bufferDesc.MiscFlags = 0u;
-    bufferDesc.ByteWidth = sizeof(DWORD) * indexCount;
-    bufferDesc.StructureByteStride = sizeof(DWORD);
-
-    ZeroMemory(&resourceData, sizeof(D3D11_SUBRESOURCE_DATA));
-    resourceData.pSysMem = cubeIndices;
-
-    // Create indexbuffer for cube
-    hr = device->CreateBuffer(&bufferDesc, &resourceData, &indexBuffer);
-    if (FAILED(hr)) {
-        MessageBox(0, L"Failed to 'CreateBuffer' for IndexBuffer_Cube.", L"Graphics scene Initialization Message", MB_ICONERROR);
-        return false;
-    }
-
     return true;
 }
 
@@ -312,6 +676,13 @@ void Model::ReleaseTexture()
         delete normalMap;
         normalMap = 0;
     }
+
+    if (lightMap)
+    {
+        lightMap->Shutdown();
+        delete lightMap;
+        lightMap = 0;
+    }
 }
 
 std::vector<int>& Model::GetSubsetIndexVector()
@@ -1,6 +1,9 @@
 #pragma once
 #include "DX.h"
 #include "Texture.h"
+#include "RenderBackend.h"
+#include "FrustumCuller.h"
+#include "GeometryBuffer.h"
 #include <vector>
 #include <string>
 
@@ -34,12 +37,39 @@ struct SurfaceMaterial
 	int textureArrayIndex = 0;
 	bool isTerrain = false;
 	bool isTransparent = false;
+	float opacity = 1.0f;			// 1 - Tr of the mtl, used when isTransparent
 
 	DirectX::XMFLOAT4 translation = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
 
 	bool hasNormalMap = false;
 	bool canMove;
 	int normMapTexArrayIndex = 0;
+
+	bool hasLightMap = false;
+};
+
+// Index range of a model drawn with one of its materials
+struct ModelSubset
+{
+	int startIndex = 0;
+	int indexCount = 0;
+	int material = 0;				// Into Model::GetMaterial()
+	DirectX::XMFLOAT4 boundingSphere = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);	// Object space, of the vertices the range uses
+};
+
+// Simplified stand-in for a whole model, its subsets index the same vertices as the full one
+struct ModelLod
+{
+	float error = 0.0f;				// Object space, how far the surface can be from the full model
+	int triangleCount = 0;
+	std::vector<ModelSubset> subsets;	// Ranges after the full indices, the bounding spheres of the full subsets
+};
+
+// Per instance vertex data of instanced models, 64 bytes
+struct ModelInstance
+{
+	DirectX::XMFLOAT4 world[3];		// Transposed world matrix without the last row, which is always 0 0 0 1
+	DirectX::XMFLOAT4 params;		// Free for the shaders, InstancedVS passes it on to the pixel shader
 };
 
 class Model {
@@ -55,11 +85,13 @@ public:
 
 	void Shutdown();
 	void Render(ID3D11DeviceContext* context);
+	void Render(RenderBackend* context);
 
 	int GetVertexCount();
 	int GetIndexCount();
 	ID3D11ShaderResourceView* GetTexture();
 	ID3D11ShaderResourceView* GetNormalMap();
+	ID3D11ShaderResourceView* GetLightMap();
 	std::vector<int>& GetSubsetIndexVector();
 	std::vector<int>& GetSubsetMaterialVector();
 	int& GetSubsetCount();
@@ -69,6 +101,8 @@ public:
 	std::vector<SurfaceMaterial>& GetMaterial();
 	std::vector<std::wstring>& GetTextureNameVector();
 	Texture* GetTextureStruct() { return this->texture; }
+	Texture* GetNormalMapStruct() { return this->normalMap; }
+	Texture* GetLightMapStruct() { return this->lightMap; }
 	ID3D11Buffer& GetVertexBuffer() { return *this->vertexBuffer; }
 	ID3D11Buffer& GetIndexBuffer() { return *this->indexBuffer; }
 	DirectX::XMMATRIX GetWorldMatrix() { return this->world; }
@@ -89,12 +123,88 @@ public:
 	bool LoadNormalMap(ID3D11Device*, LPCWSTR);
 	void LoadNormalMapFbx(Texture* tex) { this->normalMap = tex; }
 	void LoadFbxTexture(Texture* tex) { this->texture = tex; }
+	void LoadLightMap(Texture* tex) { this->lightMap = tex; }
+
+	// Object space bounds from the vertices, done when a mesh is loaded or rebuilt
+	void ComputeBounds(const std::vector<Vertex>& vertices);
+	const DirectX::XMFLOAT3& GetBoundsMin() const { return this->boundsMin; }
+	const DirectX::XMFLOAT3& GetBoundsMax() const { return this->boundsMax; }
+	const DirectX::XMFLOAT4& GetBoundingSphere() const { return this->boundingSphere; }	// xyz center, w radius
+
+	/*
+		Draw ranges from the subset starts and materials the loader filled in, with bounds of their own.
+		A model without loader subsets becomes one range over all indices with the first material.
+		Done after the vertices and indices are final, a model without ranges is drawn whole.
+	*/
+	void BuildSubsets();
+	const std::vector<ModelSubset>& GetSubsets() const { return this->subsets; }
+
+	/*
+		Level of detail chain, LOD 0 is the model itself. Every further level clusters the vertices on a grid
+		twice as coarse as the one before and keeps one vertex per cell, triangles that collapse are dropped.
+		The kept vertices are ones the model already has, so the levels only add indices after the full ones
+		and share the vertex buffer. Levels that would not save a quarter of the triangles are not made.
+		Done after BuildSubsets, the index buffer is made again with the new ranges when a device is given.
+		Returns how many levels the model has, with LOD 0.
+	*/
+	int BuildLods(ID3D11Device* device, int maxLevels);
+	static const int LOD_GRID_CELLS = 64;		// Along the longest side of the bounds, for the first level after LOD 0
+	int GetLodCount() const { return this->lods.empty() ? 1 : (int)this->lods.size(); }
+	const ModelLod& GetLod(int lod) const { return this->lods[lod]; }
+	void SetCurrentLod(int lod) { this->currentLod = lod; }
+	int GetCurrentLod() const { return this->currentLod; }
+
+	// Subsets of the level LodSelector picked, GetSubsets without levels
+	const std::vector<ModelSubset>& GetLodSubsets() const { return this->lods.empty() ? this->subsets : this->lods[this->currentLod].subsets; }
+
+	// Where MaterialTable put the materials, one after another from the first. -1 until the model is added
+	void SetMaterialTableFirst(int first) { this->materialTableFirst = first; }
+	int GetMaterialTableFirst() const { return this->materialTableFirst; }
+
+	/*
+		Hardware instancing for a mesh placed many times. Every frame the instances are culled with their
+		own bounding spheres, the visible ones are written to the instance buffer and all of them are one
+		DrawIndexedInstanced. Instance transforms are in model space, the model world matrix goes on top.
+		The bounds have to be computed before instances are added.
+	*/
+	int AddInstance(DirectX::XMMATRIX world, DirectX::XMFLOAT4 params);
+	void SetInstance(int index, DirectX::XMMATRIX world, DirectX::XMFLOAT4 params);
+	void ClearInstances();
+	int GetInstanceCount() const { return (int)this->instances.size(); }
+	const ModelInstance& GetInstance(int index) const { return this->instances[index]; }
+
+	// Dynamic vertex buffer with room for every instance, made again when more were added
+	bool CreateInstanceBuffer(ID3D11Device* device);
+	void SetInstanceBuffer(ID3D11Buffer* buffer, int capacity);
+
+	// Culls the instances and writes the visible ones to the instance buffer, returns how many
+	int GatherVisibleInstances(RenderBackend* context, DirectX::XMMATRIX viewProjection);
+	int GetVisibleInstanceCount() const { return this->visibleInstanceCount; }
+
+	// Render with the instance buffer in slot 1, for Shader::RenderInstanced
+	void RenderInstanced(RenderBackend* context);
 
 	//bool InitializeFromFbx(std::vector<Vertex> vertices, std::vector<DWORD> indices, Skeleton* skeleton, ID3D11Device* device);
 	bool InitializeTerrain(std::vector<Vertex> vertices, std::vector<DWORD> indices, ID3D11Device* device);
 
+	/*
+		While a geometry buffer is set, the vertices and indices of models go into ranges of its shared pages
+		instead of buffers of their own. Such a model binds the buffers of its page and draws with the base
+		vertex and start index of its ranges, 0 for a model with its own buffers. Set before anything is
+		loaded and cleared before the geometry buffer is deleted.
+	*/
+	static void SetSharedGeometry(GeometryBuffer* geometry) { sharedGeometry = geometry; }
+	static GeometryBuffer* GetSharedGeometry() { return sharedGeometry; }
+
+	// Puts the vertices and indices on the GPU, the level of detail indices after the full ones. Frees the
+	// buffers or ranges the model had before once the new ones are there, keeps them when that fails
+	bool CreateGeometry(ID3D11Device* device);
+	int GetBaseVertex() const { return this->baseVertex; }
+	int GetStartIndex() const { return this->startIndex; }		// Of the whole model, the subsets and levels count from it
+
 private:
 	void ShutdownBuffers();
+	void ReleaseGeometry();
 	void ReleaseTexture();
 	bool CreateQuad(ID3D11Device*);
 
@@ -103,9 +213,16 @@ private:
 	ID3D11Buffer* vertexBuffer, * indexBuffer;
 	int vertexCount, indexCount;
 
+	// Set when the buffers are a page of the geometry buffer, the model only has the ranges
+	static GeometryBuffer* sharedGeometry;
+	GeometryBuffer* geometry;
+	GeometryBuffer::Allocation geometryAllocation;
+	int baseVertex, startIndex;
+
 	Texture* cubemapTexture;
 	Texture* texture;
 	Texture* normalMap;
+	Texture* lightMap;
 	std::string modelName;
 
 	std::vector<XMFLOAT3> vertPosArray;			// Used for CPU to do calculations on the Geometry
@@ -118,6 +235,21 @@ private:
 	std::vector<SurfaceMaterial> materials;
 	std::vector<std::wstring> textureNames;
 	int subsetCount;
+	std::vector<ModelSubset> subsets;
+	int materialTableFirst;
+	std::vector<ModelLod> lods;
+	std::vector<DWORD> lodIndices;				// Of the levels after LOD 0, the index buffer has them after the full indices
+	int currentLod;
 
 	DirectX::XMMATRIX world;
+
+	DirectX::XMFLOAT3 boundsMin, boundsMax;
+	DirectX::XMFLOAT4 boundingSphere;
+
+	std::vector<ModelInstance> instances;
+	FrustumCuller instanceCuller;
+	std::vector<int> visibleInstances;
+	ID3D11Buffer* instanceBuffer;
+	int instanceCapacity;
+	int visibleInstanceCount;
 };
\ No newline at end of file
@@ -0,0 +1,752 @@
+#include "NavigationGrid.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+// Up to 4096 x 4096 grid points, the connected components grid is about 100 MB at this size
+#define STBCC_GRID_COUNT_X_LOG2 12
+#define STBCC_GRID_COUNT_Y_LOG2 12
+#define STB_CONNECTED_COMPONENTS_IMPLEMENTATION
+#include "stb_connected_components.h"
+
+// stb_connected_components wants the map size to be a multiple of its own cluster size
+static const int CONNECTIVITY_ALIGNMENT = 64;
+
+// Border runs shorter than this get one transition in the middle, longer runs one at each end
+static const int MAX_SINGLE_TRANSITION = 6;
+
+static const float DIAGONAL_COST = 1.41421356f;
+static const float INFINITE_COST = 1.0e30f;
+
+static const int NEIGHBOUR_X[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+static const int NEIGHBOUR_Z[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+typedef std::pair<float, int> HeapEntry;
+
+static void PushHeap(std::vector<HeapEntry>& heap, float cost, int index)
+{
+	heap.push_back(HeapEntry(cost, index));
+	std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+}
+
+static HeapEntry PopHeap(std::vector<HeapEntry>& heap)
+{
+	std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+	HeapEntry entry = heap.back();
+	heap.pop_back();
+	return entry;
+}
+
+// Appends a path, the first point is skipped when the path already ends there
+static void AppendPoints(std::vector<uint32_t>& path, const uint32_t* points, size_t count)
+{
+	size_t first = (!path.empty() && count > 0 && path.back() == points[0]) ? 1 : 0;
+	path.insert(path.end(), points + first, points + count);
+}
+
+NavigationGrid::NavigationGrid()
+{
+	this->heights = nullptr;
+	this->compressedHeights = nullptr;
+	this->width = 0;
+	this->height = 0;
+	this->cellSpace = 1.0f;
+	this->minSlopeCos = 0.0f;
+	this->connectivity = nullptr;
+	this->connectivityWidth = 0;
+	this->connectivityHeight = 0;
+	this->clustersX = 0;
+	this->clustersZ = 0;
+	this->nodeSearch = 0;
+}
+
+NavigationGrid::~NavigationGrid()
+{
+	Shutdown();
+}
+
+bool NavigationGrid::Initialize(const Terrain* terrain, const Settings& settings, JobSystem& jobSystem)
+{
+	if (!terrain)
+		return false;
+
+	// The raw grid is released after loading, the compressed copy stays
+	if (terrain->GetCompressedHeights().GetWidth() > 0)
+		return Initialize(terrain->GetCompressedHeights(), terrain->GetCellSpace(), settings, jobSystem);
+
+	return Initialize(terrain->GetHeightGrid().data(), terrain->GetWidth(), terrain->GetHeight(), terrain->GetCellSpace(), settings, jobSystem);
+}
+
+bool NavigationGrid::Initialize(const float* heights, int width, int height, float cellSpace, const Settings& settings, JobSystem& jobSystem)
+{
+	if (!heights)
+		return false;
+
+	return Build(heights, nullptr, width, height, cellSpace, settings, jobSystem);
+}
+
+bool NavigationGrid::Initialize(const CompressedHeightfield& heights, float cellSpace, const Settings& settings, JobSystem& jobSystem)
+{
+	return Build(nullptr, &heights, heights.GetWidth(), heights.GetHeight(), cellSpace, settings, jobSystem);
+}
+
+bool NavigationGrid::Build(const float* heights, const CompressedHeightfield* compressedHeights, int width, int height, float cellSpace, const Settings& settings, JobSystem& jobSystem)
+{
+	if (width < 2 || height < 2 || width > MAX_GRID_SIZE || height > MAX_GRID_SIZE)
+		return false;
+
+	Shutdown();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	this->heights = heights;
+	this->compressedHeights = compressedHeights;
+	this->width = width;
+	this->height = height;
+	this->cellSpace = cellSpace;
+	this->settings = settings;
+	this->minSlopeCos = cosf(settings.maxSlope * 3.14159265f / 180.0f);
+
+	// Walkability, one row per job
+	blocked.resize((size_t)width * height);
+	jobSystem.ParallelFor(height, [&](int z, int)
+	{
+		for (int x = 0; x < width; x++)
+			blocked[(size_t)z * width + x] = ComputeWalkable(x, z) ? 0 : 1;
+	});
+
+	// Connected components, the padding is closed
+	connectivityWidth = (width + CONNECTIVITY_ALIGNMENT - 1) / CONNECTIVITY_ALIGNMENT * CONNECTIVITY_ALIGNMENT;
+	connectivityHeight = (height + CONNECTIVITY_ALIGNMENT - 1) / CONNECTIVITY_ALIGNMENT * CONNECTIVITY_ALIGNMENT;
+
+	std::vector<uint8_t> map((size_t)connectivityWidth * connectivityHeight, 1);
+	for (int z = 0; z < height; z++)
+		std::copy(&blocked[(size_t)z * width], &blocked[(size_t)z * width] + width, &map[(size_t)z * connectivityWidth]);
+
+	connectivity = (st_stbcc_grid*)malloc(stbcc_grid_sizeof());
+	if (!connectivity)
+		return false;
+
+	stbcc_init_grid(connectivity, map.data(), connectivityWidth, connectivityHeight);
+
+	// Abstract graph
+	clustersX = (width + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+	clustersZ = (height + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+	int clusterCount = clustersX * clustersZ;
+
+	clusterNodes.resize(clusterCount);
+	eastBorderNodes.resize(clusterCount);
+	northBorderNodes.resize(clusterCount);
+	pathCache.resize(clusterCount);
+
+	for (int cluster = 0; cluster < clusterCount; cluster++)
+	{
+		BuildBorder(cluster, true);
+		BuildBorder(cluster, false);
+	}
+
+	workerSearches.resize(jobSystem.GetThreadCount());
+	jobSystem.ParallelFor(clusterCount, [&](int cluster, int threadIndex)
+	{
+		BuildIntraEdges(cluster, workerSearches[threadIndex]);
+	});
+
+	stats = Stats();
+	for (size_t i = 0; i < blocked.size(); i++)
+		stats.walkableCells += blocked[i] == 0;
+
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (!nodes[i].alive)
+			continue;
+
+		stats.abstractNodes++;
+		stats.abstractEdges += (int)nodes[i].edges.size();
+	}
+
+	stats.connectivityBytes = stbcc_grid_sizeof();
+	stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	char message[256];
+	snprintf(message, sizeof(message), "Navigation: %d x %d, %d walkable, %d nodes, %d edges, built in %.1f ms\n",
+		width, height, stats.walkableCells, stats.abstractNodes, stats.abstractEdges, stats.buildMilliseconds);
+	OutputDebugStringA(message);
+
+	return true;
+}
+
+void NavigationGrid::Shutdown()
+{
+	if (connectivity)
+	{
+		free(connectivity);
+		connectivity = nullptr;
+	}
+
+	blocked.clear();
+	clusterNodes.clear();
+	eastBorderNodes.clear();
+	northBorderNodes.clear();
+	pathCache.clear();
+	nodes.clear();
+	freeNodes.clear();
+	workerSearches.clear();
+
+	heights = nullptr;
+	compressedHeights = nullptr;
+	width = 0;
+	height = 0;
+	clustersX = 0;
+	clustersZ = 0;
+}
+
+float NavigationGrid::GetGridHeight(int x, int z) const
+{
+	return heights ? heights[(size_t)z * width + x] : compressedHeights->GetSample(x, z);
+}
+
+bool NavigationGrid::ComputeWalkable(int x, int z) const
+{
+	float center = GetGridHeight(x, z);
+
+	float left = GetGridHeight(std::max(x - 1, 0), z);
+	float right = GetGridHeight(std::min(x + 1, width - 1), z);
+	float down = GetGridHeight(x, std::max(z - 1, 0));
+	float up = GetGridHeight(x, std::min(z + 1, height - 1));
+
+	// stb_connected_components only knows open and closed squares, so the step limit is checked
+	// against all four neighbours instead of per move
+	if (fabsf(left - center) > settings.maxStep || fabsf(right - center) > settings.maxStep ||
+		fabsf(down - center) > settings.maxStep || fabsf(up - center) > settings.maxStep)
+		return false;
+
+	float dx = (right - left) / ((std::min(x + 1, width - 1) - std::max(x - 1, 0)) * cellSpace);
+	float dz = (up - down) / ((std::min(z + 1, height - 1) - std::max(z - 1, 0)) * cellSpace);
+
+	// Y of the normalized normal (-dx, 1, -dz)
+	return 1.0f / sqrtf(1.0f + dx * dx + dz * dz) >= minSlopeCos;
+}
+
+bool NavigationGrid::IsWalkable(int x, int z) const
+{
+	if (x < 0 || z < 0 || x >= width || z >= height)
+		return false;
+
+	return blocked[(size_t)z * width + x] == 0;
+}
+
+bool NavigationGrid::IsReachable(int startX, int startZ, int goalX, int goalZ) const
+{
+	if (!IsWalkable(startX, startZ) || !IsWalkable(goalX, goalZ))
+		return false;
+
+	return stbcc_query_grid_node_connection(connectivity, startX, startZ, goalX, goalZ) != 0;
+}
+
+int NavigationGrid::CreateNode(uint32_t cell, int cluster)
+{
+	int index;
+	if (!freeNodes.empty())
+	{
+		index = freeNodes.back();
+		freeNodes.pop_back();
+	}
+	else
+	{
+		index = (int)nodes.size();
+		nodes.push_back(Node());
+	}
+
+	Node& node = nodes[index];
+	node.cell = cell;
+	node.cluster = cluster;
+	node.alive = true;
+	node.edges.clear();
+
+	clusterNodes[cluster].push_back(index);
+	return index;
+}
+
+void NavigationGrid::AddInterEdge(int from, int to)
+{
+	nodes[from].edges.push_back({ to, 1.0f, true });
+	nodes[to].edges.push_back({ from, 1.0f, true });
+}
+
+void NavigationGrid::BuildBorder(int cluster, bool east)
+{
+	int clusterX = cluster % clustersX;
+	int clusterZ = cluster / clustersX;
+
+	// Border to the next cluster along x or z, the last column / row has none
+	if (east ? clusterX + 1 >= clustersX : clusterZ + 1 >= clustersZ)
+		return;
+
+	int neighbour = east ? cluster + 1 : cluster + clustersX;
+	std::vector<int>& border = east ? eastBorderNodes[cluster] : northBorderNodes[cluster];
+
+	// Position along the border and the fixed coordinate of the near side
+	int begin = east ? clusterZ * CLUSTER_SIZE : clusterX * CLUSTER_SIZE;
+	int end = std::min(begin + CLUSTER_SIZE, east ? height : width);
+	int nearSide = (east ? clusterX + 1 : clusterZ + 1) * CLUSTER_SIZE - 1;
+
+	auto GetCell = [&](int along, int across) -> uint32_t
+	{
+		return east ? (uint32_t)(along * width + across) : (uint32_t)(across * width + along);
+	};
+
+	auto AddTransition = [&](int along)
+	{
+		int a = CreateNode(GetCell(along, nearSide), cluster);
+		int b = CreateNode(GetCell(along, nearSide + 1), neighbour);
+		AddInterEdge(a, b);
+		border.push_back(a);
+		border.push_back(b);
+	};
+
+	int runStart = -1;
+	for (int along = begin; along <= end; along++)
+	{
+		bool open = along < end && blocked[GetCell(along, nearSide)] == 0 && blocked[GetCell(along, nearSide + 1)] == 0;
+
+		if (open && runStart < 0)
+			runStart = along;
+		else if (!open && runStart >= 0)
+		{
+			int length = along - runStart;
+			if (length < MAX_SINGLE_TRANSITION)
+				AddTransition(runStart + length / 2);
+			else
+			{
+				AddTransition(runStart);
+				AddTransition(along - 1);
+			}
+
+			runStart = -1;
+		}
+	}
+}
+
+void NavigationGrid::ClearBorder(int cluster, bool east)
+{
+	std::vector<int>& border = east ? eastBorderNodes[cluster] : northBorderNodes[cluster];
+
+	for (int index : border)
+	{
+		Node& node = nodes[index];
+		std::vector<int>& owner = clusterNodes[node.cluster];
+		owner.erase(std::remove(owner.begin(), owner.end(), index), owner.end());
+
+		node.alive = false;
+		node.edges.clear();
+		freeNodes.push_back(index);
+	}
+
+	border.clear();
+}
+
+void NavigationGrid::BuildIntraEdges(int cluster, ClusterSearch& search)
+{
+	const std::vector<int>& members = clusterNodes[cluster];
+
+	for (int index : members)
+	{
+		std::vector<Edge>& edges = nodes[index].edges;
+		edges.erase(std::remove_if(edges.begin(), edges.end(), [](const Edge& edge) { return !edge.inter; }), edges.end());
+	}
+
+	// Moves cost the same both ways, so one search per node covers the pairs after it
+	for (size_t i = 0; i + 1 < members.size(); i++)
+	{
+		SearchCluster(cluster, nodes[members[i]].cell, -1, search);
+
+		for (size_t j = i + 1; j < members.size(); j++)
+		{
+			float cost = GetSearchCost(search, nodes[members[j]].cell);
+			if (cost < INFINITE_COST)
+			{
+				nodes[members[i]].edges.push_back({ members[j], cost, false });
+				nodes[members[j]].edges.push_back({ members[i], cost, false });
+			}
+		}
+	}
+
+	pathCache[cluster].clear();
+}
+
+float NavigationGrid::Heuristic(uint32_t from, uint32_t to) const
+{
+	int dx = abs((int)(from % width) - (int)(to % width));
+	int dz = abs((int)(from / width) - (int)(to / width));
+
+	// Octile distance
+	return (float)std::max(dx, dz) + (DIAGONAL_COST - 1.0f) * (float)std::min(dx, dz);
+}
+
+void NavigationGrid::SearchCluster(int cluster, uint32_t start, int goal, ClusterSearch& search) const
+{
+	search.originX = (cluster % clustersX) * CLUSTER_SIZE;
+	search.originZ = (cluster / clustersX) * CLUSTER_SIZE;
+	search.sizeX = std::min((int)CLUSTER_SIZE, width - search.originX);
+	search.sizeZ = std::min((int)CLUSTER_SIZE, height - search.originZ);
+
+	size_t count = (size_t)CLUSTER_SIZE * CLUSTER_SIZE;
+	if (search.stamp.size() != count)
+	{
+		search.cost.resize(count);
+		search.parent.resize(count);
+		search.stamp.assign(count, 0);
+		search.current = 0;
+	}
+
+	// Stamps wrap after 4 billion searches, start clean when they do
+	if (++search.current == 0)
+	{
+		std::fill(search.stamp.begin(), search.stamp.end(), 0);
+		search.current = 1;
+	}
+
+	int goalLocal = -1;
+	if (goal >= 0)
+		goalLocal = ((int)(goal / width) - search.originZ) * search.sizeX + ((int)(goal % width) - search.originX);
+
+	int startLocal = ((int)(start / width) - search.originZ) * search.sizeX + ((int)(start % width) - search.originX);
+	search.cost[startLocal] = 0.0f;
+	search.parent[startLocal] = -1;
+	search.stamp[startLocal] = search.current;
+
+	search.heap.clear();
+	PushHeap(search.heap, goal >= 0 ? Heuristic(start, goal) : 0.0f, startLocal);
+
+	while (!search.heap.empty())
+	{
+		HeapEntry entry = PopHeap(search.heap);
+		int local = entry.second;
+
+		if (local == goalLocal)
+			return;
+
+		int x = local % search.sizeX;
+		int z = local / search.sizeX;
+		float cost = search.cost[local];
+
+		// Stale heap entry
+		float estimate = goal >= 0 ? Heuristic((uint32_t)((z + search.originZ) * width + x + search.originX), goal) : 0.0f;
+		if (entry.first > cost + estimate + 1.0e-4f)
+			continue;
+
+		for (int i = 0; i < 8; i++)
+		{
+			int nx = x + NEIGHBOUR_X[i];
+			int nz = z + NEIGHBOUR_Z[i];
+			if (nx < 0 || nz < 0 || nx >= search.sizeX || nz >= search.sizeZ)
+				continue;
+
+			int gx = nx + search.originX;
+			int gz = nz + search.originZ;
+			if (blocked[(size_t)gz * width + gx])
+				continue;
+
+			// Diagonals may not cut a blocked corner, so the reachable set is the same as with 4 neighbours
+			if (i >= 4 && (blocked[(size_t)(z + search.originZ) * width + gx] || blocked[(size_t)gz * width + x + search.originX]))
+				continue;
+
+			int next = nz * search.sizeX + nx;
+			float nextCost = cost + (i >= 4 ? DIAGONAL_COST : 1.0f);
+
+			if (search.stamp[next] == search.current && search.cost[next] <= nextCost)
+				continue;
+
+			search.cost[next] = nextCost;
+			search.parent[next] = local;
+			search.stamp[next] = search.current;
+
+			float priority = nextCost + (goal >= 0 ? Heuristic((uint32_t)(gz * width + gx), goal) : 0.0f);
+			PushHeap(search.heap, priority, next);
+		}
+	}
+}
+
+float NavigationGrid::GetSearchCost(const ClusterSearch& search, uint32_t cell) const
+{
+	int local = ((int)(cell / width) - search.originZ) * search.sizeX + ((int)(cell % width) - search.originX);
+	return search.stamp[local] == search.current ? search.cost[local] : INFINITE_COST;
+}
+
+void NavigationGrid::AppendSearchPath(const ClusterSearch& search, uint32_t cell, std::vector<uint32_t>& path, bool reverse) const
+{
+	std::vector<uint32_t> points;
+	int local = ((int)(cell / width) - search.originZ) * search.sizeX + ((int)(cell % width) - search.originX);
+
+	while (local >= 0)
+	{
+		points.push_back((uint32_t)((local / search.sizeX + search.originZ) * width + local % search.sizeX + search.originX));
+		local = search.parent[local];
+	}
+
+	// Parents lead from the cell back to where the search started
+	if (!reverse)
+		std::reverse(points.begin(), points.end());
+
+	AppendPoints(path, points.data(), points.size());
+}
+
+const std::vector<uint32_t>& NavigationGrid::GetCachedPath(int from, int to)
+{
+	int cluster = nodes[from].cluster;
+	uint64_t key = ((uint64_t)from << 32) | (uint32_t)to;
+
+	auto found = pathCache[cluster].find(key);
+	if (found != pathCache[cluster].end())
+		return found->second;
+
+	std::vector<uint32_t>& path = pathCache[cluster][key];
+	SearchCluster(cluster, nodes[from].cell, (int)nodes[to].cell, refineSearch);
+	AppendSearchPath(refineSearch, nodes[to].cell, path, false);
+
+	return path;
+}
+
+bool NavigationGrid::FindPath(int startX, int startZ, int goalX, int goalZ, std::vector<uint32_t>& path)
+{
+	path.clear();
+
+	// Walkability and connectivity first, unreachable goals never start a search
+	if (!IsReachable(startX, startZ, goalX, goalZ))
+		return false;
+
+	uint32_t start = (uint32_t)(startZ * width + startX);
+	uint32_t goal = (uint32_t)(goalZ * width + goalX);
+
+	if (start == goal)
+	{
+		path.push_back(start);
+		return true;
+	}
+
+	int startCluster = GetClusterIndex(startX, startZ);
+	int goalCluster = GetClusterIndex(goalX, goalZ);
+
+	// Both in one cluster, try a local search before going through the graph
+	if (startCluster == goalCluster)
+	{
+		SearchCluster(startCluster, start, (int)goal, startSearch);
+		if (GetSearchCost(startSearch, goal) < INFINITE_COST)
+		{
+			AppendSearchPath(startSearch, goal, path, false);
+			return true;
+		}
+	}
+
+	SearchCluster(startCluster, start, -1, startSearch);
+	SearchCluster(goalCluster, goal, -1, goalSearch);
+
+	// Abstract A*, the goal is a virtual node past the last real one
+	int goalNode = (int)nodes.size();
+	if (nodeStamp.size() < nodes.size() + 1)
+	{
+		nodeCost.resize(nodes.size() + 1);
+		nodeParent.resize(nodes.size() + 1);
+		nodeStamp.resize(nodes.size() + 1, 0);
+	}
+
+	if (++nodeSearch == 0)
+	{
+		std::fill(nodeStamp.begin(), nodeStamp.end(), 0);
+		nodeSearch = 1;
+	}
+
+	std::vector<HeapEntry>& heap = refineSearch.heap;
+	heap.clear();
+
+	auto Relax = [&](int node, int parent, float cost, uint32_t cell)
+	{
+		if (nodeStamp[node] == nodeSearch && nodeCost[node] <= cost)
+			return;
+
+		nodeCost[node] = cost;
+		nodeParent[node] = parent;
+		nodeStamp[node] = nodeSearch;
+		PushHeap(heap, cost + Heuristic(cell, goal), node);
+	};
+
+	for (int node : clusterNodes[startCluster])
+	{
+		float cost = GetSearchCost(startSearch, nodes[node].cell);
+		if (cost < INFINITE_COST)
+			Relax(node, -1, cost, nodes[node].cell);
+	}
+
+	bool found = false;
+	while (!heap.empty())
+	{
+		HeapEntry entry = PopHeap(heap);
+		int node = entry.second;
+
+		if (node == goalNode)
+		{
+			found = true;
+			break;
+		}
+
+		float cost = nodeCost[node];
+		if (entry.first > cost + Heuristic(nodes[node].cell, goal) + 1.0e-4f)
+			continue;
+
+		for (const Edge& edge : nodes[node].edges)
+			Relax(edge.target, node, cost + edge.cost, nodes[edge.target].cell);
+
+		if (nodes[node].cluster == goalCluster)
+		{
+			float toGoal = GetSearchCost(goalSearch, nodes[node].cell);
+			if (toGoal < INFINITE_COST)
+				Relax(goalNode, node, cost + toGoal, goal);
+		}
+	}
+
+	// Connectivity said yes, so this only happens when the graph is out of date
+	if (!found)
+		return false;
+
+	std::vector<int> route;
+	for (int node = nodeParent[goalNode]; node >= 0; node = nodeParent[node])
+		route.push_back(node);
+	std::reverse(route.begin(), route.end());
+
+	AppendSearchPath(startSearch, nodes[route.front()].cell, path, false);
+
+	for (size_t i = 1; i < route.size(); i++)
+	{
+		const Node& from = nodes[route[i - 1]];
+		const Node& to = nodes[route[i]];
+
+		if (from.cluster != to.cluster)
+			AppendPoints(path, &to.cell, 1);
+		else
+		{
+			const std::vector<uint32_t>& segment = GetCachedPath(route[i - 1], route[i]);
+			AppendPoints(path, segment.data(), segment.size());
+		}
+	}
+
+	// The goal search started at the goal, so its parents already point the right way
+	AppendSearchPath(goalSearch, nodes[route.back()].cell, path, true);
+
+	return true;
+}
+
+int NavigationGrid::UpdateRegion(int minX, int minZ, int maxX, int maxZ, JobSystem& jobSystem)
+{
+	if (!connectivity)
+		return 0;
+
+	// Slope and step read the neighbours, so the points around the edit can change too
+	minX = std::max(minX - 1, 0);
+	minZ = std::max(minZ - 1, 0);
+	maxX = std::min(maxX + 1, width - 1);
+	maxZ = std::min(maxZ + 1, height - 1);
+	if (minX > maxX || minZ > maxZ)
+		return 0;
+
+	int clusterCount = clustersX * clustersZ;
+	std::vector<uint8_t> dirty(clusterCount, 0);
+	int changed = 0;
+
+	stbcc_update_batch_begin(connectivity);
+	for (int z = minZ; z <= maxZ; z++)
+	{
+		for (int x = minX; x <= maxX; x++)
+		{
+			uint8_t value = ComputeWalkable(x, z) ? 0 : 1;
+			uint8_t& current = blocked[(size_t)z * width + x];
+			if (value == current)
+				continue;
+
+			current = value;
+			stbcc_update_grid(connectivity, x, z, value);
+			dirty[GetClusterIndex(x, z)] = 1;
+			stats.walkableCells += value ? -1 : 1;
+			changed++;
+		}
+	}
+	stbcc_update_batch_end(connectivity);
+
+	if (changed == 0)
+		return 0;
+
+	// Every border of a changed cluster is rebuilt, so the clusters on the other side need new edges too
+	std::vector<uint8_t> rebuild(clusterCount, 0);
+	for (int cluster = 0; cluster < clusterCount; cluster++)
+	{
+		if (!dirty[cluster])
+			continue;
+
+		int clusterX = cluster % clustersX;
+		int clusterZ = cluster / clustersX;
+		rebuild[cluster] = 1;
+
+		if (clusterX + 1 < clustersX)
+		{
+			ClearBorder(cluster, true);
+			rebuild[cluster + 1] = 1;
+		}
+		if (clusterX > 0 && !dirty[cluster - 1])
+		{
+			ClearBorder(cluster - 1, true);
+			rebuild[cluster - 1] = 1;
+		}
+		if (clusterZ + 1 < clustersZ)
+		{
+			ClearBorder(cluster, false);
+			rebuild[cluster + clustersX] = 1;
+		}
+		if (clusterZ > 0 && !dirty[cluster - clustersX])
+		{
+			ClearBorder(cluster - clustersX, false);
+			rebuild[cluster - clustersX] = 1;
+		}
+	}
+
+	for (int cluster = 0; cluster < clusterCount; cluster++)
+	{
+		if (!dirty[cluster])
+			continue;
+
+		int clusterX = cluster % clustersX;
+		int clusterZ = cluster / clustersX;
+
+		BuildBorder(cluster, true);
+		BuildBorder(cluster, false);
+		if (clusterX > 0 && !dirty[cluster - 1])
+			BuildBorder(cluster - 1, true);
+		if (clusterZ > 0 && !dirty[cluster - clustersX])
+			BuildBorder(cluster - clustersX, false);
+	}
+
+	std::vector<int> rebuildList;
+	for (int cluster = 0; cluster < clusterCount; cluster++)
+	{
+		if (rebuild[cluster])
+			rebuildList.push_back(cluster);
+	}
+
+	jobSystem.ParallelFor((int)rebuildList.size(), [&](int job, int threadIndex)
+	{
+		BuildIntraEdges(rebuildList[job], workerSearches[threadIndex]);
+	});
+
+	stats.abstractNodes = 0;
+	stats.abstractEdges = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (!nodes[i].alive)
+			continue;
+
+		stats.abstractNodes++;
+		stats.abstractEdges += (int)nodes[i].edges.size();
+	}
+
+	return changed;
+}
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+#include "Terrain.h"
+#include "JobSystem.h"
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+struct st_stbcc_grid;
+
+/*
+	Walkability and pathfinding on the terrain height grid.
+	A grid point is walkable when its slope and the height step to its neighbours are within the limits.
+	Connectivity is kept by stb_connected_components, so a query between two disconnected points fails
+	without searching. Paths are found with HPA*: the grid is split into clusters, the border crossings
+	between clusters form an abstract graph and only the path through that graph is refined.
+	Refined paths inside a cluster are cached until the cluster changes.
+	Queries are not thread safe, they share the search buffers and the path cache.
+*/
+class NavigationGrid
+{
+public:
+	static const int CLUSTER_SIZE = 32;
+	static const int MAX_GRID_SIZE = 4096;	// Compile time limit of the connected components grid
+
+	struct Settings
+	{
+		float maxSlope = 35.0f;		// Degrees
+		float maxStep = 0.5f;		// Largest height difference to a neighbouring grid point, world units
+	};
+
+	struct Stats
+	{
+		int walkableCells = 0;
+		int abstractNodes = 0;
+		int abstractEdges = 0;
+		double buildMilliseconds = 0.0;
+		size_t connectivityBytes = 0;
+	};
+
+public:
+	NavigationGrid();
+	~NavigationGrid();
+
+	// The heights have to stay alive, UpdateRegion reads them again after they were edited
+	bool Initialize(const float* heights, int width, int height, float cellSpace, const Settings& settings, JobSystem& jobSystem);
+	bool Initialize(const CompressedHeightfield& heights, float cellSpace, const Settings& settings, JobSystem& jobSystem);
+
+	// Reads the terrain's compressed heights, the raw grid only when it has no compressed copy
+	bool Initialize(const Terrain* terrain, const Settings& settings, JobSystem& jobSystem);
+	void Shutdown();
+
+	// Heights inside the rectangle (inclusive, grid points) changed. Rebuilds only the clusters whose walkability changed
+	int UpdateRegion(int minX, int minZ, int maxX, int maxZ, JobSystem& jobSystem);
+
+	bool IsWalkable(int x, int z) const;
+
+	// O(1), no search
+	bool IsReachable(int startX, int startZ, int goalX, int goalZ) const;
+
+	// Grid points from start to goal, both included. Returns false if there is no path
+	bool FindPath(int startX, int startZ, int goalX, int goalZ, std::vector<uint32_t>& path);
+
+	int GetWidth() const { return this->width; }
+	int GetHeight() const { return this->height; }
+	const Stats& GetStats() const { return this->stats; }
+
+private:
+	struct Edge
+	{
+		int target;
+		float cost;
+		bool inter;		// Crossing to the neighbour cluster, otherwise a path inside the cluster
+	};
+
+	struct Node
+	{
+		uint32_t cell;
+		int cluster;
+		bool alive;
+		std::vector<Edge> edges;
+	};
+
+	// Dijkstra / A* buffers for one cluster, reset through the stamp instead of clearing
+	struct ClusterSearch
+	{
+		std::vector<float> cost;
+		std::vector<int> parent;
+		std::vector<uint32_t> stamp;
+		std::vector<std::pair<float, int>> heap;
+		uint32_t current = 0;
+		int originX = 0, originZ = 0;
+		int sizeX = 0, sizeZ = 0;
+	};
+
+	bool Build(const float* heights, const CompressedHeightfield* compressedHeights, int width, int height, float cellSpace, const Settings& settings, JobSystem& jobSystem);
+
+	float GetGridHeight(int x, int z) const;
+	bool ComputeWalkable(int x, int z) const;
+	int GetClusterIndex(int x, int z) const { return (z / CLUSTER_SIZE) * clustersX + (x / CLUSTER_SIZE); }
+
+	void BuildBorder(int cluster, bool east);
+	void ClearBorder(int cluster, bool east);
+	void BuildIntraEdges(int cluster, ClusterSearch& search);
+
+	int CreateNode(uint32_t cell, int cluster);
+	void AddInterEdge(int from, int to);
+
+	// Searches inside one cluster from a grid point. goal < 0 runs a full Dijkstra
+	void SearchCluster(int cluster, uint32_t start, int goal, ClusterSearch& search) const;
+	float GetSearchCost(const ClusterSearch& search, uint32_t cell) const;
+	void AppendSearchPath(const ClusterSearch& search, uint32_t cell, std::vector<uint32_t>& path, bool reverse) const;
+
+	const std::vector<uint32_t>& GetCachedPath(int from, int to);
+	float Heuristic(uint32_t from, uint32_t to) const;
+
+private:
+	const float* heights;						// One of the two, the other is null
+	const CompressedHeightfield* compressedHeights;
+	int width, height;
+	float cellSpace;
+	Settings settings;
+	float minSlopeCos;
+
+	// 0 = walkable, like stb_connected_components wants it
+	std::vector<uint8_t> blocked;
+	st_stbcc_grid* connectivity;
+	int connectivityWidth, connectivityHeight;
+
+	int clustersX, clustersZ;
+	std::vector<std::vector<int>> clusterNodes;
+	std::vector<std::vector<int>> eastBorderNodes;	// Nodes on the border to the cluster at +x, both sides
+	std::vector<std::vector<int>> northBorderNodes;	// Nodes on the border to the cluster at +z
+	std::vector<std::unordered_map<uint64_t, std::vector<uint32_t>>> pathCache;
+
+	std::vector<Node> nodes;
+	std::vector<int> freeNodes;
+
+	std::vector<ClusterSearch> workerSearches;
+	ClusterSearch startSearch, goalSearch, refineSearch;
+
+	// Abstract A*
+	std::vector<float> nodeCost;
+	std::vector<int> nodeParent;
+	std::vector<uint32_t> nodeStamp;
+	uint32_t nodeSearch;
+
+	Stats stats;
+};
\ No newline at end of file
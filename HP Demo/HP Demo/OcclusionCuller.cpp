@@ -0,0 +1,580 @@
+#include "OcclusionCuller.h"
+#include "Model.h"
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <immintrin.h>
+
+// Vertices transformed per job, and triangles set up per job
+static const int TRANSFORM_BATCH = 4096;
+static const int SETUP_BATCH = 1024;
+
+// Triangles are clipped to this many times the screen, so the edge functions keep their precision
+static const float GUARD_BAND = 2.0f;
+
+static const int MAX_CLIPPED = 3 + 5;
+
+OcclusionCuller::OcclusionCuller()
+{
+	this->width = 0;
+	this->height = 0;
+	this->tilesX = 0;
+	this->tilesY = 0;
+	this->vertexCount = 0;
+	this->occluderCount = 0;
+	this->rendered = false;
+	DirectX::XMStoreFloat4x4(&this->viewProjection, DirectX::XMMatrixIdentity());
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+}
+
+bool OcclusionCuller::Initialize(int width, int height)
+{
+	if (width <= 0 || height <= 0 || width % TILE_WIDTH != 0 || height % TILE_HEIGHT != 0)
+		return false;
+
+	this->width = width;
+	this->height = height;
+	this->tilesX = width / TILE_WIDTH;
+	this->tilesY = height / TILE_HEIGHT;
+
+	// Down to one texel per tile in the smaller direction
+	levels.clear();
+	for (int level = 0; (TILE_WIDTH >> level) >= 1 && (TILE_HEIGHT >> level) >= 1; level++)
+		levels.push_back(std::vector<float>((size_t)(width >> level) * (height >> level), 1.0f));
+
+	rendered = false;
+	return true;
+}
+
+void OcclusionCuller::ClearOccluders()
+{
+	vertexX.clear();
+	vertexY.clear();
+	vertexZ.clear();
+	indices.clear();
+	vertexCount = 0;
+	occluderCount = 0;
+}
+
+int OcclusionCuller::AddOccluder(const DirectX::XMFLOAT3* vertices, int count, const DWORD* occluderIndices, int indexCount, DirectX::XMMATRIX world)
+{
+	using namespace DirectX;
+
+	// Occluders don't move, they are kept in world space
+	DWORD base = (DWORD)vertexCount;
+	vertexX.resize(vertexCount);
+	vertexY.resize(vertexCount);
+	vertexZ.resize(vertexCount);
+	for (int i = 0; i < count; i++)
+	{
+		XMFLOAT3 position;
+		XMStoreFloat3(&position, XMVector3TransformCoord(XMLoadFloat3(&vertices[i]), world));
+		vertexX.push_back(position.x);
+		vertexY.push_back(position.y);
+		vertexZ.push_back(position.z);
+	}
+	vertexCount += count;
+
+	// Padding for the last batch of 4, never indexed
+	size_t padded = (size_t)(vertexCount + 3) / 4 * 4;
+	vertexX.resize(padded, 0.0f);
+	vertexY.resize(padded, 0.0f);
+	vertexZ.resize(padded, 0.0f);
+
+	for (int i = 0; i + 2 < indexCount; i += 3)
+	{
+		indices.push_back(base + occluderIndices[i]);
+		indices.push_back(base + occluderIndices[i + 1]);
+		indices.push_back(base + occluderIndices[i + 2]);
+	}
+
+	return occluderCount++;
+}
+
+int OcclusionCuller::AddOccluder(Model* model)
+{
+	std::vector<DirectX::XMFLOAT3> positions;
+	positions.reserve(model->GetVertices().size());
+	for (const Vertex& vertex : model->GetVertices())
+		positions.push_back(vertex.pos);
+
+	const std::vector<DWORD>& modelIndices = model->GetIndices();
+	return AddOccluder(positions.data(), (int)positions.size(), modelIndices.data(), (int)modelIndices.size(), model->GetWorldMatrix());
+}
+
+int OcclusionCuller::AddHeightfield(const std::vector<float>& heights, int width, int height, float cellSpace, int step, DirectX::XMMATRIX world)
+{
+	step = std::max(step, 1);
+	int coarseWidth = (width - 2) / step + 2;
+	int coarseHeight = (height - 2) / step + 2;
+
+	std::vector<DirectX::XMFLOAT3> positions;
+	positions.reserve((size_t)coarseWidth * coarseHeight);
+	for (int cz = 0; cz < coarseHeight; cz++)
+	{
+		for (int cx = 0; cx < coarseWidth; cx++)
+		{
+			// The last row and column land on the edge of the heightfield
+			int x = std::min(cx * step, width - 1);
+			int z = std::min(cz * step, height - 1);
+
+			// Lowest sample of the coarse cells around the corner, the triangles between corners never rise above the real surface
+			float lowest = heights[(size_t)z * width + x];
+			for (int sz = std::max(z - step, 0); sz <= std::min(z + step, height - 1); sz++)
+			{
+				for (int sx = std::max(x - step, 0); sx <= std::min(x + step, width - 1); sx++)
+					lowest = std::min(lowest, heights[(size_t)sz * width + sx]);
+			}
+
+			positions.push_back(DirectX::XMFLOAT3(x * cellSpace, lowest, z * cellSpace));
+		}
+	}
+
+	// Same winding as Terrain::CreateTerrain
+	std::vector<DWORD> gridIndices;
+	gridIndices.reserve((size_t)(coarseWidth - 1) * (coarseHeight - 1) * 6);
+	for (int cz = 0; cz < coarseHeight - 1; cz++)
+	{
+		for (int cx = 0; cx < coarseWidth - 1; cx++)
+		{
+			DWORD index = (DWORD)(cz * coarseWidth + cx);
+			gridIndices.push_back(index + coarseWidth);
+			gridIndices.push_back(index + coarseWidth + 1);
+			gridIndices.push_back(index + 1);
+
+			gridIndices.push_back(index + coarseWidth);
+			gridIndices.push_back(index + 1);
+			gridIndices.push_back(index);
+		}
+	}
+
+	return AddOccluder(positions.data(), (int)positions.size(), gridIndices.data(), (int)gridIndices.size(), world);
+}
+
+void OcclusionCuller::TransformVertices(int first, int last)
+{
+	const DirectX::XMFLOAT4X4& m = viewProjection;
+	__m128 m00 = _mm_set1_ps(m._11), m01 = _mm_set1_ps(m._12), m02 = _mm_set1_ps(m._13), m03 = _mm_set1_ps(m._14);
+	__m128 m10 = _mm_set1_ps(m._21), m11 = _mm_set1_ps(m._22), m12 = _mm_set1_ps(m._23), m13 = _mm_set1_ps(m._24);
+	__m128 m20 = _mm_set1_ps(m._31), m21 = _mm_set1_ps(m._32), m22 = _mm_set1_ps(m._33), m23 = _mm_set1_ps(m._34);
+	__m128 m30 = _mm_set1_ps(m._41), m31 = _mm_set1_ps(m._42), m32 = _mm_set1_ps(m._43), m33 = _mm_set1_ps(m._44);
+
+	// Row vectors, clip = x * row 0 + y * row 1 + z * row 2 + row 3, four vertices at a time
+	for (int i = first; i < last; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&vertexX[i]);
+		__m128 y = _mm_loadu_ps(&vertexY[i]);
+		__m128 z = _mm_loadu_ps(&vertexZ[i]);
+
+		_mm_storeu_ps(&clipX[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m00), _mm_mul_ps(y, m10)), _mm_add_ps(_mm_mul_ps(z, m20), m30)));
+		_mm_storeu_ps(&clipY[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m01), _mm_mul_ps(y, m11)), _mm_add_ps(_mm_mul_ps(z, m21), m31)));
+		_mm_storeu_ps(&clipZ[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m02), _mm_mul_ps(y, m12)), _mm_add_ps(_mm_mul_ps(z, m22), m32)));
+		_mm_storeu_ps(&clipW[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m03), _mm_mul_ps(y, m13)), _mm_add_ps(_mm_mul_ps(z, m23), m33)));
+	}
+}
+
+// Signed distances to the near plane and the guard band, inside where all are >= 0
+static void ClipDistances(const DirectX::XMFLOAT4& v, float distances[5])
+{
+	distances[0] = v.z;
+	distances[1] = GUARD_BAND * v.w - v.x;
+	distances[2] = GUARD_BAND * v.w + v.x;
+	distances[3] = GUARD_BAND * v.w - v.y;
+	distances[4] = GUARD_BAND * v.w + v.y;
+}
+
+void OcclusionCuller::SetupTriangles(int first, int last, Bin& bin)
+{
+	using namespace DirectX;
+
+	for (int t = first; t < last; t++)
+	{
+		XMFLOAT4 polygon[MAX_CLIPPED];
+		float distances[3][5];
+		int outsideAll = 0x1f, outsideAny = 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			DWORD index = indices[t * 3 + corner];
+			polygon[corner] = XMFLOAT4(clipX[index], clipY[index], clipZ[index], clipW[index]);
+			ClipDistances(polygon[corner], distances[corner]);
+
+			int outside = 0;
+			for (int p = 0; p < 5; p++)
+				outside |= (distances[corner][p] < 0.0f) << p;
+			outsideAll &= outside;
+			outsideAny |= outside;
+		}
+
+		// All three behind the same plane
+		if (outsideAll)
+			continue;
+
+		if (!outsideAny)
+		{
+			SetupClipped(polygon, 3, bin);
+			continue;
+		}
+
+		// Sutherland-Hodgman against the planes the triangle crosses
+		int count = 3;
+		for (int p = 0; p < 5 && count >= 3; p++)
+		{
+			if (!(outsideAny & (1 << p)))
+				continue;
+
+			XMFLOAT4 clipped[MAX_CLIPPED];
+			int clippedCount = 0;
+			for (int i = 0; i < count; i++)
+			{
+				const XMFLOAT4& a = polygon[i];
+				const XMFLOAT4& b = polygon[(i + 1) % count];
+				float da[5], db[5];
+				ClipDistances(a, da);
+				ClipDistances(b, db);
+
+				if (da[p] >= 0.0f)
+					clipped[clippedCount++] = a;
+				if ((da[p] >= 0.0f) != (db[p] >= 0.0f))
+				{
+					float s = da[p] / (da[p] - db[p]);
+					clipped[clippedCount++] = XMFLOAT4(a.x + (b.x - a.x) * s, a.y + (b.y - a.y) * s, a.z + (b.z - a.z) * s, a.w + (b.w - a.w) * s);
+				}
+			}
+
+			memcpy(polygon, clipped, sizeof(XMFLOAT4) * clippedCount);
+			count = clippedCount;
+		}
+
+		if (count >= 3)
+			SetupClipped(polygon, count, bin);
+	}
+}
+
+void OcclusionCuller::SetupClipped(const DirectX::XMFLOAT4* polygon, int count, Bin& bin)
+{
+	// To pixels, y down, with depth in [0, 1]
+	float x[MAX_CLIPPED], y[MAX_CLIPPED], z[MAX_CLIPPED];
+	for (int i = 0; i < count; i++)
+	{
+		float invW = 1.0f / polygon[i].w;
+		x[i] = (polygon[i].x * invW * 0.5f + 0.5f) * width;
+		y[i] = (0.5f - polygon[i].y * invW * 0.5f) * height;
+		z[i] = polygon[i].z * invW;
+	}
+
+	// Fan of the clipped polygon
+	for (int i = 1; i + 1 < count; i++)
+	{
+		int v[3] = { 0, i, i + 1 };
+
+		// Clockwise on screen is the front, as in the default rasterizer state
+		float area = (x[v[1]] - x[v[0]]) * (y[v[2]] - y[v[0]]) - (x[v[2]] - x[v[0]]) * (y[v[1]] - y[v[0]]);
+		if (!(area > 0.0f))
+			continue;
+
+		// Pixels whose centers can be inside
+		float minX = std::min(x[v[0]], std::min(x[v[1]], x[v[2]]));
+		float maxX = std::max(x[v[0]], std::max(x[v[1]], x[v[2]]));
+		float minY = std::min(y[v[0]], std::min(y[v[1]], y[v[2]]));
+		float maxY = std::max(y[v[0]], std::max(y[v[1]], y[v[2]]));
+
+		Triangle triangle;
+		triangle.minX = std::max((int)ceilf(minX - 0.5f), 0);
+		triangle.maxX = std::min((int)floorf(maxX - 0.5f), width - 1);
+		triangle.minY = std::max((int)ceilf(minY - 0.5f), 0);
+		triangle.maxY = std::min((int)floorf(maxY - 0.5f), height - 1);
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+			continue;
+
+		for (int e = 0; e < 3; e++)
+		{
+			int a = v[e], b = v[(e + 1) % 3];
+			triangle.edgeA[e] = y[a] - y[b];
+			triangle.edgeB[e] = x[b] - x[a];
+			triangle.edgeC[e] = -(triangle.edgeA[e] * x[a] + triangle.edgeB[e] * y[a]);
+		}
+
+		// Depth is linear in screen space. The farthest it gets inside a pixel is what the pixel holds
+		float depthX = ((z[v[1]] - z[v[0]]) * (y[v[2]] - y[v[0]]) - (z[v[2]] - z[v[0]]) * (y[v[1]] - y[v[0]])) / area;
+		float depthY = ((x[v[1]] - x[v[0]]) * (z[v[2]] - z[v[0]]) - (x[v[2]] - x[v[0]]) * (z[v[1]] - z[v[0]])) / area;
+		triangle.depthA = depthX;
+		triangle.depthB = depthY;
+		triangle.depthC = z[v[0]] - depthX * x[v[0]] - depthY * y[v[0]] + 0.5f * (fabsf(depthX) + fabsf(depthY));
+		triangle.depthMax = std::max(z[v[0]], std::max(z[v[1]], z[v[2]]));
+
+		int index = (int)bin.triangles.size();
+		bin.triangles.push_back(triangle);
+
+		for (int ty = triangle.minY / TILE_HEIGHT; ty <= triangle.maxY / TILE_HEIGHT; ty++)
+		{
+			for (int tx = triangle.minX / TILE_WIDTH; tx <= triangle.maxX / TILE_WIDTH; tx++)
+				bin.tiles[ty * tilesX + tx].push_back(index);
+		}
+	}
+}
+
+void OcclusionCuller::RasterizeTile(int tile)
+{
+	int tileX = (tile % tilesX) * TILE_WIDTH;
+	int tileY = (tile / tilesX) * TILE_HEIGHT;
+	float* depth = levels[0].data();
+
+	for (int y = tileY; y < tileY + TILE_HEIGHT; y++)
+		std::fill(depth + (size_t)y * width + tileX, depth + (size_t)y * width + tileX + TILE_WIDTH, 1.0f);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 centers = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+	for (const Bin& bin : bins)
+	{
+		for (int index : bin.tiles[tile])
+		{
+			const Triangle& triangle = bin.triangles[index];
+
+			// Tiles start on a multiple of 4, so the spans of 4 never leave the tile
+			int minX = std::max(triangle.minX, tileX) & ~3;
+			int maxX = std::min(triangle.maxX, tileX + TILE_WIDTH - 1);
+			int minY = std::max(triangle.minY, tileY);
+			int maxY = std::min(triangle.maxY, tileY + TILE_HEIGHT - 1);
+
+			__m128 a0 = _mm_set1_ps(triangle.edgeA[0]), a1 = _mm_set1_ps(triangle.edgeA[1]), a2 = _mm_set1_ps(triangle.edgeA[2]);
+			__m128 depthA = _mm_set1_ps(triangle.depthA);
+			__m128 depthMax = _mm_set1_ps(triangle.depthMax);
+
+			for (int y = minY; y <= maxY; y++)
+			{
+				float centerY = y + 0.5f;
+				__m128 row0 = _mm_set1_ps(triangle.edgeB[0] * centerY + triangle.edgeC[0]);
+				__m128 row1 = _mm_set1_ps(triangle.edgeB[1] * centerY + triangle.edgeC[1]);
+				__m128 row2 = _mm_set1_ps(triangle.edgeB[2] * centerY + triangle.edgeC[2]);
+				__m128 rowDepth = _mm_set1_ps(triangle.depthB * centerY + triangle.depthC);
+				float* line = depth + (size_t)y * width;
+
+				for (int x = minX; x <= maxX; x += 4)
+				{
+					__m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), centers);
+					__m128 inside = _mm_and_ps(_mm_and_ps(
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, centerX), row0), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, centerX), row1), zero)),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, centerX), row2), zero));
+					if (_mm_movemask_ps(inside) == 0)
+						continue;
+
+					// Nearest of what is there and the triangle, only where the triangle covers the pixel center
+					__m128 triangleDepth = _mm_min_ps(_mm_add_ps(_mm_mul_ps(depthA, centerX), rowDepth), depthMax);
+					__m128 current = _mm_loadu_ps(line + x);
+					__m128 nearest = _mm_min_ps(current, triangleDepth);
+					_mm_storeu_ps(line + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+				}
+			}
+		}
+	}
+}
+
+void OcclusionCuller::ReduceTile(int tile)
+{
+	int tileX = (tile % tilesX) * TILE_WIDTH;
+	int tileY = (tile / tilesX) * TILE_HEIGHT;
+
+	for (int level = 1; level < (int)levels.size(); level++)
+	{
+		const float* source = levels[level - 1].data();
+		float* target = levels[level].data();
+		int sourceWidth = width >> (level - 1);
+		int targetWidth = width >> level;
+
+		for (int y = tileY >> level; y < (tileY + TILE_HEIGHT) >> level; y++)
+		{
+			const float* top = source + (size_t)y * 2 * sourceWidth;
+			const float* bottom = top + sourceWidth;
+			for (int x = tileX >> level; x < (tileX + TILE_WIDTH) >> level; x++)
+				target[(size_t)y * targetWidth + x] = std::max(std::max(top[x * 2], top[x * 2 + 1]), std::max(bottom[x * 2], bottom[x * 2 + 1]));
+		}
+	}
+}
+
+void OcclusionCuller::Render(DirectX::XMMATRIX viewProjection, JobSystem& jobSystem)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	DirectX::XMStoreFloat4x4(&this->viewProjection, viewProjection);
+	stats = Stats();
+	stats.occluders = occluderCount;
+	stats.occluderTriangles = (int)(indices.size() / 3);
+
+	size_t padded = vertexX.size();
+	clipX.resize(padded);
+	clipY.resize(padded);
+	clipZ.resize(padded);
+	clipW.resize(padded);
+
+	int transformJobs = (int)((padded + TRANSFORM_BATCH - 1) / TRANSFORM_BATCH);
+	jobSystem.ParallelFor(transformJobs, [&](int job, int threadIndex)
+	{
+		TransformVertices(job * TRANSFORM_BATCH, (int)std::min(padded, (size_t)(job + 1) * TRANSFORM_BATCH));
+	});
+
+	// Every setup job bins into its own lists, the tiles read all of them
+	int triangleCount = stats.occluderTriangles;
+	int setupJobs = (triangleCount + SETUP_BATCH - 1) / SETUP_BATCH;
+	bins.resize(setupJobs);
+	for (Bin& bin : bins)
+	{
+		bin.triangles.clear();
+		bin.tiles.resize(tilesX * tilesY);
+		for (std::vector<int>& list : bin.tiles)
+			list.clear();
+	}
+
+	jobSystem.ParallelFor(setupJobs, [&](int job, int threadIndex)
+	{
+		SetupTriangles(job * SETUP_BATCH, std::min(triangleCount, (job + 1) * SETUP_BATCH), bins[job]);
+	});
+
+	for (const Bin& bin : bins)
+	{
+		for (const std::vector<int>& list : bin.tiles)
+			stats.rasterizedTriangles += (int)list.size();
+	}
+
+	jobSystem.ParallelFor(tilesX * tilesY, [&](int tile, int threadIndex)
+	{
+		RasterizeTile(tile);
+		ReduceTile(tile);
+	});
+
+	rendered = true;
+	stats.renderMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool OcclusionCuller::ProjectBox(const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax, DirectX::XMMATRIX world, ScreenBox& box) const
+{
+	using namespace DirectX;
+
+	if (!rendered)
+		return false;
+
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, world * XMLoadFloat4x4(&viewProjection));
+
+	// The 8 corners as two groups of 4, the bottom and the top of the box
+	__m128 x = _mm_setr_ps(boxMin.x, boxMax.x, boxMin.x, boxMax.x);
+	__m128 z = _mm_setr_ps(boxMin.z, boxMin.z, boxMax.z, boxMax.z);
+	__m128 minScreenX = _mm_set1_ps(FLT_MAX), minScreenY = _mm_set1_ps(FLT_MAX), minDepth = _mm_set1_ps(FLT_MAX);
+	__m128 maxScreenX = _mm_set1_ps(-FLT_MAX), maxScreenY = _mm_set1_ps(-FLT_MAX);
+	__m128 behind = _mm_setzero_ps();
+
+	for (int group = 0; group < 2; group++)
+	{
+		__m128 y = _mm_set1_ps(group ? boxMax.y : boxMin.y);
+		__m128 clipX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m._11)), _mm_mul_ps(y, _mm_set1_ps(m._21))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m._31)), _mm_set1_ps(m._41)));
+		__m128 clipY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m._12)), _mm_mul_ps(y, _mm_set1_ps(m._22))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m._32)), _mm_set1_ps(m._42)));
+		__m128 clipZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m._13)), _mm_mul_ps(y, _mm_set1_ps(m._23))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m._33)), _mm_set1_ps(m._43)));
+		__m128 clipW = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m._14)), _mm_mul_ps(y, _mm_set1_ps(m._24))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m._34)), _mm_set1_ps(m._44)));
+
+		behind = _mm_or_ps(behind, _mm_cmplt_ps(clipZ, _mm_setzero_ps()));
+
+		__m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), clipW);
+		__m128 screenX = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(clipX, invW), _mm_set1_ps(0.5f)), _mm_set1_ps(0.5f)), _mm_set1_ps((float)width));
+		__m128 screenY = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(_mm_mul_ps(clipY, invW), _mm_set1_ps(0.5f))), _mm_set1_ps((float)height));
+
+		minScreenX = _mm_min_ps(minScreenX, screenX);
+		maxScreenX = _mm_max_ps(maxScreenX, screenX);
+		minScreenY = _mm_min_ps(minScreenY, screenY);
+		maxScreenY = _mm_max_ps(maxScreenY, screenY);
+		minDepth = _mm_min_ps(minDepth, _mm_mul_ps(clipZ, invW));
+	}
+
+	// A corner in front of the near plane, the projection can't be trusted
+	if (_mm_movemask_ps(behind))
+		return false;
+
+	float minXs[4], maxXs[4], minYs[4], maxYs[4], depths[4];
+	_mm_storeu_ps(minXs, minScreenX);
+	_mm_storeu_ps(maxXs, maxScreenX);
+	_mm_storeu_ps(minYs, minScreenY);
+	_mm_storeu_ps(maxYs, maxScreenY);
+	_mm_storeu_ps(depths, minDepth);
+
+	float left = std::min(std::min(minXs[0], minXs[1]), std::min(minXs[2], minXs[3]));
+	float right = std::max(std::max(maxXs[0], maxXs[1]), std::max(maxXs[2], maxXs[3]));
+	float top = std::min(std::min(minYs[0], minYs[1]), std::min(minYs[2], minYs[3]));
+	float bottom = std::max(std::max(maxYs[0], maxYs[1]), std::max(maxYs[2], maxYs[3]));
+
+	// Off screen is for the frustum culler to decide
+	if (right < 0.0f || bottom < 0.0f || left >= width || top >= height)
+		return false;
+
+	// Every pixel the box touches
+	box.minX = std::max((int)floorf(left), 0);
+	box.maxX = std::min((int)floorf(right), width - 1);
+	box.minY = std::max((int)floorf(top), 0);
+	box.maxY = std::min((int)floorf(bottom), height - 1);
+	box.minDepth = std::min(std::min(depths[0], depths[1]), std::min(depths[2], depths[3]));
+	return true;
+}
+
+bool OcclusionCuller::IsRectOccluded(const ScreenBox& box, int level) const
+{
+	const std::vector<float>& depth = levels[level];
+	int levelWidth = width >> level;
+
+	for (int y = box.minY >> level; y <= box.maxY >> level; y++)
+	{
+		for (int x = box.minX >> level; x <= box.maxX >> level; x++)
+		{
+			if (depth[(size_t)y * levelWidth + x] >= box.minDepth)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool OcclusionCuller::IsVisible(const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax, DirectX::XMMATRIX world) const
+{
+	ScreenBox box;
+	if (!ProjectBox(boxMin, boxMax, world, box))
+		return true;
+
+	// The level where the box covers at most about 2x2 texels
+	int extent = std::max(box.maxX - box.minX, box.maxY - box.minY) + 1;
+	int level = 0;
+	while (level + 1 < (int)levels.size() && (extent >> level) > 2)
+		level++;
+
+	return !IsRectOccluded(box, level);
+}
+
+bool OcclusionCuller::IsVisibleFullResolution(const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax, DirectX::XMMATRIX world) const
+{
+	ScreenBox box;
+	if (!ProjectBox(boxMin, boxMax, world, box))
+		return true;
+
+	return !IsRectOccluded(box, 0);
+}
+
+int OcclusionCuller::Cull(std::vector<Model*>& models)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	size_t kept = 0;
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		Model* model = models[i];
+		if (IsVisible(model->GetBoundsMin(), model->GetBoundsMax(), model->GetWorldMatrix()))
+			models[kept++] = model;
+	}
+
+	stats.tested += (int)models.size();
+	stats.occluded += (int)(models.size() - kept);
+	models.resize(kept);
+
+	stats.testMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return (int)kept;
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+#include "DX.h"
+#include "JobSystem.h"
+#include <vector>
+#include <cstdint>
+
+class Model;
+
+/*
+	Software occlusion culling.
+	A few occluders (simplified terrain, big meshes) are rasterized into a small depth buffer on the CPU
+	and the bounding boxes of the models are tested against it before they are submitted.
+	Render transforms the occluder vertices with SSE, clips and sets up the triangles and bins them into
+	screen tiles, then every tile is rasterized 4 pixels at a time by its own job and reduced into a
+	hierarchy of max depths. A box is hidden when its nearest depth is behind the farthest depth of every
+	texel it covers, at the level where it covers about 2x2 texels.
+	Occluders have to lie inside what they stand for, a simplified mesh bigger than the real one hides
+	things that can be seen. Back faces are culled like the default rasterizer state does.
+*/
+class OcclusionCuller
+{
+public:
+	static const int TILE_WIDTH = 32;
+	static const int TILE_HEIGHT = 32;
+
+	struct Stats
+	{
+		int occluders = 0;
+		int occluderTriangles = 0;
+		int rasterizedTriangles = 0;			// After clipping and back face culling, counted once per tile
+		int tested = 0;
+		int occluded = 0;
+		double renderMilliseconds = 0.0;
+		double testMilliseconds = 0.0;
+	};
+
+public:
+	OcclusionCuller();
+	~OcclusionCuller();
+
+	// The size has to be a multiple of the tile size
+	bool Initialize(int width, int height);
+
+	void ClearOccluders();
+
+	// Returns the occluder index
+	int AddOccluder(const DirectX::XMFLOAT3* vertices, int vertexCount, const DWORD* indices, int indexCount, DirectX::XMMATRIX world);
+
+	// Positions and indices of the model, which has to keep them on the CPU, moved by its world matrix
+	int AddOccluder(Model* model);
+
+	/*
+		Heightfield (z * width + x) as a grid of step cells per triangle pair, wound like Terrain.
+		Every corner takes the lowest height around it so the coarse surface stays under the real one.
+	*/
+	int AddHeightfield(const std::vector<float>& heights, int width, int height, float cellSpace, int step, DirectX::XMMATRIX world);
+
+	// Rasterizes the occluders as seen through viewProjection
+	void Render(DirectX::XMMATRIX viewProjection, JobSystem& jobSystem);
+
+	// Local space box moved by world, against the last Render. Boxes that cross the near plane are visible
+	bool IsVisible(const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax, DirectX::XMMATRIX world) const;
+
+	// Same test on the hierarchy's finest level only, every covered pixel is read
+	bool IsVisibleFullResolution(const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax, DirectX::XMMATRIX world) const;
+
+	// Removes the hidden models from the list, keeping the order
+	int Cull(std::vector<Model*>& models);
+
+	int GetWidth() const { return this->width; }
+	int GetHeight() const { return this->height; }
+	int GetLevelCount() const { return (int)this->levels.size(); }
+	const std::vector<float>& GetDepth(int level = 0) const { return this->levels[level]; }	// Max depth, 1 where nothing was drawn
+	const Stats& GetStats() const { return this->stats; }		// Of the last Render and the Culls after it
+
+private:
+	struct Triangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3];		// Inside where A * x + B * y + C >= 0 for all three, at pixel centers
+		float depthA, depthB, depthC;			// Depth plane, already moved by half a pixel of slope
+		float depthMax;
+		int minX, minY, maxX, maxY;				// Pixels
+	};
+
+	// What one setup job produced, binned by tile
+	struct Bin
+	{
+		std::vector<Triangle> triangles;
+		std::vector<std::vector<int>> tiles;
+	};
+
+	struct ScreenBox
+	{
+		int minX, minY, maxX, maxY;
+		float minDepth;
+	};
+
+	void TransformVertices(int first, int last);
+	void SetupTriangles(int first, int last, Bin& bin);
+	void SetupClipped(const DirectX::XMFLOAT4* polygon, int count, Bin& bin);
+	void RasterizeTile(int tile);
+	void ReduceTile(int tile);
+
+	// False when the box has to be drawn whatever is in the buffer
+	bool ProjectBox(const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax, DirectX::XMMATRIX world, ScreenBox& box) const;
+	bool IsRectOccluded(const ScreenBox& box, int level) const;
+
+private:
+	int width, height;
+	int tilesX, tilesY;
+
+	// World space occluder vertices as x, y, z arrays, padded to a multiple of 4
+	std::vector<float> vertexX, vertexY, vertexZ;
+	std::vector<float> clipX, clipY, clipZ, clipW;
+	std::vector<DWORD> indices;					// Into the arrays above
+	int vertexCount;
+	int occluderCount;
+
+	std::vector<Bin> bins;
+
+	// Level 0 is the depth buffer, every level above holds the max of 2x2 texels of the one below
+	std::vector<std::vector<float>> levels;
+
+	DirectX::XMFLOAT4X4 viewProjection;
+	bool rendered;
+
+	Stats stats;
+};
\ No newline at end of file
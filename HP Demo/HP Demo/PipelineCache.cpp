@@ -0,0 +1,399 @@
+#include "PipelineCache.h"
+#include <algorithm>
+
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+template<typename T>
+static uint64_t HashField(uint64_t hash, const T& value)
+{
+	return HashBytes(hash, &value, sizeof(T));
+}
+
+static const uint64_t HASH_SEED = 14695981039346656037ull;
+
+PipelineDesc::PipelineDesc()
+{
+	ZeroMemory(this, sizeof(PipelineDesc));
+
+	topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	for (int i = 0; i < 8; i++)
+	{
+		blend.RenderTarget[i].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+		blend.RenderTarget[i].SrcBlend = D3D11_BLEND_ONE;
+		blend.RenderTarget[i].DestBlend = D3D11_BLEND_ZERO;
+		blend.RenderTarget[i].BlendOp = D3D11_BLEND_OP_ADD;
+		blend.RenderTarget[i].SrcBlendAlpha = D3D11_BLEND_ONE;
+		blend.RenderTarget[i].DestBlendAlpha = D3D11_BLEND_ZERO;
+		blend.RenderTarget[i].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	}
+
+	// The same as DX11's default depth state
+	depthStencil.DepthEnable = true;
+	depthStencil.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+	depthStencil.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+	depthStencil.StencilEnable = false;
+	depthStencil.StencilReadMask = 0xFF;
+	depthStencil.StencilWriteMask = 0xFF;
+	depthStencil.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+	depthStencil.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
+	depthStencil.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+	depthStencil.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+	depthStencil.BackFace = depthStencil.FrontFace;
+	stencilRef = 1;
+
+	rasterizer.FillMode = D3D11_FILL_SOLID;
+	rasterizer.CullMode = D3D11_CULL_BACK;
+	rasterizer.DepthClipEnable = TRUE;
+}
+
+/*
+	PipelineState
+*/
+
+PipelineState::PipelineState()
+{
+	this->hash = 0;
+	this->blendHash = 0;
+	this->depthStencilHash = 0;
+	this->rasterizerHash = 0;
+	this->samplerHash = 0;
+	this->blendState = nullptr;
+	this->depthStencilState = nullptr;
+	this->rasterizerState = nullptr;
+	for (int i = 0; i < PipelineDesc::MAX_SAMPLERS; i++)
+		this->samplers[i] = nullptr;
+}
+
+int PipelineState::Bind(RenderBackend* context, const PipelineState* previous) const
+{
+	if (previous == this)
+		return 0;
+
+	int changed = 0;
+	if (!previous || previous->desc.inputLayout != desc.inputLayout)
+	{
+		context->IASetInputLayout(desc.inputLayout);
+		changed++;
+	}
+	if (!previous || previous->desc.topology != desc.topology)
+	{
+		context->IASetPrimitiveTopology(desc.topology);
+		changed++;
+	}
+	if (!previous || previous->desc.vertexShader != desc.vertexShader)
+	{
+		context->VSSetShader(desc.vertexShader, nullptr, 0);
+		changed++;
+	}
+	if (!previous || previous->desc.pixelShader != desc.pixelShader)
+	{
+		context->PSSetShader(desc.pixelShader, nullptr, 0);
+		changed++;
+	}
+
+	// Slots past samplerCount keep what they had
+	if ((!previous || previous->samplerHash != samplerHash) && desc.samplerCount > 0)
+	{
+		context->PSSetSamplers(0, desc.samplerCount, samplers);
+		changed++;
+	}
+	if (!previous || previous->blendHash != blendHash)
+	{
+		context->OMSetBlendState(blendState, nullptr, 0xffffffff);
+		changed++;
+	}
+	if (!previous || previous->depthStencilHash != depthStencilHash || previous->desc.stencilRef != desc.stencilRef)
+	{
+		context->OMSetDepthStencilState(depthStencilState, desc.stencilRef);
+		changed++;
+	}
+	if (!previous || previous->rasterizerHash != rasterizerHash)
+	{
+		context->RSSetState(rasterizerState);
+		changed++;
+	}
+
+	return changed;
+}
+
+/*
+	PipelineCache
+*/
+
+PipelineCache::PipelineCache()
+{
+	this->device = nullptr;
+}
+
+PipelineCache::~PipelineCache()
+{
+	Shutdown();
+}
+
+bool PipelineCache::Initialize(ID3D11Device* device)
+{
+	Shutdown();
+
+	this->device = device;
+	this->stats = Stats();
+	return true;
+}
+
+void PipelineCache::Shutdown()
+{
+	for (auto& entry : pipelines)
+		delete entry.second;
+	pipelines.clear();
+
+	for (auto& entry : blendStates)
+		ReleasePtr(entry.second);
+	for (auto& entry : depthStencilStates)
+		ReleasePtr(entry.second);
+	for (auto& entry : rasterizerStates)
+		ReleasePtr(entry.second);
+	for (auto& entry : samplerStates)
+		ReleasePtr(entry.second);
+	blendStates.clear();
+	depthStencilStates.clear();
+	rasterizerStates.clear();
+	samplerStates.clear();
+
+	device = nullptr;
+}
+
+template<typename T>
+bool PipelineCache::Find(std::unordered_map<uint64_t, T*>& objects, uint64_t hash, T*& object)
+{
+	auto found = objects.find(hash);
+	if (found != objects.end())
+	{
+		stats.stateHits++;
+		object = found->second;
+		return true;
+	}
+
+	stats.stateMisses++;
+	object = nullptr;
+	return false;
+}
+
+ID3D11BlendState* PipelineCache::GetBlendState(const D3D11_BLEND_DESC& desc)
+{
+	uint64_t hash = HashBlend(desc);
+	ID3D11BlendState* state;
+	if (Find(blendStates, hash, state))
+		return state;
+
+	if (device && FAILED(device->CreateBlendState(&desc, &state)))
+	{
+		stats.failures++;
+		return nullptr;
+	}
+
+	stats.objectsCreated++;
+	blendStates[hash] = state;
+	return state;
+}
+
+ID3D11DepthStencilState* PipelineCache::GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc)
+{
+	uint64_t hash = HashDepthStencil(desc);
+	ID3D11DepthStencilState* state;
+	if (Find(depthStencilStates, hash, state))
+		return state;
+
+	if (device && FAILED(device->CreateDepthStencilState(&desc, &state)))
+	{
+		stats.failures++;
+		return nullptr;
+	}
+
+	stats.objectsCreated++;
+	depthStencilStates[hash] = state;
+	return state;
+}
+
+ID3D11RasterizerState* PipelineCache::GetRasterizerState(const D3D11_RASTERIZER_DESC& desc)
+{
+	uint64_t hash = HashRasterizer(desc);
+	ID3D11RasterizerState* state;
+	if (Find(rasterizerStates, hash, state))
+		return state;
+
+	if (device && FAILED(device->CreateRasterizerState(&desc, &state)))
+	{
+		stats.failures++;
+		return nullptr;
+	}
+
+	stats.objectsCreated++;
+	rasterizerStates[hash] = state;
+	return state;
+}
+
+ID3D11SamplerState* PipelineCache::GetSamplerState(const D3D11_SAMPLER_DESC& desc)
+{
+	uint64_t hash = HashSampler(desc);
+	ID3D11SamplerState* state;
+	if (Find(samplerStates, hash, state))
+		return state;
+
+	if (device && FAILED(device->CreateSamplerState(&desc, &state)))
+	{
+		stats.failures++;
+		return nullptr;
+	}
+
+	stats.objectsCreated++;
+	samplerStates[hash] = state;
+	return state;
+}
+
+const PipelineState* PipelineCache::GetPipeline(const PipelineDesc& desc)
+{
+	uint64_t hash = HashPipeline(desc);
+	auto found = pipelines.find(hash);
+	if (found != pipelines.end())
+	{
+		stats.pipelineHits++;
+		return found->second;
+	}
+	stats.pipelineMisses++;
+
+	PipelineState* pipeline = new PipelineState;
+	pipeline->desc = desc;
+	pipeline->desc.samplerCount = std::min(std::max(desc.samplerCount, 0), PipelineDesc::MAX_SAMPLERS);
+	pipeline->hash = hash;
+	pipeline->blendHash = HashBlend(desc.blend);
+	pipeline->depthStencilHash = HashDepthStencil(desc.depthStencil);
+	pipeline->rasterizerHash = HashRasterizer(desc.rasterizer);
+
+	pipeline->blendState = GetBlendState(desc.blend);
+	pipeline->depthStencilState = GetDepthStencilState(desc.depthStencil);
+	pipeline->rasterizerState = GetRasterizerState(desc.rasterizer);
+
+	bool failed = device && (!pipeline->blendState || !pipeline->depthStencilState || !pipeline->rasterizerState);
+	pipeline->samplerHash = HashField(HASH_SEED, pipeline->desc.samplerCount);
+	for (int i = 0; i < pipeline->desc.samplerCount; i++)
+	{
+		pipeline->samplers[i] = GetSamplerState(desc.samplers[i]);
+		pipeline->samplerHash = HashField(pipeline->samplerHash, HashSampler(desc.samplers[i]));
+		failed |= device && !pipeline->samplers[i];
+	}
+
+	// The state objects that were made stay cached, they are fine on their own
+	if (failed)
+	{
+		delete pipeline;
+		return nullptr;
+	}
+
+	pipelines[hash] = pipeline;
+	return pipeline;
+}
+
+uint64_t PipelineCache::HashBlend(const D3D11_BLEND_DESC& desc)
+{
+	uint64_t hash = HASH_SEED;
+	hash = HashField(hash, desc.AlphaToCoverageEnable);
+	hash = HashField(hash, desc.IndependentBlendEnable);
+
+	// Without independent blending only the first target counts
+	int targets = desc.IndependentBlendEnable ? 8 : 1;
+	for (int i = 0; i < targets; i++)
+	{
+		const D3D11_RENDER_TARGET_BLEND_DESC& target = desc.RenderTarget[i];
+		hash = HashField(hash, target.BlendEnable);
+		hash = HashField(hash, target.SrcBlend);
+		hash = HashField(hash, target.DestBlend);
+		hash = HashField(hash, target.BlendOp);
+		hash = HashField(hash, target.SrcBlendAlpha);
+		hash = HashField(hash, target.DestBlendAlpha);
+		hash = HashField(hash, target.BlendOpAlpha);
+		hash = HashField(hash, target.RenderTargetWriteMask);
+	}
+	return hash;
+}
+
+uint64_t PipelineCache::HashDepthStencil(const D3D11_DEPTH_STENCIL_DESC& desc)
+{
+	uint64_t hash = HASH_SEED;
+	hash = HashField(hash, desc.DepthEnable);
+	hash = HashField(hash, desc.DepthWriteMask);
+	hash = HashField(hash, desc.DepthFunc);
+	hash = HashField(hash, desc.StencilEnable);
+	hash = HashField(hash, desc.StencilReadMask);
+	hash = HashField(hash, desc.StencilWriteMask);
+
+	const D3D11_DEPTH_STENCILOP_DESC* faces[2] = { &desc.FrontFace, &desc.BackFace };
+	for (const D3D11_DEPTH_STENCILOP_DESC* face : faces)
+	{
+		hash = HashField(hash, face->StencilFailOp);
+		hash = HashField(hash, face->StencilDepthFailOp);
+		hash = HashField(hash, face->StencilPassOp);
+		hash = HashField(hash, face->StencilFunc);
+	}
+	return hash;
+}
+
+uint64_t PipelineCache::HashRasterizer(const D3D11_RASTERIZER_DESC& desc)
+{
+	uint64_t hash = HASH_SEED;
+	hash = HashField(hash, desc.FillMode);
+	hash = HashField(hash, desc.CullMode);
+	hash = HashField(hash, desc.FrontCounterClockwise);
+	hash = HashField(hash, desc.DepthBias);
+	hash = HashField(hash, desc.DepthBiasClamp);
+	hash = HashField(hash, desc.SlopeScaledDepthBias);
+	hash = HashField(hash, desc.DepthClipEnable);
+	hash = HashField(hash, desc.ScissorEnable);
+	hash = HashField(hash, desc.MultisampleEnable);
+	hash = HashField(hash, desc.AntialiasedLineEnable);
+	return hash;
+}
+
+uint64_t PipelineCache::HashSampler(const D3D11_SAMPLER_DESC& desc)
+{
+	uint64_t hash = HASH_SEED;
+	hash = HashField(hash, desc.Filter);
+	hash = HashField(hash, desc.AddressU);
+	hash = HashField(hash, desc.AddressV);
+	hash = HashField(hash, desc.AddressW);
+	hash = HashField(hash, desc.MipLODBias);
+	hash = HashField(hash, desc.MaxAnisotropy);
+	hash = HashField(hash, desc.ComparisonFunc);
+	hash = HashBytes(hash, desc.BorderColor, sizeof(desc.BorderColor));
+	hash = HashField(hash, desc.MinLOD);
+	hash = HashField(hash, desc.MaxLOD);
+	return hash;
+}
+
+uint64_t PipelineCache::HashPipeline(const PipelineDesc& desc)
+{
+	uint64_t hash = HASH_SEED;
+	hash = HashField(hash, desc.vertexShader);
+	hash = HashField(hash, desc.pixelShader);
+	hash = HashField(hash, desc.inputLayout);
+	hash = HashField(hash, desc.topology);
+	hash = HashField(hash, HashBlend(desc.blend));
+	hash = HashField(hash, HashDepthStencil(desc.depthStencil));
+	hash = HashField(hash, HashRasterizer(desc.rasterizer));
+
+	int samplerCount = std::min(std::max(desc.samplerCount, 0), PipelineDesc::MAX_SAMPLERS);
+	hash = HashField(hash, samplerCount);
+	for (int i = 0; i < samplerCount; i++)
+		hash = HashField(hash, HashSampler(desc.samplers[i]));
+
+	hash = HashField(hash, desc.stencilRef);
+	return hash;
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+#include "DX.h"
+#include "RenderBackend.h"
+#include <unordered_map>
+#include <cstdint>
+
+/*
+	Everything that sets up a draw apart from its buffers, textures and constants.
+	The constructor fills in the renderer's defaults: depth test less or equal with writes, no blending,
+	back faces culled, triangle lists and no samplers.
+*/
+struct PipelineDesc
+{
+	static const int MAX_SAMPLERS = 4;
+
+	PipelineDesc();
+
+	ID3D11VertexShader* vertexShader;
+	ID3D11PixelShader* pixelShader;
+	ID3D11InputLayout* inputLayout;
+	D3D11_PRIMITIVE_TOPOLOGY topology;
+
+	D3D11_BLEND_DESC blend;
+	D3D11_DEPTH_STENCIL_DESC depthStencil;
+	D3D11_RASTERIZER_DESC rasterizer;
+	D3D11_SAMPLER_DESC samplers[MAX_SAMPLERS];		// Pixel shader slots from 0
+	int samplerCount;
+	UINT stencilRef;
+};
+
+/*
+	Immutable bundle of shaders, input layout and state objects, made by PipelineCache.
+	Pipelines made from the same descriptions share their state objects, so binding one after another
+	only has to set the parts whose descriptions differ.
+*/
+class PipelineState
+{
+public:
+	// Sets what differs from previous, everything when previous is null. Returns how many parts were set
+	int Bind(RenderBackend* context, const PipelineState* previous) const;
+
+	const PipelineDesc& GetDesc() const { return this->desc; }
+	uint64_t GetHash() const { return this->hash; }
+
+	ID3D11BlendState* GetBlendState() const { return this->blendState; }
+	ID3D11DepthStencilState* GetDepthStencilState() const { return this->depthStencilState; }
+	ID3D11RasterizerState* GetRasterizerState() const { return this->rasterizerState; }
+	ID3D11SamplerState* GetSampler(int slot) const { return this->samplers[slot]; }
+
+private:
+	friend class PipelineCache;
+	PipelineState();
+
+	PipelineDesc desc;
+	uint64_t hash;
+
+	// Equal descriptions are equal objects, the hashes are compared so the diff also works without a device
+	uint64_t blendHash, depthStencilHash, rasterizerHash, samplerHash;
+
+	ID3D11BlendState* blendState;
+	ID3D11DepthStencilState* depthStencilState;
+	ID3D11RasterizerState* rasterizerState;
+	ID3D11SamplerState* samplers[PipelineDesc::MAX_SAMPLERS];
+};
+
+/*
+	Makes pipelines and state objects once per description, keyed by a hash of the description.
+	The cache owns everything it hands out until Shutdown. Creation is not thread safe, make the pipelines
+	up front and bind them from any thread.
+*/
+class PipelineCache
+{
+public:
+	struct Stats
+	{
+		int pipelineHits = 0;
+		int pipelineMisses = 0;
+		int stateHits = 0;
+		int stateMisses = 0;
+		int objectsCreated = 0;			// D3D state objects, or how many there would be without a device
+		int failures = 0;
+	};
+
+public:
+	PipelineCache();
+	~PipelineCache();
+
+	// Without a device no D3D objects are made, the state objects stay null but everything else runs
+	bool Initialize(ID3D11Device* device);
+	void Shutdown();
+
+	// Null when a state object could not be created
+	const PipelineState* GetPipeline(const PipelineDesc& desc);
+
+	// Single state objects, for code that sets them on their own
+	ID3D11BlendState* GetBlendState(const D3D11_BLEND_DESC& desc);
+	ID3D11DepthStencilState* GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc);
+	ID3D11RasterizerState* GetRasterizerState(const D3D11_RASTERIZER_DESC& desc);
+	ID3D11SamplerState* GetSamplerState(const D3D11_SAMPLER_DESC& desc);
+
+	// Field by field, so padding never ends up in the hash
+	static uint64_t HashBlend(const D3D11_BLEND_DESC& desc);
+	static uint64_t HashDepthStencil(const D3D11_DEPTH_STENCIL_DESC& desc);
+	static uint64_t HashRasterizer(const D3D11_RASTERIZER_DESC& desc);
+	static uint64_t HashSampler(const D3D11_SAMPLER_DESC& desc);
+	static uint64_t HashPipeline(const PipelineDesc& desc);
+
+	int GetPipelineCount() const { return (int)this->pipelines.size(); }
+	const Stats& GetStats() const { return this->stats; }
+	void ResetStats() { this->stats = Stats(); }
+
+private:
+	// Looks the hash up in one of the maps, counting the hit or miss. False when the object has to be made
+	template<typename T>
+	bool Find(std::unordered_map<uint64_t, T*>& objects, uint64_t hash, T*& object);
+
+private:
+	ID3D11Device* device;
+
+	std::unordered_map<uint64_t, PipelineState*> pipelines;
+	std::unordered_map<uint64_t, ID3D11BlendState*> blendStates;
+	std::unordered_map<uint64_t, ID3D11DepthStencilState*> depthStencilStates;
+	std::unordered_map<uint64_t, ID3D11RasterizerState*> rasterizerStates;
+	std::unordered_map<uint64_t, ID3D11SamplerState*> samplerStates;
+
+	Stats stats;
+};
\ No newline at end of file
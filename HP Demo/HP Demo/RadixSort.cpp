@@ -0,0 +1,51 @@
+#include "RadixSort.h"
+#include <cstring>
+
+void RadixSort(SortKey* items, SortKey* scratch, size_t count)
+{
+	if (count < 2)
+		return;
+
+	static const int PASSES = 8;
+	size_t histograms[PASSES][256];
+	memset(histograms, 0, sizeof(histograms));
+
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t key = items[i].key;
+		for (int pass = 0; pass < PASSES; pass++)
+			histograms[pass][(key >> (pass * 8)) & 0xff]++;
+	}
+
+	SortKey* source = items;
+	SortKey* destination = scratch;
+
+	for (int pass = 0; pass < PASSES; pass++)
+	{
+		size_t* histogram = histograms[pass];
+		int shift = pass * 8;
+
+		// Every key has the same byte here, the order would not change
+		if (histogram[(source[0].key >> shift) & 0xff] == count)
+			continue;
+
+		// Counts to start offsets
+		size_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++)
+		{
+			size_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			destination[histogram[(source[i].key >> shift) & 0xff]++] = source[i];
+
+		SortKey* swap = source;
+		source = destination;
+		destination = swap;
+	}
+
+	if (source != items)
+		memcpy(items, source, count * sizeof(SortKey));
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// 64 bit key and the index of what it belongs to, the unit every sorted render list works with
+struct SortKey
+{
+	uint64_t key;
+	uint32_t index;
+	uint32_t padding;
+};
+
+/*
+	LSD radix sort on the keys, 8 bits per pass. All histograms are built in one read of the input
+	and passes where every key has the same byte are skipped, so short keys only pay for the bytes they use.
+	Stable, the result ends up in items. scratch needs room for count items.
+*/
+void RadixSort(SortKey* items, SortKey* scratch, size_t count);
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include "RenderBackend.h"
+#include <algorithm>
+
+static const uint64_t DRAW_HASH_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t BoundState::Hash() const
+{
+	// Member by member, so padding never ends up in the hash
+	uint64_t hash = 14695981039346656037ull;
+	hash = HashBytes(hash, &inputLayout, sizeof(inputLayout));
+	hash = HashBytes(hash, &topology, sizeof(topology));
+	hash = HashBytes(hash, vertexBuffers, sizeof(vertexBuffers));
+	hash = HashBytes(hash, strides, sizeof(strides));
+	hash = HashBytes(hash, offsets, sizeof(offsets));
+	hash = HashBytes(hash, &indexBuffer, sizeof(indexBuffer));
+	hash = HashBytes(hash, &indexFormat, sizeof(indexFormat));
+	hash = HashBytes(hash, &indexOffset, sizeof(indexOffset));
+	hash = HashBytes(hash, &vertexShader, sizeof(vertexShader));
+	hash = HashBytes(hash, &geometryShader, sizeof(geometryShader));
+	hash = HashBytes(hash, &pixelShader, sizeof(pixelShader));
+	hash = HashBytes(hash, constantBuffers, sizeof(constantBuffers));
+	hash = HashBytes(hash, firstConstants, sizeof(firstConstants));
+	hash = HashBytes(hash, constantCounts, sizeof(constantCounts));
+	hash = HashBytes(hash, resources, sizeof(resources));
+	hash = HashBytes(hash, samplers, sizeof(samplers));
+	hash = HashBytes(hash, &blendState, sizeof(blendState));
+	hash = HashBytes(hash, blendFactor, sizeof(blendFactor));
+	hash = HashBytes(hash, &sampleMask, sizeof(sampleMask));
+	hash = HashBytes(hash, &depthStencilState, sizeof(depthStencilState));
+	hash = HashBytes(hash, &stencilRef, sizeof(stencilRef));
+	hash = HashBytes(hash, &rasterizerState, sizeof(rasterizerState));
+	return hash;
+}
+
+/*
+	RecordingBackend
+*/
+
+RecordingBackend::RecordingBackend(size_t mappedBytes)
+{
+	this->mappedBytes = mappedBytes;
+	this->keepCalls = true;
+	Clear();
+}
+
+RecordingBackend::~RecordingBackend()
+{
+}
+
+void RecordingBackend::Clear()
+{
+	state = BoundState();
+	calls.clear();
+	std::fill(callCounts, callCounts + CALL_TYPE_COUNT, 0);
+	drawStateHash = 0;
+	hashedDraws = 0;
+}
+
+int RecordingBackend::GetTotalCalls() const
+{
+	int total = 0;
+	for (int i = 0; i < CALL_TYPE_COUNT; i++)
+		total += callCounts[i];
+	return total;
+}
+
+const char* RecordingBackend::GetCallName(CallType type)
+{
+	static const char* names[CALL_TYPE_COUNT] =
+	{
+		"SetInputLayout", "SetTopology", "SetVertexBuffers", "SetIndexBuffer", "SetShader", "SetConstantBuffers",
+		"SetShaderResources", "SetSamplers", "SetBlendState", "SetDepthStencilState", "SetRasterizerState",
+		"UpdateSubresource", "Map", "Unmap", "Draw",
+	};
+	return names[type];
+}
+
+void RecordingBackend::Record(CallType type, int stage, UINT startSlot, UINT count, const void* object)
+{
+	callCounts[type]++;
+	if (!keepCalls)
+		return;
+
+	Call call;
+	call.type = type;
+	call.stage = stage;
+	call.startSlot = startSlot;
+	call.count = count;
+	call.object = object;
+	calls.push_back(call);
+}
+
+void RecordingBackend::RecordDraw(UINT count, UINT start, INT baseVertex, UINT instanceCount, UINT startInstance)
+{
+	Record(CALL_DRAW, -1, start, count, nullptr);
+	if (!keepCalls)
+		return;
+
+	uint64_t stateHash = state.Hash();
+	uint64_t drawHash = HashBytes(14695981039346656037ull, &stateHash, sizeof(stateHash));
+	drawHash = HashBytes(drawHash, &count, sizeof(count));
+	drawHash = HashBytes(drawHash, &start, sizeof(start));
+	drawHash = HashBytes(drawHash, &baseVertex, sizeof(baseVertex));
+	drawHash = HashBytes(drawHash, &instanceCount, sizeof(instanceCount));
+	drawHash = HashBytes(drawHash, &startInstance, sizeof(startInstance));
+
+	// Polynomial over the draws in order, so recordings made apart can be joined with Append
+	drawStateHash = drawStateHash * DRAW_HASH_MULTIPLIER + drawHash;
+	hashedDraws++;
+}
+
+void RecordingBackend::Append(const RecordingBackend& other)
+{
+	for (int i = 0; i < CALL_TYPE_COUNT; i++)
+		callCounts[i] += other.callCounts[i];
+
+	if (!keepCalls)
+		return;
+
+	calls.insert(calls.end(), other.calls.begin(), other.calls.end());
+
+	uint64_t shift = 1;
+	for (int i = 0; i < other.hashedDraws; i++)
+		shift *= DRAW_HASH_MULTIPLIER;
+	drawStateHash = drawStateHash * shift + other.drawStateHash;
+	hashedDraws += other.hashedDraws;
+}
+
+void RecordingBackend::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	Record(CALL_SET_INPUT_LAYOUT, -1, 0, 1, inputLayout);
+	state.inputLayout = inputLayout;
+}
+
+void RecordingBackend::IASetPrimitiveTopology(UINT topology)
+{
+	Record(CALL_SET_TOPOLOGY, -1, 0, 1, nullptr);
+	state.topology = topology;
+}
+
+void RecordingBackend::IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	Record(CALL_SET_VERTEX_BUFFERS, -1, startSlot, count, count ? buffers[0] : nullptr);
+	for (UINT i = 0; i < count && startSlot + i < BoundState::VERTEX_BUFFER_SLOTS; i++)
+	{
+		state.vertexBuffers[startSlot + i] = buffers[i];
+		state.strides[startSlot + i] = strides[i];
+		state.offsets[startSlot + i] = offsets[i];
+	}
+}
+
+void RecordingBackend::IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset)
+{
+	Record(CALL_SET_INDEX_BUFFER, -1, 0, 1, buffer);
+	state.indexBuffer = buffer;
+	state.indexFormat = format;
+	state.indexOffset = offset;
+}
+
+void RecordingBackend::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* /*classInstances*/, UINT /*classInstanceCount*/)
+{
+	Record(CALL_SET_SHADER, BoundState::STAGE_VS, 0, 1, shader);
+	state.vertexShader = shader;
+}
+
+void RecordingBackend::GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* /*classInstances*/, UINT /*classInstanceCount*/)
+{
+	Record(CALL_SET_SHADER, BoundState::STAGE_GS, 0, 1, shader);
+	state.geometryShader = shader;
+}
+
+void RecordingBackend::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* /*classInstances*/, UINT /*classInstanceCount*/)
+{
+	Record(CALL_SET_SHADER, BoundState::STAGE_PS, 0, 1, shader);
+	state.pixelShader = shader;
+}
+
+void RecordingBackend::SetConstantBuffers(int stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	Record(CALL_SET_CONSTANT_BUFFERS, stage, startSlot, count, count ? buffers[0] : nullptr);
+	for (UINT i = 0; i < count && startSlot + i < BoundState::CONSTANT_BUFFER_SLOTS; i++)
+	{
+		state.constantBuffers[stage][startSlot + i] = buffers[i];
+		state.firstConstants[stage][startSlot + i] = firstConstants ? firstConstants[i] : 0;
+		state.constantCounts[stage][startSlot + i] = constantCounts ? constantCounts[i] : 0;
+	}
+}
+
+void RecordingBackend::SetShaderResources(int stage, UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	Record(CALL_SET_SHADER_RESOURCES, stage, startSlot, count, count ? views[0] : nullptr);
+	for (UINT i = 0; i < count && startSlot + i < BoundState::RESOURCE_SLOTS; i++)
+		state.resources[stage][startSlot + i] = views[i];
+}
+
+void RecordingBackend::SetSamplers(int stage, UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	Record(CALL_SET_SAMPLERS, stage, startSlot, count, count ? samplers[0] : nullptr);
+	for (UINT i = 0; i < count && startSlot + i < BoundState::SAMPLER_SLOTS; i++)
+		state.samplers[stage][startSlot + i] = samplers[i];
+}
+
+void RecordingBackend::VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	SetConstantBuffers(BoundState::STAGE_VS, startSlot, count, buffers, nullptr, nullptr);
+}
+
+void RecordingBackend::GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	SetConstantBuffers(BoundState::STAGE_GS, startSlot, count, buffers, nullptr, nullptr);
+}
+
+void RecordingBackend::PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	SetConstantBuffers(BoundState::STAGE_PS, startSlot, count, buffers, nullptr, nullptr);
+}
+
+void RecordingBackend::VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	SetConstantBuffers(BoundState::STAGE_VS, startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void RecordingBackend::GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	SetConstantBuffers(BoundState::STAGE_GS, startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void RecordingBackend::PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	SetConstantBuffers(BoundState::STAGE_PS, startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void RecordingBackend::VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	SetShaderResources(BoundState::STAGE_VS, startSlot, count, views);
+}
+
+void RecordingBackend::GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	SetShaderResources(BoundState::STAGE_GS, startSlot, count, views);
+}
+
+void RecordingBackend::PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	SetShaderResources(BoundState::STAGE_PS, startSlot, count, views);
+}
+
+void RecordingBackend::VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	SetSamplers(BoundState::STAGE_VS, startSlot, count, samplers);
+}
+
+void RecordingBackend::GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	SetSamplers(BoundState::STAGE_GS, startSlot, count, samplers);
+}
+
+void RecordingBackend::PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	SetSamplers(BoundState::STAGE_PS, startSlot, count, samplers);
+}
+
+void RecordingBackend::OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	Record(CALL_SET_BLEND_STATE, -1, 0, 1, blendState);
+	state.blendState = blendState;
+	for (int i = 0; i < 4; i++)
+		state.blendFactor[i] = blendFactor ? blendFactor[i] : 1.0f;
+	state.sampleMask = sampleMask;
+}
+
+void RecordingBackend::OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+	Record(CALL_SET_DEPTH_STENCIL_STATE, -1, 0, 1, depthStencilState);
+	state.depthStencilState = depthStencilState;
+	state.stencilRef = stencilRef;
+}
+
+void RecordingBackend::RSSetState(ID3D11RasterizerState* rasterizerState)
+{
+	Record(CALL_SET_RASTERIZER_STATE, -1, 0, 1, rasterizerState);
+	state.rasterizerState = rasterizerState;
+}
+
+void RecordingBackend::UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* /*box*/, const void* /*data*/, UINT /*rowPitch*/, UINT /*depthPitch*/)
+{
+	Record(CALL_UPDATE_SUBRESOURCE, -1, subresource, 1, resource);
+}
+
+HRESULT RecordingBackend::Map(ID3D11Resource* resource, UINT subresource, UINT /*mapType*/, UINT /*mapFlags*/, MappedResource* mapped)
+{
+	Record(CALL_MAP, -1, subresource, 1, resource);
+
+	// Discard or not, the same memory comes back, nothing reads it anyway
+	std::vector<uint8_t>& memory = mappedMemory[resource];
+	if (memory.empty())
+		memory.resize(mappedBytes);
+
+	mapped->pData = memory.data();
+	mapped->RowPitch = (UINT)mappedBytes;
+	mapped->DepthPitch = (UINT)mappedBytes;
+	return 0;		// S_OK
+}
+
+void RecordingBackend::Unmap(ID3D11Resource* resource, UINT subresource)
+{
+	Record(CALL_UNMAP, -1, subresource, 1, resource);
+}
+
+void RecordingBackend::Draw(UINT vertexCount, UINT startVertex)
+{
+	RecordDraw(vertexCount, startVertex, 0, 0, 0);
+}
+
+void RecordingBackend::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	RecordDraw(indexCount, startIndex, baseVertex, 0, 0);
+}
+
+void RecordingBackend::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	RecordDraw(indexCount, startIndex, baseVertex, instanceCount, startInstance);
+}
+
+/*
+	NullBackend
+*/
+
+NullBackend::NullBackend(size_t mappedBytes)
+{
+	memory.resize(mappedBytes);
+}
+
+NullBackend::~NullBackend()
+{
+}
+
+HRESULT NullBackend::Map(ID3D11Resource* /*resource*/, UINT /*subresource*/, UINT /*mapType*/, UINT /*mapFlags*/, MappedResource* mapped)
+{
+	mapped->pData = memory.data();
+	mapped->RowPitch = (UINT)memory.size();
+	mapped->DepthPitch = (UINT)memory.size();
+	return 0;		// S_OK
+}
\ No newline at end of file
@@ -0,0 +1,273 @@
+#pragma once
+#include "RenderTypes.h"
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+/*
+	The part of ID3D11DeviceContext the renderer talks to, with the same names and arguments so the calling
+	code reads the same whichever backend is behind it. Enum arguments are taken as their UINT values.
+	D3D11Backend forwards to a real context, StateCache drops calls that would not change anything and
+	RecordingBackend only records, so the render paths can be run and checked without a GPU.
+	NullBackend does nothing at all, FrameCapture captures the calls that go through it.
+	Only D3D11Backend needs the D3D headers, it has a header of its own.
+*/
+class RenderBackend
+{
+public:
+	// The D3D11_MAP values the renderer maps with
+	static const UINT MAP_WRITE_DISCARD = 4;
+	static const UINT MAP_WRITE_NO_OVERWRITE = 5;
+
+public:
+	virtual ~RenderBackend() {}
+
+	virtual void IASetInputLayout(ID3D11InputLayout* inputLayout) = 0;
+	virtual void IASetPrimitiveTopology(UINT topology) = 0;
+	virtual void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) = 0;
+	virtual void IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset) = 0;
+
+	virtual void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) = 0;
+	virtual void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) = 0;
+	virtual void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) = 0;
+
+	virtual void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) = 0;
+	virtual void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) = 0;
+	virtual void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) = 0;
+
+	// Binds a window of each buffer, in 16 byte constants. The offsets have to be multiples of 16 constants (D3D 11.1)
+	virtual void VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) = 0;
+	virtual void GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) = 0;
+	virtual void PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) = 0;
+
+	virtual void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) = 0;
+	virtual void GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) = 0;
+	virtual void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) = 0;
+
+	virtual void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) = 0;
+	virtual void GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) = 0;
+	virtual void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) = 0;
+
+	virtual void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) = 0;
+	virtual void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) = 0;
+	virtual void RSSetState(ID3D11RasterizerState* rasterizerState) = 0;
+
+	virtual void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch) = 0;
+	virtual HRESULT Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped) = 0;
+	virtual void Unmap(ID3D11Resource* resource, UINT subresource) = 0;
+
+	virtual void Draw(UINT vertexCount, UINT startVertex) = 0;
+	virtual void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) = 0;
+	virtual void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) = 0;
+};
+
+// Pipeline state as far as the backends follow it, everything starts unbound
+struct BoundState
+{
+	enum Stage
+	{
+		STAGE_VS,
+		STAGE_GS,
+		STAGE_PS,
+		STAGE_COUNT,
+	};
+
+	static const int VERTEX_BUFFER_SLOTS = 4;
+	static const int CONSTANT_BUFFER_SLOTS = 14;		// D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT
+	static const int RESOURCE_SLOTS = 16;
+	static const int SAMPLER_SLOTS = 16;				// D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT
+
+	ID3D11InputLayout* inputLayout = nullptr;
+	UINT topology = 0;
+	ID3D11Buffer* vertexBuffers[VERTEX_BUFFER_SLOTS] = {};
+	UINT strides[VERTEX_BUFFER_SLOTS] = {};
+	UINT offsets[VERTEX_BUFFER_SLOTS] = {};
+	ID3D11Buffer* indexBuffer = nullptr;
+	UINT indexFormat = 0;
+	UINT indexOffset = 0;
+
+	ID3D11VertexShader* vertexShader = nullptr;
+	ID3D11GeometryShader* geometryShader = nullptr;
+	ID3D11PixelShader* pixelShader = nullptr;
+
+	ID3D11Buffer* constantBuffers[STAGE_COUNT][CONSTANT_BUFFER_SLOTS] = {};
+	UINT firstConstants[STAGE_COUNT][CONSTANT_BUFFER_SLOTS] = {};		// 0 and 0 for the whole buffer
+	UINT constantCounts[STAGE_COUNT][CONSTANT_BUFFER_SLOTS] = {};
+	ID3D11ShaderResourceView* resources[STAGE_COUNT][RESOURCE_SLOTS] = {};
+	ID3D11SamplerState* samplers[STAGE_COUNT][SAMPLER_SLOTS] = {};
+
+	ID3D11BlendState* blendState = nullptr;
+	FLOAT blendFactor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	UINT sampleMask = 0xffffffff;
+	ID3D11DepthStencilState* depthStencilState = nullptr;
+	UINT stencilRef = 0;
+	ID3D11RasterizerState* rasterizerState = nullptr;
+
+	uint64_t Hash() const;
+};
+
+/*
+	Records every call and follows the state it sets, without touching the objects it is handed.
+	Each draw folds a hash of the bound state into GetDrawStateHash, two call streams that draw
+	the same things with the same state end up with the same hash however many calls they took.
+*/
+class RecordingBackend : public RenderBackend
+{
+public:
+	enum CallType
+	{
+		CALL_SET_INPUT_LAYOUT,
+		CALL_SET_TOPOLOGY,
+		CALL_SET_VERTEX_BUFFERS,
+		CALL_SET_INDEX_BUFFER,
+		CALL_SET_SHADER,
+		CALL_SET_CONSTANT_BUFFERS,
+		CALL_SET_SHADER_RESOURCES,
+		CALL_SET_SAMPLERS,
+		CALL_SET_BLEND_STATE,
+		CALL_SET_DEPTH_STENCIL_STATE,
+		CALL_SET_RASTERIZER_STATE,
+		CALL_UPDATE_SUBRESOURCE,
+		CALL_MAP,
+		CALL_UNMAP,
+		CALL_DRAW,
+		CALL_TYPE_COUNT,
+	};
+
+	struct Call
+	{
+		CallType type;
+		int stage;				// BoundState::Stage for the per stage calls, otherwise -1
+		UINT startSlot;
+		UINT count;
+		const void* object;		// First object the call was handed
+	};
+
+public:
+	// mappedBytes is the memory Map hands out per resource
+	RecordingBackend(size_t mappedBytes = 4 * 1024 * 1024);
+	~RecordingBackend();
+
+	// Without keeping the calls only the counters are updated, no call list and no draw state hash
+	void SetKeepCalls(bool keepCalls) { this->keepCalls = keepCalls; }
+
+	void Clear();
+
+	// Adds the calls of another recording as if they were made after these, the way command lists are executed
+	void Append(const RecordingBackend& other);
+
+	const std::vector<Call>& GetCalls() const { return this->calls; }
+	int GetCallCount(CallType type) const { return this->callCounts[type]; }
+	int GetTotalCalls() const;
+	int GetDrawCount() const { return this->callCounts[CALL_DRAW]; }
+	uint64_t GetDrawStateHash() const { return this->drawStateHash; }
+	const BoundState& GetState() const { return this->state; }
+
+	static const char* GetCallName(CallType type);
+
+	void IASetInputLayout(ID3D11InputLayout* inputLayout) override;
+	void IASetPrimitiveTopology(UINT topology) override;
+	void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+	void IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset) override;
+
+	void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+
+	void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+
+	void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+
+	void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+
+	void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) override;
+	void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) override;
+	void RSSetState(ID3D11RasterizerState* rasterizerState) override;
+
+	void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch) override;
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped) override;
+	void Unmap(ID3D11Resource* resource, UINT subresource) override;
+
+	void Draw(UINT vertexCount, UINT startVertex) override;
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) override;
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+
+private:
+	void Record(CallType type, int stage, UINT startSlot, UINT count, const void* object);
+	void RecordDraw(UINT count, UINT start, INT baseVertex, UINT instanceCount, UINT startInstance);
+
+	void SetConstantBuffers(int stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts);
+	void SetShaderResources(int stage, UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views);
+	void SetSamplers(int stage, UINT startSlot, UINT count, ID3D11SamplerState* const* samplers);
+
+private:
+	BoundState state;
+	std::vector<Call> calls;
+	int callCounts[CALL_TYPE_COUNT];
+	uint64_t drawStateHash;
+	int hashedDraws;
+	bool keepCalls;
+
+	size_t mappedBytes;
+	std::unordered_map<ID3D11Resource*, std::vector<uint8_t>> mappedMemory;
+};
+
+/*
+	Takes every call and does nothing with it. Replaying a capture into it measures what issuing the
+	calls costs on the CPU, without a driver or any bookkeeping behind them.
+*/
+class NullBackend : public RenderBackend
+{
+public:
+	// mappedBytes is the memory Map hands out, the same for every resource
+	NullBackend(size_t mappedBytes = 4 * 1024 * 1024);
+	~NullBackend();
+
+	void IASetInputLayout(ID3D11InputLayout* /*inputLayout*/) override {}
+	void IASetPrimitiveTopology(UINT /*topology*/) override {}
+	void IASetVertexBuffers(UINT /*startSlot*/, UINT /*count*/, ID3D11Buffer* const* /*buffers*/, const UINT* /*strides*/, const UINT* /*offsets*/) override {}
+	void IASetIndexBuffer(ID3D11Buffer* /*buffer*/, UINT /*format*/, UINT /*offset*/) override {}
+
+	void VSSetShader(ID3D11VertexShader* /*shader*/, ID3D11ClassInstance* const* /*classInstances*/, UINT /*classInstanceCount*/) override {}
+	void GSSetShader(ID3D11GeometryShader* /*shader*/, ID3D11ClassInstance* const* /*classInstances*/, UINT /*classInstanceCount*/) override {}
+	void PSSetShader(ID3D11PixelShader* /*shader*/, ID3D11ClassInstance* const* /*classInstances*/, UINT /*classInstanceCount*/) override {}
+
+	void VSSetConstantBuffers(UINT /*startSlot*/, UINT /*count*/, ID3D11Buffer* const* /*buffers*/) override {}
+	void GSSetConstantBuffers(UINT /*startSlot*/, UINT /*count*/, ID3D11Buffer* const* /*buffers*/) override {}
+	void PSSetConstantBuffers(UINT /*startSlot*/, UINT /*count*/, ID3D11Buffer* const* /*buffers*/) override {}
+	void VSSetConstantBuffers1(UINT /*startSlot*/, UINT /*count*/, ID3D11Buffer* const* /*buffers*/, const UINT* /*firstConstants*/, const UINT* /*constantCounts*/) override {}
+	void GSSetConstantBuffers1(UINT /*startSlot*/, UINT /*count*/, ID3D11Buffer* const* /*buffers*/, const UINT* /*firstConstants*/, const UINT* /*constantCounts*/) override {}
+	void PSSetConstantBuffers1(UINT /*startSlot*/, UINT /*count*/, ID3D11Buffer* const* /*buffers*/, const UINT* /*firstConstants*/, const UINT* /*constantCounts*/) override {}
+
+	void VSSetShaderResources(UINT /*startSlot*/, UINT /*count*/, ID3D11ShaderResourceView* const* /*views*/) override {}
+	void GSSetShaderResources(UINT /*startSlot*/, UINT /*count*/, ID3D11ShaderResourceView* const* /*views*/) override {}
+	void PSSetShaderResources(UINT /*startSlot*/, UINT /*count*/, ID3D11ShaderResourceView* const* /*views*/) override {}
+
+	void VSSetSamplers(UINT /*startSlot*/, UINT /*count*/, ID3D11SamplerState* const* /*samplers*/) override {}
+	void GSSetSamplers(UINT /*startSlot*/, UINT /*count*/, ID3D11SamplerState* const* /*samplers*/) override {}
+	void PSSetSamplers(UINT /*startSlot*/, UINT /*count*/, ID3D11SamplerState* const* /*samplers*/) override {}
+
+	void OMSetBlendState(ID3D11BlendState* /*blendState*/, const FLOAT /*blendFactor*/[4], UINT /*sampleMask*/) override {}
+	void OMSetDepthStencilState(ID3D11DepthStencilState* /*depthStencilState*/, UINT /*stencilRef*/) override {}
+	void RSSetState(ID3D11RasterizerState* /*rasterizerState*/) override {}
+
+	void UpdateSubresource(ID3D11Resource* /*resource*/, UINT /*subresource*/, const ResourceBox* /*box*/, const void* /*data*/, UINT /*rowPitch*/, UINT /*depthPitch*/) override {}
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped) override;
+	void Unmap(ID3D11Resource* /*resource*/, UINT /*subresource*/) override {}
+
+	void Draw(UINT /*vertexCount*/, UINT /*startVertex*/) override {}
+	void DrawIndexed(UINT /*indexCount*/, UINT /*startIndex*/, INT /*baseVertex*/) override {}
+	void DrawIndexedInstanced(UINT /*indexCount*/, UINT /*instanceCount*/, UINT /*startIndex*/, INT /*baseVertex*/, UINT /*startInstance*/) override {}
+
+private:
+	std::vector<uint8_t> memory;
+};
\ No newline at end of file
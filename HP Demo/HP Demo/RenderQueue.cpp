@@ -0,0 +1,464 @@
+#include "RenderQueue.h"
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+static const int PASS_SHIFT = 60;
+static const int SHADER_SHIFT = 48;
+static const int MATERIAL_SHIFT = 32;
+static const int TEXTURE_SHIFT = 16;
+static const int TRANSPARENT_DEPTH_SHIFT = 28;
+static const int TRANSPARENT_SHADER_SHIFT = 16;
+
+static const uint64_t SHADER_MASK = 0xfff;
+static const uint64_t FIELD_MASK = 0xffff;
+
+// FNV-1a, the material is hashed field by field so padding never ends up in it
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static int CountBits(uint32_t value)
+{
+	int count = 0;
+	for (; value; value &= value - 1)
+		count++;
+	return count;
+}
+
+RenderQueue::RenderQueue()
+{
+	this->view = DirectX::XMMatrixIdentity();
+	this->farDepth = 1000.0f;
+	this->cullSubsets = false;
+	this->transparentFirst = 0;
+	this->lightClusters = nullptr;
+	this->shadowCascades = nullptr;
+	this->materialTable = nullptr;
+	for (int pass = 0; pass < PASS_COUNT; pass++)
+		this->pipelines[pass] = nullptr;
+}
+
+RenderQueue::~RenderQueue()
+{
+}
+
+void RenderQueue::Begin(DirectX::XMMATRIX view, float farDepth)
+{
+	this->view = view;
+	this->farDepth = farDepth;
+	this->cullSubsets = false;
+
+	packets.clear();
+	keys.clear();
+	transparentFirst = 0;
+	stats.culledSubsets = 0;
+	stats.triangles = 0;
+}
+
+void RenderQueue::Begin(DirectX::XMMATRIX view, DirectX::XMMATRIX projection, float farDepth)
+{
+	using namespace DirectX;
+
+	Begin(view, farDepth);
+
+	// Gribb / Hartmann, as in FrustumCuller
+	XMMATRIX columns = XMMatrixTranspose(view * projection);
+	XMVECTOR extracted[6] =
+	{
+		XMVectorAdd(columns.r[3], columns.r[0]),
+		XMVectorSubtract(columns.r[3], columns.r[0]),
+		XMVectorAdd(columns.r[3], columns.r[1]),
+		XMVectorSubtract(columns.r[3], columns.r[1]),
+		columns.r[2],
+		XMVectorSubtract(columns.r[3], columns.r[2]),
+	};
+
+	for (int p = 0; p < 6; p++)
+		XMStoreFloat4(&planes[p], XMPlaneNormalize(extracted[p]));
+	cullSubsets = true;
+}
+
+bool RenderQueue::IsSphereVisible(DirectX::FXMVECTOR center, float radius) const
+{
+	using namespace DirectX;
+
+	for (int p = 0; p < 6; p++)
+	{
+		if (XMVectorGetX(XMPlaneDotCoord(XMLoadFloat4(&planes[p]), center)) < -radius)
+			return false;
+	}
+	return true;
+}
+
+uint64_t RenderQueue::HashMaterial(Model* model, int materialIndex)
+{
+	const SurfaceMaterial& material = model->GetMaterial()[materialIndex];
+
+	uint64_t hash = 14695981039346656037ull;
+	hash = HashBytes(hash, &material.diffuseColor, sizeof(material.diffuseColor));
+	hash = HashBytes(hash, &material.ambientColor, sizeof(material.ambientColor));
+	hash = HashBytes(hash, &material.specularColor, sizeof(material.specularColor));
+
+	int flags = material.hasTexture | material.isTerrain << 1 | material.hasNormalMap << 2 | material.hasLightMap << 3 | material.isTransparent << 4;
+	hash = HashBytes(hash, &flags, sizeof(flags));
+	if (material.isTransparent)
+		hash = HashBytes(hash, &material.opacity, sizeof(material.opacity));
+
+	// The maps belong to the model but are bound with the material
+	ID3D11ShaderResourceView* normalMap = material.hasNormalMap ? model->GetNormalMap() : nullptr;
+	ID3D11ShaderResourceView* lightMap = material.hasLightMap ? model->GetLightMap() : nullptr;
+	hash = HashBytes(hash, &normalMap, sizeof(normalMap));
+	hash = HashBytes(hash, &lightMap, sizeof(lightMap));
+
+	return hash;
+}
+
+uint16_t RenderQueue::GetId(std::unordered_map<uint64_t, uint16_t>& ids, uint64_t value)
+{
+	auto found = ids.find(value);
+	if (found != ids.end())
+		return found->second;
+
+	uint16_t id = (uint16_t)ids.size();
+	ids[value] = id;
+	return id;
+}
+
+void RenderQueue::Add(int pass, Shader* shader, Model* model)
+{
+	using namespace DirectX;
+
+	if (materialTable && model->GetMaterialTableFirst() < 0)
+		materialTable->AddModel(model);
+
+	// The level LodSelector picked, its subsets have the bounds of the full ones
+	XMMATRIX world = model->GetWorldMatrix();
+	const std::vector<ModelSubset>& subsets = model->GetLodSubsets();
+	if (subsets.empty())
+	{
+		const XMFLOAT4& sphere = model->GetBoundingSphere();
+		XMVECTOR center = XMVector3TransformCoord(XMVectorSet(sphere.x, sphere.y, sphere.z, 1.0f), world * view);
+
+		const SurfaceMaterial& material = model->GetMaterial()[0];
+		ID3D11ShaderResourceView* texture = material.hasTexture ? model->GetTexture() : nullptr;
+		int materialPass = pass == PASS_OPAQUE && material.isTransparent ? PASS_TRANSPARENT : pass;
+		Add(materialPass, shader, model, HashMaterial(model), texture, XMVectorGetZ(center));
+		stats.triangles += model->GetIndexCount() / 3;
+		return;
+	}
+
+	// Largest axis scale of the world matrix, for the subset radii
+	float scale = 1.0f;
+	bool cull = cullSubsets && subsets.size() > 1;
+	if (cull)
+	{
+		XMVECTOR scaleSq = XMVectorMax(XMVector3LengthSq(world.r[0]), XMVectorMax(XMVector3LengthSq(world.r[1]), XMVector3LengthSq(world.r[2])));
+		scale = sqrtf(XMVectorGetX(scaleSq));
+	}
+
+	for (const ModelSubset& subset : subsets)
+	{
+		const XMFLOAT4& sphere = subset.boundingSphere;
+		XMVECTOR center = XMVector3TransformCoord(XMVectorSet(sphere.x, sphere.y, sphere.z, 1.0f), world);
+		if (cull && !IsSphereVisible(center, sphere.w * scale))
+		{
+			stats.culledSubsets++;
+			continue;
+		}
+
+		// Textures belong to the model, the material only says whether it is used
+		const SurfaceMaterial& material = model->GetMaterial()[subset.material];
+		ID3D11ShaderResourceView* texture = material.hasTexture ? model->GetTexture() : nullptr;
+		int materialPass = pass == PASS_OPAQUE && material.isTransparent ? PASS_TRANSPARENT : pass;
+		Add(materialPass, shader, model, HashMaterial(model, subset.material), texture, XMVectorGetZ(XMVector3TransformCoord(center, view)),
+			subset.startIndex, subset.indexCount, subset.material);
+		stats.triangles += subset.indexCount / 3;
+	}
+}
+
+void RenderQueue::Add(int pass, Shader* shader, Model* model, uint64_t materialHash, ID3D11ShaderResourceView* texture, float viewDepth,
+	int startIndex, int indexCount, int material)
+{
+	DrawPacket packet;
+	packet.model = model;
+	packet.shader = shader;
+	packet.materialHash = materialHash;
+	packet.texture = texture;
+	packet.startIndex = startIndex;
+	packet.indexCount = indexCount;
+	packet.material = material;
+	packet.stateChanges = 0;
+
+	SortKey key;
+	if (pass == PASS_TRANSPARENT)
+	{
+		// Farthest first, state only breaks ties
+		key.key = (uint64_t)pass << PASS_SHIFT
+			| (uint64_t)~SortableFloat(viewDepth) << TRANSPARENT_DEPTH_SHIFT
+			| (GetId(shaderIds, (uint64_t)shader) & SHADER_MASK) << TRANSPARENT_SHADER_SHIFT
+			| (GetId(materialIds, materialHash) & FIELD_MASK);
+	}
+	else
+	{
+		// Front to back inside a state bucket, so the depth test can reject more
+		float depth = std::min(std::max(viewDepth / farDepth, 0.0f), 1.0f);
+		uint64_t depthBucket = (uint64_t)(depth * 65535.0f);
+
+		key.key = (uint64_t)pass << PASS_SHIFT
+			| (GetId(shaderIds, (uint64_t)shader) & SHADER_MASK) << SHADER_SHIFT
+			| (GetId(materialIds, materialHash) & FIELD_MASK) << MATERIAL_SHIFT
+			| (GetId(textureIds, (uint64_t)texture) & FIELD_MASK) << TEXTURE_SHIFT
+			| depthBucket;
+	}
+	key.index = (uint32_t)packets.size();
+	key.padding = 0;
+
+	packets.push_back(packet);
+	keys.push_back(key);
+}
+
+uint32_t RenderQueue::CountStateChanges(const DrawPacket& previous, const DrawPacket& next)
+{
+	// Each Shader owns its constant buffers, a new shader means binding everything of it again
+	if (previous.shader != next.shader)
+		return STATE_ALL;
+
+	uint32_t changes = 0;
+	if (previous.materialHash != next.materialHash)
+		changes |= STATE_MATERIAL;
+	if (previous.texture != next.texture)
+		changes |= STATE_TEXTURE;
+	if (previous.model != next.model)
+		changes |= STATE_GEOMETRY;
+
+	return changes;
+}
+
+uint32_t RenderQueue::SortableFloat(float value)
+{
+	// Negative floats get all bits flipped and positive ones the sign bit, then they order like unsigned ints
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+void RenderQueue::Sort()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	stats.draws = (int)packets.size();
+	stats.stateChanges = 0;
+	stats.unsortedStateChanges = 0;
+	stats.immediateStateChanges = stats.draws * CountBits(STATE_ALL);
+
+	// Submission order, for comparison
+	for (size_t i = 0; i < packets.size(); i++)
+		stats.unsortedStateChanges += CountBits(i == 0 ? STATE_ALL : CountStateChanges(packets[i - 1], packets[i]));
+
+	scratch.resize(keys.size());
+	RadixSort(keys.data(), scratch.data(), keys.size());
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		DrawPacket& packet = packets[keys[i].index];
+		packet.stateChanges = i == 0 ? STATE_ALL : CountStateChanges(packets[keys[i - 1].index], packet);
+		stats.stateChanges += CountBits(packet.stateChanges);
+	}
+
+	// Everything from the first transparent key on is drawn by SubmitTransparent
+	transparentFirst = keys.size();
+	while (transparentFirst > 0 && keys[transparentFirst - 1].key >> PASS_SHIFT >= PASS_TRANSPARENT)
+		transparentFirst--;
+	stats.transparentDraws = (int)(keys.size() - transparentFirst);
+
+	stats.sortMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool RenderQueue::Submit(RenderBackend* context, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler,
+	ShaderConstants* constants)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (!SubmitSerial(context, 0, transparentFirst, false, view, projection, camera, light, sampler, constants))
+		return false;
+
+	stats.commandLists = 0;
+	stats.recordMilliseconds = 0.0;
+	stats.submitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return true;
+}
+
+bool RenderQueue::SubmitParallel(RenderBackend* context, CommandRecorder* recorder, JobSystem& jobSystem, DirectX::XMMATRIX view, DirectX::XMMATRIX projection,
+	Camera* camera, Light* light, ID3D11SamplerState* sampler, ShaderConstants* constants)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Only the passes before the transparent one
+	size_t count = transparentFirst;
+
+	// A ring that wraps would be written over before the command lists run
+	if (constants && constants->GetRingCapacity() < count)
+		constants = nullptr;
+
+	if (constants)
+	{
+		constants->SetFrame(context, camera, light);
+		objectConstants.resize(keys.size());
+
+		if (count > 0)
+		{
+			if (constants->MapObjects(context, (int)count) != (int)count)
+				return false;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				const DrawPacket& packet = packets[keys[i].index];
+				objectConstants[i] = constants->WriteObject(packet.model, view, projection, GetTableMaterial(packet));
+			}
+			constants->UnmapObjects(context);
+		}
+	}
+
+	auto recordStart = std::chrono::high_resolution_clock::now();
+	int rangeCount = recorder->RecordParallel(jobSystem, count, MIN_RANGE_DRAWS, [&](RenderBackend* rangeContext, size_t first, size_t last)
+	{
+		BindPipeline(rangeContext, first);
+		SubmitRange(rangeContext, first, last, true, view, projection, camera, light, sampler, constants, false);
+	});
+	if (rangeCount < 0)
+		return false;
+
+	stats.recordMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+
+	stats.commandLists = rangeCount;
+	stats.submitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return true;
+}
+
+bool RenderQueue::SubmitTransparent(RenderBackend* context, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light,
+	ID3D11SamplerState* sampler, ShaderConstants* constants)
+{
+	// Something else was drawn since the opaque passes, the first draw binds everything again
+	return SubmitSerial(context, transparentFirst, keys.size(), true, view, projection, camera, light, sampler, constants);
+}
+
+bool RenderQueue::SubmitSerial(RenderBackend* context, size_t first, size_t last, bool newContext, DirectX::XMMATRIX view, DirectX::XMMATRIX projection,
+	Camera* camera, Light* light, ID3D11SamplerState* sampler, ShaderConstants* constants)
+{
+	if (first >= last)
+		return true;
+
+	BindPipeline(context, first);
+
+	if (constants)
+	{
+		constants->SetFrame(context, camera, light);
+		objectConstants.resize(keys.size());
+	}
+
+	// Object constants for as many draws as fit in the ring are written with one map, then those draws go out
+	while (first < last)
+	{
+		size_t batchLast = last;
+		if (constants)
+		{
+			int batch = constants->MapObjects(context, (int)(last - first));
+			if (batch == 0)
+				return false;
+
+			batchLast = first + batch;
+			for (size_t i = first; i < batchLast; i++)
+			{
+				const DrawPacket& packet = packets[keys[i].index];
+				objectConstants[i] = constants->WriteObject(packet.model, view, projection, GetTableMaterial(packet));
+			}
+			constants->UnmapObjects(context);
+		}
+
+		SubmitRange(context, first, batchLast, newContext, view, projection, camera, light, sampler, constants, true);
+		newContext = false;
+		first = batchLast;
+	}
+
+	return true;
+}
+
+UINT RenderQueue::GetTableMaterial(const DrawPacket& packet) const
+{
+	int first = packet.model->GetMaterialTableFirst();
+	if (!materialTable || first < 0)
+		return Shader::NO_MATERIAL;
+
+	return (UINT)(first + packet.material);
+}
+
+void RenderQueue::BindPipeline(RenderBackend* context, size_t first) const
+{
+	if (first >= keys.size())
+		return;
+
+	const PipelineState* pipeline = pipelines[keys[first].key >> PASS_SHIFT];
+	if (pipeline)
+		pipeline->Bind(context, nullptr);
+}
+
+void RenderQueue::SubmitRange(RenderBackend* context, size_t first, size_t last, bool newContext, DirectX::XMMATRIX view, DirectX::XMMATRIX projection,
+	Camera* camera, Light* light, ID3D11SamplerState* sampler, ShaderConstants* constants, bool sharedMaterials)
+{
+	for (size_t i = first; i < last; i++)
+	{
+		const DrawPacket& packet = packets[keys[i].index];
+		Shader* shader = packet.shader;
+		Model* model = packet.model;
+		uint32_t stateChanges = newContext && i == first ? (uint32_t)STATE_ALL : packet.stateChanges;
+
+		if (stateChanges & STATE_SHADER)
+		{
+			shader->Bind(context, sampler);
+			if (constants)
+				shader->SetFrameCBuffers(context, constants->GetCameraBuffer(), constants->GetLightBuffer());
+			else
+				shader->SetFrameCBuffers(context, camera, light);
+			if (lightClusters)
+				lightClusters->Bind(context);
+			if (shadowCascades)
+				shadowCascades->Bind(context);
+			if (materialTable)
+				materialTable->Bind(context);
+		}
+		if (stateChanges & STATE_MATERIAL)
+		{
+			// The table index is in the object constants, only the maps are left
+			if (constants && materialTable)
+				shader->SetMaterialTextures(context, model, packet.material);
+			else if (constants && sharedMaterials)
+			{
+				constants->SetMaterial(context, model, packet.material);
+				shader->SetMaterial(context, model, constants->GetMaterialBuffer(), packet.material);
+			}
+			else
+				shader->SetMaterial(context, model, packet.material);
+		}
+		if (stateChanges & STATE_TEXTURE)
+			shader->SetTexture(context, model, packet.material);
+		if (stateChanges & STATE_GEOMETRY)
+			model->Render(context);
+
+		if (constants)
+			shader->SetObjectCBuffer(context, constants->GetObjectRing(), objectConstants[i], ShaderConstants::OBJECT_CONSTANTS);
+		else
+			shader->SetObjectCBuffer(context, model, view, projection);
+		if (packet.indexCount > 0)
+			context->DrawIndexed(packet.indexCount, model->GetStartIndex() + packet.startIndex, model->GetBaseVertex());
+		else
+			context->DrawIndexed(model->GetIndexCount(), model->GetStartIndex(), model->GetBaseVertex());
+	}
+}
\ No newline at end of file
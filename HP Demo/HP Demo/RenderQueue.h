@@ -0,0 +1,184 @@
+#pragma once
+#include "DX.h"
+#include "Model.h"
+#include "Shader.h"
+#include "Camera.h"
+#include "Light.h"
+#include "RadixSort.h"
+#include "ShaderConstants.h"
+#include "CommandRecorder.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+#include "ShadowCascades.h"
+#include "PipelineCache.h"
+#include "MaterialTable.h"
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+/*
+	Collects the draws of a frame as packets with a 64 bit sort key, radix sorts them and submits
+	them in key order. Neighbouring packets mostly share state, so only the state groups that differ
+	from the previous draw are bound.
+
+	Key, high to low bits: pass (4) | shader (12) | material (16) | texture (16) | depth bucket (16)
+	Ids are handed out the first time a shader, material or texture is seen and stay the same between frames.
+	The ids only order the draws, what gets rebound is decided by comparing the actual state.
+
+	Transparent draws have to blend back to front, so their key is ordered by depth before state:
+	pass (4) | inverted view depth (32) | shader (12) | material (16)
+	The depth is the float's bits made to sort as unsigned, the same radix sort orders them without buckets.
+*/
+class RenderQueue
+{
+public:
+	enum Pass
+	{
+		PASS_OPAQUE = 0,
+		PASS_TRANSPARENT = 1,					// After everything opaque, see SubmitTransparent
+		PASS_COUNT,
+	};
+
+	// State groups a draw can need, see Shader::Bind / SetMaterial / SetTexture and Model::Render
+	enum StateChange
+	{
+		STATE_SHADER = 1 << 0,
+		STATE_MATERIAL = 1 << 1,
+		STATE_TEXTURE = 1 << 2,
+		STATE_GEOMETRY = 1 << 3,
+		STATE_ALL = STATE_SHADER | STATE_MATERIAL | STATE_TEXTURE | STATE_GEOMETRY,
+	};
+
+	struct DrawPacket
+	{
+		Model* model;
+		Shader* shader;
+		uint64_t materialHash;					// Material constants + normal and light map
+		ID3D11ShaderResourceView* texture;
+		int startIndex;							// Index range and material of the subset drawn
+		int indexCount;
+		int material;
+		uint32_t stateChanges;					// Filled in by Sort
+	};
+
+	struct Stats
+	{
+		int draws = 0;
+		int transparentDraws = 0;
+		int triangles = 0;						// Of the models queued this frame, at the levels of detail they were added with
+		int culledSubsets = 0;					// Subsets outside the frustum, their models were not
+		int stateChanges = 0;					// State groups bound this frame
+		int unsortedStateChanges = 0;			// Would have been bound in submission order
+		int immediateStateChanges = 0;			// Shader::Render binds every group for every draw
+		double sortMilliseconds = 0.0;
+		double submitMilliseconds = 0.0;
+		int commandLists = 0;					// Ranges recorded in parallel by SubmitParallel
+		double recordMilliseconds = 0.0;		// Recording and executing the ranges
+	};
+
+	// Fewer draws than this are not worth a context of their own
+	static const int MIN_RANGE_DRAWS = 128;
+
+public:
+	RenderQueue();
+	~RenderQueue();
+
+	// Starts a frame, depth buckets cover [0, farDepth] in view space
+	void Begin(DirectX::XMMATRIX view, float farDepth);
+
+	// Also frustum culls the subsets of models that have more than one
+	void Begin(DirectX::XMMATRIX view, DirectX::XMMATRIX projection, float farDepth);
+
+	// One packet per subset of the model, each with its own material. Transparent subsets of an opaque pass go to PASS_TRANSPARENT
+	void Add(int pass, Shader* shader, Model* model);
+
+	// Without a model lookup, the benchmark feeds fake state through this. indexCount 0 draws the whole model
+	void Add(int pass, Shader* shader, Model* model, uint64_t materialHash, ID3D11ShaderResourceView* texture, float viewDepth,
+		int startIndex = 0, int indexCount = 0, int material = 0);
+
+	// Sorts the packets and works out which state groups every draw has to bind
+	void Sort();
+
+	// Draws the passes before PASS_TRANSPARENT.
+	// With constants, per object data goes through its ring and the shaders share its frame and material buffers, or the material table
+	bool Submit(RenderBackend* context, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler,
+		ShaderConstants* constants = nullptr);
+
+	/*
+		The sorted draws split into one range per thread, recorded onto the recorder's contexts by the job system
+		and executed in order. Frame and object constants are written through context before the jobs start,
+		so constants are only used when the whole frame fits in the ring. Materials come from the table when
+		there is one, otherwise they go through the shaders' own buffers.
+	*/
+	bool SubmitParallel(RenderBackend* context, CommandRecorder* recorder, JobSystem& jobSystem, DirectX::XMMATRIX view, DirectX::XMMATRIX projection,
+		Camera* camera, Light* light, ID3D11SamplerState* sampler, ShaderConstants* constants = nullptr);
+
+	// Draws PASS_TRANSPARENT back to front on one thread, with the pipeline set for the pass
+	bool SubmitTransparent(RenderBackend* context, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler,
+		ShaderConstants* constants = nullptr);
+
+	// Bound with every shader, so every context the draws are recorded on has them
+	void SetLightClusters(LightClusters* lightClusters) { this->lightClusters = lightClusters; }
+	void SetShadowCascades(ShadowCascades* shadowCascades) { this->shadowCascades = shadowCascades; }
+
+	/*
+		Materials from the table instead of cbuffers, models are added to it the first time they are queued.
+		Only used with constants, the material index goes in the object constants.
+	*/
+	void SetMaterialTable(MaterialTable* materialTable) { this->materialTable = materialTable; }
+
+	// Fixed states of a pass, bound once at the start of every context that draws it. The packets' shaders still bind themselves
+	void SetPipeline(Pass pass, const PipelineState* pipeline) { this->pipelines[pass] = pipeline; }
+
+	int GetPacketCount() const { return (int)this->packets.size(); }
+	int GetTransparentFirst() const { return (int)this->transparentFirst; }		// Sorted index of the first transparent packet
+	const DrawPacket& GetSortedPacket(int i) const { return this->packets[this->keys[i].index]; }
+	const Stats& GetStats() const { return this->stats; }
+
+	static uint64_t HashMaterial(Model* model, int material = 0);
+
+private:
+	static uint32_t CountStateChanges(const DrawPacket& previous, const DrawPacket& next);
+	static uint32_t SortableFloat(float value);
+
+	// Sorted packets [first, last) on one thread, object constants written a ring batch at a time
+	bool SubmitSerial(RenderBackend* context, size_t first, size_t last, bool newContext, DirectX::XMMATRIX view, DirectX::XMMATRIX projection,
+		Camera* camera, Light* light, ID3D11SamplerState* sampler, ShaderConstants* constants);
+
+	// Index of the packet's material in the table, NO_MATERIAL without one
+	UINT GetTableMaterial(const DrawPacket& packet) const;
+
+	// Pipeline of the pass the sorted packet is in
+	void BindPipeline(RenderBackend* context, size_t first) const;
+
+	// Draws sorted packets [first, last). In a new context the first draw binds every state group
+	void SubmitRange(RenderBackend* context, size_t first, size_t last, bool newContext, DirectX::XMMATRIX view, DirectX::XMMATRIX projection,
+		Camera* camera, Light* light, ID3D11SamplerState* sampler, ShaderConstants* constants, bool sharedMaterials);
+	uint16_t GetId(std::unordered_map<uint64_t, uint16_t>& ids, uint64_t value);
+	bool IsSphereVisible(DirectX::FXMVECTOR center, float radius) const;
+
+private:
+	std::vector<DrawPacket> packets;
+	std::vector<SortKey> keys;
+	std::vector<SortKey> scratch;
+	std::vector<UINT> objectConstants;		// Ring offset of every sorted packet
+	size_t transparentFirst;
+
+	std::unordered_map<uint64_t, uint16_t> shaderIds;
+	std::unordered_map<uint64_t, uint16_t> materialIds;
+	std::unordered_map<uint64_t, uint16_t> textureIds;
+
+	DirectX::XMMATRIX view;
+	float farDepth;
+
+	LightClusters* lightClusters;
+	ShadowCascades* shadowCascades;
+	MaterialTable* materialTable;
+	const PipelineState* pipelines[PASS_COUNT];
+
+	// World space, normalized, for culling subsets
+	bool cullSubsets;
+	DirectX::XMFLOAT4 planes[6];
+
+	Stats stats;
+};
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/*
+	What the backend interface is written in, without the D3D headers, so the backends that never touch a
+	device build and run anywhere. The D3D objects are only handed around by pointer, declaring them is enough.
+	The typedefs are the ones Windows has, the structs have the layout and member names of D3D11_BOX and
+	D3D11_MAPPED_SUBRESOURCE so D3D11Backend can pass them straight on.
+*/
+typedef unsigned int UINT;
+typedef int INT;
+typedef float FLOAT;
+typedef long HRESULT;
+
+struct ID3D11InputLayout;
+struct ID3D11ClassInstance;
+struct ID3D11Resource;
+struct ID3D11Buffer;
+struct ID3D11VertexShader;
+struct ID3D11GeometryShader;
+struct ID3D11PixelShader;
+struct ID3D11ShaderResourceView;
+struct ID3D11SamplerState;
+struct ID3D11BlendState;
+struct ID3D11DepthStencilState;
+struct ID3D11RasterizerState;
+
+struct ResourceBox
+{
+	UINT left;
+	UINT top;
+	UINT front;
+	UINT right;
+	UINT bottom;
+	UINT back;
+};
+
+struct MappedResource
+{
+	void* pData;
+	UINT RowPitch;
+	UINT DepthPitch;
+};
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "Scene.h"
+#include <cstdio>
+#include <algorithm>
+#include <random>
 
 Scene::Scene() {
 
@@ -9,9 +12,34 @@ Scene::Scene() {
 	this->camera = 0;
 	this->shader = 0;
 	this->skyboxShader = 0;
+	this->foliageShader = 0;
+	this->instancedShader = 0;
 	this->light = 0;
 	this->skybox = nullptr;
 	this->terrain = nullptr;
+	this->voxelTerrain = nullptr;
+	this->foliage = nullptr;
+	this->navigation = nullptr;
+	this->sceneBVH = nullptr;
+	this->visibilityCache = nullptr;
+	this->renderQueue = nullptr;
+	this->materialTable = nullptr;
+	this->occlusionCuller = nullptr;
+	this->lightClusters = nullptr;
+	this->sunDirection = DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f);
+	this->shadowCascades = nullptr;
+	this->shadowQueue = nullptr;
+	this->shadowShader = nullptr;
+	this->opaquePipeline = nullptr;
+	this->transparentPipeline = nullptr;
+	this->casterPipeline = nullptr;
+	this->contextBackend = nullptr;
+	this->frameCapture = nullptr;
+	this->stateCache = nullptr;
+	this->shaderConstants = nullptr;
+	this->commandRecorder = nullptr;
+	this->jobSystem = nullptr;
+	this->geometryBuffer = nullptr;
 }
 
 Scene::~Scene()
@@ -32,6 +60,141 @@ Scene::~Scene()
 		delete terrain;
 	}
 
+	if (voxelTerrain)
+	{
+		voxelTerrain->Shutdown();
+		delete voxelTerrain;
+		voxelTerrain = 0;
+	}
+
+	if (sceneBVH)
+	{
+		delete sceneBVH;
+		sceneBVH = 0;
+	}
+
+	if (visibilityCache)
+	{
+		delete visibilityCache;
+		visibilityCache = 0;
+	}
+
+	if (renderQueue)
+	{
+		delete renderQueue;
+		renderQueue = 0;
+	}
+
+	if (materialTable)
+	{
+		materialTable->Shutdown();
+		delete materialTable;
+		materialTable = 0;
+	}
+
+	if (occlusionCuller)
+	{
+		delete occlusionCuller;
+		occlusionCuller = 0;
+	}
+
+	if (lightClusters)
+	{
+		lightClusters->Shutdown();
+		delete lightClusters;
+		lightClusters = 0;
+	}
+
+	if (shadowCascades)
+	{
+		shadowCascades->Shutdown();
+		delete shadowCascades;
+		shadowCascades = 0;
+	}
+
+	if (shadowQueue)
+	{
+		delete shadowQueue;
+		shadowQueue = 0;
+	}
+
+	if (shadowShader)
+	{
+		delete shadowShader;
+		shadowShader = 0;
+	}
+
+	if (commandRecorder)
+	{
+		delete commandRecorder;
+		commandRecorder = 0;
+	}
+
+	if (shaderConstants)
+	{
+		shaderConstants->Shutdown();
+		delete shaderConstants;
+		shaderConstants = 0;
+	}
+
+	if (stateCache)
+	{
+		delete stateCache;
+		stateCache = 0;
+	}
+
+	if (frameCapture)
+	{
+		delete frameCapture;
+		frameCapture = 0;
+	}
+
+	if (contextBackend)
+	{
+		delete contextBackend;
+		contextBackend = 0;
+	}
+
+	if (navigation)
+	{
+		navigation->Shutdown();
+		delete navigation;
+		navigation = 0;
+	}
+
+	if (foliage)
+	{
+		foliage->Shutdown();
+		delete foliage;
+		foliage = 0;
+	}
+
+	for (unsigned int i = 0; i < foliageMeshes.size(); i++)
+	{
+		foliageMeshes[i]->Shutdown();
+		delete foliageMeshes[i];
+	}
+	foliageMeshes.clear();
+
+	if (foliageShader)
+	{
+		delete foliageShader;
+		foliageShader = 0;
+	}
+
+	for (unsigned int i = 0; i < instancedModels.size(); i++)
+	{
+		instancedModels[i]->Shutdown();
+		delete instancedModels[i];
+	}
+	instancedModels.clear();
+
+	if (instancedShader)
+	{
+		delete instancedShader;
+		instancedShader = 0;
+	}
+
 	if (allModels.size() > 0) {
 		for (unsigned int i = 0; i < allModels.size(); i++)
 		{
@@ -65,6 +228,22 @@ Scene::~Scene()
 		delete light;
 		light = 0;
 	}
+
+	// After every model gave its ranges back
+	if (geometryBuffer)
+	{
+		Model::SetSharedGeometry(nullptr);
+		geometryBuffer->Shutdown();
+		delete geometryBuffer;
+		geometryBuffer = 0;
+	}
+
+	if (jobSystem)
+	{
+		jobSystem->Shutdown();
+		delete jobSystem;
+		jobSystem = 0;
+	}
 }
 
 bool Scene::Initialize(int screenWidth, int screenHeight, HWND hwnd)
@@ -86,6 +265,48 @@ bool Scene::Initialize(int screenWidth, int screenHeight, HWND hwnd)
 	this->screenWidth = screenWidth;
 	this->screenHeight = screenHeight;
 
+	contextBackend = new D3D11Backend(dx11->GetContext());
+	frameCapture = new FrameCapture(contextBackend, D3D11Backend::GetBufferSize);
+	stateCache = new StateCache(frameCapture);
+
+	// 16384 objects before the ring wraps
+	shaderConstants = new ShaderConstants;
+	if (!contextBackend->SupportsConstantOffsets() || !shaderConstants->Initialize(dx11->GetDevice(), 4 * 1024 * 1024))
+	{
+		delete shaderConstants;
+		shaderConstants = nullptr;
+	}
+
+	commandRecorder = new D3D11CommandRecorder(dx11->GetDevice(), dx11->GetContext());
+
+	/*
+		Every model loaded from here on goes into the shared geometry pages.
+	*/
+	geometryBuffer = new GeometryBuffer;
+	if (!geometryBuffer->Initialize(dx11->GetDevice(), dx11->GetContext(), GeometryBuffer::Settings()))
+		return false;
+	Model::SetSharedGeometry(geometryBuffer);
+
+	/*
+		Worker threads for the bakers and other parallel CPU work.
+	*/
+	jobSystem = new JobSystem;
+	jobSystem->Initialize();
+
+	sceneBVH = new SceneBVH;
+	visibilityCache = new VisibilityCache;
+	visibilityCache->Initialize(VisibilityCache::Settings());
+	renderQueue = new RenderQueue;
+
+	// The material index goes in the object constants, so the table needs the ring
+	if (shaderConstants)
+	{
+		materialTable = new MaterialTable;
+		if (!materialTable->Initialize(dx11->GetDevice(), 1024))
+			return false;
+		renderQueue->SetMaterialTable(materialTable);
+	}
+
 	camera = new Camera(hwnd);
 	if (!camera)
 		return false;
@@ -122,6 +343,33 @@ bool Scene::Initialize(int screenWidth, int screenHeight, HWND hwnd)
 	}
 
 	InitializeTerrain(hwnd);
+	InitializeNavigation();
+	InitializeVoxelTerrain();
+	InitializeOcclusion();
+	InitializePointLights();
+
+	if (!InitializeShadows(hwnd))
+	{
+		return false;
+	}
+
+	if (!InitializePipelines())
+	{
+		return false;
+	}
+
+	if (!InitializeFoliage(hwnd))
+	{
+		return false;
+	}
+
+	if (!InitializeInstancedModels(hwnd))
+	{
+		return false;
+	}
+
+	// The bakers, occlusion, foliage and boulders were the last to read the raw heights, navigation reads the compressed ones
+	terrain->ReleaseHeightGrid();
 
 	return true;
 }
@@ -141,11 +389,346 @@ void Scene::InitializeTerrain(HWND hwnd)
 	newMaterial.specularColor = DirectX::XMFLOAT4(0.2f, 0.2f, 0.2f, 0.0f);
 	newMaterial.hasTexture = true;
 	newMaterial.isTerrain = true;
+
+	/*
+		Bake the lighting normals from the height grid, 4 texels per cell and BC5 compressed.
+		With isTerrain the pixel shader reads the map as object space normals instead of tangent space.
+	*/
+	TerrainNormalBaker normalBaker;
+	ID3D11ShaderResourceView* normalMapView = nullptr;
+	if (normalBaker.Bake(terrain, 4, true, *jobSystem) && normalBaker.CreateTexture(dx11->GetDevice(), &normalMapView))
+	{
+		Texture* normalTexture = new Texture;
+		normalTexture->SetTexture(normalMapView);
+		terrain->GetMesh()->LoadNormalMapFbx(normalTexture);
+		newMaterial.hasNormalMap = true;
+	}
+
+	/*
+		Bake sun visibility and horizon AO. The scene only has the point light, so the "sun" is the
+		direction from the middle of the terrain towards it.
+	*/
+	DirectX::XMFLOAT3 lightPosition = light->GetLightPosition();
+	DirectX::XMVECTOR terrainCenter = DirectX::XMVector3TransformCoord(
+		DirectX::XMVectorSet(terrain->GetWidth() * terrain->GetCellSpace() * 0.5f, 0.0f, terrain->GetHeight() * terrain->GetCellSpace() * 0.5f, 1.0f),
+		terrain->GetMesh()->GetWorldMatrix());
+
+	DirectX::XMStoreFloat3(&sunDirection, DirectX::XMVector3Normalize(DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&lightPosition), terrainCenter)));
+
+	TerrainLightBaker::BakeSettings lightSettings;
+	lightSettings.sunDirection = sunDirection;
+
+	TerrainLightBaker lightBaker;
+	ID3D11ShaderResourceView* lightMapView = nullptr;
+	if (lightBaker.Bake(terrain, lightSettings, *jobSystem) && lightBaker.CreateTexture(dx11->GetDevice(), &lightMapView))
+	{
+		Texture* lightTexture = new Texture;
+		lightTexture->SetTexture(lightMapView);
+		terrain->GetMesh()->LoadLightMap(lightTexture);
+		newMaterial.hasLightMap = true;
+	}
+
 	terrain->GetMesh()->GetMaterial().push_back(newMaterial);
 
 	allModels.push_back(terrain->GetMesh());
 }
 
+void Scene::InitializeOcclusion()
+{
+	/*
+		The heightmap terrain at a quarter of its resolution is the occluder, every corner lowered to the
+		lowest height around it so nothing that shows over a hill is hidden.
+	*/
+	this->occlusionCuller = new OcclusionCuller;
+	if (!occlusionCuller->Initialize(256, 128))
+	{
+		delete occlusionCuller;
+		occlusionCuller = nullptr;
+		return;
+	}
+
+	occlusionCuller->AddHeightfield(terrain->GetHeightGrid(), terrain->GetWidth(), terrain->GetHeight(), terrain->GetCellSpace(), 4,
+		terrain->GetMesh()->GetWorldMatrix());
+}
+
+void Scene::InitializePointLights()
+{
+	/*
+		Small colored lights scattered just above the terrain, assigned to the clusters of the view each frame.
+	*/
+	lightClusters = new LightClusters;
+
+	LightClusters::Settings settings;
+	settings.nearDepth = SCREEN_NEAR;
+	settings.farDepth = SCREEN_DEPTH;
+	if (!lightClusters->Initialize(settings, dx11->GetDevice(), 4096))
+	{
+		delete lightClusters;
+		lightClusters = nullptr;
+		return;
+	}
+
+	DirectX::XMMATRIX projection;
+	dx11->GetProjectionMatrix(projection);
+	lightClusters->SetProjection(projection, screenWidth, screenHeight);
+	renderQueue->SetLightClusters(lightClusters);
+
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	float sizeX = (terrain->GetWidth() - 1) * terrain->GetCellSpace();
+	float sizeZ = (terrain->GetHeight() - 1) * terrain->GetCellSpace();
+	for (int i = 0; i < 1024; i++)
+	{
+		float x = unit(random) * sizeX;
+		float z = unit(random) * sizeZ;
+		DirectX::XMVECTOR position = DirectX::XMVector3TransformCoord(DirectX::XMVectorSet(x, terrain->GetTriangleHeight(x, z) + 1.0f + unit(random) * 3.0f, z, 1.0f),
+			terrain->GetMesh()->GetWorldMatrix());
+
+		PointLight light;
+		DirectX::XMStoreFloat3(&light.position, position);
+		light.range = 4.0f + unit(random) * 8.0f;
+		light.color = DirectX::XMFLOAT3(unit(random), unit(random), unit(random));
+		light.intensity = 1.5f;
+		pointLights.push_back(light);
+	}
+}
+
+bool Scene::InitializeShadows(HWND hwnd)
+{
+	/*
+		Shadow cascades for the sun the terrain was baked with. The models cast and receive, the terrain
+		keeps its baked self shadowing and gets the shadows of everything standing on it.
+	*/
+	shadowShader = new Shader(dx11->GetDevice());
+	bool result = shadowShader->InitializeShaders(dx11->GetDevice(), hwnd, L"Shaders/ShadowVS.hlsl", L"Shaders/ShadowPS.hlsl", "VSMain", "PSMain");
+	if (!result)
+		return false;
+	result = shadowShader->CreateDefaultInputLayout(dx11->GetDevice());
+	if (!result)
+		return false;
+
+	shadowCascades = new ShadowCascades;
+
+	ShadowCascades::Settings settings;
+	if (!shadowCascades->Initialize(settings, dx11->GetDevice()))
+	{
+		delete shadowCascades;
+		shadowCascades = nullptr;
+		return true;
+	}
+
+	shadowQueue = new RenderQueue;
+	renderQueue->SetShadowCascades(shadowCascades);
+	return true;
+}
+
+bool Scene::InitializePipelines()
+{
+	/*
+		The fixed states of the queued passes as whole pipelines, the queues bind them once per context
+		and the state cache drops what is already set.
+	*/
+	PipelineCache* pipelineCache = dx11->GetPipelineCache();
+
+	PipelineDesc desc;
+	desc.vertexShader = shader->GetVertexShader();
+	desc.pixelShader = shader->GetPixelShader();
+	desc.inputLayout = shader->GetInputLayout();
+	opaquePipeline = pipelineCache->GetPipeline(desc);
+	if (!opaquePipeline)
+		return false;
+
+	// Source over like DX11's transparent blend state, depth tested without writing it
+	desc.blend.RenderTarget[0].BlendEnable = true;
+	desc.blend.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+	desc.blend.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	desc.blend.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+	desc.blend.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+	desc.depthStencil.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+	transparentPipeline = pipelineCache->GetPipeline(desc);
+	if (!transparentPipeline)
+		return false;
+
+	renderQueue->SetPipeline(RenderQueue::PASS_OPAQUE, opaquePipeline);
+	renderQueue->SetPipeline(RenderQueue::PASS_TRANSPARENT, transparentPipeline);
+
+	if (shadowCascades)
+	{
+		PipelineDesc casterDesc;
+		casterDesc.vertexShader = shadowShader->GetVertexShader();
+		casterDesc.pixelShader = shadowShader->GetPixelShader();
+		casterDesc.inputLayout = shadowShader->GetInputLayout();
+		casterDesc.rasterizer = shadowCascades->GetCasterRasterizerDesc();
+		casterPipeline = pipelineCache->GetPipeline(casterDesc);
+		if (!casterPipeline)
+			return false;
+
+		shadowQueue->SetPipeline(RenderQueue::PASS_OPAQUE, casterPipeline);
+	}
+
+	return true;
+}
+
+void Scene::InitializeNavigation()
+{
+	/*
+		Walkable area of the heightmap terrain for pathfinding. The grid keeps reading the terrain's compressed
+		heights, so terrain edits only need an UpdateRegion over the changed points.
+	*/
+	this->navigation = new NavigationGrid;
+
+	NavigationGrid::Settings settings;
+	settings.maxSlope = 40.0f;
+	settings.maxStep = 0.75f;
+	if (!navigation->Initialize(terrain, settings, *jobSystem))
+		OutputDebugStringA("Navigation: terrain is too large for the navigation grid\n");
+}
+
+void Scene::InitializeVoxelTerrain()
+{
+	/*
+		Voxel area next to the heightmap terrain, for the caves and overhangs a heightmap can't do.
+		Chunks are meshed on the job system and uploaded here, after that only edited chunks are.
+	*/
+	this->voxelTerrain = new VoxelTerrain;
+	if (!voxelTerrain->Initialize(4, 4, 1.0f))
+		return;
+
+	voxelTerrain->Generate(1337, *jobSystem);
+	voxelTerrain->MeshDirtyChunks(*jobSystem);
+	voxelTerrain->UploadChangedChunks(dx11->GetDevice(), dx11->GetContext());
+	voxelTerrain->SetWorldMatrix(DirectX::XMMatrixTranslation(60.0f, -40.0f, -20.0f));
+
+	char message[256];
+	snprintf(message, sizeof(message), "Voxel terrain: %d chunks meshed in %.1f ms, %d quads\n",
+		voxelTerrain->GetMeshStats().chunksMeshed, voxelTerrain->GetMeshStats().milliseconds, voxelTerrain->GetMeshStats().quads);
+	OutputDebugStringA(message);
+}
+
+bool Scene::InitializeFoliage(HWND hwnd)
+{
+	foliageShader = new Shader(dx11->GetDevice());
+	bool result = foliageShader->InitializeShaders(dx11->GetDevice(), hwnd, L"Shaders/FoliageVS.hlsl", L"Shaders/DefaultPS.hlsl", "VSMain", "PSMain");
+	if (!result)
+		return false;
+	result = foliageShader->CreateInstancedInputLayout(dx11->GetDevice());
+	if (!result)
+		return false;
+
+	/*
+		Placeholder meshes until there is real content: cones for trees and grass, flat pyramids for rocks.
+		The height rules are fractions of the terrain's own height range.
+	*/
+	const std::vector<float>& heights = terrain->GetHeightGrid();
+	if (heights.empty())
+		return true;
+
+	float lowest = *std::min_element(heights.begin(), heights.end());
+	float highest = *std::max_element(heights.begin(), heights.end());
+	float range = highest - lowest;
+
+	Model* treeMesh = Foliage::CreateConeMesh(dx11->GetDevice(), 7, 0.6f, 2.5f, DirectX::XMFLOAT4(0.1f, 0.35f, 0.1f, 1.0f));
+	Model* rockMesh = Foliage::CreateConeMesh(dx11->GetDevice(), 5, 0.5f, 0.35f, DirectX::XMFLOAT4(0.4f, 0.4f, 0.38f, 1.0f));
+	Model* grassMesh = Foliage::CreateConeMesh(dx11->GetDevice(), 3, 0.08f, 0.45f, DirectX::XMFLOAT4(0.3f, 0.5f, 0.15f, 1.0f));
+	if (!treeMesh || !rockMesh || !grassMesh)
+		return false;
+
+	foliageMeshes.push_back(treeMesh);
+	foliageMeshes.push_back(rockMesh);
+	foliageMeshes.push_back(grassMesh);
+
+	foliage = new Foliage;
+
+	Foliage::Layer trees;
+	trees.name = "Trees";
+	trees.minDistance = 3.0f;
+	trees.maxHeight = lowest + range * 0.7f;
+	trees.maxSlope = 25.0f;
+	trees.density = 0.6f;
+	trees.minScale = 0.8f;
+	trees.maxScale = 1.4f;
+	trees.boundingRadius = 2.5f;
+	trees.mesh = treeMesh;
+	foliage->AddLayer(trees);
+
+	Foliage::Layer rocks;
+	rocks.name = "Rocks";
+	rocks.minDistance = 4.0f;
+	rocks.maxSlope = 60.0f;
+	rocks.density = 0.3f;
+	rocks.minScale = 0.5f;
+	rocks.maxScale = 2.0f;
+	rocks.boundingRadius = 0.5f;
+	rocks.mesh = rockMesh;
+	foliage->AddLayer(rocks);
+
+	Foliage::Layer grass;
+	grass.name = "Grass";
+	grass.minDistance = 0.5f;
+	grass.maxHeight = lowest + range * 0.5f;
+	grass.maxSlope = 35.0f;
+	grass.minScale = 0.7f;
+	grass.maxScale = 1.3f;
+	grass.boundingRadius = 0.45f;
+	grass.mesh = grassMesh;
+	foliage->AddLayer(grass);
+
+	if (foliage->Scatter(terrain, terrain->GetMesh()->GetWorldMatrix(), 1337, *jobSystem))
+	{
+		foliage->CreateBuffers(dx11->GetDevice());
+	}
+
+	return true;
+}
+
+bool Scene::InitializeInstancedModels(HWND hwnd)
+{
+	instancedShader = new Shader(dx11->GetDevice());
+	bool result = instancedShader->InitializeShaders(dx11->GetDevice(), hwnd, L"Shaders/InstancedVS.hlsl", L"Shaders/DefaultPS.hlsl", "VSMain", "PSMain");
+	if (!result)
+		return false;
+	result = instancedShader->CreateModelInstancedInputLayout(dx11->GetDevice());
+	if (!result)
+		return false;
+
+	/*
+		Boulders on a jittered grid over the terrain, one mesh with an instance each. The model world matrix
+		is the terrain's, so the instances are placed in terrain local space.
+	*/
+	if (terrain->GetHeightGrid().empty())
+		return true;
+
+	Model* boulderMesh = Foliage::CreateConeMesh(dx11->GetDevice(), 6, 1.0f, 0.8f, DirectX::XMFLOAT4(0.35f, 0.33f, 0.3f, 1.0f));
+	if (!boulderMesh)
+		return false;
+
+	boulderMesh->SetWorldMatrix(terrain->GetMesh()->GetWorldMatrix());
+	instancedModels.push_back(boulderMesh);
+
+	const int spacing = 6;
+	std::mt19937 random(1337);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	for (int z = spacing; z < terrain->GetHeight() - spacing; z += spacing)
+	{
+		for (int x = spacing; x < terrain->GetWidth() - spacing; x += spacing)
+		{
+			float localX = (x + unit(random) * spacing * 0.5f) * terrain->GetCellSpace();
+			float localZ = (z + unit(random) * spacing * 0.5f) * terrain->GetCellSpace();
+			float scale = 0.5f + unit(random) * 1.5f;
+
+			DirectX::XMMATRIX world = DirectX::XMMatrixScaling(scale, scale, scale) * DirectX::XMMatrixRotationY(unit(random) * DirectX::XM_2PI) *
+				DirectX::XMMatrixTranslation(localX, terrain->GetTriangleHeight(localX, localZ), localZ);
+			boulderMesh->AddInstance(world, DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+		}
+	}
+
+	if (boulderMesh->GetInstanceCount() > 0 && !boulderMesh->CreateInstanceBuffer(dx11->GetDevice()))
+		return false;
+
+	return true;
+}
+
 bool Scene::InitializeSkybox(HWND hwnd)
 {
 	this->skybox = new Model;
@@ -169,6 +752,11 @@ bool Scene::InitializeSkybox(HWND hwnd)
 		return false;
 }
 
+void Scene::CaptureFrames(int frames)
+{
+	frameCapture->Start(frames);
+}
+
 bool Scene::RenderFrame(float deltaTime)
 {
 	bool result;
@@ -186,10 +774,96 @@ bool Scene::RenderFrame(float deltaTime)
 
 void Scene::Update(float deltaTime)
 {
+	// Remesh and upload whatever was edited since the last frame
+	if (voxelTerrain && voxelTerrain->MeshDirtyChunks(*jobSystem) > 0)
+	{
+		voxelTerrain->UploadChangedChunks(dx11->GetDevice(), dx11->GetContext());
+	}
+
+	UpdateSceneBVH();
+
 	// FIX
 	//skybox->SetWorldMatrix(skyboxScale * skycubeRotation * XMMATRIX(XMMatrixTranslation(camera->GetPosition().x, camera->GetPosition().y, camera->GetPosition().z)));
 }
 
+void Scene::UpdateSceneBVH()
+{
+	/*
+		New models and chunks are inserted, the rest get their current world box. The tree refits
+		when something moved and rebuilds on its own when enough changed.
+	*/
+	for (unsigned int i = 0; i < allModels.size(); i++) {
+		if (i < modelHandles.size())
+			sceneBVH->MoveModel(modelHandles[i], allModels[i]);
+		else
+			modelHandles.push_back(sceneBVH->InsertModel(allModels[i]));
+	}
+
+	if (voxelTerrain)
+	{
+		std::vector<VoxelTerrain::Chunk>& chunks = voxelTerrain->GetChunks();
+		chunkHandles.resize(chunks.size(), -1);
+		for (unsigned int i = 0; i < chunks.size(); i++) {
+			if (!chunks[i].model)
+				continue;
+
+			if (chunkHandles[i] < 0)
+				chunkHandles[i] = sceneBVH->InsertModel(chunks[i].model);
+			else
+				sceneBVH->MoveModel(chunkHandles[i], chunks[i].model);
+		}
+	}
+
+	sceneBVH->Update();
+}
+
+bool Scene::RenderShadows(DirectX::XMMATRIX view, DirectX::XMMATRIX projection)
+{
+	DirectX::XMFLOAT3 sceneMin, sceneMax;
+	sceneBVH->GetBounds(sceneMin, sceneMax);
+	shadowCascades->Fit(view, projection, sunDirection, sceneMin, sceneMax);
+	shadowCascades->Cull(*sceneBVH, *jobSystem);
+
+	// Last frame's maps are still bound for reading
+	shadowCascades->Unbind(stateCache);
+
+	for (int cascade = 0; cascade < shadowCascades->GetCascadeCount(); cascade++)
+	{
+		const ShadowCascades::Cascade& fitted = shadowCascades->GetCascade(cascade);
+		DirectX::XMMATRIX lightView = DirectX::XMLoadFloat4x4(&fitted.view);
+		DirectX::XMMATRIX lightProjection = DirectX::XMLoadFloat4x4(&fitted.projection);
+
+		shadowCascades->BeginCascade(dx11->GetContext(), cascade);
+
+		// Transparent subsets land in their own pass, which is never submitted here, so they cast nothing
+		shadowQueue->Begin(lightView, lightProjection, fitted.depthMax - fitted.depthMin);
+		const std::vector<int>& casters = shadowCascades->GetCasters(cascade);
+		for (unsigned int i = 0; i < casters.size(); i++) {
+			Model* model = (Model*)sceneBVH->GetUserData(casters[i]);
+			if (model->GetIndexCount() == 0)
+				continue;
+
+			shadowQueue->Add(RenderQueue::PASS_OPAQUE, shadowShader, model);
+		}
+		shadowQueue->Sort();
+
+		if (!shadowQueue->Submit(stateCache, lightView, lightProjection, camera, light, dx11->GetMinMagMipSampler()))
+			return false;
+	}
+
+	// Back to the screen, the caster pipeline only differs in its shaders and rasterizer state
+	opaquePipeline->Bind(stateCache, casterPipeline);
+	dx11->GetContext()->OMSetRenderTargets(1, &dx11->GetRenderTarget(), dx11->GetDepthStencilView());
+	dx11->GetContext()->RSSetViewports(1, &dx11->GetViewport());
+
+	if (!shadowCascades->Upload(stateCache))
+		return false;
+
+	// For everything drawn with the default pixel shader, also the instanced models and foliage after the command lists
+	shadowCascades->Bind(stateCache);
+	return true;
+}
+
 bool Scene::Render()
 {
 	// RENDER STUFF HERE
@@ -198,28 +872,126 @@ bool Scene::Render()
 
 	dx11->BeginScene(0.0f, 0.8f, 0.2f, 1.0f);
 
+	// Geometry freed in frames the GPU finished can be used again
+	geometryBuffer->BeginFrame();
+
+	// Whatever was bound around the cache since the last frame, the next call of every kind goes through
+	stateCache->Invalidate();
+	stateCache->ResetStats();
+	if (shaderConstants)
+		shaderConstants->ResetStats();
+
+	// Does nothing unless frames were asked for, captures what the state cache lets through
+	frameCapture->BeginFrame();
+
 	// Get the world, view, and projection matrices from the camera and d3d objects.
 	camera->GetViewMatrix(view);
 	dx11->GetProjectionMatrix(projection);
 
-	/* Rest of the models here with default shader*/
-	for (unsigned int i = 0; i < allModels.size(); i++) {
-		allModels[i]->Render(dx11->GetContext());
-		result = shader->Render(dx11->GetContext(), allModels[i], view, projection, camera, light, dx11->GetMinMagMipSampler());
+	/* Sun shadow maps first, they are read by everything drawn after */
+	if (shadowCascades)
+	{
+		result = RenderShadows(view, projection);
+		if (!result)
+			return false;
+	}
+
+	/*
+		Point lights of this view into clusters. Bound here for the instanced models and foliage as well, which
+		use the default pixel shader after the queue. Command lists restore the state from before them
+	*/
+	if (lightClusters)
+	{
+		lightClusters->Build(pointLights, view, *jobSystem);
+		lightClusters->Upload(stateCache);
+		lightClusters->Bind(stateCache);
+	}
+
+	/* Models and voxel chunks in the view, found through the scene BVH or kept from the frames before. Empty chunks have no buffers */
+	visibleModels.clear();
+	visibilityCache->Query(*sceneBVH, view, projection, visibleModels);
+	sceneBVH->ClearChanged();
+
+	/* Of those, the ones the terrain doesn't hide */
+	unoccludedModels.clear();
+	for (unsigned int i = 0; i < visibleModels.size(); i++) {
+		Model* model = (Model*)sceneBVH->GetUserData(visibleModels[i]);
+		if (model->GetIndexCount() == 0)
+			continue;
+
+		unoccludedModels.push_back(model);
+	}
+	if (occlusionCuller)
+	{
+		// The terrain never moves, its depth from the last view is still right when the view is the same
+		if (visibilityCache->IsViewUnchanged())
+			visibilityCache->AddSkippedWork(occlusionCuller->GetStats().renderMilliseconds);
+		else
+			occlusionCuller->Render(view * projection, *jobSystem);
+		occlusionCuller->Cull(unoccludedModels);
+	}
+
+	/* Rest of the models here with default shader, a draw per material subset sorted so draws that share state follow each other */
+	renderQueue->Begin(view, projection, SCREEN_DEPTH);
+	for (unsigned int i = 0; i < unoccludedModels.size(); i++)
+		renderQueue->Add(RenderQueue::PASS_OPAQUE, shader, unoccludedModels[i]);
+	renderQueue->Sort();
+
+	// New models were added to the table while they were queued
+	if (materialTable && !materialTable->Upload(stateCache))
+		return false;
+
+	// Recorded in parallel when there are workers, one range per thread. Deferred contexts go around the capture
+	if (jobSystem->GetThreadCount() > 1 && !frameCapture->IsCapturing())
+		result = renderQueue->SubmitParallel(stateCache, commandRecorder, *jobSystem, view, projection, camera, light, dx11->GetMinMagMipSampler(), shaderConstants);
+	else
+		result = renderQueue->Submit(stateCache, view, projection, camera, light, dx11->GetMinMagMipSampler(), shaderConstants);
+	if (!result)
+		return false;
+
+	/* Meshes placed many times, the visible instances of each are gathered and drawn in one instanced draw */
+	for (unsigned int i = 0; i < instancedModels.size(); i++) {
+		Model* model = instancedModels[i];
+		if (model->GatherVisibleInstances(stateCache, view * projection) == 0)
+			continue;
+
+		model->RenderInstanced(stateCache);
+		result = instancedShader->RenderInstanced(stateCache, model, model->GetVisibleInstanceCount(), 0, view, projection, camera, light, dx11->GetMinMagMipSampler());
+		if (!result)
+			return false;
+	}
+
+	/* Foliage, culled per chunk and drawn with one instanced draw per layer */
+	if (foliage)
+	{
+		result = foliage->Render(stateCache, foliageShader, view, projection, camera, light, dx11->GetMinMagMipSampler());
 		if (!result)
 			return false;
 	}
 
 	// FIX
 	/*Skybox render alone with skybox shader*/
-	skybox->Render(dx11->GetContext());
-	result = skyboxShader->Render(dx11->GetContext(), skybox, view, projection, camera, light, dx11->GetMinMagMipSampler());
+	skybox->Render(stateCache);
+	result = skyboxShader->Render(stateCache, skybox, view, projection, camera, light, dx11->GetMinMagMipSampler());
 	if (!result)
 		return false;
 
-	dx11->EnableAlphaBlending();
+	/* Transparent subsets last, back to front, blended over everything and tested against the depth without writing it */
+	if (renderQueue->GetStats().transparentDraws > 0)
+	{
+		// The transparent pipeline is bound by the queue
+		stateCache->Invalidate();
+		result = renderQueue->SubmitTransparent(stateCache, view, projection, camera, light, dx11->GetMinMagMipSampler(), shaderConstants);
+
+		opaquePipeline->Bind(stateCache, transparentPipeline);
+		if (!result)
+			return false;
+	}
+
+	if (frameCapture->EndFrame())
+		frameCapture->Save("capture.hpcap");
 
-	dx11->DisableAlphaBlending();
+	geometryBuffer->EndFrame();
 
 	dx11->EndScene();
 	return true;
@@ -6,6 +6,23 @@
 #include "Light.h"
 #include "Terrain.h"
 #include "objLoader.h"
+#include "JobSystem.h"
+#include "TerrainNormalBaker.h"
+#include "TerrainLightBaker.h"
+#include "VoxelTerrain.h"
+#include "Foliage.h"
+#include "NavigationGrid.h"
+#include "SceneBVH.h"
+#include "RenderQueue.h"
+#include "StateCache.h"
+#include "D3D11Backend.h"
+#include "D3D11CommandRecorder.h"
+#include "OcclusionCuller.h"
+#include "LightClusters.h"
+#include "ShadowCascades.h"
+#include "VisibilityCache.h"
+#include "FrameCapture.h"
+#include "GeometryBuffer.h"
 
 const float SCREEN_DEPTH = 1000.0f;
 const float SCREEN_NEAR = 0.1f;
@@ -17,20 +34,80 @@ private:
 	DX11* dx11;
 	HRESULT hr;
 
+	JobSystem* jobSystem;
+
+	// Shared vertex and index pages of the models, frees wait for the GPU to finish the frame
+	GeometryBuffer* geometryBuffer;
+
 	Camera* camera;
 	Light* light;
 	objLoader objLoader;
 
 	Shader* shader;
 	Shader* skyboxShader;
+	Shader* foliageShader;
+	Shader* instancedShader;
 
 	int screenWidth, screenHeight;
 	
 	Model* skybox;
 	Terrain* terrain;
+	VoxelTerrain* voxelTerrain;
+	Foliage* foliage;
+	NavigationGrid* navigation;
+	std::vector<Model*> foliageMeshes;
+	std::vector<Model*> instancedModels;		// Drawn through their instances, not in allModels
 	std::vector<Model*> allModels;
 
+	// Every model and voxel chunk, for culling and spatial queries. Handles match allModels / the chunks
+	SceneBVH* sceneBVH;
+	std::vector<int> modelHandles;
+	std::vector<int> chunkHandles;
+	std::vector<int> visibleModels;
+
+	// Last frustum query, reused while the camera stands still
+	VisibilityCache* visibilityCache;
+
+	// Hides what is behind the terrain before it is queued
+	OcclusionCuller* occlusionCuller;
+	std::vector<Model*> unoccludedModels;
+
+	// Visible models sorted by state before they are drawn
+	RenderQueue* renderQueue;
+
+	// Materials of the queued models, indexed per draw. Null without constant buffer offsets
+	MaterialTable* materialTable;
+
+	// Drops bindings the context already has, in front of the device context. What it lets through can be
+	// captured. Render targets, viewports and clears, the geometry page and voxel chunk uploads and what is
+	// recorded on deferred contexts go around it and are not, so a frame that is captured submits serially
+	D3D11Backend* contextBackend;
+	FrameCapture* frameCapture;
+	StateCache* stateCache;
+
+	// Constant buffers by update frequency for the queued draws, null without D3D 11.1 support
+	ShaderConstants* shaderConstants;
+
+	// Deferred contexts the queued draws are recorded on by the job system
+	CommandRecorder* commandRecorder;
+
+	// Point lights on top of the sun, assigned to clusters every frame
+	std::vector<PointLight> pointLights;
+	LightClusters* lightClusters;
+
+	// Sun shadows, the casters of each cascade go through their own queue with the depth only shader
+	DirectX::XMFLOAT3 sunDirection;				// Towards the sun, the one the terrain lighting was baked with
+	ShadowCascades* shadowCascades;
+	RenderQueue* shadowQueue;
+	Shader* shadowShader;
+
+	// Fixed states of the queued passes, owned by the pipeline cache of DX11
+	const PipelineState* opaquePipeline;
+	const PipelineState* transparentPipeline;
+	const PipelineState* casterPipeline;
+
 	bool Render();
+	bool RenderShadows(DirectX::XMMATRIX view, DirectX::XMMATRIX projection);
 
 public:
 	Scene();
@@ -38,11 +115,23 @@ public:
 
 	bool Initialize(int screenWidth, int screenHeight, HWND hwnd);
 	void InitializeTerrain(HWND hwnd);
+	void InitializeVoxelTerrain();
+	bool InitializeFoliage(HWND hwnd);
+	bool InitializeInstancedModels(HWND hwnd);
+	void InitializeNavigation();
+	void InitializeOcclusion();
+	void InitializePointLights();
+	bool InitializeShadows(HWND hwnd);
+	bool InitializePipelines();
 	bool InitializeSkybox(HWND hwnd);
 
 	bool RenderFrame(float deltaTime);
 
+	// Captures the calls of the next frames into capture.hpcap
+	void CaptureFrames(int frames);
+
 	void Update(float deltaTime);
+	void UpdateSceneBVH();
 
 	/*  CUBEMAPPING */
 	/*bool InitializeCubeMapViews(ID3D11Device* device);
@@ -0,0 +1,720 @@
+#include "SceneBVH.h"
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+using namespace DirectX;
+
+// Fewer pending objects than this never force a rebuild on their own
+static const int MIN_PENDING_REBUILD = 32;
+
+// Traversal stacks are fixed size, nodes this deep become leaves no matter how many objects they hold
+static const int MAX_DEPTH = 60;
+
+static float SurfaceArea(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	float x = boundsMax.x - boundsMin.x;
+	float y = boundsMax.y - boundsMin.y;
+	float z = boundsMax.z - boundsMin.z;
+	return 2.0f * (x * y + y * z + z * x);
+}
+
+static void Grow(XMFLOAT3& boundsMin, XMFLOAT3& boundsMax, const XMFLOAT3& otherMin, const XMFLOAT3& otherMax)
+{
+	boundsMin.x = std::min(boundsMin.x, otherMin.x);
+	boundsMin.y = std::min(boundsMin.y, otherMin.y);
+	boundsMin.z = std::min(boundsMin.z, otherMin.z);
+	boundsMax.x = std::max(boundsMax.x, otherMax.x);
+	boundsMax.y = std::max(boundsMax.y, otherMax.y);
+	boundsMax.z = std::max(boundsMax.z, otherMax.z);
+}
+
+static float GetAxis(const XMFLOAT3& value, int axis)
+{
+	return axis == 0 ? value.x : (axis == 1 ? value.y : value.z);
+}
+
+static const XMFLOAT3 EMPTY_MIN(FLT_MAX, FLT_MAX, FLT_MAX);
+static const XMFLOAT3 EMPTY_MAX(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+SceneBVH::SceneBVH()
+{
+	this->objectCount = 0;
+	this->changedSinceBuild = 0;
+	this->moved = false;
+	this->rebuildCostGrowth = 1.4f;
+	this->rebuildChangedFraction = 0.1f;
+}
+
+SceneBVH::~SceneBVH()
+{
+}
+
+void SceneBVH::SetRebuildThresholds(float costGrowth, float changedFraction)
+{
+	this->rebuildCostGrowth = costGrowth;
+	this->rebuildChangedFraction = changedFraction;
+}
+
+void SceneBVH::Clear()
+{
+	objects.clear();
+	freeHandles.clear();
+	nodes.clear();
+	order.clear();
+	pending.clear();
+	changedHandles.clear();
+	objectCount = 0;
+	changedSinceBuild = 0;
+	moved = false;
+}
+
+void SceneBVH::MarkChanged(int handle)
+{
+	if (objects[handle].changed)
+		return;
+
+	objects[handle].changed = true;
+	changedHandles.push_back(handle);
+}
+
+void SceneBVH::ClearChanged()
+{
+	for (int handle : changedHandles)
+		objects[handle].changed = false;
+	changedHandles.clear();
+}
+
+int SceneBVH::Insert(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, void* userData)
+{
+	int handle;
+	if (!freeHandles.empty())
+	{
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else
+	{
+		handle = (int)objects.size();
+		objects.push_back(Object());
+		objects[handle].changed = false;
+	}
+
+	Object& object = objects[handle];
+	object.boundsMin = boundsMin;
+	object.boundsMax = boundsMax;
+	object.userData = userData;
+	object.alive = true;
+	object.inTree = false;
+
+	pending.push_back(handle);
+	objectCount++;
+	changedSinceBuild++;
+	MarkChanged(handle);
+
+	return handle;
+}
+
+void SceneBVH::Remove(int handle)
+{
+	Object& object = objects[handle];
+	if (!object.alive)
+		return;
+
+	// Objects in the tree stay in their leaf as dead entries until the next rebuild
+	if (!object.inTree)
+		pending.erase(std::remove(pending.begin(), pending.end(), handle), pending.end());
+
+	object.alive = false;
+	object.userData = nullptr;
+	objectCount--;
+	changedSinceBuild++;
+	MarkChanged(handle);
+
+	// The handle can only be reused once the tree no longer references it
+	if (!object.inTree)
+		freeHandles.push_back(handle);
+}
+
+void SceneBVH::Move(int handle, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	// Models are moved every frame whether they moved or not, only a different box is a change
+	Object& object = objects[handle];
+	if (object.boundsMin.x == boundsMin.x && object.boundsMin.y == boundsMin.y && object.boundsMin.z == boundsMin.z &&
+		object.boundsMax.x == boundsMax.x && object.boundsMax.y == boundsMax.y && object.boundsMax.z == boundsMax.z)
+		return;
+
+	object.boundsMin = boundsMin;
+	object.boundsMax = boundsMax;
+	MarkChanged(handle);
+
+	if (object.inTree)
+		moved = true;
+}
+
+void SceneBVH::TransformBounds(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, XMMATRIX world, XMFLOAT3& outMin, XMFLOAT3& outMax)
+{
+	// Arvo: the world box of a transformed box is the translation plus every matrix element times the min or max
+	XMVECTOR localMin = XMLoadFloat3(&boundsMin);
+	XMVECTOR localMax = XMLoadFloat3(&boundsMax);
+	XMVECTOR resultMin = world.r[3];
+	XMVECTOR resultMax = world.r[3];
+
+	XMVECTOR axisMin[3] = { XMVectorSplatX(localMin), XMVectorSplatY(localMin), XMVectorSplatZ(localMin) };
+	XMVECTOR axisMax[3] = { XMVectorSplatX(localMax), XMVectorSplatY(localMax), XMVectorSplatZ(localMax) };
+	for (int i = 0; i < 3; i++)
+	{
+		XMVECTOR a = XMVectorMultiply(world.r[i], axisMin[i]);
+		XMVECTOR b = XMVectorMultiply(world.r[i], axisMax[i]);
+		resultMin = XMVectorAdd(resultMin, XMVectorMin(a, b));
+		resultMax = XMVectorAdd(resultMax, XMVectorMax(a, b));
+	}
+
+	XMStoreFloat3(&outMin, resultMin);
+	XMStoreFloat3(&outMax, resultMax);
+}
+
+int SceneBVH::InsertModel(Model* model)
+{
+	XMFLOAT3 boundsMin, boundsMax;
+	TransformBounds(model->GetBoundsMin(), model->GetBoundsMax(), model->GetWorldMatrix(), boundsMin, boundsMax);
+	return Insert(boundsMin, boundsMax, model);
+}
+
+void SceneBVH::MoveModel(int handle, Model* model)
+{
+	XMFLOAT3 boundsMin, boundsMax;
+	TransformBounds(model->GetBoundsMin(), model->GetBoundsMax(), model->GetWorldMatrix(), boundsMin, boundsMax);
+	Move(handle, boundsMin, boundsMax);
+}
+
+void SceneBVH::Update()
+{
+	int threshold = std::max(MIN_PENDING_REBUILD, (int)(objectCount * rebuildChangedFraction));
+	if (changedSinceBuild > threshold || (nodes.empty() && !pending.empty()))
+	{
+		Build();
+		return;
+	}
+
+	if (!moved)
+		return;
+
+	Refit();
+
+	// Moving objects stretch the boxes, past a point a rebuild pays for itself in the queries
+	if (stats.sahCost > stats.builtSahCost * rebuildCostGrowth)
+		Build();
+}
+
+struct SceneBVH::BuildEntry
+{
+	int node;
+	int depth;
+};
+
+void SceneBVH::Build()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Dead handles in the old tree can be reused from now on
+	for (int handle : order)
+	{
+		if (!objects[handle].alive)
+			freeHandles.push_back(handle);
+	}
+
+	order.clear();
+	pending.clear();
+	for (int handle = 0; handle < (int)objects.size(); handle++)
+	{
+		objects[handle].inTree = objects[handle].alive;
+		if (objects[handle].alive)
+			order.push_back(handle);
+	}
+
+	nodes.clear();
+	stats.depth = 0;
+	if (!order.empty())
+	{
+		std::vector<XMFLOAT3> centroids(objects.size());
+		for (int handle : order)
+		{
+			XMVECTOR center = XMVectorScale(XMVectorAdd(XMLoadFloat3(&objects[handle].boundsMin), XMLoadFloat3(&objects[handle].boundsMax)), 0.5f);
+			XMStoreFloat3(&centroids[handle], center);
+		}
+
+		// At most 2n - 1 nodes, reserving keeps the references in Split valid
+		nodes.reserve(order.size() * 2);
+
+		Node root;
+		root.first = 0;
+		root.count = (int)order.size();
+		nodes.push_back(root);
+
+		std::vector<BuildEntry> stack;
+		stack.push_back({ 0, 1 });
+		while (!stack.empty())
+		{
+			BuildEntry entry = stack.back();
+			stack.pop_back();
+			stats.depth = std::max(stats.depth, entry.depth);
+
+			int left = Split(entry.node, centroids, entry.depth < MAX_DEPTH);
+			if (left < 0)
+				continue;
+
+			stack.push_back({ left + 1, entry.depth + 1 });
+			stack.push_back({ left, entry.depth + 1 });
+		}
+	}
+
+	changedSinceBuild = 0;
+	moved = false;
+
+	stats.objects = objectCount;
+	stats.nodes = (int)nodes.size();
+	stats.rebuilds++;
+	stats.sahCost = ComputeSahCost();
+	stats.builtSahCost = stats.sahCost;
+	stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int SceneBVH::Split(int nodeIndex, std::vector<XMFLOAT3>& centroids, bool canSplit)
+{
+	int first = nodes[nodeIndex].first;
+	int count = nodes[nodeIndex].count;
+
+	XMFLOAT3 boundsMin = EMPTY_MIN, boundsMax = EMPTY_MAX;
+	XMFLOAT3 centroidMin = EMPTY_MIN, centroidMax = EMPTY_MAX;
+	for (int i = first; i < first + count; i++)
+	{
+		const Object& object = objects[order[i]];
+		Grow(boundsMin, boundsMax, object.boundsMin, object.boundsMax);
+		Grow(centroidMin, centroidMax, centroids[order[i]], centroids[order[i]]);
+	}
+
+	nodes[nodeIndex].boundsMin = boundsMin;
+	nodes[nodeIndex].boundsMax = boundsMax;
+
+	if (count <= MAX_LEAF_OBJECTS || !canSplit)
+		return -1;
+
+	/*
+		Binned SAH over all three axes: objects go into bins by centroid, a sweep from both sides
+		gives the cost of splitting after every bin. Cost is area * count, the traversal cost
+		is the count of the node itself, so a split has to beat testing every object.
+	*/
+	struct Bin
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		int count;
+	};
+
+	float bestCost = SurfaceArea(boundsMin, boundsMax) * count;
+	int bestAxis = -1, bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float axisMin = GetAxis(centroidMin, axis);
+		float extent = GetAxis(centroidMax, axis) - axisMin;
+		if (extent <= 0.0f)
+			continue;
+
+		Bin bins[BIN_COUNT];
+		for (int b = 0; b < BIN_COUNT; b++)
+		{
+			bins[b].boundsMin = EMPTY_MIN;
+			bins[b].boundsMax = EMPTY_MAX;
+			bins[b].count = 0;
+		}
+
+		float scale = BIN_COUNT / extent;
+		for (int i = first; i < first + count; i++)
+		{
+			int b = std::min(BIN_COUNT - 1, (int)((GetAxis(centroids[order[i]], axis) - axisMin) * scale));
+			Grow(bins[b].boundsMin, bins[b].boundsMax, objects[order[i]].boundsMin, objects[order[i]].boundsMax);
+			bins[b].count++;
+		}
+
+		float leftArea[BIN_COUNT - 1];
+		int leftCount[BIN_COUNT - 1];
+		XMFLOAT3 sweepMin = EMPTY_MIN, sweepMax = EMPTY_MAX;
+		int sweepCount = 0;
+		for (int b = 0; b < BIN_COUNT - 1; b++)
+		{
+			Grow(sweepMin, sweepMax, bins[b].boundsMin, bins[b].boundsMax);
+			sweepCount += bins[b].count;
+			leftArea[b] = sweepCount ? SurfaceArea(sweepMin, sweepMax) : 0.0f;
+			leftCount[b] = sweepCount;
+		}
+
+		sweepMin = EMPTY_MIN;
+		sweepMax = EMPTY_MAX;
+		sweepCount = 0;
+		for (int b = BIN_COUNT - 1; b > 0; b--)
+		{
+			Grow(sweepMin, sweepMax, bins[b].boundsMin, bins[b].boundsMax);
+			sweepCount += bins[b].count;
+			if (sweepCount == 0 || leftCount[b - 1] == 0)
+				continue;
+
+			float cost = leftArea[b - 1] * leftCount[b - 1] + SurfaceArea(sweepMin, sweepMax) * sweepCount;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// Nothing beats a leaf. Leaves still have to stay small, big ones are split in the middle of the list
+	if (bestAxis < 0 && count <= MAX_LEAF_OBJECTS * 4)
+		return -1;
+
+	int middle;
+	if (bestAxis >= 0)
+	{
+		float axisMin = GetAxis(centroidMin, bestAxis);
+		float scale = BIN_COUNT / (GetAxis(centroidMax, bestAxis) - axisMin);
+		int* partition = std::partition(&order[first], &order[first] + count, [&](int handle)
+		{
+			return std::min(BIN_COUNT - 1, (int)((GetAxis(centroids[handle], bestAxis) - axisMin) * scale)) < bestSplit;
+		});
+		middle = (int)(partition - &order[0]);
+	}
+	else
+		middle = first + count / 2;
+
+	int left = (int)nodes.size();
+	Node child;
+	child.first = first;
+	child.count = middle - first;
+	nodes.push_back(child);
+	child.first = middle;
+	child.count = first + count - middle;
+	nodes.push_back(child);
+
+	nodes[nodeIndex].first = left;
+	nodes[nodeIndex].count = 0;
+
+	return left;
+}
+
+void SceneBVH::Refit()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Children always come after their parent, so one backwards pass updates everything bottom up
+	for (int i = (int)nodes.size() - 1; i >= 0; i--)
+	{
+		Node& node = nodes[i];
+		XMFLOAT3 boundsMin = EMPTY_MIN, boundsMax = EMPTY_MAX;
+
+		if (node.count > 0)
+		{
+			for (int j = node.first; j < node.first + node.count; j++)
+			{
+				const Object& object = objects[order[j]];
+				if (object.alive)
+					Grow(boundsMin, boundsMax, object.boundsMin, object.boundsMax);
+			}
+		}
+		else
+		{
+			Grow(boundsMin, boundsMax, nodes[node.first].boundsMin, nodes[node.first].boundsMax);
+			Grow(boundsMin, boundsMax, nodes[node.first + 1].boundsMin, nodes[node.first + 1].boundsMax);
+		}
+
+		node.boundsMin = boundsMin;
+		node.boundsMax = boundsMax;
+	}
+
+	moved = false;
+
+	stats.refits++;
+	stats.sahCost = ComputeSahCost();
+	stats.refitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+float SceneBVH::ComputeSahCost() const
+{
+	if (nodes.empty())
+		return 0.0f;
+
+	float rootArea = SurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax);
+	if (rootArea <= 0.0f)
+		return 0.0f;
+
+	// Inner nodes cost one box test per child, leaves one per object
+	float cost = 0.0f;
+	for (const Node& node : nodes)
+	{
+		if (node.boundsMax.x < node.boundsMin.x)
+			continue;
+
+		cost += SurfaceArea(node.boundsMin, node.boundsMax) * (node.count > 0 ? node.count : 2);
+	}
+
+	return cost / rootArea;
+}
+
+void SceneBVH::GetBounds(XMFLOAT3& boundsMin, XMFLOAT3& boundsMax) const
+{
+	boundsMin = EMPTY_MIN;
+	boundsMax = EMPTY_MAX;
+
+	if (!nodes.empty())
+		Grow(boundsMin, boundsMax, nodes[0].boundsMin, nodes[0].boundsMax);
+	for (int handle : pending)
+		Grow(boundsMin, boundsMax, objects[handle].boundsMin, objects[handle].boundsMax);
+
+	if (boundsMin.x > boundsMax.x)
+	{
+		boundsMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	}
+}
+
+void SceneBVH::QueryFrustum(XMMATRIX viewProjection, std::vector<int>& results) const
+{
+	// Planes straight from the matrix, like the foliage culling. Only signs matter for the box test
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+	XMFLOAT4 planes[6];
+	XMStoreFloat4(&planes[0], XMVectorAdd(columns.r[3], columns.r[0]));
+	XMStoreFloat4(&planes[1], XMVectorSubtract(columns.r[3], columns.r[0]));
+	XMStoreFloat4(&planes[2], XMVectorAdd(columns.r[3], columns.r[1]));
+	XMStoreFloat4(&planes[3], XMVectorSubtract(columns.r[3], columns.r[1]));
+	XMStoreFloat4(&planes[4], columns.r[2]);
+	XMStoreFloat4(&planes[5], XMVectorSubtract(columns.r[3], columns.r[2]));
+
+	QueryPlanes(planes, results);
+}
+
+void SceneBVH::QueryPlanes(const XMFLOAT4* planes, std::vector<int>& results) const
+{
+	// Returns the planes the box is not completely inside of, or -1 when it is outside one
+	auto TestBox = [&](const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, int planeMask) -> int
+	{
+		float centerX = (boundsMin.x + boundsMax.x) * 0.5f, extentX = (boundsMax.x - boundsMin.x) * 0.5f;
+		float centerY = (boundsMin.y + boundsMax.y) * 0.5f, extentY = (boundsMax.y - boundsMin.y) * 0.5f;
+		float centerZ = (boundsMin.z + boundsMax.z) * 0.5f, extentZ = (boundsMax.z - boundsMin.z) * 0.5f;
+
+		int remaining = 0;
+		for (int p = 0; p < 6; p++)
+		{
+			if (!(planeMask & (1 << p)))
+				continue;
+
+			const XMFLOAT4& plane = planes[p];
+			float distance = plane.x * centerX + plane.y * centerY + plane.z * centerZ + plane.w;
+			float radius = fabsf(plane.x) * extentX + fabsf(plane.y) * extentY + fabsf(plane.z) * extentZ;
+
+			if (distance + radius < 0.0f)
+				return -1;
+			if (distance - radius < 0.0f)
+				remaining |= 1 << p;
+		}
+
+		return remaining;
+	};
+
+	for (int handle : pending)
+	{
+		if (TestBox(objects[handle].boundsMin, objects[handle].boundsMax, 0x3f) >= 0)
+			results.push_back(handle);
+	}
+
+	if (nodes.empty())
+		return;
+
+	struct Entry
+	{
+		int node;
+		int planeMask;
+	};
+
+	Entry stack[MAX_DEPTH + 2];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0x3f };
+
+	while (stackSize > 0)
+	{
+		Entry entry = stack[--stackSize];
+		const Node& node = nodes[entry.node];
+
+		int planeMask = TestBox(node.boundsMin, node.boundsMax, entry.planeMask);
+		if (planeMask < 0)
+			continue;
+
+		// Completely inside, take the whole subtree without testing anything below
+		if (planeMask == 0)
+		{
+			int inside[MAX_DEPTH + 2];
+			int insideSize = 0;
+			inside[insideSize++] = entry.node;
+			while (insideSize > 0)
+			{
+				const Node& subtree = nodes[inside[--insideSize]];
+				if (subtree.count > 0)
+				{
+					for (int i = subtree.first; i < subtree.first + subtree.count; i++)
+					{
+						if (objects[order[i]].alive)
+							results.push_back(order[i]);
+					}
+				}
+				else
+				{
+					inside[insideSize++] = subtree.first;
+					inside[insideSize++] = subtree.first + 1;
+				}
+			}
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				const Object& object = objects[order[i]];
+				if (object.alive && TestBox(object.boundsMin, object.boundsMax, planeMask) >= 0)
+					results.push_back(order[i]);
+			}
+		}
+		else
+		{
+			stack[stackSize++] = { node.first, planeMask };
+			stack[stackSize++] = { node.first + 1, planeMask };
+		}
+	}
+}
+
+void SceneBVH::QuerySphere(const XMFLOAT3& center, float radius, std::vector<int>& results) const
+{
+	float radiusSq = radius * radius;
+
+	// Squared distance from the center to the closest point of the box
+	auto Overlaps = [&](const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax) -> bool
+	{
+		float dx = std::max(std::max(boundsMin.x - center.x, center.x - boundsMax.x), 0.0f);
+		float dy = std::max(std::max(boundsMin.y - center.y, center.y - boundsMax.y), 0.0f);
+		float dz = std::max(std::max(boundsMin.z - center.z, center.z - boundsMax.z), 0.0f);
+		return dx * dx + dy * dy + dz * dz <= radiusSq;
+	};
+
+	for (int handle : pending)
+	{
+		if (Overlaps(objects[handle].boundsMin, objects[handle].boundsMax))
+			results.push_back(handle);
+	}
+
+	if (nodes.empty())
+		return;
+
+	int stack[MAX_DEPTH + 2];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodes[stack[--stackSize]];
+		if (!Overlaps(node.boundsMin, node.boundsMax))
+			continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				const Object& object = objects[order[i]];
+				if (object.alive && Overlaps(object.boundsMin, object.boundsMax))
+					results.push_back(order[i]);
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.first;
+			stack[stackSize++] = node.first + 1;
+		}
+	}
+}
+
+bool SceneBVH::Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, RayHit& hit) const
+{
+	// Division by zero gives infinities, which the slab test handles
+	XMFLOAT3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	// Entry distance of the ray into the box, or FLT_MAX when it misses or starts past closest
+	auto Intersect = [&](const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, float closest) -> float
+	{
+		float x0 = (boundsMin.x - origin.x) * inverse.x, x1 = (boundsMax.x - origin.x) * inverse.x;
+		float y0 = (boundsMin.y - origin.y) * inverse.y, y1 = (boundsMax.y - origin.y) * inverse.y;
+		float z0 = (boundsMin.z - origin.z) * inverse.z, z1 = (boundsMax.z - origin.z) * inverse.z;
+
+		float enter = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+		float exit = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), closest));
+		return enter <= exit ? enter : FLT_MAX;
+	};
+
+	hit.handle = -1;
+	hit.distance = maxDistance;
+
+	for (int handle : pending)
+	{
+		float distance = Intersect(objects[handle].boundsMin, objects[handle].boundsMax, hit.distance);
+		if (distance != FLT_MAX && (distance < hit.distance || hit.handle < 0))
+		{
+			hit.handle = handle;
+			hit.distance = distance;
+		}
+	}
+
+	if (!nodes.empty() && Intersect(nodes[0].boundsMin, nodes[0].boundsMax, hit.distance) != FLT_MAX)
+	{
+		int stack[MAX_DEPTH + 2];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0)
+		{
+			const Node& node = nodes[stack[--stackSize]];
+
+			if (node.count > 0)
+			{
+				for (int i = node.first; i < node.first + node.count; i++)
+				{
+					const Object& object = objects[order[i]];
+					if (!object.alive)
+						continue;
+
+					float distance = Intersect(object.boundsMin, object.boundsMax, hit.distance);
+					if (distance != FLT_MAX && (distance < hit.distance || hit.handle < 0))
+					{
+						hit.handle = order[i];
+						hit.distance = distance;
+					}
+				}
+				continue;
+			}
+
+			// Nearer child on top of the stack so it is visited first and shrinks the ray early
+			int nearChild = node.first, farChild = node.first + 1;
+			float nearDistance = Intersect(nodes[nearChild].boundsMin, nodes[nearChild].boundsMax, hit.distance);
+			float farDistance = Intersect(nodes[farChild].boundsMin, nodes[farChild].boundsMax, hit.distance);
+			if (farDistance < nearDistance)
+			{
+				std::swap(nearChild, farChild);
+				std::swap(nearDistance, farDistance);
+			}
+
+			if (farDistance != FLT_MAX)
+				stack[stackSize++] = farChild;
+			if (nearDistance != FLT_MAX)
+				stack[stackSize++] = nearChild;
+		}
+	}
+
+	return hit.handle >= 0;
+}
\ No newline at end of file
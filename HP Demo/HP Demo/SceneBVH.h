@@ -0,0 +1,126 @@
+#pragma once
+#include "DX.h"
+#include "Model.h"
+#include <vector>
+#include <cstdint>
+
+/*
+	Bounding volume hierarchy over world space boxes, shared by culling, picking and light assignment.
+	The tree is built top down with a binned SAH. Objects that move only refit the boxes,
+	the tree is rebuilt when the refit boxes got too loose or enough objects were added or removed.
+	New objects are kept in a short list that queries test directly until the next rebuild.
+	Queries skip whole subtrees, a frustum query takes a subtree that is completely inside without testing it.
+*/
+class SceneBVH
+{
+public:
+	static const int MAX_LEAF_OBJECTS = 4;
+	static const int BIN_COUNT = 16;
+
+	struct RayHit
+	{
+		int handle = -1;
+		float distance = 0.0f;
+	};
+
+	struct Stats
+	{
+		int objects = 0;
+		int nodes = 0;
+		int depth = 0;
+		int rebuilds = 0;
+		int refits = 0;
+		float sahCost = 0.0f;			// Of the current boxes, relative to the root box
+		float builtSahCost = 0.0f;		// Right after the last build
+		double buildMilliseconds = 0.0;
+		double refitMilliseconds = 0.0;
+	};
+
+public:
+	SceneBVH();
+	~SceneBVH();
+
+	// Handles stay valid until the object is removed, freed handles are reused
+	int Insert(const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax, void* userData);
+	void Remove(int handle);
+	void Move(int handle, const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax);
+	void Clear();
+
+	// World space box of the model's object space bounds
+	int InsertModel(Model* model);
+	void MoveModel(int handle, Model* model);
+	static void TransformBounds(const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax, DirectX::XMMATRIX world,
+		DirectX::XMFLOAT3& outMin, DirectX::XMFLOAT3& outMax);
+
+	// Once per frame after the moves: refits, or rebuilds when the tree got bad
+	void Update();
+	void Build();
+	void Refit();
+
+	// Queries append object handles
+	void QueryFrustum(DirectX::XMMATRIX viewProjection, std::vector<int>& results) const;
+	void QueryPlanes(const DirectX::XMFLOAT4* planes, std::vector<int>& results) const;	// 6 planes, inside is positive
+	void QuerySphere(const DirectX::XMFLOAT3& center, float radius, std::vector<int>& results) const;
+	bool Raycast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance, RayHit& hit) const;
+
+	// Box around every object, zero sized at the origin when there are none
+	void GetBounds(DirectX::XMFLOAT3& boundsMin, DirectX::XMFLOAT3& boundsMax) const;
+
+	void* GetUserData(int handle) const { return this->objects[handle].userData; }
+	bool IsAlive(int handle) const { return this->objects[handle].alive; }
+	const DirectX::XMFLOAT3& GetBoundsMin(int handle) const { return this->objects[handle].boundsMin; }
+	const DirectX::XMFLOAT3& GetBoundsMax(int handle) const { return this->objects[handle].boundsMax; }
+
+	// Handles inserted, removed or moved to another box since ClearChanged, each once. Cleared once per frame by the owner
+	const std::vector<int>& GetChangedHandles() const { return this->changedHandles; }
+	void ClearChanged();
+	int GetObjectCount() const { return this->objectCount; }
+	const Stats& GetStats() const { return this->stats; }
+
+	// Rebuild when the SAH cost grew by this factor, or this fraction of the objects was added or removed
+	void SetRebuildThresholds(float costGrowth, float changedFraction);
+
+private:
+	struct Object
+	{
+		DirectX::XMFLOAT3 boundsMin;
+		DirectX::XMFLOAT3 boundsMax;
+		void* userData;
+		bool alive;
+		bool inTree;		// Otherwise on the pending list
+		bool changed;		// In changedHandles
+	};
+
+	// 32 bytes. Leaves have count > 0 and their objects at order[first], inner nodes have children at first and first + 1
+	struct Node
+	{
+		DirectX::XMFLOAT3 boundsMin;
+		int first;
+		DirectX::XMFLOAT3 boundsMax;
+		int count;
+	};
+
+	struct BuildEntry;
+
+	void MarkChanged(int handle);
+	int Split(int node, std::vector<DirectX::XMFLOAT3>& centroids, bool canSplit);
+	float ComputeSahCost() const;
+
+private:
+	std::vector<Object> objects;
+	std::vector<int> freeHandles;
+	int objectCount;
+
+	std::vector<Node> nodes;
+	std::vector<int> order;
+	std::vector<int> pending;
+	std::vector<int> changedHandles;
+
+	int changedSinceBuild;
+	bool moved;
+
+	float rebuildCostGrowth;
+	float rebuildChangedFraction;
+
+	Stats stats;
+};
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "Shader.h"
+#include "D3D11Backend.h"
 
 Shader::Shader(ID3D11Device* device)
 {
@@ -19,12 +20,14 @@ Shader::Shader(ID3D11Device* device)
 
 	this->cubeMap = 0;
 	this->normalMapSRV = 0;
+	this->lightMapSRV = 0;
 	this->texture = 0;
 
 	ZeroMemory(&cameraCB, sizeof(cBufferCamera));
 	ZeroMemory(&lightCB, sizeof(cBufferLight));
 	ZeroMemory(&materialCB, sizeof(cBufferMaterial));
 	ZeroMemory(&objectCB, sizeof(cBufferPerObject));
+	objectCB.materialIndex = NO_MATERIAL;
 }
 
 Shader::~Shader()
@@ -92,6 +95,12 @@ Shader::~Shader()
 }
 
 bool Shader::Render(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler)
+{
+	D3D11Backend backend(context);
+	return Render(&backend, model, view, projection, camera, light, sampler);
+}
+
+bool Shader::Render(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler)
 {
 	bool result;
 	result = SetCBuffers(context, model, view, projection, camera, light);
@@ -99,11 +108,29 @@ bool Shader::Render(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRI
 		return false;
 	}
 
-	RenderShader(context, model->GetIndexCount(), sampler);
+	// Models with several materials are drawn subset by subset
+	const std::vector<ModelSubset>& subsets = model->GetSubsets();
+	if (subsets.size() > 1) {
+		Bind(context, sampler);
+		for (const ModelSubset& subset : subsets) {
+			SetTexture(context, model, subset.material);
+			SetMaterial(context, model, subset.material);
+			context->DrawIndexed(subset.indexCount, model->GetStartIndex() + subset.startIndex, model->GetBaseVertex());
+		}
+		return true;
+	}
+
+	RenderShader(context, model->GetIndexCount(), model->GetStartIndex(), model->GetBaseVertex(), sampler);
 	return true;
 }
 
 bool Shader::RenderWithCubemap(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light, ID3D11SamplerState* sampler)
+{
+	D3D11Backend backend(context);
+	return RenderWithCubemap(&backend, model, view, projection, cubemap, camera, light, sampler);
+}
+
+bool Shader::RenderWithCubemap(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light, ID3D11SamplerState* sampler)
 {
 
 	bool result;
@@ -112,7 +139,25 @@ bool Shader::RenderWithCubemap(ID3D11DeviceContext* context, Model* model, Direc
 		return false;
 	}
 
-	RenderShader(context, model->GetIndexCount(), sampler);
+	RenderShader(context, model->GetIndexCount(), model->GetStartIndex(), model->GetBaseVertex(), sampler);
+	return true;
+}
+
+bool Shader::RenderInstanced(ID3D11DeviceContext* context, Model* model, int instanceCount, int startInstance, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler)
+{
+	D3D11Backend backend(context);
+	return RenderInstanced(&backend, model, instanceCount, startInstance, view, projection, camera, light, sampler);
+}
+
+bool Shader::RenderInstanced(RenderBackend* context, Model* model, int instanceCount, int startInstance, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler)
+{
+	bool result;
+	result = SetCBuffers(context, model, view, projection, camera, light);
+	if (!result) {
+		return false;
+	}
+
+	RenderShaderInstanced(context, model->GetIndexCount(), model->GetStartIndex(), model->GetBaseVertex(), instanceCount, startInstance, sampler);
 	return true;
 }
 
@@ -266,6 +311,62 @@ bool Shader::CreateDefaultInputLayout(ID3D11Device* device)
 	return true;
 }
 
+bool Shader::CreateInstancedInputLayout(ID3D11Device* device)
+{
+	/*
+		Per instance data is the 16 byte FoliageInstance, position + yaw and scale as 16 bit unorms
+	*/
+	D3D11_INPUT_ELEMENT_DESC instancedLayout[] =
+	{
+		{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0,	 D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0,	D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"NORMAL",	 0, DXGI_FORMAT_R32G32B32_FLOAT, 0,	D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT,  0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"INSTANCEPOSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1},
+		{"INSTANCEYAWSCALE", 0, DXGI_FORMAT_R16G16_UNORM, 1, 12, D3D11_INPUT_PER_INSTANCE_DATA, 1},
+	};
+
+	hr = device->CreateInputLayout(instancedLayout, ARRAYSIZE(instancedLayout), VSBlob->GetBufferPointer(), VSBlob->GetBufferSize(), &inputLayout);
+	if (FAILED(hr))
+	{
+		return false;
+	}
+
+	ReleasePtr(VSBlob);
+	ReleasePtr(PSBlob);
+
+	return true;
+}
+
+bool Shader::CreateModelInstancedInputLayout(ID3D11Device* device)
+{
+	/*
+		Per instance data is the 64 byte ModelInstance, three rows of the transposed world matrix and the params
+	*/
+	D3D11_INPUT_ELEMENT_DESC instancedLayout[] =
+	{
+		{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0,	 D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0,	D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"NORMAL",	 0, DXGI_FORMAT_R32G32B32_FLOAT, 0,	D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT,  0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
+		{"INSTANCEWORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1},
+		{"INSTANCEWORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1},
+		{"INSTANCEWORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1},
+		{"INSTANCEPARAMS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1},
+	};
+
+	hr = device->CreateInputLayout(instancedLayout, ARRAYSIZE(instancedLayout), VSBlob->GetBufferPointer(), VSBlob->GetBufferSize(), &inputLayout);
+	if (FAILED(hr))
+	{
+		return false;
+	}
+
+	ReleasePtr(VSBlob);
+	ReleasePtr(PSBlob);
+
+	return true;
+}
+
 bool Shader::CreateSkyboxInputLayout(ID3D11Device* device, ID3D11DeviceContext* context)
 {
 	/* Input layout for skyVertex */
@@ -291,70 +392,148 @@ bool Shader::CreateSkyboxInputLayout(ID3D11Device* device, ID3D11DeviceContext*
 	return true;
 }
 
-bool Shader::SetCBuffers(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light)
+bool Shader::SetCBuffers(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light)
 {
-	DirectX::XMMATRIX worldViewProjection;
-	worldViewProjection = model->GetWorldMatrix() * view * projection;
+	SetObjectCBuffer(context, model, view, projection);
+	SetTexture(context, model);
+	SetMaterial(context, model);
+	SetFrameCBuffers(context, camera, light);
 
-	objectCB.worldViewProj = DirectX::XMMatrixTranspose(worldViewProjection);
-	objectCB.world = DirectX::XMMatrixTranspose(model->GetWorldMatrix());
-	objectCB.InverseWorld = DirectX::XMMatrixInverse(nullptr, model->GetWorldMatrix());
+	return true;
+}
 
-	context->UpdateSubresource(objectBuffer, 0, nullptr, &objectCB, 0, 0);
+void Shader::SetObjectCBuffer(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection)
+{
+	cBufferPerObject objectData;
+	FillObjectCB(objectData, model, view, projection);
+
+	context->UpdateSubresource(objectBuffer, 0, nullptr, &objectData, 0, 0);
 	context->VSSetConstantBuffers(0, 1, &objectBuffer);
+}
 
+void Shader::SetObjectCBuffer(RenderBackend* context, ID3D11Buffer* objectBuffer, UINT firstConstant, UINT constantCount)
+{
+	context->VSSetConstantBuffers1(0, 1, &objectBuffer, &firstConstant, &constantCount);
+}
+
+void Shader::SetTexture(RenderBackend* context, Model* model, int material)
+{
 	// Set shader texture resource in the pixel shader.	
-	if (model->GetMaterial()[0].hasTexture) {
-		texture = model->GetTexture();
+	if (model->GetMaterial()[material].hasTexture) {
+		ID3D11ShaderResourceView* texture = model->GetTexture();
 		context->PSSetShaderResources(0, 1, &texture);
 	}
+}
 
-	if (model->GetMaterial()[0].hasNormalMap) {
-		normalMapSRV = model->GetNormalMap();
-		context->PSSetShaderResources(2, 1, &normalMapSRV);
+void Shader::SetMaterialTextures(RenderBackend* context, Model* model, int material)
+{
+	if (model->GetMaterial()[material].hasNormalMap) {
+		ID3D11ShaderResourceView* normalMap = model->GetNormalMap();
+		context->PSSetShaderResources(2, 1, &normalMap);
 	}
 
+	if (model->GetMaterial()[material].hasLightMap) {
+		ID3D11ShaderResourceView* lightMap = model->GetLightMap();
+		context->PSSetShaderResources(3, 1, &lightMap);
+	}
+}
+
+void Shader::SetMaterial(RenderBackend* context, Model* model, int material)
+{
+	SetMaterialTextures(context, model, material);
+
+	/*
+		MATERIALEEE			// To Pixelshader
+	*/
+	cBufferMaterial materialData;
+	ZeroMemory(&materialData, sizeof(cBufferMaterial));
+	FillMaterialCB(materialData, model, material);
+
+	context->UpdateSubresource(materialBuffer, 0, nullptr, &materialData, 0, 0);
+	context->PSSetConstantBuffers(1, 1, &materialBuffer);
+	context->GSSetConstantBuffers(1, 1, &materialBuffer);
+}
+
+void Shader::SetMaterial(RenderBackend* context, Model* model, ID3D11Buffer* materialBuffer, int material)
+{
+	SetMaterialTextures(context, model, material);
+
+	context->PSSetConstantBuffers(1, 1, &materialBuffer);
+	context->GSSetConstantBuffers(1, 1, &materialBuffer);
+}
+
+void Shader::SetFrameCBuffers(RenderBackend* context, Camera* camera, Light* light)
+{
 	/*
 		Set Camera buffer	// To Vertexshader
 	*/
-	cameraCB.cameraPosition = camera->GetPosition();
+	cBufferCamera cameraData;
+	ZeroMemory(&cameraData, sizeof(cBufferCamera));
+	FillCameraCB(cameraData, camera);
 
-	context->UpdateSubresource(cameraBuffer, 0, nullptr, &cameraCB, 0, 0);
+	context->UpdateSubresource(cameraBuffer, 0, nullptr, &cameraData, 0, 0);
 	context->VSSetConstantBuffers(1, 1, &cameraBuffer);
 	context->GSSetConstantBuffers(0, 1, &cameraBuffer);
 
 	/*
 		Set Light buffer	// To Pixelshader
 	*/
-	lightCB.ambientLightColor = light->GetAmbientColor();
-	lightCB.diffuseLightColor = light->GetDiffuseColor();
-	lightCB.specularLightColor = light->GetSpecularColor();
-	lightCB.lightPosition = light->GetLightPosition();
-	lightCB.lightRange = light->GetLightRange();
-	lightCB.lightAttenuation = light->GetLightAttenuation();
+	cBufferLight lightData;
+	ZeroMemory(&lightData, sizeof(cBufferLight));
+	FillLightCB(lightData, light);
 
-	context->UpdateSubresource(lightBuffer, 0, nullptr, &lightCB, 0, 0);
+	context->UpdateSubresource(lightBuffer, 0, nullptr, &lightData, 0, 0);
+	context->PSSetConstantBuffers(0, 1, &lightBuffer);
+}
+
+void Shader::SetFrameCBuffers(RenderBackend* context, ID3D11Buffer* cameraBuffer, ID3D11Buffer* lightBuffer)
+{
+	context->VSSetConstantBuffers(1, 1, &cameraBuffer);
+	context->GSSetConstantBuffers(0, 1, &cameraBuffer);
 	context->PSSetConstantBuffers(0, 1, &lightBuffer);
+}
 
+void Shader::FillObjectCB(cBufferPerObject& data, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, UINT materialIndex)
+{
+	DirectX::XMMATRIX worldViewProjection;
+	worldViewProjection = model->GetWorldMatrix() * view * projection;
 
-	/*
-		MATERIALEEE			// To Pixelshader
-	*/
-	materialCB.ambientColor = model->GetMaterial()[0].ambientColor;
-	materialCB.diffuseColor = model->GetMaterial()[0].diffuseColor;
-	materialCB.specularColor = model->GetMaterial()[0].specularColor;
-	materialCB.hasTexture = model->GetMaterial()[0].hasTexture;
-	materialCB.isTerrain = model->GetMaterial()[0].isTerrain;
-	materialCB.hasNormMap = model->GetMaterial()[0].hasNormalMap;
+	data.worldViewProj = DirectX::XMMatrixTranspose(worldViewProjection);
+	data.world = DirectX::XMMatrixTranspose(model->GetWorldMatrix());
+	data.InverseWorld = DirectX::XMMatrixInverse(nullptr, model->GetWorldMatrix());
+	data.materialIndex = materialIndex;
+}
 
-	context->UpdateSubresource(materialBuffer, 0, nullptr, &materialCB, 0, 0);
-	context->PSSetConstantBuffers(1, 1, &materialBuffer);
-	context->GSSetConstantBuffers(1, 1, &materialBuffer);
+void Shader::FillCameraCB(cBufferCamera& data, Camera* camera)
+{
+	data.cameraPosition = camera->GetPosition();
+}
 
-	return true;
+void Shader::FillLightCB(cBufferLight& data, Light* light)
+{
+	data.ambientLightColor = light->GetAmbientColor();
+	data.diffuseLightColor = light->GetDiffuseColor();
+	data.specularLightColor = light->GetSpecularColor();
+	data.lightPosition = light->GetLightPosition();
+	data.lightRange = light->GetLightRange();
+	data.lightAttenuation = light->GetLightAttenuation();
+}
+
+void Shader::FillMaterialCB(cBufferMaterial& data, Model* model, int materialIndex)
+{
+	const SurfaceMaterial& material = model->GetMaterial()[materialIndex];
+
+	data.ambientColor = material.ambientColor;
+	data.diffuseColor = material.diffuseColor;
+	data.specularColor = material.specularColor;
+	data.hasTexture = material.hasTexture;
+	data.isTerrain = material.isTerrain;
+	data.hasNormMap = material.hasNormalMap;
+	data.hasLightMap = material.hasLightMap;
+	data.opacity = material.isTransparent ? material.opacity : 1.0f;
 }
 
-bool Shader::SetCBuffersWithCubemap(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light)
+bool Shader::SetCBuffersWithCubemap(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light)
 {
 	int vertexBuffernumber = 0;
 	int pixelBuffernumber = 0;
@@ -428,7 +607,14 @@ bool Shader::SetCBuffersWithCubemap(ID3D11DeviceContext* context, Model* model,
 	return true;
 }
 
-void Shader::RenderShader(ID3D11DeviceContext* context, int indexcount, ID3D11SamplerState* sampler)
+void Shader::RenderShader(RenderBackend* context, int indexcount, int startIndex, int baseVertex, ID3D11SamplerState* sampler)
+{
+	Bind(context, sampler);
+
+	context->DrawIndexed(indexcount, startIndex, baseVertex);
+}
+
+void Shader::Bind(RenderBackend* context, ID3D11SamplerState* sampler)
 {
 	// sets the vertex shader and layout
 	context->IASetInputLayout(inputLayout);
@@ -439,6 +625,16 @@ void Shader::RenderShader(ID3D11DeviceContext* context, int indexcount, ID3D11Sa
 
 	// Set the sampler state in the pixel shader.
 	context->PSSetSamplers(0, 1, &sampler);
+}
+
+void Shader::RenderShaderInstanced(RenderBackend* context, int indexCount, int startIndex, int baseVertex, int instanceCount, int startInstance, ID3D11SamplerState* sampler)
+{
+	context->IASetInputLayout(inputLayout);
+
+	context->VSSetShader(vertexShader, 0, 0);
+	context->PSSetShader(pixelShader, 0, 0);
+
+	context->PSSetSamplers(0, 1, &sampler);
 
-	context->DrawIndexed(indexcount, 0, 0);
+	context->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
 }
\ No newline at end of file
@@ -3,9 +3,11 @@
 #include "Model.h"
 #include "Light.h"
 #include "Camera.h"
+#include "RenderBackend.h"
 
 class Shader {
-private:
+public:
+	// Constant buffer layouts of the default shaders
 	__declspec(align(16))
 		struct cBufferPerObject
 	{
@@ -14,8 +16,12 @@ private:
 		DirectX::XMMATRIX worldViewProj;
 		DirectX::XMMATRIX world;
 		DirectX::XMMATRIX InverseWorld;
+		UINT materialIndex;				// Into the MaterialTable, NO_MATERIAL reads cBufferMaterial
+		UINT padding[3];
 	};
 
+	static const UINT NO_MATERIAL = 0xffffffff;
+
 	__declspec(align(16))
 		struct cBufferCamera {
 
@@ -47,6 +53,10 @@ private:
 		int isTerrain;
 		int hasNormMap;
 		int canMove;
+
+		int hasLightMap;
+		float opacity;
+		int padding[2];
 	};
 
 public:
@@ -58,15 +68,58 @@ public:
 	bool CreateDefaultInputLayout(ID3D11Device* device);
 	bool CreateSkyboxInputLayout(ID3D11Device* device, ID3D11DeviceContext* context);
 
+	// Default vertex layout in slot 0 + FoliageInstance data in slot 1
+	bool CreateInstancedInputLayout(ID3D11Device* device);
+
+	// Default vertex layout in slot 0 + ModelInstance data in slot 1
+	bool CreateModelInstancedInputLayout(ID3D11Device* device);
+
+	// The context versions bind everything straight away, through a backend the calls can be filtered or recorded
 	bool Render(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler);
+	bool Render(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler);
 	bool RenderWithCubemap(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light, ID3D11SamplerState* sampler);
+	bool RenderWithCubemap(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light, ID3D11SamplerState* sampler);
+
+	// The instance buffer has to be bound to slot 1 already
+	bool RenderInstanced(ID3D11DeviceContext* context, Model* model, int instanceCount, int startInstance, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler);
+	bool RenderInstanced(RenderBackend* context, Model* model, int instanceCount, int startInstance, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light, ID3D11SamplerState* sampler);
+
+	/*
+		Render split into its state groups, for callers that sort their draws and only rebind what changed.
+		Every Shader has its own constant buffers, so after switching shaders all groups have to be set again.
+		material picks one of the model's materials, for drawing a subset of it.
+		The groups keep nothing in the Shader, several threads can record them onto their own contexts.
+	*/
+	void Bind(RenderBackend* context, ID3D11SamplerState* sampler);
+	void SetFrameCBuffers(RenderBackend* context, Camera* camera, Light* light);
+	void SetMaterial(RenderBackend* context, Model* model, int material = 0);		// Material cbuffer, normal and light map
+	void SetTexture(RenderBackend* context, Model* model, int material = 0);
+	void SetObjectCBuffer(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection);
+
+	// The same groups with constant buffers someone else keeps up to date, see ShaderConstants
+	void SetFrameCBuffers(RenderBackend* context, ID3D11Buffer* cameraBuffer, ID3D11Buffer* lightBuffer);
+	void SetMaterial(RenderBackend* context, Model* model, ID3D11Buffer* materialBuffer, int material = 0);
+	void SetObjectCBuffer(RenderBackend* context, ID3D11Buffer* objectBuffer, UINT firstConstant, UINT constantCount);
+
+	// Normal and light map only, for draws that read their material from the MaterialTable
+	void SetMaterialTextures(RenderBackend* context, Model* model, int material);
+
+	// For building pipelines around the shader, see PipelineCache
+	ID3D11VertexShader* GetVertexShader() const { return this->vertexShader; }
+	ID3D11PixelShader* GetPixelShader() const { return this->pixelShader; }
+	ID3D11InputLayout* GetInputLayout() const { return this->inputLayout; }
+
+	static void FillObjectCB(cBufferPerObject& data, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, UINT materialIndex = NO_MATERIAL);
+	static void FillCameraCB(cBufferCamera& data, Camera* camera);
+	static void FillLightCB(cBufferLight& data, Light* light);
+	static void FillMaterialCB(cBufferMaterial& data, Model* model, int material = 0);
 
 private:
+	bool SetCBuffers(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light);
+	bool SetCBuffersWithCubemap(RenderBackend* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light);
 
-	bool SetCBuffers(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Camera* camera, Light* light);
-	bool SetCBuffersWithCubemap(ID3D11DeviceContext* context, Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, ID3D11ShaderResourceView* cubemap, Camera* camera, Light* light);
-
-	void RenderShader(ID3D11DeviceContext*, int, ID3D11SamplerState* sampler);
+	void RenderShader(RenderBackend*, int, int startIndex, int baseVertex, ID3D11SamplerState* sampler);
+	void RenderShaderInstanced(RenderBackend* context, int indexCount, int startIndex, int baseVertex, int instanceCount, int startInstance, ID3D11SamplerState* sampler);
 
 private:
 	HRESULT hr;
@@ -91,6 +144,7 @@ private:
 
 	ID3D11ShaderResourceView* cubeMap;
 	ID3D11ShaderResourceView* normalMapSRV;
+	ID3D11ShaderResourceView* lightMapSRV;
 	ID3D11ShaderResourceView* texture;
 
 	ID3D11Device* dx11;
@@ -0,0 +1,197 @@
+#include "ShaderConstants.h"
+#include <cstring>
+#include <algorithm>
+
+static bool CreateConstantBuffer(ID3D11Device* device, UINT size, bool dynamic, ID3D11Buffer** buffer)
+{
+	D3D11_BUFFER_DESC bufferDesc;
+	ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+	bufferDesc.Usage = dynamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_DEFAULT;
+	bufferDesc.ByteWidth = (size + 15) & ~15u;
+	bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bufferDesc.CPUAccessFlags = dynamic ? D3D11_CPU_ACCESS_WRITE : 0;
+
+	return SUCCEEDED(device->CreateBuffer(&bufferDesc, nullptr, buffer));
+}
+
+ShaderConstants::ShaderConstants()
+{
+	this->cameraBuffer = nullptr;
+	this->lightBuffer = nullptr;
+	this->materialBuffer = nullptr;
+	this->objectRing = nullptr;
+	this->ownsBuffers = false;
+
+	ZeroMemory(&cameraCB, sizeof(Shader::cBufferCamera));
+	ZeroMemory(&lightCB, sizeof(Shader::cBufferLight));
+	ZeroMemory(&materialCB, sizeof(Shader::cBufferMaterial));
+	this->frameUploaded = false;
+	this->materialUploaded = false;
+
+	this->ringCapacity = 0;
+	this->ringHead = 0;
+	this->ringMapped = false;
+	this->mappedRing = nullptr;
+}
+
+ShaderConstants::~ShaderConstants()
+{
+	Shutdown();
+}
+
+bool ShaderConstants::Initialize(ID3D11Device* device, UINT ringBytes)
+{
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options;
+	ZeroMemory(&options, sizeof(options));
+	if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))))
+		return false;
+	if (!options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+		return false;
+
+	Shutdown();
+	ownsBuffers = true;
+
+	if (!CreateConstantBuffer(device, sizeof(Shader::cBufferCamera), false, &cameraBuffer) ||
+		!CreateConstantBuffer(device, sizeof(Shader::cBufferLight), false, &lightBuffer) ||
+		!CreateConstantBuffer(device, sizeof(Shader::cBufferMaterial), false, &materialBuffer) ||
+		!CreateConstantBuffer(device, ringBytes, true, &objectRing))
+	{
+		Shutdown();
+		return false;
+	}
+
+	Initialize(cameraBuffer, lightBuffer, materialBuffer, objectRing, ringBytes);
+	ownsBuffers = true;
+	return true;
+}
+
+void ShaderConstants::Initialize(ID3D11Buffer* cameraBuffer, ID3D11Buffer* lightBuffer, ID3D11Buffer* materialBuffer, ID3D11Buffer* objectRing, UINT ringBytes)
+{
+	this->cameraBuffer = cameraBuffer;
+	this->lightBuffer = lightBuffer;
+	this->materialBuffer = materialBuffer;
+	this->objectRing = objectRing;
+	this->ownsBuffers = false;
+
+	frameUploaded = false;
+	materialUploaded = false;
+
+	ringCapacity = ringBytes / OBJECT_STRIDE;
+	ringHead = ringCapacity;		// So the first map discards
+	ringMapped = false;
+}
+
+void ShaderConstants::Shutdown()
+{
+	if (ownsBuffers)
+	{
+		ReleasePtr(cameraBuffer);
+		ReleasePtr(lightBuffer);
+		ReleasePtr(materialBuffer);
+		ReleasePtr(objectRing);
+	}
+
+	cameraBuffer = nullptr;
+	lightBuffer = nullptr;
+	materialBuffer = nullptr;
+	objectRing = nullptr;
+	ownsBuffers = false;
+	ringCapacity = 0;
+}
+
+void ShaderConstants::SetFrame(RenderBackend* context, Camera* camera, Light* light)
+{
+	Shader::cBufferCamera cameraData;
+	Shader::cBufferLight lightData;
+	ZeroMemory(&cameraData, sizeof(cameraData));
+	ZeroMemory(&lightData, sizeof(lightData));
+	Shader::FillCameraCB(cameraData, camera);
+	Shader::FillLightCB(lightData, light);
+
+	if (!frameUploaded || memcmp(&cameraData, &cameraCB, sizeof(cameraData)) != 0)
+	{
+		cameraCB = cameraData;
+		context->UpdateSubresource(cameraBuffer, 0, nullptr, &cameraCB, 0, 0);
+		stats.bytesUploaded += sizeof(cameraCB);
+		stats.updates++;
+	}
+	else
+		stats.skippedUpdates++;
+
+	if (!frameUploaded || memcmp(&lightData, &lightCB, sizeof(lightData)) != 0)
+	{
+		lightCB = lightData;
+		context->UpdateSubresource(lightBuffer, 0, nullptr, &lightCB, 0, 0);
+		stats.bytesUploaded += sizeof(lightCB);
+		stats.updates++;
+	}
+	else
+		stats.skippedUpdates++;
+
+	frameUploaded = true;
+}
+
+void ShaderConstants::SetMaterial(RenderBackend* context, Model* model, int material)
+{
+	Shader::cBufferMaterial materialData;
+	ZeroMemory(&materialData, sizeof(materialData));
+	Shader::FillMaterialCB(materialData, model, material);
+
+	if (materialUploaded && memcmp(&materialData, &materialCB, sizeof(materialData)) == 0)
+	{
+		stats.skippedUpdates++;
+		return;
+	}
+
+	materialCB = materialData;
+	context->UpdateSubresource(materialBuffer, 0, nullptr, &materialCB, 0, 0);
+	stats.bytesUploaded += sizeof(materialCB);
+	stats.updates++;
+	materialUploaded = true;
+}
+
+int ShaderConstants::MapObjects(RenderBackend* context, int count)
+{
+	UINT batch = std::min((UINT)count, ringCapacity);
+
+	// What the GPU may still read is never written over, a full ring starts over in fresh memory
+	UINT mapType = RenderBackend::MAP_WRITE_NO_OVERWRITE;
+	if (ringHead + batch > ringCapacity)
+	{
+		mapType = RenderBackend::MAP_WRITE_DISCARD;
+		ringHead = 0;
+		stats.discards++;
+	}
+
+	MappedResource mapped;
+	if (batch == 0 || FAILED(context->Map(objectRing, 0, mapType, 0, &mapped)))
+		return 0;
+
+	mappedRing = (uint8_t*)mapped.pData;
+	ringMapped = true;
+	stats.maps++;
+	return (int)batch;
+}
+
+UINT ShaderConstants::WriteObject(Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, UINT materialIndex)
+{
+	assert(ringMapped && ringHead < ringCapacity);
+
+	// Filled in place, the mapped memory is only written
+	Shader::cBufferPerObject* data = (Shader::cBufferPerObject*)(mappedRing + (size_t)ringHead * OBJECT_STRIDE);
+	Shader::FillObjectCB(*data, model, view, projection, materialIndex);
+
+	stats.bytesUploaded += sizeof(Shader::cBufferPerObject);
+	stats.objects++;
+	return ringHead++ * OBJECT_CONSTANTS;
+}
+
+void ShaderConstants::UnmapObjects(RenderBackend* context)
+{
+	if (!ringMapped)
+		return;
+
+	context->Unmap(objectRing, 0);
+	ringMapped = false;
+	mappedRing = nullptr;
+}
\ No newline at end of file
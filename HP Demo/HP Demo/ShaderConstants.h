@@ -0,0 +1,78 @@
+#pragma once
+#include "Shader.h"
+#include "RenderBackend.h"
+
+/*
+	Constant data of the default shaders split by how often it changes, shared by every Shader
+	drawing through it.
+	Camera and light are written once per frame and material constants when they differ from what
+	the buffer holds. Per object constants go into one big dynamic ring, mapped with no overwrite
+	for a whole batch of draws and bound by offset, the ring is discarded when it is full.
+*/
+class ShaderConstants
+{
+public:
+	// Bind offsets go in steps of 16 constants, so every object takes 256 bytes of the ring
+	static const UINT OBJECT_STRIDE = 256;
+	static const UINT OBJECT_CONSTANTS = OBJECT_STRIDE / 16;
+
+	struct Stats
+	{
+		size_t bytesUploaded = 0;
+		int updates = 0;				// UpdateSubresource calls
+		int skippedUpdates = 0;			// Frame or material data that was already in the buffer
+		int maps = 0;
+		int discards = 0;
+		int objects = 0;
+	};
+
+public:
+	ShaderConstants();
+	~ShaderConstants();
+
+	// False when the device can't bind constant buffers by offset or map them with no overwrite
+	bool Initialize(ID3D11Device* device, UINT ringBytes);
+
+	// Buffers made elsewhere and not released here, the benchmark hands in stand-ins for a RecordingBackend
+	void Initialize(ID3D11Buffer* cameraBuffer, ID3D11Buffer* lightBuffer, ID3D11Buffer* materialBuffer, ID3D11Buffer* objectRing, UINT ringBytes);
+	void Shutdown();
+
+	void SetFrame(RenderBackend* context, Camera* camera, Light* light);
+	void SetMaterial(RenderBackend* context, Model* model, int material = 0);
+
+	// Maps ring space for up to count objects and returns how many fit, write them and unmap before drawing
+	int MapObjects(RenderBackend* context, int count);
+	UINT WriteObject(Model* model, DirectX::XMMATRIX view, DirectX::XMMATRIX projection,
+		UINT materialIndex = Shader::NO_MATERIAL);		// First constant to bind
+	void UnmapObjects(RenderBackend* context);
+
+	ID3D11Buffer* GetCameraBuffer() const { return this->cameraBuffer; }
+	ID3D11Buffer* GetLightBuffer() const { return this->lightBuffer; }
+	ID3D11Buffer* GetMaterialBuffer() const { return this->materialBuffer; }
+	ID3D11Buffer* GetObjectRing() const { return this->objectRing; }
+	UINT GetRingCapacity() const { return this->ringCapacity; }		// In objects
+
+	const Stats& GetStats() const { return this->stats; }
+	void ResetStats() { this->stats = Stats(); }
+
+private:
+	ID3D11Buffer* cameraBuffer;
+	ID3D11Buffer* lightBuffer;
+	ID3D11Buffer* materialBuffer;
+	ID3D11Buffer* objectRing;
+	bool ownsBuffers;
+
+	// What the buffers hold, to skip uploads that change nothing
+	Shader::cBufferCamera cameraCB;
+	Shader::cBufferLight lightCB;
+	Shader::cBufferMaterial materialCB;
+	bool frameUploaded;
+	bool materialUploaded;
+
+	UINT ringCapacity;			// In objects
+	UINT ringHead;
+	bool ringMapped;
+	uint8_t* mappedRing;
+
+	Stats stats;
+};
\ No newline at end of file
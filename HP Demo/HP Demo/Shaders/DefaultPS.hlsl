@@ -1,8 +1,45 @@
 Texture2D diffuseMap : register(t0);
 TextureCube cubeMap : register(t1);
 Texture2D normalMap : register(t2);
+Texture2D lightMap : register(t3);	// Baked terrain lighting, r = sun visibility, g = ambient occlusion
+
+// Point lights by cluster, see LightClusters
+struct ClusterLight
+{
+	float3 position;
+	float range;
+	float3 color;
+	float padding;
+};
+
+StructuredBuffer<ClusterLight> clusterLights : register(t4);
+StructuredBuffer<uint2> clusterGrid : register(t5);			// Offset and count in clusterLightIndices
+StructuredBuffer<uint> clusterLightIndices : register(t6);
+
+// Sun shadow cascades, see ShadowCascades
+Texture2DArray shadowMap : register(t7);
+
+// Materials of the queued draws, see MaterialTable
+struct TableMaterial
+{
+	float4 diffuseColor;
+	float4 ambientColor;
+	float4 specularColor;
+	uint flags;
+	float opacity;
+	uint2 padding;
+};
+
+#define MATERIAL_TEXTURE 1
+#define MATERIAL_TERRAIN 2
+#define MATERIAL_NORMAL_MAP 4
+#define MATERIAL_LIGHT_MAP 8
+#define NO_MATERIAL 0xffffffff
+
+StructuredBuffer<TableMaterial> materials : register(t8);
 
 SamplerState defaultSampleType : register(s0);
+SamplerComparisonState shadowSampler : register(s1);
 
 cbuffer cBufferLight : register(b0)
 {
@@ -26,6 +63,35 @@ cbuffer cBufferMaterial : register(b1)
 	bool isTerrain;
 	bool hasNormMap;
 	bool canMove;
+
+	bool hasLightMap;
+	float opacity;
+	float2 materialPadding;
+};
+
+// All zero when no clusters are bound
+cbuffer cBufferClusters : register(b2)
+{
+	float3 clusterCameraPosition;
+	float clusterDepthScale;
+	float3 clusterCameraForward;
+	float clusterDepthBias;
+	float2 clusterTileScale;
+	uint2 clusterCountXY;
+	uint clusterCountZ;
+	uint clusterLightCount;
+	uint2 clusterPadding;
+};
+
+// All zero when no shadow maps are bound
+cbuffer cBufferShadows : register(b3)
+{
+	row_major matrix shadowViewProjection[4];
+	float4 shadowSplitFar;
+	float3 shadowCameraPosition;
+	float shadowTexelSize;
+	float3 shadowCameraForward;
+	uint shadowCascadeCount;
 };
 
 
@@ -37,18 +103,46 @@ struct PixelInput
 	float3 WNormal : NORMAL;
 	float3 WTangent : TANGENT;
 	float3 ViewDir : TEXCOORD1;
+	nointerpolation uint MaterialIndex : MATERIAL;
 };
 
 float4 PSMain(PixelInput input) : SV_TARGET
 {
+	// From the table for queued draws, from cBufferMaterial for the rest
+	TableMaterial material;
+	if (input.MaterialIndex != NO_MATERIAL)
+		material = materials[input.MaterialIndex];
+	else
+	{
+		material.diffuseColor = diffuseColor;
+		material.ambientColor = ambientColor;
+		material.specularColor = specularColor;
+		material.flags = (hasTexture ? MATERIAL_TEXTURE : 0) | (isTerrain ? MATERIAL_TERRAIN : 0) |
+			(hasNormMap ? MATERIAL_NORMAL_MAP : 0) | (hasLightMap ? MATERIAL_LIGHT_MAP : 0);
+		material.opacity = opacity;
+		material.padding = uint2(0, 0);
+	}
+
+	bool textured = (material.flags & MATERIAL_TEXTURE) != 0;
+	bool terrain = (material.flags & MATERIAL_TERRAIN) != 0;
+	bool normalMapped = (material.flags & MATERIAL_NORMAL_MAP) != 0;
+	bool lightMapped = (material.flags & MATERIAL_LIGHT_MAP) != 0;
+
 	float4 textureColor = float4(1.0f, 1.0f, 1.0f, 1.0f);
 
 	// Sample the pixel color from the texture using the sampler at this texture coordinate location.	
-	if (hasTexture)
+	if (textured)
 		textureColor = diffuseMap.Sample(defaultSampleType, input.WTexCoord);
 
+	// Terrain normal map is baked in object space with only X and Z stored (RG / BC5)
+	// The terrain world matrix is a translation, so object space is world space
+	if (normalMapped && terrain)
+	{
+		float2 normalXZ = normalMap.Sample(defaultSampleType, input.WTexCoord).rg * 2.0f - 1.0f;
+		input.WNormal = float3(normalXZ.x, sqrt(saturate(1.0f - dot(normalXZ, normalXZ))), normalXZ.y);
+	}
 	//FOR NORMAL MAP
-	if (hasNormMap == true)
+	else if (normalMapped)
 	{
 		float3 tempTangent;
 
@@ -89,7 +183,7 @@ float4 PSMain(PixelInput input) : SV_TARGET
 	lightVector /= distance;
 
 	// Calc ambient
-	ambient = ambientColor * ambientLightColor;
+	ambient = material.ambientColor * ambientLightColor;
 
 	// Diffuse factor
 	float diffuseFactor = dot(lightVector, normalizedNormal);
@@ -100,11 +194,11 @@ float4 PSMain(PixelInput input) : SV_TARGET
 		float3 lightReflection = reflect(-lightVector, normalizedNormal);
 
 		float specularShade = max(dot(lightReflection, input.ViewDir), 0.0f);
-		float specularFactor = pow(specularShade, specularColor.w);		//specularColor.w  =  SpecularPower
+		float specularFactor = pow(specularShade, material.specularColor.w);		//specularColor.w  =  SpecularPower
 
 		// Set diffuse and specular
-		diffuse = diffuseFactor * diffuseColor * diffuseLightColor;
-		specular = specularFactor * specularColor * specularLightColor;
+		diffuse = diffuseFactor * material.diffuseColor * diffuseLightColor;
+		specular = specularFactor * material.specularColor * specularLightColor;
 	}
 
 	// Calc attenuation factor
@@ -114,6 +208,72 @@ float4 PSMain(PixelInput input) : SV_TARGET
 	diffuse *= attenuationFactor;
 	specular *= attenuationFactor;
 
+	// Precomputed self shadowing and occlusion instead of runtime shadow maps
+	if (lightMapped)
+	{
+		float2 bakedLight = lightMap.Sample(defaultSampleType, input.WTexCoord).rg;
+		diffuse *= bakedLight.r;
+		specular *= bakedLight.r;
+		ambient *= bakedLight.g;
+	}
+
+	// Sun shadow from the first cascade that reaches the pixel, 3x3 bilinear comparisons
+	if (shadowCascadeCount > 0)
+	{
+		float shadowDepth = dot(input.WPosition.xyz - shadowCameraPosition, shadowCameraForward);
+		uint cascade = 0;
+		while (cascade < shadowCascadeCount - 1 && shadowDepth > shadowSplitFar[cascade])
+			cascade++;
+
+		float4 shadowPosition = mul(shadowViewProjection[cascade], float4(input.WPosition.xyz, 1.0f));
+		float2 shadowUV = float2(shadowPosition.x * 0.5f + 0.5f, 0.5f - shadowPosition.y * 0.5f);
+
+		if (shadowDepth <= shadowSplitFar[shadowCascadeCount - 1])
+		{
+			float sunVisibility = 0.0f;
+			for (int y = -1; y <= 1; y++)
+			{
+				for (int x = -1; x <= 1; x++)
+					sunVisibility += shadowMap.SampleCmpLevelZero(shadowSampler, float3(shadowUV + float2(x, y) * shadowTexelSize, cascade), shadowPosition.z);
+			}
+			sunVisibility /= 9.0f;
+
+			diffuse *= sunVisibility;
+			specular *= sunVisibility;
+		}
+	}
+
+	// Point lights of the cluster the pixel is in, without baked shadows
+	if (clusterLightCount > 0)
+	{
+		float viewDepth = max(dot(input.WPosition.xyz - clusterCameraPosition, clusterCameraForward), 0.0001f);
+		uint3 cluster;
+		cluster.xy = min((uint2)(input.WVPPosition.xy * clusterTileScale), clusterCountXY - 1);
+		cluster.z = (uint)clamp(log(viewDepth) * clusterDepthScale + clusterDepthBias, 0.0f, (float)(clusterCountZ - 1));
+
+		uint2 lightRange = clusterGrid[(cluster.z * clusterCountXY.y + cluster.y) * clusterCountXY.x + cluster.x];
+		for (uint i = 0; i < lightRange.y; i++)
+		{
+			ClusterLight pointLight = clusterLights[clusterLightIndices[lightRange.x + i]];
+
+			float3 toLight = pointLight.position - input.WPosition.xyz;
+			float lightDistance = length(toLight);
+			toLight /= max(lightDistance, 0.0001f);
+
+			// Smooth falloff that reaches 0 at the range
+			float falloff = saturate(1.0f - (lightDistance * lightDistance) / (pointLight.range * pointLight.range));
+			falloff *= falloff;
+
+			float pointDiffuse = dot(toLight, normalizedNormal);
+			if (pointDiffuse > 0.0f)
+			{
+				float pointSpecular = pow(max(dot(reflect(-toLight, normalizedNormal), input.ViewDir), 0.0f), material.specularColor.w);
+				diffuse += float4(pointLight.color * (pointDiffuse * falloff), 0.0f) * material.diffuseColor;
+				specular += float4(pointLight.color * (pointSpecular * falloff), 0.0f) * material.specularColor;
+			}
+		}
+	}
+
 	diffuse = saturate(diffuse);
 	specular = saturate(specular);
 	ambient = saturate(ambient);
@@ -129,11 +289,14 @@ float4 PSMain(PixelInput input) : SV_TARGET
 	}*/
 
 	// Removes the specularity from the terrain
-	if (isTerrain)
+	if (terrain)
 		finalColor = textureColor * (ambient + diffuse);
 	// Complete phong shading
 	else
 		finalColor = textureColor * (ambient + diffuse) + specular;
 
+	// Only read with blending on, in the transparent pass
+	finalColor.a = textureColor.a * material.opacity;
+
 	return finalColor;
 }
\ No newline at end of file
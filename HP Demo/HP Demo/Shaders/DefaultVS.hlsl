@@ -4,6 +4,8 @@ cbuffer cbPerObject : register(b0)
 	row_major matrix worldViewProjection;
 	row_major matrix worldspace;
 	row_major matrix InverseTransposeWorldMatrix;
+	uint materialIndex;			// Into the material table, 0xffffffff for cBufferMaterial
+	uint3 objectPadding;
 };
 
 cbuffer cBufferCamera : register(b1)
@@ -28,6 +30,7 @@ struct VertexOutput
 	float3 WNormal : NORMAL;
 	float3 WTangent : TANGENT;
 	float3 ViewDir : TEXCOORD1;
+	nointerpolation uint MaterialIndex : MATERIAL;
 };
 
 VertexOutput VSMain(VertexInput input) {
@@ -44,5 +47,7 @@ VertexOutput VSMain(VertexInput input) {
 	output.ViewDir = cameraPosition.xyz - output.WPosition.xyz;
 	output.ViewDir = normalize(output.ViewDir);
 
+	output.MaterialIndex = materialIndex;
+
 	return output;
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+cbuffer cbPerObject : register(b0)
+{
+	row_major matrix worldViewProjection;
+	row_major matrix worldspace;
+	row_major matrix InverseTransposeWorldMatrix;
+};
+
+cbuffer cBufferCamera : register(b1)
+{
+	float3 cameraPosition;
+	float padding;
+};
+
+// Has to match Foliage::MAX_SCALE
+static const float MAX_SCALE = 8.0f;
+
+struct VertexInput
+{
+	float3 Position : POSITION;
+	float2 TexCoord : TEXCOORD;
+	float3 Normal : NORMAL;
+	float3 Tangent : TANGENT;
+
+	// Per instance, world space position + yaw and scale as unorms
+	float3 InstancePosition : INSTANCEPOSITION;
+	float2 InstanceYawScale : INSTANCEYAWSCALE;
+};
+
+struct VertexOutput
+{
+	float4 WVPPosition : SV_POSITION;
+	float4 WPosition : WPOSITION;
+	float2 WTexCoord : TEXCOORD;
+	float3 WNormal : NORMAL;
+	float3 WTangent : TANGENT;
+	float3 ViewDir : TEXCOORD1;
+	nointerpolation uint MaterialIndex : MATERIAL;		// Always the material cbuffer
+};
+
+float3 RotateY(float3 value, float sine, float cosine)
+{
+	return float3(value.x * cosine + value.z * sine, value.y, value.z * cosine - value.x * sine);
+}
+
+VertexOutput VSMain(VertexInput input) {
+
+	VertexOutput output = (VertexOutput)0;
+
+	float sine, cosine;
+	sincos(input.InstanceYawScale.x * 6.28318530f, sine, cosine);
+	float scale = input.InstanceYawScale.y * MAX_SCALE;
+
+	// The model world matrix is identity for instanced meshes, so worldViewProjection is view * projection
+	float3 position = RotateY(input.Position * scale, sine, cosine) + input.InstancePosition;
+
+	output.WVPPosition = mul(worldViewProjection, float4(position, 1.0f));
+	output.WPosition = float4(position, 1.0f);
+	output.WTexCoord = input.TexCoord;
+	output.WNormal = RotateY(input.Normal, sine, cosine);
+	output.WTangent = RotateY(input.Tangent, sine, cosine);
+
+	output.ViewDir = normalize(cameraPosition.xyz - output.WPosition.xyz);
+	output.MaterialIndex = 0xffffffff;
+
+	return output;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+cbuffer cbPerObject : register(b0)
+{
+	row_major matrix worldViewProjection;
+	row_major matrix worldspace;
+	row_major matrix InverseTransposeWorldMatrix;
+};
+
+cbuffer cBufferCamera : register(b1)
+{
+	float3 cameraPosition;
+	float padding;
+};
+
+struct VertexInput
+{
+	float3 Position : POSITION;
+	float2 TexCoord : TEXCOORD;
+	float3 Normal : NORMAL;
+	float3 Tangent : TANGENT;
+
+	// Per instance, ModelInstance. The rows of the transposed instance world matrix + free parameters
+	float4 InstanceWorld0 : INSTANCEWORLD0;
+	float4 InstanceWorld1 : INSTANCEWORLD1;
+	float4 InstanceWorld2 : INSTANCEWORLD2;
+	float4 InstanceParams : INSTANCEPARAMS;
+};
+
+// Same as the default shaders up to ViewDir, so DefaultPS can be used and the params are left over
+struct VertexOutput
+{
+	float4 WVPPosition : SV_POSITION;
+	float4 WPosition : WPOSITION;
+	float2 WTexCoord : TEXCOORD;
+	float3 WNormal : NORMAL;
+	float3 WTangent : TANGENT;
+	float3 ViewDir : TEXCOORD1;
+	nointerpolation uint MaterialIndex : MATERIAL;		// Always the material cbuffer
+	float4 InstanceParams : TEXCOORD2;
+};
+
+VertexOutput VSMain(VertexInput input) {
+
+	VertexOutput output = (VertexOutput)0;
+
+	// Instance to model space, the model matrices in the cbuffer take it from there
+	float4 local = float4(input.Position, 1.0f);
+	float3 position = float3(dot(input.InstanceWorld0, local), dot(input.InstanceWorld1, local), dot(input.InstanceWorld2, local));
+	float3x3 instanceRotation = float3x3(input.InstanceWorld0.xyz, input.InstanceWorld1.xyz, input.InstanceWorld2.xyz);
+
+	// Rotation and uniform scale only, normals are renormalized in the pixel shader
+	float3 normal = mul(instanceRotation, input.Normal);
+	float3 tangent = mul(instanceRotation, input.Tangent);
+
+	output.WVPPosition = mul(worldViewProjection, float4(position, 1.0f));
+	output.WPosition = mul(worldspace, float4(position, 1.0f));
+	output.WTexCoord = input.TexCoord;
+	output.WNormal = mul((float3x3)InverseTransposeWorldMatrix, normal);
+	output.WTangent = mul((float3x3)InverseTransposeWorldMatrix, tangent);
+	output.InstanceParams = input.InstanceParams;
+	output.MaterialIndex = 0xffffffff;
+
+	output.ViewDir = normalize(cameraPosition.xyz - output.WPosition.xyz);
+
+	return output;
+}
\ No newline at end of file
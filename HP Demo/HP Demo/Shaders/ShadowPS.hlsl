@@ -0,0 +1,4 @@
+// Nothing to write, the caster pass only has a depth target
+void PSMain()
+{
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+cbuffer cbPerObject : register(b0)
+{
+	row_major matrix worldViewProjection;
+	row_major matrix worldspace;
+	row_major matrix InverseTransposeWorldMatrix;
+};
+
+// Same input layout as DefaultVS, only the position is used
+struct VertexInput
+{
+	float3 Position : POSITION;
+	float2 TexCoord : TEXCOORD;
+	float3 Normal : NORMAL;
+	float3 Tangent : TANGENT;
+};
+
+// Depth only, worldViewProjection holds the view and projection of the shadow cascade
+float4 VSMain(VertexInput input) : SV_POSITION
+{
+	return mul(worldViewProjection, float4(input.Position, 1.0f));
+}
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include "ShadowCascades.h"
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+
+ShadowCascades::ShadowCascades()
+{
+	this->cameraPosition = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	this->cameraForward = DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f);
+
+	this->shadowMap = nullptr;
+	for (int i = 0; i < MAX_CASCADES; i++)
+		this->depthViews[i] = nullptr;
+	this->shadowView = nullptr;
+	this->comparisonSampler = nullptr;
+	this->constantBuffer = nullptr;
+	ZeroMemory(&this->viewport, sizeof(D3D11_VIEWPORT));
+	ZeroMemory(this->cascades, sizeof(this->cascades));
+}
+
+ShadowCascades::~ShadowCascades()
+{
+	Shutdown();
+}
+
+bool ShadowCascades::Initialize(const Settings& settings, ID3D11Device* device)
+{
+	Shutdown();
+
+	if (settings.cascadeCount <= 0 || settings.cascadeCount > MAX_CASCADES || settings.resolution <= 2 || settings.shadowDistance <= 0.0f)
+		return false;
+
+	this->settings = settings;
+	this->stats = Stats();
+
+	viewport.Width = (float)settings.resolution;
+	viewport.Height = (float)settings.resolution;
+	viewport.MinDepth = 0.0f;
+	viewport.MaxDepth = 1.0f;
+
+	if (!device)
+		return true;
+
+	// Typeless so the same texture is a depth target and a shader resource
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(D3D11_TEXTURE2D_DESC));
+	textureDesc.Width = settings.resolution;
+	textureDesc.Height = settings.resolution;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = settings.cascadeCount;
+	textureDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+
+	if (FAILED(device->CreateTexture2D(&textureDesc, nullptr, &shadowMap)))
+		return false;
+
+	for (int i = 0; i < settings.cascadeCount; i++)
+	{
+		D3D11_DEPTH_STENCIL_VIEW_DESC depthDesc;
+		ZeroMemory(&depthDesc, sizeof(D3D11_DEPTH_STENCIL_VIEW_DESC));
+		depthDesc.Format = DXGI_FORMAT_D32_FLOAT;
+		depthDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+		depthDesc.Texture2DArray.FirstArraySlice = i;
+		depthDesc.Texture2DArray.ArraySize = 1;
+
+		if (FAILED(device->CreateDepthStencilView(shadowMap, &depthDesc, &depthViews[i])))
+			return false;
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+	ZeroMemory(&viewDesc, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
+	viewDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	viewDesc.Texture2DArray.MipLevels = 1;
+	viewDesc.Texture2DArray.ArraySize = settings.cascadeCount;
+
+	if (FAILED(device->CreateShaderResourceView(shadowMap, &viewDesc, &shadowView)))
+		return false;
+
+	// Bilinear comparison, every tap is already 2x2 filtered
+	D3D11_SAMPLER_DESC samplerDesc;
+	ZeroMemory(&samplerDesc, sizeof(D3D11_SAMPLER_DESC));
+	samplerDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_BORDER;
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_BORDER;
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;
+	samplerDesc.BorderColor[0] = 1.0f;
+	samplerDesc.BorderColor[1] = 1.0f;
+	samplerDesc.BorderColor[2] = 1.0f;
+	samplerDesc.BorderColor[3] = 1.0f;
+	samplerDesc.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL;
+	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	if (FAILED(device->CreateSamplerState(&samplerDesc, &comparisonSampler)))
+		return false;
+
+	D3D11_BUFFER_DESC bufferDesc;
+	ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.ByteWidth = sizeof(cBufferShadows);
+	bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	return SUCCEEDED(device->CreateBuffer(&bufferDesc, nullptr, &constantBuffer));
+}
+
+void ShadowCascades::Shutdown()
+{
+	ReleasePtr(constantBuffer);
+	ReleasePtr(comparisonSampler);
+	ReleasePtr(shadowView);
+	for (int i = 0; i < MAX_CASCADES; i++)
+		ReleasePtr(depthViews[i]);
+	ReleasePtr(shadowMap);
+
+	for (int i = 0; i < MAX_CASCADES; i++)
+		casters[i].clear();
+}
+
+void ShadowCascades::Fit(DirectX::XMMATRIX view, DirectX::XMMATRIX projection, DirectX::XMFLOAT3 toLight,
+	const DirectX::XMFLOAT3& sceneMin, const DirectX::XMFLOAT3& sceneMax)
+{
+	using namespace DirectX;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	XMMATRIX inverseView = XMMatrixInverse(nullptr, view);
+	XMVECTOR eye = inverseView.r[3];
+	XMVECTOR forward = XMVector3Normalize(inverseView.r[2]);
+	XMStoreFloat3(&cameraPosition, eye);
+	XMStoreFloat3(&cameraForward, forward);
+
+	// Half the view size at depth 1 and the near plane, from the perspective projection
+	XMFLOAT4X4 perspective;
+	XMStoreFloat4x4(&perspective, projection);
+	float tanX = 1.0f / perspective._11;
+	float tanY = 1.0f / perspective._22;
+	float nearDepth = -perspective._43 / perspective._33;
+	float cornerSlope = tanX * tanX + tanY * tanY;		// Squared distance of a frustum corner from the axis, per squared depth
+	float distance = std::max(settings.shadowDistance, nearDepth * 2.0f);
+
+	// Rotation only, the snapped origins then mean the same texels in every frame
+	XMVECTOR lightDirection = XMVector3Normalize(XMVectorNegate(XMLoadFloat3(&toLight)));
+	XMVECTOR lightUp = fabsf(XMVectorGetY(lightDirection)) > 0.99f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+	XMMATRIX lightView = XMMatrixLookToLH(XMVectorZero(), lightDirection, lightUp);
+
+	// Nearest light space depth anything in the scene has
+	float sceneDepth = FLT_MAX;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		XMVECTOR point = XMVectorSet(corner & 1 ? sceneMax.x : sceneMin.x, corner & 2 ? sceneMax.y : sceneMin.y, corner & 4 ? sceneMax.z : sceneMin.z, 1.0f);
+		sceneDepth = std::min(sceneDepth, XMVectorGetZ(XMVector3TransformCoord(point, lightView)));
+	}
+
+	float splitNear = nearDepth;
+	for (int i = 0; i < settings.cascadeCount; i++)
+	{
+		Cascade& cascade = cascades[i];
+
+		float fraction = (i + 1) / (float)settings.cascadeCount;
+		float even = nearDepth + (distance - nearDepth) * fraction;
+		float logarithmic = nearDepth * powf(distance / nearDepth, fraction);
+		float splitFar = even + (logarithmic - even) * settings.splitLambda;
+
+		/*
+			Smallest sphere around the slice: on the view axis where the near and the far corners are the same
+			distance away, or at the far plane when the slice is wide. It only depends on the split depths,
+			so it keeps its size when the camera turns. Rounded up so float noise doesn't change it either.
+		*/
+		float centerDepth = 0.5f * (splitNear + splitFar) * (1.0f + cornerSlope);
+		float radius;
+		if (centerDepth >= splitFar)
+		{
+			centerDepth = splitFar;
+			radius = splitFar * sqrtf(cornerSlope);
+		}
+		else
+		{
+			radius = sqrtf((splitFar - centerDepth) * (splitFar - centerDepth) + splitFar * splitFar * cornerSlope);
+		}
+		radius = ceilf(radius * 16.0f) / 16.0f;
+
+		XMVECTOR center = XMVectorAdd(eye, XMVectorScale(forward, centerDepth));
+		XMFLOAT3 lightCenter;
+		XMStoreFloat3(&lightCenter, XMVector3TransformCoord(center, lightView));
+
+		// A texel of margin around the sphere, snapping the origin down by less than a texel keeps it covered
+		float texelSize = 2.0f * radius / (settings.resolution - 2);
+		float halfWidth = radius + texelSize;
+		float originX = floorf((lightCenter.x - halfWidth) / texelSize) * texelSize;
+		float originY = floorf((lightCenter.y - halfWidth) / texelSize) * texelSize;
+		float width = texelSize * settings.resolution;
+
+		cascade.splitNear = splitNear;
+		cascade.splitFar = splitFar;
+		XMStoreFloat3(&cascade.center, center);
+		cascade.radius = radius;
+		cascade.texelSize = texelSize;
+		cascade.depthMin = std::min(sceneDepth, lightCenter.z - radius);
+		cascade.depthMax = lightCenter.z + radius;
+
+		XMMATRIX lightProjection = XMMatrixOrthographicOffCenterLH(originX, originX + width, originY, originY + width, cascade.depthMin, cascade.depthMax);
+		XMStoreFloat4x4(&cascade.view, lightView);
+		XMStoreFloat4x4(&cascade.projection, lightProjection);
+		XMStoreFloat4x4(&cascade.viewProjection, lightView * lightProjection);
+
+		splitNear = splitFar;
+	}
+
+	stats.cascades = settings.cascadeCount;
+	stats.fitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void ShadowCascades::Cull(const SceneBVH& sceneBVH, JobSystem& jobSystem)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// The box of a cascade runs from the scene bounds to behind its sphere, so the frustum query finds every caster
+	jobSystem.ParallelFor(settings.cascadeCount, [&](int cascade, int)
+	{
+		casters[cascade].clear();
+		sceneBVH.QueryFrustum(DirectX::XMLoadFloat4x4(&cascades[cascade].viewProjection), casters[cascade]);
+	});
+
+	stats.totalCasters = 0;
+	for (int i = 0; i < MAX_CASCADES; i++)
+	{
+		stats.casters[i] = i < settings.cascadeCount ? (int)casters[i].size() : 0;
+		stats.totalCasters += stats.casters[i];
+	}
+
+	stats.cullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void ShadowCascades::BeginCascade(ID3D11DeviceContext* deviceContext, int cascade)
+{
+	deviceContext->OMSetRenderTargets(0, nullptr, depthViews[cascade]);
+	deviceContext->RSSetViewports(1, &viewport);
+	deviceContext->ClearDepthStencilView(depthViews[cascade], D3D11_CLEAR_DEPTH, 1.0f, 0);
+}
+
+D3D11_RASTERIZER_DESC ShadowCascades::GetCasterRasterizerDesc() const
+{
+	D3D11_RASTERIZER_DESC rasterizerDesc;
+	ZeroMemory(&rasterizerDesc, sizeof(D3D11_RASTERIZER_DESC));
+	rasterizerDesc.FillMode = D3D11_FILL_SOLID;
+	rasterizerDesc.CullMode = D3D11_CULL_BACK;
+	rasterizerDesc.DepthBias = settings.depthBias;
+	rasterizerDesc.SlopeScaledDepthBias = settings.slopeScaledDepthBias;
+	rasterizerDesc.DepthClipEnable = TRUE;
+	return rasterizerDesc;
+}
+
+bool ShadowCascades::Upload(RenderBackend* context)
+{
+	if (!constantBuffer)
+		return false;
+
+	cBufferShadows data;
+	ZeroMemory(&data, sizeof(cBufferShadows));
+	for (int i = 0; i < settings.cascadeCount; i++)
+	{
+		data.viewProjection[i] = DirectX::XMMatrixTranspose(DirectX::XMLoadFloat4x4(&cascades[i].viewProjection));
+		data.splitFar[i] = cascades[i].splitFar;
+	}
+	data.cameraPosition = cameraPosition;
+	data.texelSize = 1.0f / settings.resolution;
+	data.cameraForward = cameraForward;
+	data.cascadeCount = settings.cascadeCount;
+
+	MappedResource mapped;
+	if (FAILED(context->Map(constantBuffer, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	memcpy(mapped.pData, &data, sizeof(cBufferShadows));
+	context->Unmap(constantBuffer, 0);
+
+	return true;
+}
+
+void ShadowCascades::Bind(RenderBackend* context) const
+{
+	context->PSSetShaderResources(SHADOW_MAP_SLOT, 1, &shadowView);
+	context->PSSetSamplers(SAMPLER_SLOT, 1, &comparisonSampler);
+	context->PSSetConstantBuffers(CBUFFER_SLOT, 1, &constantBuffer);
+}
+
+void ShadowCascades::Unbind(RenderBackend* context) const
+{
+	ID3D11ShaderResourceView* none = nullptr;
+	context->PSSetShaderResources(SHADOW_MAP_SLOT, 1, &none);
+}
\ No newline at end of file
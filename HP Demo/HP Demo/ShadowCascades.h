@@ -0,0 +1,125 @@
+#pragma once
+#include "DX.h"
+#include "RenderBackend.h"
+#include "JobSystem.h"
+#include "SceneBVH.h"
+#include <vector>
+
+/*
+	Cascaded shadow maps for the sun.
+	The view up to shadowDistance is split into cascades, between even and logarithmic splits. Every
+	cascade is fitted around the bounding sphere of its slice of the view frustum, which keeps its size
+	however the camera turns, and the light space origin is snapped to whole texels so the shadow edges
+	don't crawl while the camera moves. The near plane of every cascade is pulled back to the scene bounds,
+	so things between the sun and the view that are out of sight still cast into it.
+	Casters are found per cascade through the scene BVH, each cascade is a job.
+*/
+class ShadowCascades
+{
+public:
+	static const int MAX_CASCADES = 4;
+
+	struct Settings
+	{
+		int cascadeCount = 4;
+		int resolution = 2048;				// Of every cascade, square
+		float shadowDistance = 300.0f;		// Nothing further than this is shadowed
+		float splitLambda = 0.75f;			// 0 splits evenly, 1 logarithmically
+		int depthBias = 1000;				// Rasterizer bias of the caster pipeline
+		float slopeScaledDepthBias = 2.0f;
+	};
+
+	struct Cascade
+	{
+		float splitNear, splitFar;			// View depth range
+		DirectX::XMFLOAT3 center;			// Bounding sphere of the slice, world space
+		float radius;
+		float texelSize;					// World units per shadow map texel
+		float depthMin, depthMax;			// Light space depth range, depthMin reaches back to the scene bounds
+		DirectX::XMFLOAT4X4 view;
+		DirectX::XMFLOAT4X4 projection;
+		DirectX::XMFLOAT4X4 viewProjection;
+	};
+
+	struct Stats
+	{
+		int cascades = 0;
+		int casters[MAX_CASCADES] = {};
+		int totalCasters = 0;				// Summed over the cascades, a caster can be in several
+		double fitMilliseconds = 0.0;
+		double cullMilliseconds = 0.0;
+	};
+
+	// Layout of cBufferShadows in DefaultPS
+	__declspec(align(16))
+		struct cBufferShadows
+	{
+		DirectX::XMMATRIX viewProjection[MAX_CASCADES];		// Transposed like the other cbuffer matrices
+		float splitFar[MAX_CASCADES];		// One float4 in the shader
+		DirectX::XMFLOAT3 cameraPosition;
+		float texelSize;					// Of the shadow map, in uv
+		DirectX::XMFLOAT3 cameraForward;
+		UINT cascadeCount;
+	};
+
+	// Shader slots, see DefaultPS
+	static const UINT SHADOW_MAP_SLOT = 7;
+	static const UINT SAMPLER_SLOT = 1;
+	static const UINT CBUFFER_SLOT = 3;
+
+public:
+	ShadowCascades();
+	~ShadowCascades();
+
+	// Without a device only the fitting and culling run, for the benchmark
+	bool Initialize(const Settings& settings, ID3D11Device* device);
+	void Shutdown();
+
+	/*
+		Fits the cascades to the camera. toLight points from the scene towards the sun and the scene box
+		is what can cast shadows. The projection has to be a perspective one, near and field of view are read from it.
+	*/
+	void Fit(DirectX::XMMATRIX view, DirectX::XMMATRIX projection, DirectX::XMFLOAT3 toLight,
+		const DirectX::XMFLOAT3& sceneMin, const DirectX::XMFLOAT3& sceneMax);
+
+	// BVH handles of what casts into each cascade after the last Fit, one job per cascade
+	void Cull(const SceneBVH& sceneBVH, JobSystem& jobSystem);
+
+	// Sets the shadow map of a cascade as the depth target and clears it
+	void BeginCascade(ID3D11DeviceContext* deviceContext, int cascade);
+
+	// Depth biased rasterizer state for the caster pipeline, sloped surfaces would shadow themselves without it
+	D3D11_RASTERIZER_DESC GetCasterRasterizerDesc() const;
+
+	// Writes the cascade matrices into the constant buffer
+	bool Upload(RenderBackend* context);
+
+	// Binds the shadow maps to the pixel shader. Only reads, several threads can bind onto their own contexts
+	void Bind(RenderBackend* context) const;
+
+	// Unbinds the shadow maps, they can't be read while they are drawn into
+	void Unbind(RenderBackend* context) const;
+
+	int GetCascadeCount() const { return this->settings.cascadeCount; }
+	const Cascade& GetCascade(int cascade) const { return this->cascades[cascade]; }
+	const std::vector<int>& GetCasters(int cascade) const { return this->casters[cascade]; }
+	const Settings& GetSettings() const { return this->settings; }
+	const Stats& GetStats() const { return this->stats; }
+
+private:
+	Settings settings;
+	Cascade cascades[MAX_CASCADES];
+	std::vector<int> casters[MAX_CASCADES];
+
+	DirectX::XMFLOAT3 cameraPosition;
+	DirectX::XMFLOAT3 cameraForward;
+
+	ID3D11Texture2D* shadowMap;						// One array slice per cascade
+	ID3D11DepthStencilView* depthViews[MAX_CASCADES];
+	ID3D11ShaderResourceView* shadowView;
+	ID3D11SamplerState* comparisonSampler;
+	ID3D11Buffer* constantBuffer;
+	D3D11_VIEWPORT viewport;
+
+	Stats stats;
+};
\ No newline at end of file
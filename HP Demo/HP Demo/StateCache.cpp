@@ -0,0 +1,465 @@
+#include "StateCache.h"
+
+// Never a real object, marks a slot whose contents are not known
+template<typename T>
+static T* Stale()
+{
+	return reinterpret_cast<T*>(~(uintptr_t)0);
+}
+
+template<typename T>
+static void MarkStale(T** items, int count)
+{
+	for (int i = 0; i < count; i++)
+		items[i] = Stale<T>();
+}
+
+/*
+	Trims [startSlot, startSlot + count) down to the first and last slot that differ from the copy,
+	and copies the new values over. Returns false when nothing differs.
+	Ranges that run past the followed slots are forwarded whole.
+*/
+template<typename T>
+static bool TrimSlots(T** bound, int slotCount, UINT& startSlot, UINT& count, T* const*& items)
+{
+	if (startSlot + count > (UINT)slotCount)
+	{
+		for (UINT i = startSlot; i < (UINT)slotCount; i++)
+			bound[i] = items[i - startSlot];
+		return true;
+	}
+
+	int first = -1;
+	int last = -1;
+	for (UINT i = 0; i < count; i++)
+	{
+		if (bound[startSlot + i] == items[i])
+			continue;
+
+		if (first < 0)
+			first = i;
+		last = i;
+		bound[startSlot + i] = items[i];
+	}
+
+	if (first < 0)
+		return false;
+
+	startSlot += first;
+	items += first;
+	count = last - first + 1;
+	return true;
+}
+
+StateCache::StateCache(RenderBackend* backend)
+{
+	this->backend = backend;
+	Invalidate();
+}
+
+StateCache::~StateCache()
+{
+}
+
+void StateCache::Invalidate()
+{
+	state.inputLayout = Stale<ID3D11InputLayout>();
+	state.topology = ~0u;
+	MarkStale(state.vertexBuffers, BoundState::VERTEX_BUFFER_SLOTS);
+	state.indexBuffer = Stale<ID3D11Buffer>();
+
+	state.vertexShader = Stale<ID3D11VertexShader>();
+	state.geometryShader = Stale<ID3D11GeometryShader>();
+	state.pixelShader = Stale<ID3D11PixelShader>();
+
+	for (int stage = 0; stage < BoundState::STAGE_COUNT; stage++)
+	{
+		MarkStale(state.constantBuffers[stage], BoundState::CONSTANT_BUFFER_SLOTS);
+		MarkStale(state.resources[stage], BoundState::RESOURCE_SLOTS);
+		MarkStale(state.samplers[stage], BoundState::SAMPLER_SLOTS);
+	}
+
+	state.blendState = Stale<ID3D11BlendState>();
+	state.depthStencilState = Stale<ID3D11DepthStencilState>();
+	state.rasterizerState = Stale<ID3D11RasterizerState>();
+}
+
+void StateCache::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	stats.calls++;
+	if (state.inputLayout == inputLayout)
+		return;
+
+	state.inputLayout = inputLayout;
+	stats.forwarded++;
+	backend->IASetInputLayout(inputLayout);
+}
+
+void StateCache::IASetPrimitiveTopology(UINT topology)
+{
+	stats.calls++;
+	if (state.topology == topology)
+		return;
+
+	state.topology = topology;
+	stats.forwarded++;
+	backend->IASetPrimitiveTopology(topology);
+}
+
+void StateCache::IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	stats.calls++;
+
+	// A buffer with a different stride or offset is a different binding, so this can't use TrimSlots
+	bool changed = startSlot + count > BoundState::VERTEX_BUFFER_SLOTS;
+	for (UINT i = 0; i < count && startSlot + i < BoundState::VERTEX_BUFFER_SLOTS; i++)
+	{
+		UINT slot = startSlot + i;
+		if (state.vertexBuffers[slot] == buffers[i] && state.strides[slot] == strides[i] && state.offsets[slot] == offsets[i])
+			continue;
+
+		state.vertexBuffers[slot] = buffers[i];
+		state.strides[slot] = strides[i];
+		state.offsets[slot] = offsets[i];
+		changed = true;
+	}
+
+	if (!changed)
+		return;
+
+	stats.forwarded++;
+	backend->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+}
+
+void StateCache::IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset)
+{
+	stats.calls++;
+	if (state.indexBuffer == buffer && state.indexFormat == format && state.indexOffset == offset)
+		return;
+
+	state.indexBuffer = buffer;
+	state.indexFormat = format;
+	state.indexOffset = offset;
+	stats.forwarded++;
+	backend->IASetIndexBuffer(buffer, format, offset);
+}
+
+/*
+	Shaders. With class instances the call always goes through, the instances aren't followed
+*/
+
+void StateCache::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	stats.calls++;
+	if (state.vertexShader == shader && classInstanceCount == 0)
+		return;
+
+	state.vertexShader = classInstanceCount == 0 ? shader : Stale<ID3D11VertexShader>();
+	stats.forwarded++;
+	backend->VSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void StateCache::GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	stats.calls++;
+	if (state.geometryShader == shader && classInstanceCount == 0)
+		return;
+
+	state.geometryShader = classInstanceCount == 0 ? shader : Stale<ID3D11GeometryShader>();
+	stats.forwarded++;
+	backend->GSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void StateCache::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	stats.calls++;
+	if (state.pixelShader == shader && classInstanceCount == 0)
+		return;
+
+	state.pixelShader = classInstanceCount == 0 ? shader : Stale<ID3D11PixelShader>();
+	stats.forwarded++;
+	backend->PSSetShader(shader, classInstances, classInstanceCount);
+}
+
+/*
+	Per stage slots
+*/
+
+/*
+	Like TrimSlots, a slot also differs when the window into the buffer moved.
+	Null offsets and counts stand for the whole buffer.
+*/
+bool StateCache::TrimConstantBuffers(int stage, UINT& startSlot, UINT& count, ID3D11Buffer* const*& buffers, const UINT*& firstConstants, const UINT*& constantCounts)
+{
+	ID3D11Buffer** bound = state.constantBuffers[stage];
+	UINT* boundFirst = state.firstConstants[stage];
+	UINT* boundCount = state.constantCounts[stage];
+
+	int first = -1;
+	int last = -1;
+	for (UINT i = 0; i < count; i++)
+	{
+		UINT slot = startSlot + i;
+		UINT firstConstant = firstConstants ? firstConstants[i] : 0;
+		UINT constantCount = constantCounts ? constantCounts[i] : 0;
+		if (slot >= BoundState::CONSTANT_BUFFER_SLOTS)
+		{
+			last = i;
+			first = first < 0 ? i : first;
+			continue;
+		}
+
+		if (bound[slot] == buffers[i] && boundFirst[slot] == firstConstant && boundCount[slot] == constantCount)
+			continue;
+
+		if (first < 0)
+			first = i;
+		last = i;
+		bound[slot] = buffers[i];
+		boundFirst[slot] = firstConstant;
+		boundCount[slot] = constantCount;
+	}
+
+	if (first < 0)
+		return false;
+
+	startSlot += first;
+	buffers += first;
+	if (firstConstants)
+		firstConstants += first;
+	if (constantCounts)
+		constantCounts += first;
+	count = last - first + 1;
+	return true;
+}
+
+void StateCache::VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	const UINT* firstConstants = nullptr;
+	const UINT* constantCounts = nullptr;
+
+	stats.calls++;
+	if (!TrimConstantBuffers(BoundState::STAGE_VS, startSlot, count, buffers, firstConstants, constantCounts))
+		return;
+
+	stats.forwarded++;
+	backend->VSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void StateCache::GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	const UINT* firstConstants = nullptr;
+	const UINT* constantCounts = nullptr;
+
+	stats.calls++;
+	if (!TrimConstantBuffers(BoundState::STAGE_GS, startSlot, count, buffers, firstConstants, constantCounts))
+		return;
+
+	stats.forwarded++;
+	backend->GSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void StateCache::PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	const UINT* firstConstants = nullptr;
+	const UINT* constantCounts = nullptr;
+
+	stats.calls++;
+	if (!TrimConstantBuffers(BoundState::STAGE_PS, startSlot, count, buffers, firstConstants, constantCounts))
+		return;
+
+	stats.forwarded++;
+	backend->PSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void StateCache::VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	stats.calls++;
+	if (!TrimConstantBuffers(BoundState::STAGE_VS, startSlot, count, buffers, firstConstants, constantCounts))
+		return;
+
+	stats.forwarded++;
+	backend->VSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void StateCache::GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	stats.calls++;
+	if (!TrimConstantBuffers(BoundState::STAGE_GS, startSlot, count, buffers, firstConstants, constantCounts))
+		return;
+
+	stats.forwarded++;
+	backend->GSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void StateCache::PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+	stats.calls++;
+	if (!TrimConstantBuffers(BoundState::STAGE_PS, startSlot, count, buffers, firstConstants, constantCounts))
+		return;
+
+	stats.forwarded++;
+	backend->PSSetConstantBuffers1(startSlot, count, buffers, firstConstants, constantCounts);
+}
+
+void StateCache::VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	stats.calls++;
+	if (!TrimSlots(state.resources[BoundState::STAGE_VS], BoundState::RESOURCE_SLOTS, startSlot, count, views))
+		return;
+
+	stats.forwarded++;
+	backend->VSSetShaderResources(startSlot, count, views);
+}
+
+void StateCache::GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	stats.calls++;
+	if (!TrimSlots(state.resources[BoundState::STAGE_GS], BoundState::RESOURCE_SLOTS, startSlot, count, views))
+		return;
+
+	stats.forwarded++;
+	backend->GSSetShaderResources(startSlot, count, views);
+}
+
+void StateCache::PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	stats.calls++;
+	if (!TrimSlots(state.resources[BoundState::STAGE_PS], BoundState::RESOURCE_SLOTS, startSlot, count, views))
+		return;
+
+	stats.forwarded++;
+	backend->PSSetShaderResources(startSlot, count, views);
+}
+
+void StateCache::VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	stats.calls++;
+	if (!TrimSlots(state.samplers[BoundState::STAGE_VS], BoundState::SAMPLER_SLOTS, startSlot, count, samplers))
+		return;
+
+	stats.forwarded++;
+	backend->VSSetSamplers(startSlot, count, samplers);
+}
+
+void StateCache::GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	stats.calls++;
+	if (!TrimSlots(state.samplers[BoundState::STAGE_GS], BoundState::SAMPLER_SLOTS, startSlot, count, samplers))
+		return;
+
+	stats.forwarded++;
+	backend->GSSetSamplers(startSlot, count, samplers);
+}
+
+void StateCache::PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	stats.calls++;
+	if (!TrimSlots(state.samplers[BoundState::STAGE_PS], BoundState::SAMPLER_SLOTS, startSlot, count, samplers))
+		return;
+
+	stats.forwarded++;
+	backend->PSSetSamplers(startSlot, count, samplers);
+}
+
+/*
+	Output merger and rasterizer
+*/
+
+void StateCache::OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	stats.calls++;
+
+	// A null factor means 1, 1, 1, 1
+	FLOAT factor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	if (blendFactor)
+	{
+		for (int i = 0; i < 4; i++)
+			factor[i] = blendFactor[i];
+	}
+
+	bool same = state.blendState == blendState && state.sampleMask == sampleMask;
+	for (int i = 0; i < 4; i++)
+		same = same && state.blendFactor[i] == factor[i];
+	if (same)
+		return;
+
+	state.blendState = blendState;
+	for (int i = 0; i < 4; i++)
+		state.blendFactor[i] = factor[i];
+	state.sampleMask = sampleMask;
+	stats.forwarded++;
+	backend->OMSetBlendState(blendState, blendFactor, sampleMask);
+}
+
+void StateCache::OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+	stats.calls++;
+	if (state.depthStencilState == depthStencilState && state.stencilRef == stencilRef)
+		return;
+
+	state.depthStencilState = depthStencilState;
+	state.stencilRef = stencilRef;
+	stats.forwarded++;
+	backend->OMSetDepthStencilState(depthStencilState, stencilRef);
+}
+
+void StateCache::RSSetState(ID3D11RasterizerState* rasterizerState)
+{
+	stats.calls++;
+	if (state.rasterizerState == rasterizerState)
+		return;
+
+	state.rasterizerState = rasterizerState;
+	stats.forwarded++;
+	backend->RSSetState(rasterizerState);
+}
+
+/*
+	Always forwarded. Bindings point at the resource, so a changed buffer doesn't need binding again
+*/
+
+void StateCache::UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch)
+{
+	stats.calls++;
+	stats.forwarded++;
+	backend->UpdateSubresource(resource, subresource, box, data, rowPitch, depthPitch);
+}
+
+HRESULT StateCache::Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped)
+{
+	stats.calls++;
+	stats.forwarded++;
+	return backend->Map(resource, subresource, mapType, mapFlags, mapped);
+}
+
+void StateCache::Unmap(ID3D11Resource* resource, UINT subresource)
+{
+	stats.calls++;
+	stats.forwarded++;
+	backend->Unmap(resource, subresource);
+}
+
+void StateCache::Draw(UINT vertexCount, UINT startVertex)
+{
+	stats.calls++;
+	stats.forwarded++;
+	stats.draws++;
+	backend->Draw(vertexCount, startVertex);
+}
+
+void StateCache::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	stats.calls++;
+	stats.forwarded++;
+	stats.draws++;
+	backend->DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void StateCache::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	stats.calls++;
+	stats.forwarded++;
+	stats.draws++;
+	backend->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
\ No newline at end of file
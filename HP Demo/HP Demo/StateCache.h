@@ -0,0 +1,77 @@
+#pragma once
+#include "RenderBackend.h"
+
+/*
+	Sits in front of another backend and keeps a copy of the state it has bound. Calls that would
+	bind what is already bound are dropped, slot ranges are trimmed to the slots that change.
+	Updates, maps and draws always go through.
+	Anything that talks to the device context directly leaves the copy stale, call Invalidate after it.
+*/
+class StateCache : public RenderBackend
+{
+public:
+	struct Stats
+	{
+		int calls = 0;			// Calls made to the cache
+		int forwarded = 0;		// Calls that reached the backend behind it
+		int draws = 0;
+	};
+
+public:
+	StateCache(RenderBackend* backend);
+	~StateCache();
+
+	// Forget the bound state, the next call of every kind is forwarded
+	void Invalidate();
+
+	RenderBackend* GetBackend() const { return this->backend; }
+	const Stats& GetStats() const { return this->stats; }
+	void ResetStats() { this->stats = Stats(); }
+
+	void IASetInputLayout(ID3D11InputLayout* inputLayout) override;
+	void IASetPrimitiveTopology(UINT topology) override;
+	void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+	void IASetIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset) override;
+
+	void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+
+	void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void VSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void GSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+	void PSSetConstantBuffers1(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+
+	void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void GSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+
+	void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void GSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+
+	void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) override;
+	void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) override;
+	void RSSetState(ID3D11RasterizerState* rasterizerState) override;
+
+	void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const ResourceBox* box, const void* data, UINT rowPitch, UINT depthPitch) override;
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, UINT mapType, UINT mapFlags, MappedResource* mapped) override;
+	void Unmap(ID3D11Resource* resource, UINT subresource) override;
+
+	void Draw(UINT vertexCount, UINT startVertex) override;
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) override;
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+
+private:
+	bool TrimConstantBuffers(int stage, UINT& startSlot, UINT& count, ID3D11Buffer* const*& buffers, const UINT*& firstConstants, const UINT*& constantCounts);
+
+private:
+	RenderBackend* backend;
+
+	// Stale entries hold a value no real object has, so the next call never matches them
+	BoundState state;
+
+	Stats stats;
+};
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "StaticBatcher.h"
+#include "RenderQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+StaticBatcher::StaticBatcher()
+{
+}
+
+StaticBatcher::~StaticBatcher()
+{
+	Shutdown();
+}
+
+void StaticBatcher::Add(Model* model)
+{
+	models.push_back(model);
+}
+
+void StaticBatcher::Clear()
+{
+	models.clear();
+}
+
+uint64_t StaticBatcher::HashGroup(Model* model, int material)
+{
+	// Everything the render queue compares, with the texture by the object that owns it
+	uint64_t hash = RenderQueue::HashMaterial(model, material);
+	Texture* texture = model->GetMaterial()[material].hasTexture ? model->GetTextureStruct() : nullptr;
+	hash ^= (uint64_t)(uintptr_t)texture + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+
+	return hash;
+}
+
+void StaticBatcher::AppendSubset(const Entry& entry, std::vector<Vertex>& vertices, std::vector<DWORD>& indices)
+{
+	using namespace DirectX;
+
+	Model* model = entry.model;
+	XMMATRIX world = model->GetWorldMatrix();
+	XMMATRIX normalMatrix = XMMatrixTranspose(XMMatrixInverse(nullptr, world));
+
+	// A mirroring transform turns the triangles around, they are wound back so culling still holds
+	bool mirrored = XMVectorGetX(XMMatrixDeterminant(world)) < 0.0f;
+
+	// Only the vertices the subset uses are copied, each once
+	const std::vector<Vertex>& sourceVertices = model->GetVertices();
+	const std::vector<DWORD>& sourceIndices = model->GetIndices();
+	remap.assign(sourceVertices.size(), -1);
+
+	int first = entry.subset.startIndex;
+	int last = first + entry.subset.indexCount - entry.subset.indexCount % 3;
+	for (int i = first; i < last; i += 3)
+	{
+		DWORD triangle[3];
+		for (int corner = 0; corner < 3; corner++)
+		{
+			DWORD index = sourceIndices[i + corner];
+			if (remap[index] < 0)
+			{
+				const Vertex& source = sourceVertices[index];
+				Vertex vertex = source;
+				XMStoreFloat3(&vertex.pos, XMVector3TransformCoord(XMLoadFloat3(&source.pos), world));
+				XMStoreFloat3(&vertex.normal, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&source.normal), normalMatrix)));
+				XMStoreFloat3(&vertex.tangent, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&source.tangent), world)));
+
+				remap[index] = (int)vertices.size();
+				vertices.push_back(vertex);
+			}
+			triangle[corner] = (DWORD)remap[index];
+		}
+
+		indices.push_back(triangle[0]);
+		indices.push_back(triangle[mirrored ? 2 : 1]);
+		indices.push_back(triangle[mirrored ? 1 : 2]);
+	}
+}
+
+bool StaticBatcher::FinishBatch(const Entry& source, std::vector<Vertex>& vertices, std::vector<DWORD>& indices, ID3D11Device* device)
+{
+	Model* batch = new Model;
+	batch->GetMaterial().push_back(source.model->GetMaterial()[source.subset.material]);
+	batch->LoadFbxTexture(source.model->GetTextureStruct());
+	batch->LoadNormalMapFbx(source.model->GetNormalMapStruct());
+	batch->LoadLightMap(source.model->GetLightMapStruct());
+
+	if (device)
+	{
+		if (!batch->InitializeTerrain(vertices, indices, device))
+		{
+			batch->LoadFbxTexture(nullptr);
+			batch->LoadNormalMapFbx(nullptr);
+			batch->LoadLightMap(nullptr);
+			batch->Shutdown();
+			delete batch;
+			return false;
+		}
+	}
+	else
+	{
+		batch->GetVertices() = vertices;
+		batch->GetIndices() = indices;
+		batch->SetVertexCount((int)vertices.size());
+		batch->SetIndexCount((int)indices.size());
+		batch->ComputeBounds(vertices);
+		batch->BuildSubsets();
+	}
+
+	batches.push_back(batch);
+	stats.batches++;
+	stats.vertices += (int)vertices.size();
+	stats.indices += (int)indices.size();
+
+	vertices.clear();
+	indices.clear();
+	return true;
+}
+
+int StaticBatcher::Build(const Settings& settings, ID3D11Device* device)
+{
+	using namespace DirectX;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Shutdown();
+	stats = Stats();
+	stats.sourceModels = (int)models.size();
+
+	// Sorted by group, then cell, so every batch is one run of entries
+	std::vector<Entry> entries;
+	entries.reserve(models.size());
+	for (Model* model : models)
+	{
+		if (model->GetMaterial().empty() || model->GetVertices().empty() || model->GetIndices().empty())
+			continue;
+
+		// A model nobody built subsets for is one subset with its first material
+		std::vector<ModelSubset> subsets = model->GetSubsets();
+		if (subsets.empty())
+		{
+			subsets.push_back(ModelSubset());
+			subsets[0].indexCount = (int)model->GetIndices().size();
+			subsets[0].boundingSphere = model->GetBoundingSphere();
+		}
+
+		for (const ModelSubset& subset : subsets)
+		{
+			const XMFLOAT4& sphere = subset.boundingSphere;
+			XMFLOAT3 center;
+			XMStoreFloat3(&center, XMVector3TransformCoord(XMVectorSet(sphere.x, sphere.y, sphere.z, 1.0f), model->GetWorldMatrix()));
+
+			Entry entry;
+			entry.model = model;
+			entry.subset = subset;
+			entry.group = HashGroup(model, subset.material);
+			entry.cellX = (int32_t)floorf(center.x / settings.cellSize);
+			entry.cellZ = (int32_t)floorf(center.z / settings.cellSize);
+			entries.push_back(entry);
+		}
+	}
+
+	std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+	{
+		if (a.group != b.group)
+			return a.group < b.group;
+		if (a.cellX != b.cellX)
+			return a.cellX < b.cellX;
+		return a.cellZ < b.cellZ;
+	});
+
+	std::vector<Vertex> vertices;
+	std::vector<DWORD> indices;
+	for (size_t first = 0; first < entries.size();)
+	{
+		size_t last = first + 1;
+		while (last < entries.size() && entries[last].group == entries[first].group &&
+			entries[last].cellX == entries[first].cellX && entries[last].cellZ == entries[first].cellZ)
+			last++;
+
+		if (first == 0 || entries[first].group != entries[first - 1].group)
+			stats.groups++;
+
+		for (size_t i = first; i < last; i++)
+		{
+			// At most every index a new vertex
+			if (!vertices.empty() && vertices.size() + entries[i].subset.indexCount > (size_t)settings.maxBatchVertices)
+			{
+				if (!FinishBatch(entries[first], vertices, indices, device))
+					return -1;
+			}
+
+			AppendSubset(entries[i], vertices, indices);
+		}
+
+		if (!FinishBatch(entries[first], vertices, indices, device))
+			return -1;
+
+		first = last;
+	}
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return (int)batches.size();
+}
+
+void StaticBatcher::Shutdown()
+{
+	for (Model* batch : batches)
+	{
+		// The textures belong to the source models
+		batch->LoadFbxTexture(nullptr);
+		batch->LoadNormalMapFbx(nullptr);
+		batch->LoadLightMap(nullptr);
+		batch->Shutdown();
+		delete batch;
+	}
+	batches.clear();
+}
\ No newline at end of file
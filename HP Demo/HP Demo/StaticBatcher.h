@@ -0,0 +1,67 @@
+#pragma once
+#include "DX.h"
+#include "Model.h"
+#include <vector>
+#include <cstdint>
+
+/*
+	Merges models that never move into a few big ones, done once at load time.
+	Model subsets with the same material and maps are grouped, every group is split into a grid of
+	cells by where the subsets are and each cell becomes one batch: the vertices moved to world space
+	in one vertex and index buffer. A batch is a plain Model with an identity world matrix, it is culled
+	with its own bounds and drawn like any other model, so a cell costs one draw instead of one per model.
+	The batches point at the textures of the models they were made from and don't release them.
+*/
+class StaticBatcher
+{
+public:
+	struct Settings
+	{
+		float cellSize = 64.0f;				// World units, on x and z
+		int maxBatchVertices = 1 << 20;		// A fuller cell is split into more batches
+	};
+
+	struct Stats
+	{
+		int sourceModels = 0;
+		int groups = 0;						// Different materials
+		int batches = 0;
+		int vertices = 0;
+		int indices = 0;
+		double milliseconds = 0.0;
+	};
+
+public:
+	StaticBatcher();
+	~StaticBatcher();
+
+	// The model has to keep its vertices and indices on the CPU. Its world matrix is read by Build
+	void Add(Model* model);
+	void Clear();
+
+	// Makes the batches, with GPU buffers when device is given. Returns how many there are, -1 when a buffer failed
+	int Build(const Settings& settings, ID3D11Device* device);
+	void Shutdown();
+
+	const std::vector<Model*>& GetBatches() const { return this->batches; }
+	const Stats& GetStats() const { return this->stats; }
+
+private:
+	struct Entry
+	{
+		Model* model;
+		ModelSubset subset;
+		uint64_t group;
+		int32_t cellX, cellZ;
+	};
+
+	static uint64_t HashGroup(Model* model, int material);
+	void AppendSubset(const Entry& entry, std::vector<Vertex>& vertices, std::vector<DWORD>& indices);
+	bool FinishBatch(const Entry& source, std::vector<Vertex>& vertices, std::vector<DWORD>& indices, ID3D11Device* device);
+
+private:
+	std::vector<Model*> models;
+	std::vector<Model*> batches;
+	std::vector<int> remap;			// Source vertex to batch vertex while a subset is appended
+	Stats stats;
+};
\ No newline at end of file
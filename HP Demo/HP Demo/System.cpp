@@ -184,6 +184,15 @@ LRESULT CALLBACK System::MessageHandler(HWND hwnd, UINT umsg, WPARAM wparam, LPA
     {
         PostQuitMessage(0);
         break;
+    }
+        /* F12 captures the next frame, F11 the next 60 */
+    case WM_KEYDOWN:
+    {
+        if (scene && wparam == VK_F12)
+            scene->CaptureFrames(1);
+        else if (scene && wparam == VK_F11)
+            scene->CaptureFrames(60);
+        break;
     }
     case WM_CREATE:
     {
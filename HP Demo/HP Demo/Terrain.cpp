@@ -6,6 +6,8 @@
 Terrain::Terrain()
 {
 	this->mesh = nullptr;
+	this->width = 0;
+	this->height = 0;
 
 	// Cellspace for how large we want the grid to be
 	this->cellSpace = 1.0f;
@@ -24,43 +26,44 @@ Terrain::~Terrain()
 
 float Terrain::GetTriangleHeight(const float x, const float z)
 {
-	// Values for which cell in the terrains grid we are in and transform from terrain local space to "cell" space.
-	float valueX = x - (int)(x / cellSpace);
-	float valueZ = z - (int)(z / cellSpace);
-
-	// Which column and row we are in
-	int column = (int)floorf(x);
-	int row = (int)floorf(z);
-
-	// If we are outside of the terrain, we step off of it
-	if (row < 0 || column < 0 || row >= width - 1 || column >= height - 1)
+	// Transform from terrain local space to grid space and let the compressed heightfield interpolate
+	float gridX = x / cellSpace;
+	float gridZ = z / cellSpace;
+	if (compressedHeights.GetWidth() > 0)
+		return compressedHeights.GetTriangleHeight(gridX, gridZ);
+
+	// Compressing failed, the same interpolation on the raw grid
+	int column = (int)floorf(gridX);
+	int row = (int)floorf(gridZ);
+	if (heights.empty() || row < 0 || column < 0 || column >= width - 1 || row >= height - 1)
 	{
 		return 0;
 	}
 
-	// Height values for each unique vertex in the quad. We work in quads because our terrain is divided into a grid with "cells"
-	float topRight = GetMesh()->GetVertices()[(row * (long long)width + (long long)column)].pos.y;
-	float topLeft = GetMesh()->GetVertices()[(row * (long long)width + (long long)column + 1)].pos.y;
-	float bottomLeft = GetMesh()->GetVertices()[((row + (long long)1) * (long long)width + (long long)column)].pos.y;
-	float bottomRight = GetMesh()->GetVertices()[((row + (long long)1) * (long long)width + (long long)column + 1)].pos.y;
+	float valueX = gridX - column;
+	float valueZ = gridZ - row;
 
-	float height = 0;
+	float topRight = heights[(size_t)row * width + column];
+	float topLeft = heights[(size_t)row * width + column + 1];
+	float bottomLeft = heights[(size_t)(row + 1) * width + column];
+	float bottomRight = heights[(size_t)(row + 1) * width + column + 1];
 
 	// Upper triangle in the quad
 	if (valueX + valueZ <= 1.0f)
 	{
-		float uy = topLeft - topRight;
-		float vy = bottomLeft - topRight;
-		height = topRight + valueX * uy + valueZ * vy;
-	}
-	else // If we are inside the lower triangle in the quad
-	{
-		float uy = bottomLeft - bottomRight;
-		float vy = topLeft - bottomRight;
-		height = bottomRight + (1.0f - valueX) * uy + (1.0f - valueZ) * vy;
+		return topRight + valueX * (topLeft - topRight) + valueZ * (bottomLeft - topRight);
 	}
 
-	return height;
+	// Lower triangle
+	return bottomRight + (1.0f - valueX) * (bottomLeft - bottomRight) + (1.0f - valueZ) * (topLeft - bottomRight);
+}
+
+void Terrain::ReleaseHeightGrid()
+{
+	if (compressedHeights.GetWidth() == 0)
+		return;
+
+	std::vector<float>().swap(heights);
 }
 
 void Terrain::CreateTerrain(std::string filename, ID3D11Device* device, HWND hwnd)
@@ -78,6 +81,7 @@ void Terrain::CreateTerrain(std::string filename, ID3D11Device* device, HWND hwn
 	// Vectors to hold the vertices and indices
 	std::vector<Vertex> vertices;
 	std::vector<DWORD> indices;
+	heights.resize((size_t)width * height);
 
 	// Amount of indices
 	size_t indexCount = 0;
@@ -106,6 +110,7 @@ void Terrain::CreateTerrain(std::string filename, ID3D11Device* device, HWND hwn
 			// And multiply by a height factor, in this case 15
 			temp.pos.y = (float)image[z * width + x + 0] / 255.0f;
 			temp.pos.y *= 15.0f;
+			heights[z * width + x] = temp.pos.y;
 
 			// UV and normals
 			temp.texCoord = DirectX::XMFLOAT2(UIndex, VIndex);
@@ -139,6 +144,11 @@ void Terrain::CreateTerrain(std::string filename, ID3D11Device* device, HWND hwn
 	// Deallocation
 	delete image;
 
+	// Heights from the image are 8 bit, so 0.01 is well below the precision we started with.
+	// Without the compressed copy the raw heights answer the queries and are never released
+	if (!compressedHeights.Compress(heights.data(), width, height, 0.01f))
+		OutputDebugStringA("Terrain: compressing the heights failed, keeping the raw grid\n");
+
 	// Vector to store temporary normals
 	std::vector<DirectX::XMFLOAT3> tempNormal;
 	DirectX::XMFLOAT3 unnormalized;
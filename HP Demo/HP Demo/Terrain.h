@@ -1,7 +1,9 @@
 #pragma once
 #include "Model.h"
+#include "CompressedHeightfield.h"
 #include <DirectXMath.h>
 #include <string>
+#include <vector>
 
 class Terrain
 {
@@ -14,6 +16,12 @@ private:
 	// cellSpace, is used if you want to create a grid over the whole terrain and how big you want it to be
 	float cellSpace;
 
+	// Height of every grid point, row by row (z * width + x). Only kept for the load time readers, see ReleaseHeightGrid
+	std::vector<float> heights;
+
+	// Compressed copy used for height queries at runtime, empty when compressing failed
+	CompressedHeightfield compressedHeights;
+
 public:
 	Terrain();
 	~Terrain();
@@ -21,6 +29,16 @@ public:
 	// Get the mesh which the terrain is based on
 	Model* GetMesh() { return this->mesh; }
 
+	// Grid size and the raw height samples
+	int GetWidth() const { return this->width; }
+	int GetHeight() const { return this->height; }
+	float GetCellSpace() const { return this->cellSpace; }
+	const std::vector<float>& GetHeightGrid() const { return this->heights; }
+	const CompressedHeightfield& GetCompressedHeights() const { return this->compressedHeights; }
+
+	// Frees the raw heights once the load time readers are done, the compressed copy answers from then on. Kept without one
+	void ReleaseHeightGrid();
+
 	// Returns the height of a triangle at the given X and Z coordinates
 	float GetTriangleHeight(const float x, const float z);
 
@@ -0,0 +1,237 @@
+#include "TerrainLightBaker.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+// Height used for everything outside the grid, low enough to never occlude
+static const float OUTSIDE_HEIGHT = -1.0e6f;
+
+TerrainLightBaker::TerrainLightBaker()
+{
+	this->heights = nullptr;
+	this->gridWidth = 0;
+	this->gridHeight = 0;
+	this->cellSpace = 1.0f;
+}
+
+TerrainLightBaker::~TerrainLightBaker()
+{
+}
+
+bool TerrainLightBaker::Bake(const Terrain* terrain, const BakeSettings& settings, JobSystem& jobSystem)
+{
+	if (!terrain || terrain->GetHeightGrid().empty() || settings.aoDirections < 1 || settings.marchSteps < 2)
+		return false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	this->heights = terrain->GetHeightGrid().data();
+	this->gridWidth = terrain->GetWidth();
+	this->gridHeight = terrain->GetHeight();
+	this->cellSpace = terrain->GetCellSpace();
+	this->settings = settings;
+
+	/*
+		Step distances grow exponentially, small steps close to the sample where detail matters
+		and big steps far away where only large hills can still occlude.
+	*/
+	float firstStep = cellSpace * 0.5f;
+	stepDistances.resize(settings.marchSteps);
+	for (int i = 0; i < settings.marchSteps; i++)
+	{
+		float t = (float)i / (settings.marchSteps - 1);
+		stepDistances[i] = firstStep * powf(settings.maxDistance / firstStep, t);
+	}
+
+	aoSteps.resize(settings.aoDirections);
+	for (int i = 0; i < settings.aoDirections; i++)
+	{
+		float angle = DirectX::XM_2PI * (i + 0.5f) / settings.aoDirections;
+		aoSteps[i] = DirectX::XMFLOAT2(cosf(angle), sinf(angle));
+	}
+
+	lightMap.resize((size_t)gridWidth * gridHeight * 2);
+
+	jobSystem.ParallelFor(gridHeight, [&](int row, int thread) {
+		BakeRow(row);
+	});
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.width = gridWidth;
+	stats.height = gridHeight;
+	stats.bytes = lightMap.size();
+	stats.bakeMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+	char message[256];
+	snprintf(message, sizeof(message), "Terrain lightmap: %dx%d RG8, %d AO directions, %.2f MB, baked in %.1f ms on %d threads\n",
+		stats.width, stats.height, settings.aoDirections, stats.bytes / (1024.0 * 1024.0), stats.bakeMilliseconds, jobSystem.GetThreadCount());
+	OutputDebugStringA(message);
+
+	return true;
+}
+
+bool TerrainLightBaker::CreateTexture(ID3D11Device* device, ID3D11ShaderResourceView** textureView)
+{
+	if (lightMap.empty())
+		return false;
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(D3D11_TEXTURE2D_DESC));
+	textureDesc.Width = gridWidth;
+	textureDesc.Height = gridHeight;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R8G8_UNORM;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA resourceData;
+	ZeroMemory(&resourceData, sizeof(D3D11_SUBRESOURCE_DATA));
+	resourceData.pSysMem = lightMap.data();
+	resourceData.SysMemPitch = gridWidth * 2;
+
+	ID3D11Texture2D* lightTexture;
+	HRESULT hr = device->CreateTexture2D(&textureDesc, &resourceData, &lightTexture);
+	if (FAILED(hr))
+		return false;
+
+	hr = device->CreateShaderResourceView(lightTexture, nullptr, textureView);
+	lightTexture->Release();
+	if (FAILED(hr))
+		return false;
+
+	return true;
+}
+
+DirectX::XMVECTOR TerrainLightBaker::SampleHeights(DirectX::FXMVECTOR x, DirectX::FXMVECTOR z) const
+{
+	// Bilinear height for each of the 4 lanes, the gather itself has to be scalar
+	DirectX::XMFLOAT4 xs, zs;
+	DirectX::XMStoreFloat4(&xs, x);
+	DirectX::XMStoreFloat4(&zs, z);
+
+	float laneX[4] = { xs.x, xs.y, xs.z, xs.w };
+	float laneZ[4] = { zs.x, zs.y, zs.z, zs.w };
+	float result[4];
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (laneX[i] < 0.0f || laneZ[i] < 0.0f || laneX[i] > gridWidth - 1 || laneZ[i] > gridHeight - 1)
+		{
+			result[i] = OUTSIDE_HEIGHT;
+			continue;
+		}
+
+		int column = std::min((int)laneX[i], gridWidth - 2);
+		int row = std::min((int)laneZ[i], gridHeight - 2);
+		float fx = laneX[i] - column;
+		float fz = laneZ[i] - row;
+
+		const float* sample = &heights[row * gridWidth + column];
+		float top = sample[0] + (sample[1] - sample[0]) * fx;
+		float bottom = sample[gridWidth] + (sample[gridWidth + 1] - sample[gridWidth]) * fx;
+		result[i] = top + (bottom - top) * fz;
+	}
+
+	return DirectX::XMVectorSet(result[0], result[1], result[2], result[3]);
+}
+
+void TerrainLightBaker::BakeRow(int row)
+{
+	using namespace DirectX;
+
+	/*
+		Texel row 0 is v = 0, which is the far end of the grid (v = 1 - z / height).
+		Samples sit in the texel centers so the lightmap lines up with the terrain UVs.
+	*/
+	float gridZ = std::min(std::max(gridHeight - row - 0.5f, 0.0f), (float)(gridHeight - 1));
+
+	XMFLOAT3 sun = settings.sunDirection;
+	float sunHorizontal = sqrtf(sun.x * sun.x + sun.z * sun.z);
+	bool sunOverhead = sunHorizontal < 1.0e-4f;
+	float sunStepX = sunOverhead ? 0.0f : sun.x / sunHorizontal;
+	float sunStepZ = sunOverhead ? 0.0f : sun.z / sunHorizontal;
+	XMVECTOR sunSlope = XMVectorReplicate(sunOverhead ? 0.0f : sun.y / sunHorizontal);
+	bool sunBelowHorizon = sun.y <= 0.0f;
+
+	XMVECTOR zero = XMVectorZero();
+	XMVECTOR one = XMVectorReplicate(1.0f);
+	XMVECTOR penumbra = XMVectorReplicate(settings.penumbra);
+	XMVECTOR laneOffsets = XMVectorSet(0.0f, 1.0f, 2.0f, 3.0f);
+	XMVECTOR sampleZ = XMVectorReplicate(gridZ);
+	XMVECTOR aoScale = XMVectorReplicate(1.0f / settings.aoDirections);
+
+	for (int column = 0; column < gridWidth; column += 4)
+	{
+		XMVECTOR sampleX = XMVectorMin(XMVectorAdd(XMVectorReplicate(column + 0.5f), laneOffsets), XMVectorReplicate((float)(gridWidth - 1)));
+		XMVECTOR baseHeight = SampleHeights(sampleX, sampleZ);
+
+		/*
+			Sun visibility, soft shadow estimate: the smallest clearance between the ray towards the sun
+			and the terrain, relative to the distance travelled.
+		*/
+		XMVECTOR visibility = sunBelowHorizon ? zero : one;
+		if (!sunBelowHorizon && !sunOverhead)
+		{
+			for (unsigned int s = 0; s < stepDistances.size(); s++)
+			{
+				float distance = stepDistances[s];
+				float gridDistance = distance / cellSpace;
+
+				XMVECTOR marchX = XMVectorAdd(sampleX, XMVectorReplicate(sunStepX * gridDistance));
+				XMVECTOR marchZ = XMVectorAdd(sampleZ, XMVectorReplicate(sunStepZ * gridDistance));
+				XMVECTOR terrainHeight = SampleHeights(marchX, marchZ);
+
+				XMVECTOR rayHeight = XMVectorAdd(baseHeight, XMVectorScale(sunSlope, distance));
+				XMVECTOR clearance = XMVectorScale(XMVectorSubtract(rayHeight, terrainHeight), 1.0f / distance);
+				visibility = XMVectorMin(visibility, XMVectorMultiply(clearance, penumbra));
+			}
+		}
+		visibility = XMVectorSaturate(visibility);
+
+		/*
+			Horizon AO: highest horizon tangent per direction, turned into sin(angle) and averaged.
+		*/
+		XMVECTOR occlusion = zero;
+		for (unsigned int d = 0; d < aoSteps.size(); d++)
+		{
+			XMVECTOR maxTangent = zero;
+			for (unsigned int s = 0; s < stepDistances.size(); s++)
+			{
+				float distance = stepDistances[s];
+				float gridDistance = distance / cellSpace;
+
+				XMVECTOR marchX = XMVectorAdd(sampleX, XMVectorReplicate(aoSteps[d].x * gridDistance));
+				XMVECTOR marchZ = XMVectorAdd(sampleZ, XMVectorReplicate(aoSteps[d].y * gridDistance));
+				XMVECTOR terrainHeight = SampleHeights(marchX, marchZ);
+
+				XMVECTOR tangent = XMVectorScale(XMVectorSubtract(terrainHeight, baseHeight), 1.0f / distance);
+				maxTangent = XMVectorMax(maxTangent, tangent);
+			}
+
+			XMVECTOR sine = XMVectorDivide(maxTangent, XMVectorSqrt(XMVectorAdd(one, XMVectorMultiply(maxTangent, maxTangent))));
+			occlusion = XMVectorAdd(occlusion, sine);
+		}
+		XMVECTOR ambient = XMVectorSaturate(XMVectorSubtract(one, XMVectorMultiply(occlusion, aoScale)));
+
+		XMFLOAT4 visibilityOut, ambientOut;
+		XMStoreFloat4(&visibilityOut, visibility);
+		XMStoreFloat4(&ambientOut, ambient);
+		float visibilityLanes[4] = { visibilityOut.x, visibilityOut.y, visibilityOut.z, visibilityOut.w };
+		float ambientLanes[4] = { ambientOut.x, ambientOut.y, ambientOut.z, ambientOut.w };
+
+		int lanes = std::min(4, gridWidth - column);
+		for (int i = 0; i < lanes; i++)
+		{
+			size_t index = ((size_t)row * gridWidth + column + i) * 2;
+			lightMap[index + 0] = (uint8_t)(visibilityLanes[i] * 255.0f + 0.5f);
+			lightMap[index + 1] = (uint8_t)(ambientLanes[i] * 255.0f + 0.5f);
+		}
+	}
+}
\ No newline at end of file
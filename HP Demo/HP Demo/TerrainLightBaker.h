@@ -0,0 +1,64 @@
+#pragma once
+#include "DX.h"
+#include "Terrain.h"
+#include "JobSystem.h"
+#include <vector>
+#include <cstdint>
+
+/*
+	Precomputes terrain self shadowing and horizon based ambient occlusion.
+	For every height sample the heightfield is marched towards the sun (soft visibility) and
+	along K directions around the sample (highest horizon angle -> occlusion).
+	Rows are spread over the job system and 4 neighbouring samples are marched together with SIMD.
+	Result is an RG8 lightmap: R = sun visibility, G = ambient occlusion (1 = fully open).
+*/
+class TerrainLightBaker
+{
+public:
+	struct BakeSettings
+	{
+		DirectX::XMFLOAT3 sunDirection = DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f);	// Points towards the sun
+		int aoDirections = 12;
+		int marchSteps = 48;
+		float maxDistance = 64.0f;		// In world units
+		float penumbra = 8.0f;			// Higher = harder shadow edges
+	};
+
+	struct BakeStats
+	{
+		int width = 0;
+		int height = 0;
+		size_t bytes = 0;
+		double bakeMilliseconds = 0.0;
+	};
+
+public:
+	TerrainLightBaker();
+	~TerrainLightBaker();
+
+	bool Bake(const Terrain* terrain, const BakeSettings& settings, JobSystem& jobSystem);
+
+	// Creates an immutable RG8 texture + SRV from the last bake. The caller owns the SRV
+	bool CreateTexture(ID3D11Device* device, ID3D11ShaderResourceView** textureView);
+
+	const BakeStats& GetStats() const { return this->stats; }
+	const std::vector<uint8_t>& GetLightMap() const { return this->lightMap; }
+
+private:
+	DirectX::XMVECTOR SampleHeights(DirectX::FXMVECTOR x, DirectX::FXMVECTOR z) const;
+	void BakeRow(int row);
+
+private:
+	const float* heights;
+	int gridWidth, gridHeight;
+	float cellSpace;
+
+	BakeSettings settings;
+
+	// Unit step along the ground for every marched direction, and the distance of every step
+	std::vector<DirectX::XMFLOAT2> aoSteps;
+	std::vector<float> stepDistances;
+
+	std::vector<uint8_t> lightMap;
+	BakeStats stats;
+};
\ No newline at end of file
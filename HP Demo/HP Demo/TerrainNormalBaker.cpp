@@ -0,0 +1,305 @@
+#include "TerrainNormalBaker.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#define STB_DXT_IMPLEMENTATION
+#include "stb_dxt.h"
+
+// Size of the square texel tiles that are handed out to the job system
+static const int TILE_SIZE = 64;
+
+TerrainNormalBaker::TerrainNormalBaker()
+{
+	this->heights = nullptr;
+	this->gridWidth = 0;
+	this->gridHeight = 0;
+	this->cellSpace = 1.0f;
+
+	this->mapWidth = 0;
+	this->mapHeight = 0;
+	this->resolutionScale = 1;
+	this->compressBC5 = false;
+}
+
+TerrainNormalBaker::~TerrainNormalBaker()
+{
+}
+
+bool TerrainNormalBaker::Bake(const Terrain* terrain, int resolutionScale, bool compressBC5, JobSystem& jobSystem)
+{
+	if (!terrain || terrain->GetHeightGrid().empty() || resolutionScale < 1)
+		return false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	this->heights = terrain->GetHeightGrid().data();
+	this->gridWidth = terrain->GetWidth();
+	this->gridHeight = terrain->GetHeight();
+	this->cellSpace = terrain->GetCellSpace();
+	this->resolutionScale = resolutionScale;
+	this->compressBC5 = compressBC5;
+
+	// Block compression works on 4x4 blocks, keep the top level a multiple of 4
+	this->mapWidth = ((gridWidth * resolutionScale) + 3) & ~3;
+	this->mapHeight = ((gridHeight * resolutionScale) + 3) & ~3;
+
+	mips.clear();
+	mipWidths.clear();
+	mipHeights.clear();
+
+	/*
+		Level 0 is baked from the heights in tiles, the rest of the chain is filtered from it.
+		Normals are kept as float X/Z pairs until they get encoded.
+	*/
+	std::vector<float> normals((size_t)mapWidth * mapHeight * 2);
+
+	int tilesX = (mapWidth + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (mapHeight + TILE_SIZE - 1) / TILE_SIZE;
+
+	jobSystem.ParallelFor(tilesX * tilesY, [&](int job, int thread) {
+		BakeTile(job % tilesX, job / tilesX, normals);
+	});
+
+	int levelWidth = mapWidth;
+	int levelHeight = mapHeight;
+	std::vector<float> smaller;
+
+	while (true)
+	{
+		mips.push_back(std::vector<uint8_t>());
+		mipWidths.push_back(levelWidth);
+		mipHeights.push_back(levelHeight);
+		EncodeLevel(normals, levelWidth, levelHeight, mips.back(), jobSystem);
+
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+
+		DownsampleNormals(normals, levelWidth, levelHeight, smaller);
+		normals.swap(smaller);
+		levelWidth = std::max(1, levelWidth / 2);
+		levelHeight = std::max(1, levelHeight / 2);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.width = mapWidth;
+	stats.height = mapHeight;
+	stats.mipLevels = (int)mips.size();
+	stats.compressed = compressBC5;
+	stats.bytes = 0;
+	for (unsigned int i = 0; i < mips.size(); i++)
+	{
+		stats.bytes += mips[i].size();
+	}
+	stats.bakeMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+	char message[256];
+	snprintf(message, sizeof(message), "Terrain normal map: %dx%d %s, %d mips, %.2f MB, baked in %.1f ms on %d threads\n",
+		stats.width, stats.height, compressBC5 ? "BC5" : "RG8", stats.mipLevels, stats.bytes / (1024.0 * 1024.0), stats.bakeMilliseconds, jobSystem.GetThreadCount());
+	OutputDebugStringA(message);
+
+	return true;
+}
+
+bool TerrainNormalBaker::CreateTexture(ID3D11Device* device, ID3D11ShaderResourceView** textureView)
+{
+	if (mips.empty())
+		return false;
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(D3D11_TEXTURE2D_DESC));
+	textureDesc.Width = mapWidth;
+	textureDesc.Height = mapHeight;
+	textureDesc.MipLevels = (UINT)mips.size();
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = compressBC5 ? DXGI_FORMAT_BC5_UNORM : DXGI_FORMAT_R8G8_UNORM;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	std::vector<D3D11_SUBRESOURCE_DATA> levelData(mips.size());
+	for (unsigned int i = 0; i < mips.size(); i++)
+	{
+		ZeroMemory(&levelData[i], sizeof(D3D11_SUBRESOURCE_DATA));
+		levelData[i].pSysMem = mips[i].data();
+
+		// BC5 rows are rows of 4x4 blocks, 16 bytes each
+		if (compressBC5)
+			levelData[i].SysMemPitch = ((mipWidths[i] + 3) / 4) * 16;
+		else
+			levelData[i].SysMemPitch = mipWidths[i] * 2;
+	}
+
+	ID3D11Texture2D* normalTexture;
+	HRESULT hr = device->CreateTexture2D(&textureDesc, levelData.data(), &normalTexture);
+	if (FAILED(hr))
+		return false;
+
+	hr = device->CreateShaderResourceView(normalTexture, nullptr, textureView);
+	normalTexture->Release();
+	if (FAILED(hr))
+		return false;
+
+	return true;
+}
+
+float TerrainNormalBaker::SampleHeight(float x, float z) const
+{
+	/*
+		Catmull-Rom filtered height in grid space.
+		Plain bilinear would give one flat gradient per cell and the baked normals would look faceted.
+	*/
+	int baseX = (int)floorf(x);
+	int baseZ = (int)floorf(z);
+	float fx = x - baseX;
+	float fz = z - baseZ;
+
+	float weightsX[4], weightsZ[4];
+	float t[2] = { fx, fz };
+	float* weights[2] = { weightsX, weightsZ };
+	for (int i = 0; i < 2; i++)
+	{
+		float t1 = t[i], t2 = t1 * t1, t3 = t2 * t1;
+		weights[i][0] = 0.5f * (-t3 + 2.0f * t2 - t1);
+		weights[i][1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+		weights[i][2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t1);
+		weights[i][3] = 0.5f * (t3 - t2);
+	}
+
+	float result = 0.0f;
+	for (int j = 0; j < 4; j++)
+	{
+		int row = std::min(std::max(baseZ + j - 1, 0), gridHeight - 1);
+		float rowSum = 0.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			int column = std::min(std::max(baseX + i - 1, 0), gridWidth - 1);
+			rowSum += weightsX[i] * heights[row * gridWidth + column];
+		}
+		result += weightsZ[j] * rowSum;
+	}
+
+	return result;
+}
+
+void TerrainNormalBaker::BakeTile(int tileX, int tileY, std::vector<float>& normals)
+{
+	int startX = tileX * TILE_SIZE;
+	int startY = tileY * TILE_SIZE;
+	int endX = std::min(startX + TILE_SIZE, mapWidth);
+	int endY = std::min(startY + TILE_SIZE, mapHeight);
+
+	// One texel in grid units, used as the step for the central differences
+	float stepX = (float)gridWidth / mapWidth;
+	float stepZ = (float)gridHeight / mapHeight;
+
+	for (int ty = startY; ty < endY; ty++)
+	{
+		for (int tx = startX; tx < endX; tx++)
+		{
+			/*
+				Same mapping as the terrain UVs: u = x / width and v = 1 - z / height.
+			*/
+			float u = (tx + 0.5f) / mapWidth;
+			float v = (ty + 0.5f) / mapHeight;
+			float gridX = u * gridWidth;
+			float gridZ = (1.0f - v) * gridHeight;
+
+			float dhdx = (SampleHeight(gridX + stepX, gridZ) - SampleHeight(gridX - stepX, gridZ)) / (2.0f * stepX * cellSpace);
+			float dhdz = (SampleHeight(gridX, gridZ + stepZ) - SampleHeight(gridX, gridZ - stepZ)) / (2.0f * stepZ * cellSpace);
+
+			float length = sqrtf(dhdx * dhdx + 1.0f + dhdz * dhdz);
+
+			size_t index = ((size_t)ty * mapWidth + tx) * 2;
+			normals[index + 0] = -dhdx / length;
+			normals[index + 1] = -dhdz / length;
+		}
+	}
+}
+
+void TerrainNormalBaker::DownsampleNormals(const std::vector<float>& source, int sourceWidth, int sourceHeight, std::vector<float>& destination)
+{
+	int width = std::max(1, sourceWidth / 2);
+	int height = std::max(1, sourceHeight / 2);
+	destination.resize((size_t)width * height * 2);
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			// Average the full normals (Y rebuilt) of the 2x2 footprint and renormalize
+			float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+			for (int j = 0; j < 2; j++)
+			{
+				for (int i = 0; i < 2; i++)
+				{
+					int sx = std::min(x * 2 + i, sourceWidth - 1);
+					int sy = std::min(y * 2 + j, sourceHeight - 1);
+					size_t index = ((size_t)sy * sourceWidth + sx) * 2;
+
+					float nx = source[index + 0];
+					float nz = source[index + 1];
+					sumX += nx;
+					sumZ += nz;
+					sumY += sqrtf(std::max(0.0f, 1.0f - nx * nx - nz * nz));
+				}
+			}
+
+			float length = sqrtf(sumX * sumX + sumY * sumY + sumZ * sumZ);
+			size_t index = ((size_t)y * width + x) * 2;
+			destination[index + 0] = sumX / length;
+			destination[index + 1] = sumZ / length;
+		}
+	}
+}
+
+static uint8_t EncodeUnorm8(float value)
+{
+	float scaled = (value * 0.5f + 0.5f) * 255.0f + 0.5f;
+	return (uint8_t)std::min(std::max(scaled, 0.0f), 255.0f);
+}
+
+void TerrainNormalBaker::EncodeLevel(const std::vector<float>& normals, int width, int height, std::vector<uint8_t>& output, JobSystem& jobSystem)
+{
+	if (!compressBC5)
+	{
+		output.resize((size_t)width * height * 2);
+		for (size_t i = 0; i < output.size(); i++)
+		{
+			output[i] = EncodeUnorm8(normals[i]);
+		}
+		return;
+	}
+
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	output.resize((size_t)blocksX * blocksY * 16);
+
+	// One job per row of blocks, edge blocks repeat the last texel
+	jobSystem.ParallelFor(blocksY, [&](int blockY, int thread) {
+		uint8_t block[16 * 2];
+
+		for (int blockX = 0; blockX < blocksX; blockX++)
+		{
+			for (int y = 0; y < 4; y++)
+			{
+				for (int x = 0; x < 4; x++)
+				{
+					int sx = std::min(blockX * 4 + x, width - 1);
+					int sy = std::min(blockY * 4 + y, height - 1);
+					size_t index = ((size_t)sy * width + sx) * 2;
+
+					block[(y * 4 + x) * 2 + 0] = EncodeUnorm8(normals[index + 0]);
+					block[(y * 4 + x) * 2 + 1] = EncodeUnorm8(normals[index + 1]);
+				}
+			}
+
+			stb_compress_bc5_block(&output[((size_t)blockY * blocksX + blockX) * 16], block);
+		}
+	});
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+#include "DX.h"
+#include "Terrain.h"
+#include "JobSystem.h"
+#include <vector>
+#include <cstdint>
+
+/*
+	Bakes an object space normal map straight from the terrain height grid.
+	The map can have a higher resolution than the grid (resolutionScale texels per cell), so the
+	lighting keeps its detail even if the mesh that is drawn is coarser.
+	Only X and Z are stored (RG8 or BC5), the shader rebuilds Y since the normals always point up.
+*/
+class TerrainNormalBaker
+{
+public:
+	struct BakeStats
+	{
+		int width = 0;
+		int height = 0;
+		int mipLevels = 0;
+		bool compressed = false;
+		size_t bytes = 0;
+		double bakeMilliseconds = 0.0;
+	};
+
+public:
+	TerrainNormalBaker();
+	~TerrainNormalBaker();
+
+	// Bakes the full mip chain. Texel tiles are spread over the job system
+	bool Bake(const Terrain* terrain, int resolutionScale, bool compressBC5, JobSystem& jobSystem);
+
+	// Creates an immutable texture + SRV from the last bake. The caller owns the SRV
+	bool CreateTexture(ID3D11Device* device, ID3D11ShaderResourceView** textureView);
+
+	const BakeStats& GetStats() const { return this->stats; }
+	const std::vector<uint8_t>& GetMipData(int level) const { return this->mips[level]; }
+
+private:
+	float SampleHeight(float x, float z) const;
+	void BakeTile(int tileX, int tileY, std::vector<float>& normals);
+
+	static void DownsampleNormals(const std::vector<float>& source, int sourceWidth, int sourceHeight, std::vector<float>& destination);
+	void EncodeLevel(const std::vector<float>& normals, int width, int height, std::vector<uint8_t>& output, JobSystem& jobSystem);
+
+private:
+	const float* heights;
+	int gridWidth, gridHeight;
+	float cellSpace;
+
+	int mapWidth, mapHeight;
+	int resolutionScale;
+	bool compressBC5;
+
+	std::vector<std::vector<uint8_t>> mips;
+	std::vector<int> mipWidths;
+	std::vector<int> mipHeights;
+
+	BakeStats stats;
+};
\ No newline at end of file
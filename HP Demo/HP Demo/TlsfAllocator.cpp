@@ -0,0 +1,320 @@
+#include "TlsfAllocator.h"
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Lowest and highest set bit, word is never 0
+static int FindFirstSet(uint32_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, word);
+	return (int)index;
+#else
+	return __builtin_ctz(word);
+#endif
+}
+
+static int FindLastSet(uint32_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, word);
+	return (int)index;
+#else
+	return 31 - __builtin_clz(word);
+#endif
+}
+
+TlsfAllocator::TlsfAllocator()
+{
+	Initialize(0);
+}
+
+void TlsfAllocator::Initialize(uint32_t capacity)
+{
+	this->capacity = capacity;
+	this->used = 0;
+	this->allocations = 0;
+
+	blocks.clear();
+	unusedBlocks.clear();
+
+	flBitmap = 0;
+	for (int fl = 0; fl < FL_COUNT; fl++)
+	{
+		slBitmaps[fl] = 0;
+		for (int sl = 0; sl < SL_COUNT; sl++)
+			heads[fl][sl] = -1;
+	}
+
+	if (capacity == 0)
+		return;
+
+	// Block 0 always starts the range, merges keep the block in front
+	int block = NewBlock();
+	blocks[block].offset = 0;
+	blocks[block].size = capacity;
+	blocks[block].free = true;
+	InsertFree(block);
+}
+
+void TlsfAllocator::Mapping(uint32_t size, int& fl, int& sl)
+{
+	if (size < (uint32_t)SL_COUNT)
+	{
+		fl = 0;
+		sl = (int)size;
+		return;
+	}
+
+	int highest = FindLastSet(size);
+	sl = (int)(size >> (highest - SL_LOG2)) - SL_COUNT;
+	fl = highest - SL_LOG2 + 1;
+}
+
+int TlsfAllocator::FindSuitable(int fl, int sl) const
+{
+	uint32_t slMap = slBitmaps[fl] & (~0u << sl);
+	if (!slMap)
+	{
+		// Nothing left in this power of two, the next one with blocks has them all big enough
+		uint32_t flMap = flBitmap & (~0u << (fl + 1));
+		if (!flMap)
+			return -1;
+
+		fl = FindFirstSet(flMap);
+		slMap = slBitmaps[fl];
+	}
+
+	return heads[fl][FindFirstSet(slMap)];
+}
+
+int TlsfAllocator::Allocate(uint32_t size)
+{
+	size = std::max(size, 1u);
+	if (size > capacity)
+		return -1;
+
+	// The first block of the size's own class is taken when it is big enough, a block that fits exactly is
+	// not passed over. Otherwise up to the next class, where every block in the list found is big enough
+	int fl, sl;
+	Mapping(size, fl, sl);
+	int block = heads[fl][sl];
+	if (block < 0 || blocks[block].size < size)
+	{
+		uint32_t rounded = size;
+		if (rounded >= (uint32_t)SL_COUNT)
+			rounded += (1u << (FindLastSet(rounded) - SL_LOG2)) - 1;
+
+		Mapping(rounded, fl, sl);
+		block = fl < FL_COUNT ? FindSuitable(fl, sl) : -1;
+		if (block < 0)
+			return -1;
+	}
+
+	RemoveFree(block);
+
+	if (blocks[block].size > size)
+	{
+		int rest = NewBlock();
+		Block& front = blocks[block];
+		Block& back = blocks[rest];
+		back.offset = front.offset + size;
+		back.size = front.size - size;
+		back.prevPhysical = block;
+		back.nextPhysical = front.nextPhysical;
+		back.free = true;
+		if (front.nextPhysical >= 0)
+			blocks[front.nextPhysical].prevPhysical = rest;
+		front.nextPhysical = rest;
+		front.size = size;
+		InsertFree(rest);
+	}
+
+	blocks[block].free = false;
+	used += size;
+	allocations++;
+	return block;
+}
+
+void TlsfAllocator::Free(int block)
+{
+	used -= blocks[block].size;
+	allocations--;
+	blocks[block].free = true;
+
+	int next = blocks[block].nextPhysical;
+	if (next >= 0 && blocks[next].free)
+	{
+		RemoveFree(next);
+		blocks[block].size += blocks[next].size;
+		blocks[block].nextPhysical = blocks[next].nextPhysical;
+		if (blocks[next].nextPhysical >= 0)
+			blocks[blocks[next].nextPhysical].prevPhysical = block;
+		ReleaseBlock(next);
+	}
+
+	int previous = blocks[block].prevPhysical;
+	if (previous >= 0 && blocks[previous].free)
+	{
+		RemoveFree(previous);
+		blocks[previous].size += blocks[block].size;
+		blocks[previous].nextPhysical = blocks[block].nextPhysical;
+		if (blocks[block].nextPhysical >= 0)
+			blocks[blocks[block].nextPhysical].prevPhysical = previous;
+		ReleaseBlock(block);
+		block = previous;
+	}
+
+	InsertFree(block);
+}
+
+int TlsfAllocator::NewBlock()
+{
+	int block;
+	if (!unusedBlocks.empty())
+	{
+		block = unusedBlocks.back();
+		unusedBlocks.pop_back();
+	}
+	else
+	{
+		block = (int)blocks.size();
+		blocks.push_back(Block());
+	}
+
+	Block& node = blocks[block];
+	node.offset = 0;
+	node.size = 0;
+	node.prevPhysical = -1;
+	node.nextPhysical = -1;
+	node.prevFree = -1;
+	node.nextFree = -1;
+	node.free = false;
+	return block;
+}
+
+void TlsfAllocator::ReleaseBlock(int block)
+{
+	unusedBlocks.push_back(block);
+}
+
+void TlsfAllocator::InsertFree(int block)
+{
+	int fl, sl;
+	Mapping(blocks[block].size, fl, sl);
+
+	int head = heads[fl][sl];
+	blocks[block].prevFree = -1;
+	blocks[block].nextFree = head;
+	if (head >= 0)
+		blocks[head].prevFree = block;
+	heads[fl][sl] = block;
+
+	flBitmap |= 1u << fl;
+	slBitmaps[fl] |= 1u << sl;
+}
+
+void TlsfAllocator::RemoveFree(int block)
+{
+	int fl, sl;
+	Mapping(blocks[block].size, fl, sl);
+
+	const Block& node = blocks[block];
+	if (node.prevFree >= 0)
+		blocks[node.prevFree].nextFree = node.nextFree;
+	else
+		heads[fl][sl] = node.nextFree;
+	if (node.nextFree >= 0)
+		blocks[node.nextFree].prevFree = node.prevFree;
+
+	if (heads[fl][sl] < 0)
+	{
+		slBitmaps[fl] &= ~(1u << sl);
+		if (!slBitmaps[fl])
+			flBitmap &= ~(1u << fl);
+	}
+}
+
+TlsfAllocator::Stats TlsfAllocator::GetStats() const
+{
+	Stats stats;
+	stats.capacity = capacity;
+	stats.used = used;
+	stats.allocations = allocations;
+
+	uint32_t totalFree = 0;
+	for (int block = blocks.empty() ? -1 : 0; block >= 0; block = blocks[block].nextPhysical)
+	{
+		if (!blocks[block].free)
+			continue;
+
+		stats.freeBlocks++;
+		stats.largestFree = std::max(stats.largestFree, blocks[block].size);
+		totalFree += blocks[block].size;
+	}
+
+	stats.fragmentation = totalFree > 0 ? 1.0f - (float)stats.largestFree / (float)totalFree : 0.0f;
+	return stats;
+}
+
+bool TlsfAllocator::Validate() const
+{
+	// The blocks in the range follow each other from 0 to the capacity, no two free ones next to each other
+	uint32_t end = 0;
+	uint32_t usedSize = 0;
+	int usedBlocks = 0;
+	int freeBlocks = 0;
+	int previous = -1;
+	int steps = 0;
+	for (int block = blocks.empty() ? -1 : 0; block >= 0; block = blocks[block].nextPhysical)
+	{
+		const Block& node = blocks[block];
+		if (++steps > (int)blocks.size() || node.prevPhysical != previous || node.offset != end || node.size == 0)
+			return false;
+		if (node.free && previous >= 0 && blocks[previous].free)
+			return false;
+
+		end += node.size;
+		if (node.free)
+			freeBlocks++;
+		else
+		{
+			usedSize += node.size;
+			usedBlocks++;
+		}
+		previous = block;
+	}
+
+	if (end != capacity || usedSize != used || usedBlocks != allocations)
+		return false;
+
+	// Every free block is in the list of its class, a bit is set exactly for the lists that have blocks
+	int listed = 0;
+	for (int fl = 0; fl < FL_COUNT; fl++)
+	{
+		if (((flBitmap >> fl) & 1) != (slBitmaps[fl] != 0 ? 1u : 0u))
+			return false;
+
+		for (int sl = 0; sl < SL_COUNT; sl++)
+		{
+			if (((slBitmaps[fl] >> sl) & 1) != (heads[fl][sl] >= 0 ? 1u : 0u))
+				return false;
+
+			int previousFree = -1;
+			for (int block = heads[fl][sl]; block >= 0; block = blocks[block].nextFree)
+			{
+				const Block& node = blocks[block];
+				int blockFl, blockSl;
+				Mapping(node.size, blockFl, blockSl);
+				if (++listed > freeBlocks || !node.free || node.prevFree != previousFree || blockFl != fl || blockSl != sl)
+					return false;
+				previousFree = block;
+			}
+		}
+	}
+
+	return listed == freeBlocks;
+}
\ No newline at end of file
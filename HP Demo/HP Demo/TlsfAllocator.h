@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+/*
+	Two level segregated fit allocator of ranges in something it doesn't own, a buffer counted in vertices
+	or indices. Free blocks are kept in lists by size class: the first level is the highest bit of the size,
+	the second splits every power of two into 16 linear steps. A bitmap per level says which lists have
+	blocks, so finding a block is two bit scans and allocate and free take the same time whatever the
+	number of blocks. The first block of the request's own class is taken when it is big enough, otherwise
+	the request is rounded up to the next class, where any block fits.
+	What is left of a block is split off, and a freed block merges with free neighbours at once, so two
+	free blocks are never next to each other. Blocks are nodes in a pool, handles are node indices.
+*/
+class TlsfAllocator
+{
+public:
+	static const int SL_LOG2 = 4;
+	static const int SL_COUNT = 1 << SL_LOG2;		// Second level lists per power of two
+	static const int FL_COUNT = 32 - SL_LOG2 + 1;	// Sizes under SL_COUNT have the first list to themselves
+
+	struct Stats
+	{
+		uint32_t capacity = 0;
+		uint32_t used = 0;
+		int allocations = 0;
+		int freeBlocks = 0;
+		uint32_t largestFree = 0;
+		float fragmentation = 0.0f;		// 1 - largest free block / all free space, 0 when it is one block
+	};
+
+public:
+	TlsfAllocator();
+
+	// Everything is one free block again, handles from before are gone
+	void Initialize(uint32_t capacity);
+
+	// Handle of a block of at least size units, -1 when no free block is big enough
+	int Allocate(uint32_t size);
+	void Free(int block);
+
+	uint32_t GetOffset(int block) const { return this->blocks[block].offset; }
+	uint32_t GetSize(int block) const { return this->blocks[block].size; }
+
+	uint32_t GetCapacity() const { return this->capacity; }
+	uint32_t GetUsed() const { return this->used; }
+	int GetAllocationCount() const { return this->allocations; }
+
+	// Walks all blocks, for statistics
+	Stats GetStats() const;
+
+	// Walks all blocks and free lists, false when they don't agree with each other or the counts. For tests
+	bool Validate() const;
+
+	// Lists a block of the size goes in
+	static void Mapping(uint32_t size, int& fl, int& sl);
+
+private:
+	struct Block
+	{
+		uint32_t offset;
+		uint32_t size;
+		int prevPhysical;				// Neighbours in the range, -1 at the ends
+		int nextPhysical;
+		int prevFree;					// In the list of the size class, only while free
+		int nextFree;
+		bool free;
+	};
+
+	int NewBlock();
+	void ReleaseBlock(int block);
+
+	void InsertFree(int block);
+	void RemoveFree(int block);
+
+	// Head of the first list at or above the class, -1 when all of them are empty
+	int FindSuitable(int fl, int sl) const;
+
+private:
+	uint32_t capacity;
+	uint32_t used;
+	int allocations;
+
+	std::vector<Block> blocks;
+	std::vector<int> unusedBlocks;
+
+	uint32_t flBitmap;
+	uint32_t slBitmaps[FL_COUNT];
+	int heads[FL_COUNT][SL_COUNT];
+};
\ No newline at end of file
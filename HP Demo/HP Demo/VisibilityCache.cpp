@@ -0,0 +1,269 @@
+#include "VisibilityCache.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using namespace DirectX;
+
+// The far plane of the raw matrix is a difference of nearly equal numbers, rounded differently it would drop boxes that touch it
+const float VisibilityCache::PLANE_TOLERANCE = 0.01f;
+
+// Whether the box is not completely outside one of the planes, the same test SceneBVH::QueryPlanes makes
+static bool IsBoxInside(const XMFLOAT4* planes, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	float centerX = (boundsMin.x + boundsMax.x) * 0.5f, extentX = (boundsMax.x - boundsMin.x) * 0.5f;
+	float centerY = (boundsMin.y + boundsMax.y) * 0.5f, extentY = (boundsMax.y - boundsMin.y) * 0.5f;
+	float centerZ = (boundsMin.z + boundsMax.z) * 0.5f, extentZ = (boundsMax.z - boundsMin.z) * 0.5f;
+
+	for (int p = 0; p < 6; p++)
+	{
+		const XMFLOAT4& plane = planes[p];
+		float distance = plane.x * centerX + plane.y * centerY + plane.z * centerZ + plane.w;
+		float radius = fabsf(plane.x) * extentX + fabsf(plane.y) * extentY + fabsf(plane.z) * extentZ;
+		if (distance + radius < 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+VisibilityCache::VisibilityCache()
+{
+	this->valid = false;
+	this->havePrevious = false;
+	this->queryMilliseconds = 0.0;
+	ZeroMemory(&this->cached, sizeof(Frustum));
+	ZeroMemory(&this->previous, sizeof(Frustum));
+	XMStoreFloat4x4(&this->lastViewProjection, XMMatrixIdentity());
+}
+
+void VisibilityCache::Initialize(const Settings& settings)
+{
+	this->settings = settings;
+	this->valid = false;
+	this->havePrevious = false;
+	this->candidates.clear();
+	this->states.clear();
+	this->queryMilliseconds = 0.0;
+	this->stats = Stats();
+}
+
+void VisibilityCache::GetPlanes(XMMATRIX view, XMMATRIX projection, XMFLOAT4* planes)
+{
+	XMMATRIX columns = XMMatrixTranspose(view * projection);
+	XMVECTOR rawPlanes[6] =
+	{
+		XMVectorAdd(columns.r[3], columns.r[0]),
+		XMVectorSubtract(columns.r[3], columns.r[0]),
+		XMVectorAdd(columns.r[3], columns.r[1]),
+		XMVectorSubtract(columns.r[3], columns.r[1]),
+		columns.r[2],
+		XMVectorSubtract(columns.r[3], columns.r[2]),
+	};
+	for (int p = 0; p < 6; p++)
+		XMStoreFloat4(&planes[p], XMVectorDivide(rawPlanes[p], XMVector3Length(rawPlanes[p])));
+}
+
+void VisibilityCache::MakeFrustum(XMMATRIX view, XMMATRIX projection, Frustum& frustum)
+{
+	GetPlanes(view, projection, frustum.planes);
+	XMMATRIX viewProjection = view * projection;
+
+	XMVECTOR eye = XMMatrixInverse(nullptr, view).r[3];
+	XMStoreFloat3(&frustum.eye, eye);
+
+	XMMATRIX inverseViewProjection = XMMatrixInverse(nullptr, viewProjection);
+	frustum.reach = 0.0f;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		XMVECTOR clip = XMVectorSet(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : 0.0f, 1.0f);
+		XMVECTOR position = XMVector3TransformCoord(clip, inverseViewProjection);
+		frustum.reach = std::max(frustum.reach, XMVectorGetX(XMVector3Length(XMVectorSubtract(position, eye))));
+	}
+}
+
+bool VisibilityCache::IsWithin(const Frustum& frustum, const Frustum& reference, float margin)
+{
+	/*
+		A point p the frustum sees is at most reach from its eye e and has n'.p + d' >= 0. For the reference
+		plane n.p + d = n'.p + d' + (n - n').(p - e) + (n.e + d) - (n'.e + d'), which is at least
+		-(|n - n'| * reach + |(n.e + d) - (n'.e + d')|). While that stays under the margin for every plane,
+		p is inside the reference planes pushed out by the margin. The reach also covers what the reference
+		saw, so what was inside it by the margin stays inside the frustum.
+	*/
+	XMVECTOR eye = XMLoadFloat3(&frustum.eye);
+	float eyeMoved = XMVectorGetX(XMVector3Length(XMVectorSubtract(eye, XMLoadFloat3(&reference.eye))));
+	float reach = std::max(frustum.reach, reference.reach + eyeMoved);
+
+	for (int p = 0; p < 6; p++)
+	{
+		XMVECTOR referencePlane = XMLoadFloat4(&reference.planes[p]);
+		XMVECTOR plane = XMLoadFloat4(&frustum.planes[p]);
+		float normalDrift = XMVectorGetX(XMVector3Length(XMVectorSubtract(referencePlane, plane)));
+		float referenceDistance = XMVectorGetX(XMVector3Dot(referencePlane, eye)) + reference.planes[p].w;
+		float distance = XMVectorGetX(XMVector3Dot(plane, eye)) + frustum.planes[p].w;
+		if (normalDrift * reach + fabsf(referenceDistance - distance) > margin)
+			return false;
+	}
+
+	return true;
+}
+
+uint8_t VisibilityCache::Classify(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax) const
+{
+	float centerX = (boundsMin.x + boundsMax.x) * 0.5f, extentX = (boundsMax.x - boundsMin.x) * 0.5f;
+	float centerY = (boundsMin.y + boundsMax.y) * 0.5f, extentY = (boundsMax.y - boundsMin.y) * 0.5f;
+	float centerZ = (boundsMin.z + boundsMax.z) * 0.5f, extentZ = (boundsMax.z - boundsMin.z) * 0.5f;
+
+	uint8_t state = STATE_INNER;
+	for (int p = 0; p < 6; p++)
+	{
+		const XMFLOAT4& plane = cached.planes[p];
+		float distance = plane.x * centerX + plane.y * centerY + plane.z * centerZ + plane.w;
+		float radius = fabsf(plane.x) * extentX + fabsf(plane.y) * extentY + fabsf(plane.z) * extentZ;
+		if (distance + radius < -settings.margin)
+			return STATE_NONE;
+		if (distance - radius < settings.margin)
+			state = STATE_BOUNDARY;
+	}
+
+	return state;
+}
+
+void VisibilityCache::Rebuild(const SceneBVH& sceneBVH)
+{
+	for (int handle : candidates)
+		states[handle] = STATE_NONE;
+	candidates.clear();
+
+	XMFLOAT4 pushedOut[6];
+	for (int p = 0; p < 6; p++)
+	{
+		pushedOut[p] = cached.planes[p];
+		pushedOut[p].w += settings.margin;
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	sceneBVH.QueryPlanes(pushedOut, candidates);
+	queryMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// The BVH takes whole subtrees without testing them, what Classify would still drop stays a boundary object
+	for (int handle : candidates)
+	{
+		if (handle >= (int)states.size())
+			states.resize(handle + 1, STATE_NONE);
+
+		uint8_t state = Classify(sceneBVH.GetBoundsMin(handle), sceneBVH.GetBoundsMax(handle));
+		states[handle] = state == STATE_NONE ? STATE_BOUNDARY : state;
+	}
+}
+
+void VisibilityCache::ApplyChanges(const SceneBVH& sceneBVH)
+{
+	bool removed = false;
+	for (int handle : sceneBVH.GetChangedHandles())
+	{
+		if (handle >= (int)states.size())
+			states.resize(handle + 1, STATE_NONE);
+
+		uint8_t state = sceneBVH.IsAlive(handle) ? Classify(sceneBVH.GetBoundsMin(handle), sceneBVH.GetBoundsMax(handle)) : STATE_NONE;
+		if (states[handle] == STATE_NONE && state != STATE_NONE)
+			candidates.push_back(handle);
+		else if (states[handle] != STATE_NONE && state == STATE_NONE)
+			removed = true;
+
+		states[handle] = state;
+		stats.changedTests++;
+	}
+
+	if (removed)
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](int handle) { return states[handle] == STATE_NONE; }), candidates.end());
+}
+
+void VisibilityCache::Query(const SceneBVH& sceneBVH, XMMATRIX view, XMMATRIX projection, std::vector<int>& results)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Stats totals = stats;
+	stats = Stats();
+	stats.plainQueries = totals.plainQueries;
+	stats.rebuilds = totals.rebuilds;
+	stats.reuses = totals.reuses;
+	stats.totalSavedMilliseconds = totals.totalSavedMilliseconds;
+
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, view * projection);
+	stats.viewUnchanged = havePrevious && memcmp(&viewProjection, &lastViewProjection, sizeof(XMFLOAT4X4)) == 0;
+	lastViewProjection = viewProjection;
+
+	Frustum frustum;
+	MakeFrustum(view, projection, frustum);
+
+	// What the plain query takes and the boundary objects are tested against
+	XMFLOAT4 planes[6];
+	for (int p = 0; p < 6; p++)
+	{
+		planes[p] = frustum.planes[p];
+		planes[p].w += PLANE_TOLERANCE;
+	}
+
+	// The tolerance lets boxes that far outside the frustum in, the cached set has to reach that much further
+	stats.reused = settings.enabled && valid && IsWithin(frustum, cached, settings.margin - PLANE_TOLERANCE);
+	bool settled = settings.enabled && havePrevious && IsWithin(frustum, previous, settings.margin * settings.settleFraction);
+	previous = frustum;
+	havePrevious = true;
+
+	size_t first = results.size();
+	if (stats.reused)
+	{
+		ApplyChanges(sceneBVH);
+		stats.reuses++;
+	}
+	else if (settled)
+	{
+		cached = frustum;
+		Rebuild(sceneBVH);
+		valid = true;
+		stats.rebuilds++;
+	}
+	else
+	{
+		// Still moving, the set would not last
+		valid = false;
+		auto queryStart = std::chrono::high_resolution_clock::now();
+		sceneBVH.QueryPlanes(planes, results);
+		queryMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - queryStart).count();
+		stats.plainQueries++;
+	}
+
+	// Inner objects are in the view wherever the camera is within the margin, boundary ones are tested again
+	if (valid)
+	{
+		for (int handle : candidates)
+		{
+			if (states[handle] == STATE_INNER)
+			{
+				results.push_back(handle);
+				continue;
+			}
+
+			stats.boundaryTests++;
+			if (IsBoxInside(planes, sceneBVH.GetBoundsMin(handle), sceneBVH.GetBoundsMax(handle)))
+				results.push_back(handle);
+		}
+		stats.candidates = (int)candidates.size();
+	}
+
+	stats.visible = (int)(results.size() - first);
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// The last BVH query is about what the frame would have cost without the cache
+	stats.savedMilliseconds = queryMilliseconds - stats.milliseconds;
+	stats.totalSavedMilliseconds += stats.savedMilliseconds;
+}
+
+void VisibilityCache::AddSkippedWork(double milliseconds)
+{
+	stats.savedMilliseconds += milliseconds;
+	stats.totalSavedMilliseconds += milliseconds;
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+#include "DX.h"
+#include "SceneBVH.h"
+#include <vector>
+#include <cstdint>
+
+/*
+	Keeps the frustum query of the scene BVH while the camera stands still.
+	Once the camera settles, a full query takes everything in the frustum with its planes pushed out by a
+	margin, and sorts it into objects inside the planes pulled in by the margin and boundary objects between.
+	Later frames reuse the set while every plane of their frustum is within the margin of the cached one,
+	over the whole reach of the frustum, so everything they can see is still in it. Only the boundary objects
+	are tested against the new frustum, and only the objects the BVH says changed against the cached one.
+	A camera that keeps moving gets the plain query, the cache would be made again every few frames.
+*/
+class VisibilityCache
+{
+public:
+	struct Settings
+	{
+		float margin = 2.0f;				// World units the cached set reaches past the frustum
+		float settleFraction = 0.25f;		// Of the margin, the camera moved less since the frame before when the set is made
+		bool enabled = true;
+	};
+
+	struct Stats
+	{
+		bool reused = false;				// This frame came from the cache
+		bool viewUnchanged = false;			// Same view and projection as the frame before
+		int candidates = 0;					// In the cached set
+		int boundaryTests = 0;
+		int changedTests = 0;				// Objects the BVH inserted, removed or moved since the frame before
+		int visible = 0;
+		double milliseconds = 0.0;
+		double savedMilliseconds = 0.0;		// Against a plain BVH query and with the work skipped for an unchanged view, below 0 when the set was made
+
+		// Since Initialize
+		int plainQueries = 0;
+		int rebuilds = 0;
+		int reuses = 0;
+		double totalSavedMilliseconds = 0.0;
+	};
+
+public:
+	// World units a box may be outside the planes of GetPlanes and still count as inside
+	static const float PLANE_TOLERANCE;
+
+public:
+	VisibilityCache();
+
+	void Initialize(const Settings& settings);
+
+	// The next query does not reuse anything
+	void Invalidate() { this->valid = false; this->havePrevious = false; }
+
+	/*
+		Appends the handles of what is in the view, like SceneBVH::QueryFrustum. Reads the changed handles
+		of the BVH, which the caller clears after every query.
+	*/
+	void Query(const SceneBVH& sceneBVH, DirectX::XMMATRIX view, DirectX::XMMATRIX projection, std::vector<int>& results);
+
+	// Same view and projection as the last query, whatever was made for that view is still right
+	bool IsViewUnchanged() const { return this->stats.viewUnchanged; }
+
+	// Work for the view the caller skipped because it was unchanged, counted as saved
+	void AddSkippedWork(double milliseconds);
+
+	// The frustum planes of the view, like SceneBVH::QueryFrustum but with unit normals so distances are world units
+	static void GetPlanes(DirectX::XMMATRIX view, DirectX::XMMATRIX projection, DirectX::XMFLOAT4* planes);
+
+	const Settings& GetSettings() const { return this->settings; }
+	const Stats& GetStats() const { return this->stats; }
+
+private:
+	enum : uint8_t
+	{
+		STATE_NONE,							// Not in the cached set
+		STATE_INNER,						// Inside the cached frustum by the margin
+		STATE_BOUNDARY,
+	};
+
+	struct Frustum
+	{
+		DirectX::XMFLOAT4 planes[6];		// Normalized, distances are world units
+		DirectX::XMFLOAT3 eye;
+		float reach;						// Farthest corner from the eye
+	};
+
+	static void MakeFrustum(DirectX::XMMATRIX view, DirectX::XMMATRIX projection, Frustum& frustum);
+
+	// Whether everything the frustum sees is inside the planes of the reference pushed out by margin
+	static bool IsWithin(const Frustum& frustum, const Frustum& reference, float margin);
+
+	uint8_t Classify(const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax) const;
+	void Rebuild(const SceneBVH& sceneBVH);
+	void ApplyChanges(const SceneBVH& sceneBVH);
+
+private:
+	Settings settings;
+	bool valid;
+	bool havePrevious;
+
+	Frustum cached;							// The cached set was made for it
+	Frustum previous;						// Of the last query
+	DirectX::XMFLOAT4X4 lastViewProjection;
+
+	std::vector<int> candidates;
+	std::vector<uint8_t> states;			// Per handle
+	double queryMilliseconds;				// BVH part of the last full query
+
+	Stats stats;
+};
\ No newline at end of file
@@ -0,0 +1,480 @@
+#include "VoxelTerrain.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "stb_perlin.h"
+
+// Mode 0: one 32 bit position and one 32 bit face word per vertex, 4 vertices per quad
+#define STBVOX_CONFIG_MODE 0
+#define STB_VOXEL_RENDER_IMPLEMENTATION
+#include "stb_voxel_render.h"
+
+// Quads stb_voxel_render writes before handing the buffer back, big chunks are meshed in several passes
+static const int QUADS_PER_PASS = 16384;
+static const int BYTES_PER_QUAD = 32;
+
+/*
+	stb_voxel_render is Z up and right handed, the engine is Y up and left handed.
+	Swapping Y and Z handles both, face normals are in stb's face order (east, north, west, south, up, down).
+*/
+static const DirectX::XMFLOAT3 FACE_NORMALS[6] =
+{
+	DirectX::XMFLOAT3(1.0f, 0.0f, 0.0f),
+	DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f),
+	DirectX::XMFLOAT3(-1.0f, 0.0f, 0.0f),
+	DirectX::XMFLOAT3(0.0f, 0.0f, -1.0f),
+	DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f),
+	DirectX::XMFLOAT3(0.0f, -1.0f, 0.0f),
+};
+
+static const DirectX::XMFLOAT3 FACE_TANGENTS[6] =
+{
+	DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f),
+	DirectX::XMFLOAT3(-1.0f, 0.0f, 0.0f),
+	DirectX::XMFLOAT3(0.0f, 0.0f, -1.0f),
+	DirectX::XMFLOAT3(1.0f, 0.0f, 0.0f),
+	DirectX::XMFLOAT3(1.0f, 0.0f, 0.0f),
+	DirectX::XMFLOAT3(1.0f, 0.0f, 0.0f),
+};
+
+struct VoxelTerrain::MeshWorkspace
+{
+	stbvox_mesh_maker meshMaker;
+	std::vector<uint8_t> output;
+};
+
+VoxelTerrain::VoxelTerrain()
+{
+	this->chunksX = 0;
+	this->chunksZ = 0;
+	this->blockSize = 1.0f;
+	this->paddedX = 0;
+	this->paddedZ = 0;
+	this->paddedY = 0;
+	this->world = DirectX::XMMatrixIdentity();
+
+	this->material.ambientColor = DirectX::XMFLOAT4(0.2f, 0.2f, 0.2f, 1.0f);
+	this->material.diffuseColor = DirectX::XMFLOAT4(0.45f, 0.4f, 0.35f, 1.0f);
+	this->material.specularColor = DirectX::XMFLOAT4(0.1f, 0.1f, 0.1f, 0.0f);
+}
+
+VoxelTerrain::~VoxelTerrain()
+{
+	Shutdown();
+}
+
+bool VoxelTerrain::Initialize(int chunksX, int chunksZ, float blockSize)
+{
+	if (chunksX < 1 || chunksZ < 1 || blockSize <= 0.0f)
+		return false;
+
+	Shutdown();
+
+	this->chunksX = chunksX;
+	this->chunksZ = chunksZ;
+	this->blockSize = blockSize;
+
+	// One empty block on every side so the mesher can always read its neighbours
+	this->paddedX = chunksX * CHUNK_SIZE + 2;
+	this->paddedZ = chunksZ * CHUNK_SIZE + 2;
+	this->paddedY = CHUNK_HEIGHT + 2;
+	blocks.assign((size_t)paddedX * paddedZ * paddedY, 0);
+
+	chunks.resize((size_t)chunksX * chunksZ);
+	for (int z = 0; z < chunksZ; z++)
+	{
+		for (int x = 0; x < chunksX; x++)
+		{
+			Chunk& chunk = chunks[z * chunksX + x];
+			chunk.chunkX = x;
+			chunk.chunkZ = z;
+		}
+	}
+
+	return true;
+}
+
+void VoxelTerrain::Shutdown()
+{
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		if (chunks[i].model)
+		{
+			chunks[i].model->Shutdown();
+			delete chunks[i].model;
+			chunks[i].model = nullptr;
+		}
+	}
+	chunks.clear();
+	blocks.clear();
+
+	for (unsigned int i = 0; i < workspaces.size(); i++)
+	{
+		delete workspaces[i];
+	}
+	workspaces.clear();
+}
+
+void VoxelTerrain::Generate(int seed, JobSystem& jobSystem)
+{
+	jobSystem.ParallelFor((int)chunks.size(), [&](int chunkIndex, int thread) {
+		GenerateChunk(chunks[chunkIndex], seed);
+	});
+
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		chunks[i].dirty = true;
+	}
+}
+
+void VoxelTerrain::GenerateChunk(Chunk& chunk, int seed)
+{
+	/*
+		Density is the distance below a rolling surface, pushed around by 3D noise so the
+		surface can fold over itself. Caves are carved where a second noise field is close to zero.
+	*/
+	float offset = (float)(seed % 1024) * 17.31f;
+	float ground = CHUNK_HEIGHT * 0.45f;
+
+	for (int localX = 0; localX < CHUNK_SIZE; localX++)
+	{
+		int x = chunk.chunkX * CHUNK_SIZE + localX;
+		for (int localZ = 0; localZ < CHUNK_SIZE; localZ++)
+		{
+			int z = chunk.chunkZ * CHUNK_SIZE + localZ;
+
+			float surface = ground + stb_perlin_fbm_noise3(x * 0.015f + offset, 0.0f, z * 0.015f + offset, 2.0f, 0.5f, 4) * 14.0f;
+			uint8_t* column = &blocks[GetBlockIndex(x, 0, z)];
+
+			for (int y = 0; y < CHUNK_HEIGHT; y++)
+			{
+				float density = surface - y;
+
+				// Far above or below the surface the warp can't change the result
+				if (density > -12.0f && density < 12.0f)
+				{
+					density += stb_perlin_fbm_noise3(x * 0.045f, y * 0.06f + offset, z * 0.045f, 2.0f, 0.5f, 3) * 10.0f;
+				}
+
+				bool solid = density > 0.0f || y == 0;
+				if (solid && y > 2 && y < surface - 3.0f)
+				{
+					float cave = stb_perlin_noise3(x * 0.05f + offset, y * 0.08f, z * 0.05f - offset, 0, 0, 0);
+					solid = fabsf(cave) > 0.09f;
+				}
+
+				column[y] = solid ? 1 : 0;
+			}
+		}
+	}
+}
+
+size_t VoxelTerrain::GetBlockIndex(int x, int y, int z) const
+{
+	return ((size_t)(x + 1) * paddedZ + (z + 1)) * paddedY + (y + 1);
+}
+
+uint8_t VoxelTerrain::GetBlock(int x, int y, int z) const
+{
+	if (x < 0 || z < 0 || y < 0 || x >= GetBlocksX() || z >= GetBlocksZ() || y >= CHUNK_HEIGHT)
+		return 0;
+
+	return blocks[GetBlockIndex(x, y, z)];
+}
+
+void VoxelTerrain::SetBlock(int x, int y, int z, uint8_t block)
+{
+	if (x < 0 || z < 0 || y < 0 || x >= GetBlocksX() || z >= GetBlocksZ() || y >= CHUNK_HEIGHT)
+		return;
+
+	uint8_t& current = blocks[GetBlockIndex(x, y, z)];
+	if (current == block)
+		return;
+
+	current = block;
+
+	// Faces on a chunk border belong to the neighbour as well
+	MarkDirty(x, z);
+	MarkDirty(x - 1, z);
+	MarkDirty(x + 1, z);
+	MarkDirty(x, z - 1);
+	MarkDirty(x, z + 1);
+}
+
+void VoxelTerrain::MarkDirty(int x, int z)
+{
+	if (x < 0 || z < 0 || x >= GetBlocksX() || z >= GetBlocksZ())
+		return;
+
+	chunks[(z / CHUNK_SIZE) * chunksX + (x / CHUNK_SIZE)].dirty = true;
+}
+
+int VoxelTerrain::FillSphere(float centerX, float centerY, float centerZ, float radius, uint8_t block)
+{
+	int changed = 0;
+	int minX = (int)floorf(centerX - radius), maxX = (int)ceilf(centerX + radius);
+	int minY = (int)floorf(centerY - radius), maxY = (int)ceilf(centerY + radius);
+	int minZ = (int)floorf(centerZ - radius), maxZ = (int)ceilf(centerZ + radius);
+
+	for (int x = minX; x <= maxX; x++)
+	{
+		for (int z = minZ; z <= maxZ; z++)
+		{
+			for (int y = minY; y <= maxY; y++)
+			{
+				float dx = x + 0.5f - centerX;
+				float dy = y + 0.5f - centerY;
+				float dz = z + 0.5f - centerZ;
+				if (dx * dx + dy * dy + dz * dz > radius * radius)
+					continue;
+
+				if (x < 0 || z < 0 || y < 0 || x >= GetBlocksX() || z >= GetBlocksZ() || y >= CHUNK_HEIGHT)
+					continue;
+
+				if (GetBlock(x, y, z) != block)
+				{
+					SetBlock(x, y, z, block);
+					changed++;
+				}
+			}
+		}
+	}
+
+	return changed;
+}
+
+int VoxelTerrain::MeshDirtyChunks(JobSystem& jobSystem)
+{
+	std::vector<int> dirtyChunks;
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		if (chunks[i].dirty)
+			dirtyChunks.push_back(i);
+	}
+
+	meshStats = MeshStats();
+	if (dirtyChunks.empty())
+		return 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// stbvox_init_mesh_maker touches a shared palette, so workspaces are only created from this thread
+	while ((int)workspaces.size() < jobSystem.GetThreadCount())
+	{
+		MeshWorkspace* workspace = new MeshWorkspace;
+		stbvox_init_mesh_maker(&workspace->meshMaker);
+		workspace->output.resize((size_t)QUADS_PER_PASS * BYTES_PER_QUAD);
+		workspaces.push_back(workspace);
+	}
+
+	jobSystem.ParallelFor((int)dirtyChunks.size(), [&](int job, int thread) {
+		MeshChunk(chunks[dirtyChunks[job]], *workspaces[thread]);
+	});
+
+	meshStats.chunksMeshed = (int)dirtyChunks.size();
+	for (unsigned int i = 0; i < dirtyChunks.size(); i++)
+	{
+		meshStats.quads += chunks[dirtyChunks[i]].quadCount;
+	}
+	meshStats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return meshStats.chunksMeshed;
+}
+
+void VoxelTerrain::MeshChunk(Chunk& chunk, MeshWorkspace& workspace)
+{
+	using namespace DirectX;
+
+	stbvox_mesh_maker* meshMaker = &workspace.meshMaker;
+
+	/*
+		The input pointer starts at the chunk corner, so stb sees chunk local coordinates and
+		the block at -1 is the neighbour chunk or the empty border.
+	*/
+	stbvox_input_description* input = stbvox_get_input_description(meshMaker);
+	input->blocktype = &blocks[GetBlockIndex(chunk.chunkX * CHUNK_SIZE, 0, chunk.chunkZ * CHUNK_SIZE)];
+	stbvox_set_input_stride(meshMaker, paddedZ * paddedY, paddedY);
+	stbvox_set_input_range(meshMaker, 0, 0, 0, CHUNK_SIZE, CHUNK_SIZE, CHUNK_HEIGHT);
+
+	chunk.vertices.clear();
+	chunk.indices.clear();
+	chunk.quadCount = 0;
+
+	float originX = (float)(chunk.chunkX * CHUNK_SIZE);
+	float originZ = (float)(chunk.chunkZ * CHUNK_SIZE);
+
+	bool finished = false;
+	while (!finished)
+	{
+		stbvox_set_buffer(meshMaker, 0, 0, workspace.output.data(), workspace.output.size());
+		finished = stbvox_make_mesh(meshMaker) != 0;
+
+		int quads = stbvox_get_quad_count(meshMaker, 0);
+		const uint32_t* packed = (const uint32_t*)workspace.output.data();
+
+		for (int quad = 0; quad < quads; quad++)
+		{
+			const uint32_t* quadData = packed + quad * 8;
+
+			// face_info is the top byte of the face word: normal * 4 + rotation
+			int face = (quadData[1] >> 26) & 63;
+			if (face > 5)
+				face = 4;
+
+			XMFLOAT3 normal = FACE_NORMALS[face];
+			DWORD base = (DWORD)chunk.vertices.size();
+
+			for (int corner = 0; corner < 4; corner++)
+			{
+				uint32_t packedVertex = quadData[corner * 2];
+				float x = originX + (float)(packedVertex & 127);
+				float z = originZ + (float)((packedVertex >> 7) & 127);
+				float y = (float)((packedVertex >> 14) & 511) * 0.5f;
+
+				// Planar UVs in block units along the face
+				float u = face >= 4 ? x : (face == 0 || face == 2 ? z : x);
+				float v = face >= 4 ? z : y;
+
+				Vertex vertex;
+				vertex.pos = XMFLOAT3(x * blockSize, y * blockSize, z * blockSize);
+				vertex.texCoord = XMFLOAT2(u, -v);
+				vertex.normal = normal;
+				vertex.tangent = FACE_TANGENTS[face];
+				chunk.vertices.push_back(vertex);
+			}
+
+			/*
+				The axis swap mirrors the quads, so check the winding against the face normal
+				instead of trusting stb's order. Front faces are clockwise.
+			*/
+			XMVECTOR p0 = XMLoadFloat3(&chunk.vertices[base].pos);
+			XMVECTOR p1 = XMLoadFloat3(&chunk.vertices[base + 1].pos);
+			XMVECTOR p2 = XMLoadFloat3(&chunk.vertices[base + 2].pos);
+			XMVECTOR winding = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+			bool flip = XMVectorGetX(XMVector3Dot(winding, XMLoadFloat3(&normal))) < 0.0f;
+
+			if (!flip)
+			{
+				DWORD quadIndices[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+				chunk.indices.insert(chunk.indices.end(), quadIndices, quadIndices + 6);
+			}
+			else
+			{
+				DWORD quadIndices[6] = { base, base + 2, base + 1, base, base + 3, base + 2 };
+				chunk.indices.insert(chunk.indices.end(), quadIndices, quadIndices + 6);
+			}
+		}
+
+		chunk.quadCount += quads;
+	}
+
+	chunk.dirty = false;
+	chunk.meshChanged = true;
+}
+
+int VoxelTerrain::UploadChangedChunks(ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	uploadStats = UploadStats();
+
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		if (!chunks[i].meshChanged)
+			continue;
+
+		if (UploadChunk(chunks[i], device, context))
+			uploadStats.chunksUploaded++;
+	}
+
+	return uploadStats.chunksUploaded;
+}
+
+bool VoxelTerrain::UploadChunk(Chunk& chunk, ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	chunk.meshChanged = false;
+
+	if (!chunk.model)
+	{
+		chunk.model = new Model("VoxelChunk");
+		chunk.model->GetMaterial().push_back(material);
+		chunk.model->SetWorldMatrix(world);
+	}
+
+	int vertexCount = (int)chunk.vertices.size();
+	int indexCount = (int)chunk.indices.size();
+	chunk.model->SetVertexCount(vertexCount);
+	chunk.model->SetIndexCount(indexCount);
+	chunk.model->ComputeBounds(chunk.vertices);
+
+	// Nothing to draw, keep the old buffers around for when the chunk fills up again
+	if (indexCount == 0)
+		return true;
+
+	/*
+		Edits usually change a chunk by a few quads, so buffers get some headroom and
+		are updated in place until the mesh no longer fits.
+	*/
+	if (vertexCount > chunk.vertexCapacity || indexCount > chunk.indexCapacity)
+	{
+		int vertexCapacity = vertexCount + vertexCount / 4;
+		int indexCapacity = indexCount + indexCount / 4;
+
+		D3D11_BUFFER_DESC bufferDesc;
+		ZeroMemory(&bufferDesc, sizeof(D3D11_BUFFER_DESC));
+		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		bufferDesc.ByteWidth = sizeof(Vertex) * vertexCapacity;
+		bufferDesc.StructureByteStride = sizeof(Vertex);
+
+		ID3D11Buffer* vertexBuffer = nullptr;
+		HRESULT hr = device->CreateBuffer(&bufferDesc, nullptr, &vertexBuffer);
+		if (FAILED(hr))
+			return false;
+
+		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		bufferDesc.ByteWidth = sizeof(DWORD) * indexCapacity;
+		bufferDesc.StructureByteStride = sizeof(DWORD);
+
+		ID3D11Buffer* indexBuffer = nullptr;
+		hr = device->CreateBuffer(&bufferDesc, nullptr, &indexBuffer);
+		if (FAILED(hr))
+		{
+			vertexBuffer->Release();
+			return false;
+		}
+
+		if (chunk.vertexCapacity > 0)
+		{
+			chunk.model->GetVertexBuffer().Release();
+			chunk.model->GetIndexBuffer().Release();
+		}
+
+		chunk.model->SetVertexBuffer(vertexBuffer);
+		chunk.model->SetIndexBuffer(indexBuffer);
+		chunk.vertexCapacity = vertexCapacity;
+		chunk.indexCapacity = indexCapacity;
+		uploadStats.buffersCreated++;
+	}
+
+	D3D11_BOX vertexBox = { 0, 0, 0, (UINT)(sizeof(Vertex) * vertexCount), 1, 1 };
+	context->UpdateSubresource(&chunk.model->GetVertexBuffer(), 0, &vertexBox, chunk.vertices.data(), 0, 0);
+
+	D3D11_BOX indexBox = { 0, 0, 0, (UINT)(sizeof(DWORD) * indexCount), 1, 1 };
+	context->UpdateSubresource(&chunk.model->GetIndexBuffer(), 0, &indexBox, chunk.indices.data(), 0, 0);
+
+	uploadStats.bytes += sizeof(Vertex) * vertexCount + sizeof(DWORD) * indexCount;
+	return true;
+}
+
+void VoxelTerrain::SetWorldMatrix(DirectX::XMMATRIX world)
+{
+	this->world = world;
+
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		if (chunks[i].model)
+			chunks[i].model->SetWorldMatrix(world);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+#include "DX.h"
+#include "Model.h"
+#include "JobSystem.h"
+#include <vector>
+#include <cstdint>
+
+/*
+	Chunked voxel terrain for the parts of a level a heightmap can't express, like caves and overhangs.
+	Blocks come from 3D perlin noise and live in one grid with an empty border around it.
+	Chunks are meshed with stb_voxel_render on the job system when their blocks changed,
+	and only chunks with a new mesh are uploaded to the GPU.
+	Everything except UploadChangedChunks is CPU only, so it can run headless.
+*/
+class VoxelTerrain
+{
+public:
+	static const int CHUNK_SIZE = 32;		// Blocks along X and Z per chunk
+	static const int CHUNK_HEIGHT = 64;		// Blocks along Y, the terrain is one chunk tall
+
+	struct Chunk
+	{
+		int chunkX = 0;
+		int chunkZ = 0;
+		bool dirty = false;			// Blocks changed since the last mesh
+		bool meshChanged = false;	// Has a mesh that is not uploaded yet
+		int quadCount = 0;
+
+		std::vector<Vertex> vertices;
+		std::vector<DWORD> indices;
+
+		// GPU side, created on the first upload
+		Model* model = nullptr;
+		int vertexCapacity = 0;
+		int indexCapacity = 0;
+	};
+
+	struct MeshStats
+	{
+		int chunksMeshed = 0;
+		int quads = 0;
+		double milliseconds = 0.0;
+	};
+
+	struct UploadStats
+	{
+		int chunksUploaded = 0;
+		int buffersCreated = 0;
+		size_t bytes = 0;
+	};
+
+public:
+	VoxelTerrain();
+	~VoxelTerrain();
+
+	// blockSize is the edge length of a block in world units
+	bool Initialize(int chunksX, int chunksZ, float blockSize);
+	void Shutdown();
+
+	// Fills every block from noise and marks all chunks dirty
+	void Generate(int seed, JobSystem& jobSystem);
+
+	// Block coordinates, 0 is empty. Outside of the terrain reads as empty and writes are ignored
+	uint8_t GetBlock(int x, int y, int z) const;
+	void SetBlock(int x, int y, int z, uint8_t block);
+
+	// Sets every block inside the sphere (block coordinates), returns how many changed
+	int FillSphere(float centerX, float centerY, float centerZ, float radius, uint8_t block);
+
+	// Meshes the dirty chunks in parallel, returns how many were meshed
+	int MeshDirtyChunks(JobSystem& jobSystem);
+
+	// Copies the new meshes to their buffers, buffers are only recreated when a mesh outgrows them
+	int UploadChangedChunks(ID3D11Device* device, ID3D11DeviceContext* context);
+
+	void SetMaterial(const SurfaceMaterial& material) { this->material = material; }
+	void SetWorldMatrix(DirectX::XMMATRIX world);
+
+	int GetChunksX() const { return this->chunksX; }
+	int GetChunksZ() const { return this->chunksZ; }
+	int GetBlocksX() const { return this->chunksX * CHUNK_SIZE; }
+	int GetBlocksZ() const { return this->chunksZ * CHUNK_SIZE; }
+	float GetBlockSize() const { return this->blockSize; }
+	std::vector<Chunk>& GetChunks() { return this->chunks; }
+
+	const MeshStats& GetMeshStats() const { return this->meshStats; }
+	const UploadStats& GetUploadStats() const { return this->uploadStats; }
+
+private:
+	struct MeshWorkspace;
+
+	size_t GetBlockIndex(int x, int y, int z) const;
+	void MarkDirty(int x, int z);
+	void GenerateChunk(Chunk& chunk, int seed);
+	void MeshChunk(Chunk& chunk, MeshWorkspace& workspace);
+	bool UploadChunk(Chunk& chunk, ID3D11Device* device, ID3D11DeviceContext* context);
+
+private:
+	int chunksX, chunksZ;
+	float blockSize;
+
+	// Padded grid, Y is the fastest axis so a column is what stb_voxel_render reads as its Z
+	int paddedX, paddedZ, paddedY;
+	std::vector<uint8_t> blocks;
+
+	std::vector<Chunk> chunks;
+	std::vector<MeshWorkspace*> workspaces;		// One per job system thread
+
+	SurfaceMaterial material;
+	DirectX::XMMATRIX world;
+
+	MeshStats meshStats;
+	UploadStats uploadStats;
+};
\ No newline at end of file
@@ -2,11 +2,20 @@
 #include <stdlib.h>
 #include <crtdbg.h>
 #include "System.h"
+#include "Benchmark.h"
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nShowCmd)
 {
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 
+	// Headless mode, run the CPU benchmarks without creating a window or a device
+	std::wstring commandLine = lpCmdLine ? lpCmdLine : L"";
+	if (commandLine.find(L"-benchmark") != std::wstring::npos)
+	{
+		Benchmark benchmark;
+		return benchmark.Run(commandLine) ? 0 : 1;
+	}
+
 	bool result;
 	System application(hInstance);
 
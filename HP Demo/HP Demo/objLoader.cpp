@@ -397,6 +397,7 @@ bool objLoader::loadObj(Model* model, ID3D11Device* device, wstring fileName, bo
 				break;
 
 				// Check for transparency
+			case 'T':
 				checkChar = fileIn.get();
 				if (checkChar == 'r')
 				{
@@ -404,7 +405,8 @@ bool objLoader::loadObj(Model* model, ID3D11Device* device, wstring fileName, bo
 					float transparency;
 					fileIn >> transparency;
 
-					model->GetMaterial()[materialCount - (long long)1].isTransparent = true;
+					model->GetMaterial()[materialCount - (long long)1].isTransparent = transparency > 0.0f;
+					model->GetMaterial()[materialCount - (long long)1].opacity = 1.0f - transparency;
 				}
 				break;
 				// Specular shine
@@ -716,43 +718,12 @@ bool objLoader::loadObj(Model* model, ID3D11Device* device, wstring fileName, bo
 
 	model->SetVertexCount((int)model->GetVertices().size());
 	model->SetIndexCount((int)model->GetIndices().size());
+	model->ComputeBounds(model->GetVertices());
+	model->BuildSubsets();
 
-	// Create index buffer
-	D3D11_BUFFER_DESC indexBufferDesc;
-	ZeroMemory(&indexBufferDesc, sizeof(indexBufferDesc));
-
-	indexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	indexBufferDesc.ByteWidth = sizeof(DWORD) * meshTriangles * 3;
-	indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	indexBufferDesc.CPUAccessFlags = 0;
-	indexBufferDesc.MiscFlags = 0;
-
-	ID3D11Buffer* indexBuffer;
-	ID3D11Buffer* vertexBuffer;
-
-	D3D11_SUBRESOURCE_DATA iinitData;
-	iinitData.pSysMem = &model->GetIndices()[0];
-	this->hr = device->CreateBuffer(&indexBufferDesc, &iinitData, &indexBuffer);
-	assert(SUCCEEDED(this->hr));
-
-	// Create vertex buffer
-	D3D11_BUFFER_DESC vertexBufferDesc;
-	ZeroMemory(&vertexBufferDesc, sizeof(vertexBufferDesc));
-
-	vertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	vertexBufferDesc.ByteWidth = sizeof(Vertex) * totalVertices;
-	vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	vertexBufferDesc.CPUAccessFlags = 0;
-	vertexBufferDesc.MiscFlags = 0;
-
-	D3D11_SUBRESOURCE_DATA vertexBufferData;
-	ZeroMemory(&vertexBufferData, sizeof(vertexBufferData));
-	vertexBufferData.pSysMem = &model->GetVertices()[0];
-	this->hr = device->CreateBuffer(&vertexBufferDesc, &vertexBufferData, &vertexBuffer);
-	assert(SUCCEEDED(this->hr));
-
-	model->SetIndexBuffer(indexBuffer);
-	model->SetVertexBuffer(vertexBuffer);
+	// Into the shared geometry pages when the scene has them, otherwise buffers of its own
+	if (!model->CreateGeometry(device))
+		return false;
 
 	return true;
 }
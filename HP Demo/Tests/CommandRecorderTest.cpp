@@ -0,0 +1,149 @@
+#include "Test.h"
+#include "CommandRecorder.h"
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+/*
+	One draw per item, with the state the item needs bound first. The state changes every few items, so
+	a range that starts in the middle of a run has to bind what the items before it left bound.
+*/
+static void RecordItems(RenderBackend* backend, size_t first, size_t last, std::vector<std::atomic<int>>* recorded)
+{
+	for (size_t item = first; item < last; item++)
+	{
+		backend->VSSetShader(Handle<ID3D11VertexShader>(0x400 + item / 50 % 3 * 0x10), nullptr, 0);
+		backend->PSSetShader(Handle<ID3D11PixelShader>(0x600 + item / 7 % 4 * 0x10), nullptr, 0);
+
+		ID3D11ShaderResourceView* texture = Handle<ID3D11ShaderResourceView>(0x40000 + item / 3 % 5 * 0x100);
+		backend->PSSetShaderResources(0, 1, &texture);
+		backend->DrawIndexed(36, (UINT)item, 0);
+
+		if (recorded)
+			(*recorded)[item]++;
+	}
+}
+
+// Finish fails for one context, the way a deferred context that runs out of memory would
+class FailingRecorder : public RecordingCommandRecorder
+{
+public:
+	FailingRecorder(RecordingBackend* target, int failingContext) : RecordingCommandRecorder(target, true)
+	{
+		this->failingContext = failingContext;
+	}
+
+	bool Finish(int index) override { return index != this->failingContext; }
+
+private:
+	int failingContext;
+};
+
+static void TestRanges()
+{
+	const size_t counts[] = { 0, 1, 5, 127, 128, 1000, 1001 };
+	for (size_t count : counts)
+	{
+		for (int rangeCount = 1; rangeCount <= 8; rangeCount++)
+		{
+			size_t end = 0;
+			size_t smallest = count;
+			size_t largest = 0;
+			for (int range = 0; range < rangeCount; range++)
+			{
+				size_t first, last;
+				CommandRecorder::GetRange(count, rangeCount, range, first, last);
+				CHECK(first == end);
+				end = last;
+				smallest = std::min(smallest, last - first);
+				largest = std::max(largest, last - first);
+			}
+			CHECK(end == count);
+			CHECK(largest - smallest <= 1);
+		}
+	}
+}
+
+static void TestParallelMatchesSerial(int threadCount, size_t count, size_t minRangeItems)
+{
+	RecordingBackend serial;
+	StateCache serialCache(&serial);
+	RecordItems(&serialCache, 0, count, nullptr);
+
+	JobSystem jobSystem;
+	jobSystem.Initialize(threadCount - 1);
+
+	RecordingBackend target;
+	RecordingCommandRecorder recorder(&target, true);
+	std::vector<std::atomic<int>> recorded(count);
+	for (std::atomic<int>& times : recorded)
+		times = 0;
+
+	int rangeCount = recorder.RecordParallel(jobSystem, count, minRangeItems, [&](RenderBackend* backend, size_t first, size_t last)
+	{
+		RecordItems(backend, first, last, &recorded);
+	});
+
+	// As many ranges as there are threads, unless that would make them smaller than minRangeItems
+	size_t expectedRanges = std::min((size_t)threadCount, (count + minRangeItems - 1) / minRangeItems);
+	CHECK(rangeCount == (int)expectedRanges);
+
+	bool once = true;
+	for (const std::atomic<int>& times : recorded)
+		once = once && times == 1;
+	CHECK(once);
+
+	// Executed in order, so the draws come out as the serial ones did with the same state bound
+	CHECK(target.GetDrawCount() == (int)count);
+	CHECK(target.GetDrawStateHash() == serial.GetDrawStateHash());
+
+	bool inOrder = true;
+	UINT nextItem = 0;
+	for (const RecordingBackend::Call& call : target.GetCalls())
+	{
+		if (call.type != RecordingBackend::CALL_DRAW)
+			continue;
+		inOrder = inOrder && call.startSlot == nextItem;
+		nextItem++;
+	}
+	CHECK(inOrder);
+
+	jobSystem.Shutdown();
+}
+
+static void TestFailedFinish()
+{
+	JobSystem jobSystem;
+	jobSystem.Initialize(3);
+
+	RecordingBackend target;
+	FailingRecorder recorder(&target, 2);
+	int rangeCount = recorder.RecordParallel(jobSystem, 1000, 100, [&](RenderBackend* backend, size_t first, size_t last)
+	{
+		RecordItems(backend, first, last, nullptr);
+	});
+
+	// Nothing is executed when a range did not finish
+	CHECK(rangeCount == -1);
+	CHECK(target.GetTotalCalls() == 0);
+
+	jobSystem.Shutdown();
+}
+
+int main()
+{
+	TestRanges();
+
+	const int threadCounts[] = { 1, 2, 3, 4, 8 };
+	for (int threadCount : threadCounts)
+	{
+		TestParallelMatchesSerial(threadCount, 0, 128);
+		TestParallelMatchesSerial(threadCount, 100, 128);
+		TestParallelMatchesSerial(threadCount, 1000, 128);
+		TestParallelMatchesSerial(threadCount, 20000, 128);
+		TestParallelMatchesSerial(threadCount, 1001, 1);
+	}
+
+	TestFailedFinish();
+	return TestResult();
+}
\ No newline at end of file
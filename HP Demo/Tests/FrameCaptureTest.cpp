@@ -0,0 +1,195 @@
+#include "Test.h"
+#include "FrameCapture.h"
+#include <random>
+#include <cstring>
+#include <cstdio>
+
+static const UINT RING_BYTES = 1024;
+static const int FRAMES = 3;
+
+static ID3D11Buffer* const objectRing = Handle<ID3D11Buffer>(0x1100);
+static ID3D11Buffer* const materials = Handle<ID3D11Buffer>(0x1200);
+
+// State only bound before the capture starts, the capture has to carry it
+static void BindOnce(RenderBackend* backend)
+{
+	backend->IASetInputLayout(Handle<ID3D11InputLayout>(0x200));
+	backend->IASetPrimitiveTopology(4);
+
+	ID3D11SamplerState* samplers[2] = { Handle<ID3D11SamplerState>(0x700), Handle<ID3D11SamplerState>(0x710) };
+	backend->PSSetSamplers(0, 2, samplers);
+
+	FLOAT blendFactor[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	backend->OMSetBlendState(Handle<ID3D11BlendState>(0x800), blendFactor, 0xffffffff);
+	backend->OMSetDepthStencilState(Handle<ID3D11DepthStencilState>(0x900), 1);
+	backend->RSSetState(Handle<ID3D11RasterizerState>(0xa00));
+}
+
+// A frame of draws, each writing its constants into the ring, with the odd material update
+static void IssueFrame(RenderBackend* backend, std::mt19937& random)
+{
+	for (int batch = 0; batch < 8; batch++)
+	{
+		// The ring is written a bit at a time, so later maps of it only change some blocks
+		MappedResource mapped;
+		backend->Map((ID3D11Resource*)objectRing, 0, batch == 0 ? RenderBackend::MAP_WRITE_DISCARD : RenderBackend::MAP_WRITE_NO_OVERWRITE, 0, &mapped);
+		uint8_t* ring = (uint8_t*)mapped.pData;
+		for (int i = 0; i < 16; i++)
+			ring[random() % RING_BYTES] = (uint8_t)random();
+		backend->Unmap((ID3D11Resource*)objectRing, 0);
+
+		if (random() % 2 == 0)
+		{
+			uint8_t material[32];
+			for (uint8_t& byte : material)
+				byte = (uint8_t)random();
+			ResourceBox box = { (UINT)(random() % 8) * 32, 0, 0, 0, 1, 1 };
+			box.right = box.left + sizeof(material);
+			backend->UpdateSubresource((ID3D11Resource*)materials, 0, &box, material, 0, 0);
+		}
+
+		for (int draw = 0; draw < 16; draw++)
+		{
+			int mesh = random() % 6;
+			ID3D11Buffer* vertexBuffer = Handle<ID3D11Buffer>(0x10000 + mesh * 0x100);
+			UINT stride = 32;
+			UINT offset = 0;
+			backend->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
+			backend->IASetIndexBuffer(Handle<ID3D11Buffer>(0x30000 + mesh * 0x100), 42, 0);
+
+			backend->VSSetShader(Handle<ID3D11VertexShader>(0x400 + random() % 3 * 0x10), nullptr, 0);
+			backend->PSSetShader(Handle<ID3D11PixelShader>(0x600 + random() % 4 * 0x10), nullptr, 0);
+
+			ID3D11Buffer* buffers[2] = { materials, objectRing };
+			UINT firstConstants[2] = { 0, (UINT)(batch * 16 + draw) * 16 };
+			UINT constantCounts[2] = { 0, 16 };
+			backend->VSSetConstantBuffers1(0, 2, buffers, firstConstants, constantCounts);
+
+			ID3D11ShaderResourceView* texture = Handle<ID3D11ShaderResourceView>(0x40000 + random() % 5 * 0x100);
+			backend->PSSetShaderResources(0, 1, &texture);
+
+			if (random() % 4 == 0)
+				backend->DrawIndexedInstanced(36, 1 + random() % 4, mesh * 36, 0, 0);
+			else
+				backend->DrawIndexed(36, mesh * 36, 0);
+		}
+	}
+}
+
+/*
+	Binds and maps before the capture starts, then captures FRAMES frames. original sees every call, but
+	nothing is drawn before the capture, so its draws are the captured ones.
+*/
+static void Capture(FrameCapture& capture, uint32_t seed)
+{
+	std::mt19937 random(seed);
+	BindOnce(&capture);
+	MappedResource mapped;
+	capture.Map((ID3D11Resource*)objectRing, 0, RenderBackend::MAP_WRITE_DISCARD, 0, &mapped);
+	memset(mapped.pData, 0x5a, RING_BYTES);
+	capture.Unmap((ID3D11Resource*)objectRing, 0);
+
+	capture.Start(FRAMES);
+	for (int frame = 0; frame < FRAMES; frame++)
+	{
+		capture.BeginFrame();
+		IssueFrame(&capture, random);
+		CHECK(capture.EndFrame() == (frame == FRAMES - 1));
+	}
+}
+
+static bool SameMemory(RecordingBackend& first, RecordingBackend& second, ID3D11Buffer* buffer)
+{
+	MappedResource a, b;
+	first.Map((ID3D11Resource*)buffer, 0, RenderBackend::MAP_WRITE_NO_OVERWRITE, 0, &a);
+	second.Map((ID3D11Resource*)buffer, 0, RenderBackend::MAP_WRITE_NO_OVERWRITE, 0, &b);
+	return memcmp(a.pData, b.pData, RING_BYTES) == 0;
+}
+
+static void TestReplayMatchesCapture(uint32_t seed)
+{
+	RecordingBackend original(RING_BYTES);
+	FrameCapture capture(&original, nullptr);
+	Capture(capture, seed);
+	CHECK(!capture.IsCapturing() && !capture.IsPending());
+	CHECK(capture.GetStats().frames == FRAMES);
+
+	FrameReplay replay;
+	CHECK(replay.Load(capture.GetData()));
+	CHECK(replay.GetFrameCount() == FRAMES);
+	CHECK(replay.GetObjectCount() == (int)capture.GetObjects().size() - 1);
+
+	// With the objects it was captured with, the same draws with the same state and the same ring
+	RecordingBackend replayed(RING_BYTES);
+	for (uint32_t id = 1; id < (uint32_t)capture.GetObjects().size(); id++)
+		replay.SetObject(id, capture.GetObjects()[id]);
+	CHECK(replay.Replay(&replayed));
+	CHECK(replayed.GetDrawCount() == original.GetDrawCount());
+	CHECK(replayed.GetDrawStateHash() == original.GetDrawStateHash());
+	CHECK(replayed.GetCallCount(RecordingBackend::CALL_UPDATE_SUBRESOURCE) == original.GetCallCount(RecordingBackend::CALL_UPDATE_SUBRESOURCE));
+	CHECK(SameMemory(replayed, original, objectRing));
+
+	int draws = replay.GetStats().opCounts[FrameCapture::OP_DRAW] + replay.GetStats().opCounts[FrameCapture::OP_DRAW_INDEXED] +
+		replay.GetStats().opCounts[FrameCapture::OP_DRAW_INDEXED_INSTANCED];
+	CHECK(draws == original.GetDrawCount());
+
+	// Without a device or any bookkeeping behind it
+	NullBackend null(RING_BYTES);
+	CHECK(replay.Replay(&null));
+
+	// Stand-ins are the same every time
+	FrameReplay standIns;
+	CHECK(standIns.Load(capture.GetData()));
+	RecordingBackend first(RING_BYTES), second(RING_BYTES);
+	CHECK(standIns.Replay(&first));
+	CHECK(standIns.Replay(&second));
+	CHECK(first.GetDrawCount() == original.GetDrawCount());
+	CHECK(first.GetDrawStateHash() == second.GetDrawStateHash());
+	CHECK(first.GetDrawStateHash() != original.GetDrawStateHash());
+}
+
+static void TestFile()
+{
+	RecordingBackend original(RING_BYTES);
+	FrameCapture capture(&original, nullptr);
+	Capture(capture, 7);
+
+	const char* path = "FrameCaptureTest.hpcap";
+	CHECK(capture.Save(path));
+
+	FrameReplay replay;
+	CHECK(replay.Load(path));
+	remove(path);
+
+	RecordingBackend replayed(RING_BYTES);
+	for (uint32_t id = 1; id < (uint32_t)capture.GetObjects().size(); id++)
+		replay.SetObject(id, capture.GetObjects()[id]);
+	CHECK(replay.Replay(&replayed));
+	CHECK(replayed.GetDrawStateHash() == original.GetDrawStateHash());
+}
+
+static void TestDamagedCapture()
+{
+	RecordingBackend original(RING_BYTES);
+	FrameCapture capture(&original, nullptr);
+	Capture(capture, 11);
+
+	std::vector<uint8_t> data = capture.GetData();
+	data.resize(data.size() / 2);
+	FrameReplay cut;
+	CHECK(!cut.Load(data));
+
+	data = capture.GetData();
+	data[0] ^= 0xff;
+	FrameReplay wrongMagic;
+	CHECK(!wrongMagic.Load(data));
+}
+
+int main()
+{
+	for (uint32_t seed = 1; seed <= 4; seed++)
+		TestReplayMatchesCapture(seed);
+	TestFile();
+	TestDamagedCapture();
+	return TestResult();
+}
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include "Test.h"
+#include "StateCache.h"
+#include <random>
+
+static const UINT TOPOLOGY_TRIANGLE_LIST = 4;
+static const UINT TOPOLOGY_TRIANGLE_STRIP = 5;
+static const UINT FORMAT_R32_UINT = 42;
+static const UINT FORMAT_R16_UINT = 57;
+
+/*
+	Calls the way the render paths make them: every draw sets all of its state, most of it what the draw
+	before it set as well. Maps, updates, ranges past the followed slots and, with a cache, the odd
+	Invalidate are mixed in. The same seed makes the same calls.
+*/
+static void IssueCalls(RenderBackend* backend, StateCache* cache, uint32_t seed, int drawCount)
+{
+	std::mt19937 random(seed);
+	auto pick = [&](int count) { return (int)(random() % (uint32_t)count); };
+
+	ID3D11Buffer* camera = Handle<ID3D11Buffer>(0x1040);
+	ID3D11Buffer* light = Handle<ID3D11Buffer>(0x1080);
+	ID3D11Buffer* objectRing = Handle<ID3D11Buffer>(0x1100);
+
+	for (int draw = 0; draw < drawCount; draw++)
+	{
+		// The pass changes rarely, the shaders now and then, the mesh and material all the time
+		int pass = draw / 256 % 2;
+		int mesh = pick(6);
+
+		backend->IASetInputLayout(Handle<ID3D11InputLayout>(0x200 + pass * 0x10));
+		backend->IASetPrimitiveTopology(pick(8) == 0 ? TOPOLOGY_TRIANGLE_STRIP : TOPOLOGY_TRIANGLE_LIST);
+
+		ID3D11Buffer* vertexBuffers[2] = { Handle<ID3D11Buffer>(0x10000 + mesh * 0x100), Handle<ID3D11Buffer>(0x20000 + pick(2) * 0x100) };
+		UINT strides[2] = { 32, 64 };
+		UINT offsets[2] = { 0, (UINT)pick(2) * 64 };
+		backend->IASetVertexBuffers(0, 2, vertexBuffers, strides, offsets);
+		backend->IASetIndexBuffer(Handle<ID3D11Buffer>(0x30000 + mesh * 0x100), mesh < 4 ? FORMAT_R32_UINT : FORMAT_R16_UINT, 0);
+
+		backend->VSSetShader(Handle<ID3D11VertexShader>(0x400 + pick(3) * 0x10), nullptr, 0);
+		backend->GSSetShader(pick(16) == 0 ? Handle<ID3D11GeometryShader>(0x500) : nullptr, nullptr, 0);
+		backend->PSSetShader(Handle<ID3D11PixelShader>(0x600 + pick(4) * 0x10), nullptr, 0);
+
+		ID3D11Buffer* vsBuffers[3] = { camera, light, objectRing };
+		UINT firstConstants[3] = { 0, 0, (UINT)(draw % 64) * 16 };
+		UINT constantCounts[3] = { 0, 0, 16 };
+		if (pick(4) == 0)
+			backend->VSSetConstantBuffers(0, 2, vsBuffers);
+		else
+			backend->VSSetConstantBuffers1(0, 3, vsBuffers, firstConstants, constantCounts);
+
+		ID3D11Buffer* psBuffers[3] = { camera, light, Handle<ID3D11Buffer>(0x1200 + pick(3) * 0x40) };
+		backend->PSSetConstantBuffers(0, 3, psBuffers);
+
+		ID3D11ShaderResourceView* views[4];
+		for (int i = 0; i < 4; i++)
+			views[i] = Handle<ID3D11ShaderResourceView>(0x40000 + i * 0x1000 + pick(3) * 0x100);
+		backend->PSSetShaderResources(0, 4, views);
+		if (pick(32) == 0)
+			backend->VSSetShaderResources(0, 1, views);
+		if (pick(64) == 0)
+		{
+			ID3D11ShaderResourceView* tail[8] = {};
+			tail[pick(8)] = views[0];
+			backend->PSSetShaderResources(BoundState::RESOURCE_SLOTS - 4, 8, tail);
+		}
+
+		ID3D11SamplerState* samplers[2] = { Handle<ID3D11SamplerState>(0x700), Handle<ID3D11SamplerState>(0x710 + pick(2) * 0x10) };
+		backend->PSSetSamplers(0, 2, samplers);
+
+		FLOAT blendFactor[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+		backend->OMSetBlendState(Handle<ID3D11BlendState>(0x800 + pass * 0x10), pick(8) == 0 ? blendFactor : nullptr, 0xffffffff);
+		backend->OMSetDepthStencilState(Handle<ID3D11DepthStencilState>(0x900 + pass * 0x10), (UINT)pick(2));
+		backend->RSSetState(Handle<ID3D11RasterizerState>(0xa00 + pick(8) / 7 * 0x10));
+
+		if (draw % 16 == 0)
+		{
+			MappedResource mapped;
+			backend->Map((ID3D11Resource*)objectRing, 0, draw % 256 == 0 ? RenderBackend::MAP_WRITE_DISCARD : RenderBackend::MAP_WRITE_NO_OVERWRITE, 0, &mapped);
+			backend->Unmap((ID3D11Resource*)objectRing, 0);
+		}
+		if (pick(32) == 0)
+		{
+			uint8_t data[64] = {};
+			ResourceBox box = { 0, 0, 0, 64, 1, 1 };
+			backend->UpdateSubresource((ID3D11Resource*)psBuffers[2], 0, &box, data, 0, 0);
+		}
+
+		switch (pick(3))
+		{
+		case 0: backend->Draw(36, 0); break;
+		case 1: backend->DrawIndexed(36 + mesh * 6, mesh * 64, mesh * 24); break;
+		case 2: backend->DrawIndexedInstanced(36, 1 + pick(4), 0, 0, (UINT)draw); break;
+		}
+
+		// Picked with or without a cache, so both runs take the same numbers
+		bool invalidate = pick(100) == 0;
+		if (cache && invalidate)
+			cache->Invalidate();
+	}
+}
+
+static void TestFilteredMatchesUnfiltered(uint32_t seed)
+{
+	static const int DRAWS = 4000;
+
+	RecordingBackend unfiltered(256);
+	IssueCalls(&unfiltered, nullptr, seed, DRAWS);
+
+	RecordingBackend filtered(256);
+	StateCache cache(&filtered);
+	IssueCalls(&cache, &cache, seed, DRAWS);
+
+	// The same draws with the same state, in fewer calls
+	CHECK(filtered.GetDrawCount() == DRAWS);
+	CHECK(filtered.GetDrawCount() == unfiltered.GetDrawCount());
+	CHECK(filtered.GetDrawStateHash() == unfiltered.GetDrawStateHash());
+	CHECK(filtered.GetState().Hash() == unfiltered.GetState().Hash());
+	CHECK(filtered.GetTotalCalls() < unfiltered.GetTotalCalls());
+
+	// Updates, maps and draws always go through
+	CHECK(filtered.GetCallCount(RecordingBackend::CALL_MAP) == unfiltered.GetCallCount(RecordingBackend::CALL_MAP));
+	CHECK(filtered.GetCallCount(RecordingBackend::CALL_UNMAP) == unfiltered.GetCallCount(RecordingBackend::CALL_UNMAP));
+	CHECK(filtered.GetCallCount(RecordingBackend::CALL_UPDATE_SUBRESOURCE) == unfiltered.GetCallCount(RecordingBackend::CALL_UPDATE_SUBRESOURCE));
+
+	// The cache counts what it was handed and what it passed on
+	const StateCache::Stats& stats = cache.GetStats();
+	CHECK(stats.calls == unfiltered.GetTotalCalls());
+	CHECK(stats.forwarded == filtered.GetTotalCalls());
+	CHECK(stats.draws == DRAWS);
+}
+
+// A different call stream has to change the hash, or the comparison above proves nothing
+static void TestHashFollowsState()
+{
+	RecordingBackend first;
+	IssueCalls(&first, nullptr, 1, 100);
+
+	RecordingBackend second;
+	IssueCalls(&second, nullptr, 1, 100);
+	CHECK(first.GetDrawStateHash() == second.GetDrawStateHash());
+
+	second.PSSetShader(Handle<ID3D11PixelShader>(0xfff0), nullptr, 0);
+	second.Draw(36, 0);
+	first.Draw(36, 0);
+	CHECK(first.GetDrawStateHash() != second.GetDrawStateHash());
+	CHECK(first.GetDrawCount() == second.GetDrawCount());
+}
+
+static void TestRedundantCalls()
+{
+	RecordingBackend recording;
+	StateCache cache(&recording);
+
+	cache.RSSetState(Handle<ID3D11RasterizerState>(0xa00));
+	cache.RSSetState(Handle<ID3D11RasterizerState>(0xa00));
+	CHECK(recording.GetCallCount(RecordingBackend::CALL_SET_RASTERIZER_STATE) == 1);
+
+	// Unbound and stale are not the same, null is bound the first time
+	cache.PSSetShader(nullptr, nullptr, 0);
+	CHECK(recording.GetCallCount(RecordingBackend::CALL_SET_SHADER) == 1);
+
+	cache.Invalidate();
+	cache.RSSetState(Handle<ID3D11RasterizerState>(0xa00));
+	CHECK(recording.GetCallCount(RecordingBackend::CALL_SET_RASTERIZER_STATE) == 2);
+
+	cache.OMSetDepthStencilState(Handle<ID3D11DepthStencilState>(0x900), 0);
+	cache.OMSetDepthStencilState(Handle<ID3D11DepthStencilState>(0x900), 1);
+	CHECK(recording.GetCallCount(RecordingBackend::CALL_SET_DEPTH_STENCIL_STATE) == 2);
+}
+
+static void TestSlotTrimming()
+{
+	RecordingBackend recording;
+	StateCache cache(&recording);
+
+	ID3D11ShaderResourceView* views[4];
+	for (int i = 0; i < 4; i++)
+		views[i] = Handle<ID3D11ShaderResourceView>(0x40000 + i * 0x100);
+	cache.PSSetShaderResources(0, 4, views);
+
+	views[2] = Handle<ID3D11ShaderResourceView>(0x50000);
+	cache.PSSetShaderResources(0, 4, views);
+
+	const RecordingBackend::Call& trimmed = recording.GetCalls().back();
+	CHECK(recording.GetCallCount(RecordingBackend::CALL_SET_SHADER_RESOURCES) == 2);
+	CHECK(trimmed.startSlot == 2 && trimmed.count == 1);
+	CHECK(trimmed.object == views[2]);
+
+	// The same buffer with its window moved is a different binding
+	ID3D11Buffer* buffers[2] = { Handle<ID3D11Buffer>(0x1040), Handle<ID3D11Buffer>(0x1100) };
+	UINT firstConstants[2] = { 0, 0 };
+	UINT constantCounts[2] = { 0, 16 };
+	cache.VSSetConstantBuffers1(0, 2, buffers, firstConstants, constantCounts);
+	firstConstants[1] = 16;
+	cache.VSSetConstantBuffers1(0, 2, buffers, firstConstants, constantCounts);
+
+	const RecordingBackend::Call& moved = recording.GetCalls().back();
+	CHECK(recording.GetCallCount(RecordingBackend::CALL_SET_CONSTANT_BUFFERS) == 2);
+	CHECK(moved.startSlot == 1 && moved.count == 1);
+	CHECK(recording.GetState().firstConstants[BoundState::STAGE_VS][1] == 16);
+}
+
+int main()
+{
+	for (uint32_t seed = 1; seed <= 8; seed++)
+		TestFilteredMatchesUnfiltered(seed);
+	TestHashFollowsState();
+	TestRedundantCalls();
+	TestSlotTrimming();
+	return TestResult();
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+
+/*
+	What the tests share. A failed CHECK prints where it was and is counted, every test returns
+	TestResult from main so ctest sees the failure.
+	The tests only build the parts of the renderer that need no D3D headers, D3D objects are stood in
+	for by Handle, which the code under test only compares and stores.
+*/
+static int testChecks = 0;
+static int testFailures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		testChecks++; \
+		if (!(condition)) \
+		{ \
+			testFailures++; \
+			printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while (0)
+
+template<typename T>
+static T* Handle(uintptr_t value)
+{
+	return reinterpret_cast<T*>(value);
+}
+
+static int TestResult()
+{
+	printf("%d of %d checks failed\n", testFailures, testChecks);
+	return testFailures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "Test.h"
+#include "TlsfAllocator.h"
+#include <random>
+#include <vector>
+#include <algorithm>
+
+struct Range
+{
+	int block;
+	uint32_t offset;
+	uint32_t size;
+};
+
+// Inside the capacity and apart from each other
+static bool RangesApart(std::vector<Range> live, uint32_t capacity)
+{
+	std::sort(live.begin(), live.end(), [](const Range& a, const Range& b) { return a.offset < b.offset; });
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		if ((uint64_t)live[i].offset + live[i].size > capacity)
+			return false;
+		if (i + 1 < live.size() && live[i].offset + live[i].size > live[i + 1].offset)
+			return false;
+	}
+	return true;
+}
+
+// The classes from a plain loop over the bits, against the bit scans Mapping uses
+static void TestMapping()
+{
+	bool matches = true;
+	for (uint64_t size = 1; size <= 0xffffffffull; size = size * 3 / 2 + 1)
+	{
+		int highest = 0;
+		while ((size >> (highest + 1)) != 0)
+			highest++;
+
+		int fl, sl;
+		TlsfAllocator::Mapping((uint32_t)size, fl, sl);
+		if (size < (uint64_t)TlsfAllocator::SL_COUNT)
+			matches = matches && fl == 0 && sl == (int)size;
+		else
+			matches = matches && fl == highest - TlsfAllocator::SL_LOG2 + 1 && sl == (int)(size >> (highest - TlsfAllocator::SL_LOG2)) - TlsfAllocator::SL_COUNT;
+		matches = matches && fl < TlsfAllocator::FL_COUNT && sl >= 0 && sl < TlsfAllocator::SL_COUNT;
+	}
+	CHECK(matches);
+}
+
+/*
+	Random allocations and frees, small and large mixed, with the allocator validated after every one. Every
+	block has to be at least the size asked for and apart from all the others.
+*/
+static void TestChurn(uint32_t seed, uint32_t capacity, uint32_t largestSize)
+{
+	std::mt19937 random(seed);
+	TlsfAllocator allocator;
+	allocator.Initialize(capacity);
+	CHECK(allocator.Validate());
+
+	std::vector<Range> live;
+	bool valid = true, bigEnough = true, apart = true;
+	int failed = 0;
+	for (int operation = 0; operation < 20000; operation++)
+	{
+		// Leaning towards allocating while there are few live blocks, towards freeing when there are many
+		bool allocate = live.empty() || random() % 100 >= std::min<uint32_t>((uint32_t)live.size() / 2, 90);
+		if (allocate)
+		{
+			uint32_t size = random() % 4 == 0 ? 1 + random() % largestSize : 1 + random() % 64;
+			int block = allocator.Allocate(size);
+			if (block < 0)
+				failed++;
+			else
+			{
+				bigEnough = bigEnough && allocator.GetSize(block) >= size;
+				live.push_back({ block, allocator.GetOffset(block), allocator.GetSize(block) });
+			}
+		}
+		else
+		{
+			size_t victim = random() % live.size();
+			allocator.Free(live[victim].block);
+			live[victim] = live.back();
+			live.pop_back();
+		}
+
+		valid = valid && allocator.Validate();
+		if (operation % 64 == 0)
+			apart = apart && RangesApart(live, capacity);
+	}
+
+	CHECK(valid);
+	CHECK(bigEnough);
+	CHECK(apart && RangesApart(live, capacity));
+	CHECK(allocator.GetAllocationCount() == (int)live.size());
+
+	// Everything merges back into the one block it started as
+	for (const Range& range : live)
+		allocator.Free(range.block);
+	TlsfAllocator::Stats stats = allocator.GetStats();
+	CHECK(allocator.Validate());
+	CHECK(stats.freeBlocks == 1 && stats.largestFree == capacity && stats.used == 0);
+}
+
+static void TestReuse()
+{
+	TlsfAllocator allocator;
+	allocator.Initialize(1000);
+
+	int first = allocator.Allocate(100);
+	int second = allocator.Allocate(200);
+	int third = allocator.Allocate(300);
+	CHECK(allocator.GetOffset(first) == 0 && allocator.GetOffset(second) == 100 && allocator.GetOffset(third) == 300);
+
+	// The hole fits exactly, it is not passed over for the rest of the range
+	allocator.Free(second);
+	int again = allocator.Allocate(200);
+	CHECK(allocator.GetOffset(again) == 100);
+
+	// Too big for what is left, and nothing changes
+	CHECK(allocator.Allocate(401) == -1);
+	CHECK(allocator.Allocate(2000) == -1);
+	CHECK(allocator.Validate());
+
+	CHECK(allocator.Allocate(400) >= 0);
+	CHECK(allocator.GetUsed() == 1000);
+	CHECK(allocator.Allocate(1) == -1);
+	CHECK(allocator.Validate());
+}
+
+int main()
+{
+	TestMapping();
+	TestReuse();
+
+	for (uint32_t seed = 1; seed <= 4; seed++)
+	{
+		TestChurn(seed, 1 << 16, 512);
+		TestChurn(seed, 1 << 20, 32768);
+		TestChurn(seed, 5000, 4000);
+	}
+	return TestResult();
+}
\ No newline at end of file